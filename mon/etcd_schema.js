@@ -253,6 +253,14 @@ const etcd_tree = {
                     degraded: { count: uint64_t, bytes: uint64_t },
                     misplaced: { count: uint64_t, bytes: uint64_t },
                 },
+                blockstore_stats: {
+                    <string>: uint64_t,
+                },
+                // wait_<reason>, queue_<opcode>, exec_<opcode>
+                // buckets[i] = number of values below 2^i usec
+                blockstore_latency: {
+                    <string>: { count: uint64_t, usec: uint64_t, buckets: uint64_t[] },
+                },
             }, */
         },
         inodestats: {
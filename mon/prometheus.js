@@ -34,6 +34,8 @@ const metric_help =
 # TYPE vitastor_osd_stat_usec counter
 # HELP vitastor_osd_stat_bytes Per-image total operation size in bytes
 # TYPE vitastor_osd_stat_bytes counter
+# HELP vitastor_osd_blockstore_usec OSD blockstore wait, queue and execution time histogram in usec
+# TYPE vitastor_osd_blockstore_usec histogram
 
 # HELP vitastor_monitor_info Monitor info, 1 is master, 0 is standby
 # TYPE vitastor_monitor_info gauge
@@ -131,6 +133,22 @@ function export_prometheus_metrics(st)
                 res += `vitastor_osd_stat_${k}{osd_num="${osd}",op="${op}",op_type="subop"} ${ist[k]||0}\n`;
             }
         }
+        for (const stage in osd_stat.blockstore_latency||{})
+        {
+            // Bucket i counts values below 2^i usec, i.e. up to 2^i-1 usec inclusive,
+            // the last (24th) one also counts everything above
+            const hist = osd_stat.blockstore_latency[stage];
+            const buckets = hist.buckets||[];
+            let total = 0;
+            for (let i = 0; i < buckets.length && i < 23; i++)
+            {
+                total += buckets[i];
+                res += `vitastor_osd_blockstore_usec_bucket{osd_num="${osd}",stage="${stage}",le="${2**i - 1}"} ${total}\n`;
+            }
+            res += `vitastor_osd_blockstore_usec_bucket{osd_num="${osd}",stage="${stage}",le="+Inf"} ${hist.count||0}\n`;
+            res += `vitastor_osd_blockstore_usec_sum{osd_num="${osd}",stage="${stage}"} ${hist.usec||0}\n`;
+            res += `vitastor_osd_blockstore_usec_count{osd_num="${osd}",stage="${stage}"} ${hist.count||0}\n`;
+        }
     }
 
     // Monitor statistics
@@ -2,88 +2,137 @@
 // License: VNPL-1.1 (see README.md for details)
 
 #include "blockstore_impl.h"
+#include "blockstore_shards.h"
 
 blockstore_t::blockstore_t(blockstore_config_t & config, ring_loop_t *ringloop, timerfd_manager_t *tfd)
 {
-    impl = new blockstore_impl_t(config, ringloop, tfd);
+    uint64_t shard_count = strtoull(config["blockstore_shards"].c_str(), NULL, 10);
+    if (shard_count > 1)
+        sharded = new blockstore_sharded_t(config, ringloop, shard_count);
+    else
+        impl = new blockstore_impl_t(config, ringloop, tfd);
 }
 
 blockstore_t::~blockstore_t()
 {
-    delete impl;
+    if (sharded)
+        delete sharded;
+    else
+        delete impl;
 }
 
 void blockstore_t::parse_config(blockstore_config_t & config)
 {
-    impl->parse_config(config, false);
+    if (sharded)
+        sharded->parse_config(config);
+    else
+        impl->parse_config(config, false);
 }
 
 void blockstore_t::loop()
 {
-    impl->loop();
+    // Shards have their own event loops
+    if (!sharded)
+        impl->loop();
 }
 
 bool blockstore_t::is_started()
 {
-    return impl->is_started();
+    return sharded ? sharded->is_started() : impl->is_started();
 }
 
 bool blockstore_t::is_stalled()
 {
-    return impl->is_stalled();
+    return sharded ? sharded->is_stalled() : impl->is_stalled();
 }
 
 bool blockstore_t::is_safe_to_stop()
 {
-    return impl->is_safe_to_stop();
+    return sharded ? sharded->is_safe_to_stop() : impl->is_safe_to_stop();
 }
 
 void blockstore_t::enqueue_op(blockstore_op_t *op)
 {
-    impl->enqueue_op(op);
+    if (sharded)
+        sharded->enqueue_op(op);
+    else
+        impl->enqueue_op(op);
 }
 
 int blockstore_t::read_bitmap(object_id oid, uint64_t target_version, void *bitmap, uint64_t *result_version)
 {
-    return impl->read_bitmap(oid, target_version, bitmap, result_version);
+    return sharded
+        ? sharded->read_bitmap(oid, target_version, bitmap, result_version)
+        : impl->read_bitmap(oid, target_version, bitmap, result_version);
 }
 
 std::map<uint64_t, uint64_t> & blockstore_t::get_inode_space_stats()
 {
-    return impl->inode_space_stats;
+    return sharded ? sharded->get_inode_space_stats() : impl->inode_space_stats;
 }
 
 void blockstore_t::dump_diagnostics()
 {
-    return impl->dump_diagnostics();
+    if (sharded)
+        sharded->dump_diagnostics();
+    else
+        impl->dump_diagnostics();
+}
+
+std::map<std::string, uint64_t> blockstore_t::get_counters()
+{
+    std::map<std::string, uint64_t> counters;
+    if (sharded)
+        sharded->get_counters(counters);
+    else
+        impl->get_counters(counters);
+    return counters;
+}
+
+std::map<std::string, blockstore_hist_t> blockstore_t::get_histograms()
+{
+    std::map<std::string, blockstore_hist_t> hists;
+    if (sharded)
+        sharded->get_histograms(hists);
+    else
+        impl->get_histograms(hists);
+    return hists;
+}
+
+bool blockstore_t::save_meta_snapshot()
+{
+    return sharded ? sharded->save_meta_snapshot() : impl->save_meta_snapshot();
 }
 
 uint32_t blockstore_t::get_block_size()
 {
-    return impl->get_block_size();
+    return sharded ? sharded->get_block_size() : impl->get_block_size();
 }
 
 uint64_t blockstore_t::get_block_count()
 {
-    return impl->get_block_count();
+    return sharded ? sharded->get_block_count() : impl->get_block_count();
 }
 
 uint64_t blockstore_t::get_free_block_count()
 {
-    return impl->get_free_block_count();
+    return sharded ? sharded->get_free_block_count() : impl->get_free_block_count();
 }
 
 uint64_t blockstore_t::get_journal_size()
 {
-    return impl->get_journal_size();
+    return sharded ? sharded->get_journal_size() : impl->get_journal_size();
 }
 
 uint32_t blockstore_t::get_bitmap_granularity()
 {
-    return impl->get_bitmap_granularity();
+    return sharded ? sharded->get_bitmap_granularity() : impl->get_bitmap_granularity();
 }
 
 void blockstore_t::set_no_inode_stats(const std::vector<uint64_t> & pool_ids)
 {
-    impl->set_no_inode_stats(pool_ids);
+    if (sharded)
+        sharded->set_no_inode_stats(pool_ids);
+    else
+        impl->set_no_inode_stats(pool_ids);
 }
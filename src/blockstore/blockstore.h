@@ -16,6 +16,7 @@
 #include "object_id.h"
 #include "ringloop.h"
 #include "timerfd_manager.h"
+#include "mem_pool.h"
 
 // Memory alignment for direct I/O (usually 512 bytes)
 #ifndef DIRECT_IO_ALIGNMENT
@@ -42,9 +43,16 @@
 #define BS_OP_DELETE 6
 #define BS_OP_LIST 7
 #define BS_OP_ROLLBACK 8
-#define BS_OP_MAX 8
+#define BS_OP_READ_BITMAP 9
+#define BS_OP_MAX 9
 
-#define BS_OP_PRIVATE_DATA_SIZE 256
+#define BS_OP_PRIVATE_DATA_SIZE 312
+
+// QoS classes of blockstore operations
+#define BS_QOS_CLIENT 0
+#define BS_QOS_RECOVERY 1
+#define BS_QOS_SCRUB 2
+#define BS_QOS_CLASSES 3
 
 /*
 
@@ -70,6 +78,8 @@ Input:
 - buf = pre-allocated buffer for data (read) / with data (write). may be NULL if len == 0.
 - bitmap = pointer to the new 'external' object bitmap data. Its part which is respective to the
   write request is copied into the metadata area bitwise and stored there.
+- qos_class = BS_QOS_CLIENT, BS_QOS_RECOVERY or BS_QOS_SCRUB, used by the QoS scheduler
+  when it's enabled with qos_iodepth. Also applies to BS_OP_DELETE
 
 Output:
 - retval = number of bytes actually read/written or negative error number
@@ -133,6 +143,21 @@ Output:
   You must free it yourself after usage with free().
   Output includes all objects for which (((inode + stripe / <PG alignment>) % <PG count>) == <PG number>).
 
+## BS_OP_READ_BITMAP
+
+Get current versions and bitmaps of objects, like read_bitmap(), but asynchronously.
+Bitmaps are kept in memory, so the operation never waits for the disk.
+
+Input:
+- len = count of obj_ver_id's
+- buf = pre-allocated obj_ver_id array <len> units long. version is the maximum version to return
+- bitmap = pre-allocated buffer for <len> entries, each of 8 bytes for the version followed
+  by the object bitmap (clean_entry_bitmap_size bytes)
+
+Output:
+- retval = 0
+- bitmap = versions and bitmaps of objects, zeroes for objects which don't exist
+
 */
 
 struct __attribute__ ((visibility("default"))) blockstore_op_t
@@ -140,7 +165,7 @@ struct __attribute__ ((visibility("default"))) blockstore_op_t
     // operation
     uint64_t opcode = 0;
     // finish callback
-    std::function<void (blockstore_op_t*)> callback;
+    callback_t<void (blockstore_op_t*)> callback;
     union __attribute__((__packed__))
     {
         // R/W
@@ -165,17 +190,52 @@ struct __attribute__ ((visibility("default"))) blockstore_op_t
     void *buf = NULL;
     void *bitmap = NULL;
     int retval = 0;
+    int qos_class = BS_QOS_CLIENT;
 
     uint8_t private_data[BS_OP_PRIVATE_DATA_SIZE];
+
+    // Operations are allocated from the memory pool
+    static void* operator new(size_t size) { return pool_alloc(size); }
+    static void operator delete(void *ptr) { pool_free(ptr); }
 };
 
 typedef std::map<std::string, std::string> blockstore_config_t;
 
+// Bucket 0 counts values below 1 us, bucket i counts values from 2^(i-1) to 2^i-1 us
+// and the last bucket counts everything above
+#define BS_HIST_BUCKETS 24
+
+// Latency histogram with power of 2 microsecond buckets
+struct blockstore_hist_t
+{
+    uint64_t count = 0, usec = 0;
+    uint64_t buckets[BS_HIST_BUCKETS] = { 0 };
+
+    inline void add(uint64_t us)
+    {
+        int i = us ? 64-__builtin_clzll(us) : 0;
+        buckets[i < BS_HIST_BUCKETS ? i : BS_HIST_BUCKETS-1]++;
+        count++;
+        usec += us;
+    }
+
+    inline void merge(const blockstore_hist_t & other)
+    {
+        count += other.count;
+        usec += other.usec;
+        for (int i = 0; i < BS_HIST_BUCKETS; i++)
+            buckets[i] += other.buckets[i];
+    }
+};
+
 class blockstore_impl_t;
+class blockstore_sharded_t;
 
 class __attribute__((visibility("default"))) blockstore_t
 {
-    blockstore_impl_t *impl;
+    blockstore_impl_t *impl = NULL;
+    // Set instead of <impl> when blockstore_shards > 1
+    blockstore_sharded_t *sharded = NULL;
 public:
     blockstore_t(blockstore_config_t & config, ring_loop_t *ringloop, timerfd_manager_t *tfd);
     ~blockstore_t();
@@ -201,7 +261,8 @@ public:
     // Submission
     void enqueue_op(blockstore_op_t *op);
 
-    // Simplified synchronous operation: get object bitmap & current version
+    // Simplified synchronous operation: get object bitmap & current version.
+    // Blocks until the shard thread handles it in the sharded mode, use BS_OP_READ_BITMAP there
     int read_bitmap(object_id oid, uint64_t target_version, void *bitmap, uint64_t *result_version = NULL);
 
     // Get per-inode space usage statistics
@@ -213,6 +274,17 @@ public:
     // Print diagnostics to stdout
     void dump_diagnostics();
 
+    // Get internal counters (metadata cache hits and misses and so on)
+    std::map<std::string, uint64_t> get_counters();
+
+    // Get latency histograms: time spent waiting for each reason (wait_*), time from
+    // enqueueing to submitting (queue_<opcode>) and from submitting to completion (exec_<opcode>)
+    std::map<std::string, blockstore_hist_t> get_histograms();
+
+    // Save clean metadata snapshot to speed up the next start, if enabled by <meta_snapshot_file>.
+    // Should only be called on stop after is_safe_to_stop() returns true, makes blockstore readonly
+    bool save_meta_snapshot();
+
     uint32_t get_block_size();
     uint64_t get_block_count();
     uint64_t get_free_block_count();
@@ -0,0 +1,238 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include "blockstore_clean_db.h"
+
+#define POOL_ID_BITS 16
+#define INODE_NUM_MASK ((1ul << (64-POOL_ID_BITS)) - 1)
+
+blockstore_clean_db_t::iterator::iterator(blockstore_clean_db_t *db, compact_map_t::iterator c_it, full_map_t::iterator f_it)
+{
+    this->db = db;
+    this->c_it = c_it;
+    this->f_it = f_it;
+    load();
+}
+
+void blockstore_clean_db_t::iterator::load()
+{
+    bool c_end = c_it == db->compact.end(), f_end = f_it == db->full.end();
+    if (c_end && f_end)
+    {
+        return;
+    }
+    object_id c_oid;
+    if (!c_end)
+    {
+        c_oid = db->decode_key(c_it->first);
+    }
+    is_compact = f_end || !c_end && c_oid < f_it->first;
+    if (is_compact)
+    {
+        value.first = c_oid;
+        value.second = {
+            .version = c_it->second.version,
+            .location = (uint64_t)c_it->second.block << db->block_order,
+        };
+    }
+    else
+    {
+        value = *f_it;
+    }
+}
+
+blockstore_clean_db_t::iterator & blockstore_clean_db_t::iterator::operator ++ ()
+{
+    if (is_compact)
+        c_it++;
+    else
+        f_it++;
+    load();
+    return *this;
+}
+
+blockstore_clean_db_t::iterator blockstore_clean_db_t::iterator::operator ++ (int)
+{
+    iterator prev = *this;
+    ++*this;
+    return prev;
+}
+
+void blockstore_clean_db_t::set_compact(uint32_t block_order)
+{
+    if (!size())
+    {
+        this->use_compact = true;
+        this->block_order = block_order;
+    }
+}
+
+bool blockstore_clean_db_t::encode_key(const object_id & oid, compact_clean_key & key) const
+{
+    if (!use_compact || compact.size() && (oid.inode & ~INODE_NUM_MASK) != compact_pool)
+    {
+        return false;
+    }
+    uint64_t inode_num = oid.inode & INODE_NUM_MASK;
+    uint64_t block = oid.stripe >> block_order;
+    uint64_t part = oid.stripe & ((1ul << block_order) - 1);
+    if (inode_num > UINT32_MAX || block > UINT32_MAX || part > UINT8_MAX)
+    {
+        return false;
+    }
+    key = { .inode = (uint32_t)inode_num, .block = (uint32_t)block, .part = (uint8_t)part };
+    return true;
+}
+
+object_id blockstore_clean_db_t::decode_key(const compact_clean_key & key) const
+{
+    return (object_id){
+        .inode = compact_pool | key.inode,
+        .stripe = ((uint64_t)key.block << block_order) | key.part,
+    };
+}
+
+bool blockstore_clean_db_t::encode_entry(const clean_entry & entry, compact_clean_entry & centry) const
+{
+    if (entry.version > UINT32_MAX || (entry.location & ((1ul << block_order) - 1)) ||
+        (entry.location >> block_order) > UINT32_MAX)
+    {
+        return false;
+    }
+    centry = { .version = (uint32_t)entry.version, .block = (uint32_t)(entry.location >> block_order) };
+    return true;
+}
+
+// Find the first compact entry which is >= oid (or > oid if <upper> is true),
+// taking into account that <oid> itself may be out of the compact key range
+blockstore_clean_db_t::compact_map_t::iterator blockstore_clean_db_t::compact_bound(const object_id & oid, bool upper)
+{
+    if (!compact.size())
+    {
+        return compact.end();
+    }
+    uint64_t pool = oid.inode & ~INODE_NUM_MASK;
+    if (pool != compact_pool)
+    {
+        return pool < compact_pool ? compact.begin() : compact.end();
+    }
+    uint64_t inode_num = oid.inode & INODE_NUM_MASK;
+    if (inode_num > UINT32_MAX)
+    {
+        return compact.end();
+    }
+    uint64_t block = oid.stripe >> block_order;
+    if (block > UINT32_MAX)
+    {
+        return compact.upper_bound({ .inode = (uint32_t)inode_num, .block = UINT32_MAX, .part = UINT8_MAX });
+    }
+    uint64_t part = oid.stripe & ((1ul << block_order) - 1);
+    if (part > UINT8_MAX)
+    {
+        return compact.upper_bound({ .inode = (uint32_t)inode_num, .block = (uint32_t)block, .part = UINT8_MAX });
+    }
+    compact_clean_key key = { .inode = (uint32_t)inode_num, .block = (uint32_t)block, .part = (uint8_t)part };
+    return upper ? compact.upper_bound(key) : compact.lower_bound(key);
+}
+
+blockstore_clean_db_t::iterator blockstore_clean_db_t::find(const object_id & oid)
+{
+    compact_clean_key key;
+    if (compact.size() && encode_key(oid, key))
+    {
+        auto c_it = compact.find(key);
+        if (c_it != compact.end())
+        {
+            return iterator(this, c_it, full.size() ? full.lower_bound(oid) : full.end());
+        }
+    }
+    if (full.size())
+    {
+        auto f_it = full.find(oid);
+        if (f_it != full.end())
+        {
+            return iterator(this, compact_bound(oid, false), f_it);
+        }
+    }
+    return end();
+}
+
+blockstore_clean_db_t::iterator blockstore_clean_db_t::lower_bound(const object_id & oid)
+{
+    return iterator(this, compact_bound(oid, false), full.lower_bound(oid));
+}
+
+blockstore_clean_db_t::iterator blockstore_clean_db_t::upper_bound(const object_id & oid)
+{
+    return iterator(this, compact_bound(oid, true), full.upper_bound(oid));
+}
+
+void blockstore_clean_db_t::set(const object_id & oid, const clean_entry & entry)
+{
+    compact_clean_key key;
+    compact_clean_entry centry;
+    if (encode_key(oid, key))
+    {
+        if (encode_entry(entry, centry))
+        {
+            if (!compact.size())
+                compact_pool = oid.inode & ~INODE_NUM_MASK;
+            compact[key] = centry;
+            if (full.size())
+                full.erase(oid);
+            return;
+        }
+        if (compact.size())
+            compact.erase(key);
+    }
+    full[oid] = entry;
+}
+
+void blockstore_clean_db_t::insert(const iterator & hint, const value_type & value)
+{
+    compact_clean_key key;
+    compact_clean_entry centry;
+    if (encode_key(value.first, key) && encode_entry(value.second, centry))
+    {
+        if (!compact.size())
+            compact_pool = value.first.inode & ~INODE_NUM_MASK;
+        compact.insert(hint.c_it, std::make_pair(key, centry));
+    }
+    else
+    {
+        full.insert(hint.f_it, value);
+    }
+}
+
+size_t blockstore_clean_db_t::erase(const object_id & oid)
+{
+    compact_clean_key key;
+    if (compact.size() && encode_key(oid, key) && compact.erase(key))
+    {
+        return 1;
+    }
+    return full.size() ? full.erase(oid) : 0;
+}
+
+blockstore_clean_db_t::iterator blockstore_clean_db_t::erase(const iterator & it)
+{
+    if (it.is_compact)
+        return iterator(this, compact.erase(it.c_it), it.f_it);
+    return iterator(this, it.c_it, full.erase(it.f_it));
+}
+
+void blockstore_clean_db_t::swap(blockstore_clean_db_t & other)
+{
+    full.swap(other.full);
+    compact.swap(other.compact);
+    std::swap(use_compact, other.use_compact);
+    std::swap(block_order, other.block_order);
+    std::swap(compact_pool, other.compact_pool);
+}
+
+void blockstore_clean_db_t::clear()
+{
+    full.clear();
+    compact.clear();
+    compact_pool = 0;
+}
@@ -0,0 +1,113 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <utility>
+
+#include "cpp-btree/btree_map.h"
+#include "object_id.h"
+
+// 32 = 16 + 16 bytes per "clean" entry in memory (object_id => clean_entry)
+struct __attribute__((__packed__)) clean_entry
+{
+    uint64_t version;
+    uint64_t location;
+};
+
+// 17 = 9 + 8 bytes per "clean" entry in the compact representation.
+// The pool ID (upper 16 bits of the inode) is stored once per clean_db, so the inode number
+// inside the pool must fit in 32 bits. The stripe is split into the data block number
+// and the low part (replica or EC part number) which must fit in 8 bits
+struct __attribute__((__packed__)) compact_clean_key
+{
+    uint32_t inode;
+    uint32_t block;
+    uint8_t part;
+};
+
+inline bool operator < (const compact_clean_key & a, const compact_clean_key & b)
+{
+    return a.inode < b.inode || a.inode == b.inode &&
+        (a.block < b.block || a.block == b.block && a.part < b.part);
+}
+
+// The version must fit in 32 bits and the location is stored as the data block number
+struct __attribute__((__packed__)) compact_clean_entry
+{
+    uint32_t version;
+    uint32_t block;
+};
+
+// https://github.com/algorithm-ninja/cpp-btree
+// https://github.com/greg7mdp/sparsepp/ was used previously, but it was TERRIBLY slow after resizing
+// with sparsepp, random reads dropped to ~700 iops very fast with just as much as ~32k objects in the DB
+//
+// clean_db is a B-tree of object_id => clean_entry. In the compact mode (compact_clean_db=true),
+// entries which fit into compact_clean_key/compact_clean_entry are stored in a second B-tree
+// and all others are stored in the usual one. Both trees are iterated together in object_id order.
+// Iterators return copies of entries, so entries can't be modified through them, use set() instead.
+class blockstore_clean_db_t
+{
+public:
+    typedef btree::btree_map<object_id, clean_entry> full_map_t;
+    typedef btree::btree_map<compact_clean_key, compact_clean_entry> compact_map_t;
+    typedef std::pair<object_id, clean_entry> value_type;
+
+    class iterator
+    {
+        friend class blockstore_clean_db_t;
+        blockstore_clean_db_t *db = NULL;
+        compact_map_t::iterator c_it;
+        full_map_t::iterator f_it;
+        bool is_compact = false;
+        value_type value;
+
+        iterator(blockstore_clean_db_t *db, compact_map_t::iterator c_it, full_map_t::iterator f_it);
+        void load();
+    public:
+        iterator() {}
+        const value_type & operator * () const { return value; }
+        const value_type * operator -> () const { return &value; }
+        iterator & operator ++ ();
+        iterator operator ++ (int);
+        bool operator == (const iterator & other) const { return c_it == other.c_it && f_it == other.f_it; }
+        bool operator != (const iterator & other) const { return c_it != other.c_it || f_it != other.f_it; }
+    };
+
+private:
+    full_map_t full;
+    compact_map_t compact;
+    bool use_compact = false;
+    uint32_t block_order = 0;
+    // Upper POOL_ID_BITS bits of the inode of all compact entries
+    uint64_t compact_pool = 0;
+
+    bool encode_key(const object_id & oid, compact_clean_key & key) const;
+    object_id decode_key(const compact_clean_key & key) const;
+    bool encode_entry(const clean_entry & entry, compact_clean_entry & centry) const;
+    compact_map_t::iterator compact_bound(const object_id & oid, bool upper);
+
+public:
+    // Enable the compact representation. Only has effect on an empty clean_db
+    void set_compact(uint32_t block_order);
+
+    iterator begin() { return iterator(this, compact.begin(), full.begin()); }
+    iterator end() { return iterator(this, compact.end(), full.end()); }
+    iterator find(const object_id & oid);
+    iterator lower_bound(const object_id & oid);
+    iterator upper_bound(const object_id & oid);
+    size_t size() const { return compact.size() + full.size(); }
+    size_t compact_size() const { return compact.size(); }
+    // Memory used by B-tree nodes
+    size_t bytes_used() const { return compact.bytes_used() + full.bytes_used(); }
+
+    // Insert or replace an entry
+    void set(const object_id & oid, const clean_entry & entry);
+    // Insert a new entry, <hint> is usually end() when entries are added in order
+    void insert(const iterator & hint, const value_type & value);
+    size_t erase(const object_id & oid);
+    iterator erase(const iterator & it);
+    void swap(blockstore_clean_db_t & other);
+    void clear();
+};
@@ -0,0 +1,183 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include "blockstore_impl.h"
+
+blockstore_discard_t::~blockstore_discard_t()
+{
+    if (timer_id >= 0)
+        bs->tfd->clear_timer(timer_id);
+}
+
+void blockstore_discard_t::init(blockstore_impl_t *bs, bool enable)
+{
+    this->bs = bs;
+    active = enable && bs->discard_mbs > 0 && bs->discard_iops > 0;
+    byte_tokens = bs->discard_mbs*1024*1024;
+    op_tokens = bs->discard_iops*1000000;
+}
+
+void blockstore_discard_t::add(uint64_t block_num)
+{
+    if (!active)
+        return;
+    pending.add(block_num);
+}
+
+// Refill the token bucket. Request tokens are counted in millionths to not lose fractions
+void blockstore_discard_t::refill()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    uint64_t now_us = tv.tv_sec*1000000 + tv.tv_nsec/1000;
+    if (last_refill_us && now_us > last_refill_us)
+    {
+        // Bucket size is one second worth of tokens
+        int64_t max_bytes = bs->discard_mbs*1024*1024;
+        int64_t max_ops = bs->discard_iops*1000000;
+        byte_tokens += (now_us-last_refill_us) * bs->discard_mbs*1024*1024 / 1000000;
+        if (byte_tokens > max_bytes)
+            byte_tokens = max_bytes;
+        op_tokens += (now_us-last_refill_us) * bs->discard_iops;
+        if (op_tokens > max_ops)
+            op_tokens = max_ops;
+    }
+    last_refill_us = now_us;
+}
+
+// Find the next range to discard starting from <scan_pos>. Blocks which are already reused are
+// dropped from ranges, and parts of ranges which can't be discarded yet are put back
+bool blockstore_discard_t::pick_range(uint64_t & first_block, uint64_t & end_block, uint64_t & offset, uint64_t & len)
+{
+    auto & dsk = bs->dsk;
+    uint64_t max_len = bs->max_discard_size;
+    if (max_len > bs->discard_mbs*1024*1024)
+        max_len = bs->discard_mbs*1024*1024;
+    auto it = pending.ranges.lower_bound(scan_pos);
+    for (int i = 0; i < DISCARD_SCAN_LIMIT && pending.ranges.size() > 0; i++)
+    {
+        if (it == pending.ranges.end())
+            it = pending.ranges.begin();
+        uint64_t rs = it->first, re = it->second;
+        it = pending.take(it);
+        bool found = false;
+        while (rs < re)
+        {
+            while (rs < re && bs->data_alloc->get(rs))
+                rs++;
+            uint64_t run_end = rs;
+            while (run_end < re && !bs->data_alloc->get(run_end))
+                run_end++;
+            if (run_end == rs)
+                break;
+            if (!found)
+            {
+                uint64_t start = dsk.data_offset + rs*dsk.data_block_size;
+                uint64_t end = dsk.data_offset + run_end*dsk.data_block_size;
+                if (dsk.discard_granularity)
+                {
+                    if (start % dsk.discard_granularity)
+                        start += dsk.discard_granularity - (start % dsk.discard_granularity);
+                    end -= end % dsk.discard_granularity;
+                }
+                if (end > start && end-start > max_len)
+                {
+                    end = start + max_len;
+                    if (dsk.discard_granularity)
+                        end -= end % dsk.discard_granularity;
+                }
+                if (end > start && end-start >= dsk.min_discard_size)
+                {
+                    found = true;
+                    offset = start;
+                    len = end-start;
+                    first_block = (start-dsk.data_offset) / dsk.data_block_size;
+                    end_block = (end-dsk.data_offset + dsk.data_block_size-1) / dsk.data_block_size;
+                    pending.put_back(rs, first_block);
+                    pending.put_back(end_block, run_end);
+                    scan_pos = end_block;
+                    rs = run_end;
+                    continue;
+                }
+            }
+            pending.put_back(rs, run_end);
+            rs = run_end;
+        }
+        if (found)
+            return true;
+        // <it> is still valid because std::map::insert doesn't invalidate iterators
+    }
+    if (it != pending.ranges.end())
+        scan_pos = it->first;
+    return false;
+}
+
+void blockstore_discard_t::loop()
+{
+    if (!active || inflight > 0 || !pending.ranges.size() || timer_id >= 0)
+        return;
+    // Yield to client I/O
+    if (bs->submit_queue.size() > 0 || bs->inflight_reads > 0 || bs->write_iodepth > 0)
+        return;
+    refill();
+    if (byte_tokens <= 0 || op_tokens < 1000000)
+    {
+        uint64_t wait_us = op_tokens < 1000000 ? (1000000-op_tokens) / bs->discard_iops : 0;
+        uint64_t wait_bytes_us = byte_tokens <= 0 ? (1-byte_tokens)*1000000 / (bs->discard_mbs*1024*1024) : 0;
+        if (wait_us < wait_bytes_us)
+            wait_us = wait_bytes_us;
+        timer_id = bs->tfd->set_timer_us(wait_us > 0 ? wait_us : 1, false, [this](int timer_id)
+        {
+            this->timer_id = -1;
+            bs->ringloop->wakeup();
+        });
+        return;
+    }
+    uint64_t first_block, end_block, offset, len;
+    if (!pick_range(first_block, end_block, offset, len))
+        return;
+    io_uring_sqe *sqe = bs->get_sqe();
+    if (!sqe)
+    {
+        pending.put_back(first_block, end_block);
+        return;
+    }
+    // Don't let the allocator give these blocks away until the discard completes
+    bs->data_alloc->set_range(first_block, end_block-first_block, true);
+    ring_data_t *data = ((ring_data_t*)sqe->user_data);
+    io_uring_prep_cmd_discard(sqe, bs->dsk.data_fd, offset, len);
+    data->iov = { 0, len };
+    data->callback = [this, first_block, end_block, offset](ring_data_t *data)
+    {
+        handle_discard(data, first_block, end_block, offset);
+    };
+    inflight++;
+    byte_tokens -= len;
+    op_tokens -= 1000000;
+}
+
+void blockstore_discard_t::handle_discard(ring_data_t *data, uint64_t first_block, uint64_t end_block, uint64_t offset)
+{
+    inflight--;
+    bs->data_alloc->set_range(first_block, end_block-first_block, false);
+    if (data->res == -EOPNOTSUPP || data->res == -EINVAL || data->res == -ENOTTY)
+    {
+        // BLOCK_URING_CMD_DISCARD requires Linux 6.12 and a block device
+        fprintf(stderr, "Online discard is not supported for %s: %s, disabling it\n",
+            bs->dsk.data_device.c_str(), strerror(-data->res));
+        active = false;
+        pending.clear();
+    }
+    else if (data->res < 0)
+    {
+        fprintf(stderr, "Failed to discard %ju+%ju on %s: %s (code %d)\n",
+            offset, data->iov.iov_len, bs->dsk.data_device.c_str(), strerror(-data->res), data->res);
+        discard_errors++;
+    }
+    else
+    {
+        discarded_bytes += data->iov.iov_len;
+        discard_ops++;
+    }
+    bs->ringloop->wakeup();
+}
@@ -0,0 +1,115 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+
+#define DEFAULT_DISCARD_MBS 100
+#define DEFAULT_DISCARD_IOPS 10
+#define DEFAULT_MAX_DISCARD_SIZE (64*1024*1024)
+// Maximum number of pending ranges checked in one loop() iteration
+#define DISCARD_SCAN_LIMIT 64
+
+class blockstore_impl_t;
+struct ring_data_t;
+
+// Ranges of freed data blocks: first block => end block (exclusive).
+// Adjacent freed blocks are merged into one range
+struct discard_ranges_t
+{
+    std::map<uint64_t, uint64_t> ranges;
+    uint64_t blocks = 0;
+
+    void add(uint64_t block_num)
+    {
+        uint64_t start = block_num, end = block_num+1;
+        auto next_it = ranges.lower_bound(block_num);
+        if (next_it != ranges.end() && next_it->first == block_num)
+        {
+            // Block is freed again before its discard
+            return;
+        }
+        // Merge with the previous and the next range
+        if (next_it != ranges.begin())
+        {
+            auto prev_it = std::prev(next_it);
+            if (prev_it->second > block_num)
+                return;
+            if (prev_it->second == block_num)
+            {
+                start = prev_it->first;
+                ranges.erase(prev_it);
+            }
+        }
+        if (next_it != ranges.end() && next_it->first == end)
+        {
+            end = next_it->second;
+            ranges.erase(next_it);
+        }
+        ranges[start] = end;
+        blocks++;
+    }
+
+    // Return a part of a range taken with take() back
+    void put_back(uint64_t start, uint64_t end)
+    {
+        if (start < end)
+        {
+            ranges[start] = end;
+            blocks += end-start;
+        }
+    }
+
+    // Remove the range and return the next one
+    std::map<uint64_t, uint64_t>::iterator take(std::map<uint64_t, uint64_t>::iterator it)
+    {
+        blocks -= it->second-it->first;
+        return ranges.erase(it);
+    }
+
+    void clear()
+    {
+        ranges.clear();
+        blocks = 0;
+    }
+};
+
+// Online discard (TRIM) of freed data blocks.
+// Freed blocks are merged into ranges of adjacent blocks. Ranges which are at least
+// min_discard_size long after aligning them to discard_granularity are discarded in the
+// background, one at a time, within a token bucket of bytes and requests per second,
+// and only while there are no operations waiting in the blockstore submit queue.
+// Blocks are marked as used in the allocator while their discard is in progress.
+// Blocks reused before their discard is submitted are simply removed from the ranges.
+class blockstore_discard_t
+{
+    blockstore_impl_t *bs = NULL;
+    bool active = false;
+    discard_ranges_t pending;
+    uint64_t scan_pos = 0;
+    int inflight = 0;
+    // Token bucket, may go below zero after a large discard. Request tokens are in millionths
+    int64_t byte_tokens = 0, op_tokens = 0;
+    uint64_t last_refill_us = 0;
+    int timer_id = -1;
+
+    void refill();
+    bool pick_range(uint64_t & first_block, uint64_t & end_block, uint64_t & offset, uint64_t & len);
+    void handle_discard(ring_data_t *data, uint64_t first_block, uint64_t end_block, uint64_t offset);
+
+public:
+    uint64_t discarded_bytes = 0, discard_ops = 0, discard_errors = 0;
+
+    ~blockstore_discard_t();
+    void init(blockstore_impl_t *bs, bool enable);
+    bool enabled() { return active; }
+    bool is_active() { return inflight > 0; }
+    uint64_t pending_count() { return pending.blocks; }
+    // Remember a freed data block
+    void add(uint64_t block_num);
+    // Submit the next discard request if the budget allows it
+    void loop();
+};
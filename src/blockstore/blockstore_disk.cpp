@@ -90,6 +90,9 @@ void blockstore_disk_t::parse_config(std::map<std::string, std::string> & config
     if (!min_discard_size)
         min_discard_size = 1024*1024;
     discard_granularity = parse_size(config["discard_granularity"]);
+    shard_count = stoull_full(config["blockstore_shards"]);
+    if (!shard_count)
+        shard_count = 1;
     // Validate
     if (!data_block_size)
     {
@@ -40,6 +40,8 @@ struct blockstore_disk_t
     bool discard_on_start = false;
     uint64_t min_discard_size = 1024*1024;
     uint64_t discard_granularity = 0;
+    // Number of blockstore shards the disk is split into. Layout depends on it
+    uint64_t shard_count = 1;
 
     int meta_fd = -1, data_fd = -1, journal_fd = -1;
     uint64_t meta_offset, meta_device_sect, meta_device_size, meta_len, meta_format = 0;
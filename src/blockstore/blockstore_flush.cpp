@@ -33,6 +33,7 @@ journal_flusher_t::journal_flusher_t(blockstore_impl_t *bs)
 journal_flusher_co::journal_flusher_co()
 {
     wait_state = 0;
+    wait_count = wait_journal_count = 0;
     simple_callback_r = [this](ring_data_t* data)
     {
         bs->live = true;
@@ -68,13 +69,30 @@ bool journal_flusher_t::is_active()
     return active_flushers > 0 || dequeuing;
 }
 
-void journal_flusher_t::loop()
+void journal_flusher_t::calc_target_flusher_count()
 {
     target_flusher_count = bs->write_iodepth*2;
+    if (trim_wanted > 0 && (bs->flusher_target_latency_us || bs->flusher_read_backoff))
+    {
+        // Writes are waiting for journal or data space, so flush at the full speed
+        target_flusher_count = max_flusher_count;
+    }
+    else
+    {
+        if (bs->flusher_target_latency_us && target_flusher_count > latency_flusher_count)
+            target_flusher_count = latency_flusher_count;
+        if (bs->flusher_read_backoff && bs->inflight_reads > 0)
+            target_flusher_count = min_flusher_count;
+    }
     if (target_flusher_count < min_flusher_count)
         target_flusher_count = min_flusher_count;
     else if (target_flusher_count > max_flusher_count)
         target_flusher_count = max_flusher_count;
+}
+
+void journal_flusher_t::loop()
+{
+    calc_target_flusher_count();
     if (target_flusher_count > cur_flusher_count)
         cur_flusher_count = target_flusher_count;
     else if (target_flusher_count < cur_flusher_count)
@@ -161,6 +179,79 @@ void journal_flusher_t::remove_flush(object_id oid)
     }
 }
 
+// Get the data device location which the flush of <oid> up to <version> will write to
+uint64_t journal_flusher_t::get_flush_location(object_id oid, uint64_t version)
+{
+    auto dirty_it = bs->dirty_db.find((obj_ver_id){ .oid = oid, .version = version });
+    while (dirty_it != bs->dirty_db.end() && dirty_it->first.oid == oid && !IS_DELETE(dirty_it->second.state))
+    {
+        if (IS_BIG_WRITE(dirty_it->second.state))
+            return dirty_it->second.location;
+        if (dirty_it == bs->dirty_db.begin())
+            break;
+        dirty_it--;
+    }
+    auto & clean_db = bs->clean_db_shard(oid);
+    auto clean_it = clean_db.find(oid);
+    return clean_it != clean_db.end() ? clean_it->second.location : UINT64_MAX;
+}
+
+// Elevator (C-SCAN) ordering: move the object nearest to the previous flush in the forward direction
+// among first <flusher_sort_window> queue entries to the front of the queue. It reduces seeks on HDDs.
+// Not used when the journal is full because then the oldest entries must be flushed first
+void journal_flusher_t::pick_nearest_flush()
+{
+    if (bs->flusher_sort_window < 2 || trim_wanted > 0 || flush_queue.size() < 2)
+        return;
+    int n = flush_queue.size() < bs->flusher_sort_window ? flush_queue.size() : bs->flusher_sort_window;
+    int best = 0;
+    uint64_t best_dist = UINT64_MAX;
+    for (int i = 0; i < n; i++)
+    {
+        auto v_it = flush_versions.find(flush_queue[i]);
+        if (v_it == flush_versions.end())
+            continue;
+        uint64_t loc = get_flush_location(flush_queue[i], v_it->second);
+        if (loc == UINT64_MAX)
+            continue;
+        uint64_t dist = loc >= last_flush_loc ? loc-last_flush_loc : bs->dsk.data_len-last_flush_loc+loc;
+        if (dist < best_dist)
+        {
+            best = i;
+            best_dist = dist;
+        }
+    }
+    if (best > 0)
+        std::swap(flush_queue[0], flush_queue[best]);
+}
+
+void journal_flusher_t::add_write_stats(uint64_t loc, uint64_t len)
+{
+    stat_flush_count++;
+    stat_flush_bytes += len;
+    stat_seek_bytes += loc > last_flush_loc ? loc-last_flush_loc : last_flush_loc-loc;
+    if (loc == last_flush_loc || loc == last_flush_loc+bs->dsk.data_block_size)
+        stat_sequential++;
+    last_flush_loc = loc;
+}
+
+// Adjust the flusher count limit with AIMD: every <latency_flusher_count> completed flushes
+// halve it if the average data write latency is above the target and increase it by 1 otherwise
+void journal_flusher_t::add_write_latency(timespec & start)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t latency = (now.tv_sec-start.tv_sec)*1000000 + (now.tv_nsec-start.tv_nsec)/1000;
+    avg_write_latency_us = avg_write_latency_us ? (avg_write_latency_us*7 + latency)/8 : latency;
+    if (!bs->flusher_target_latency_us || ++latency_flush_counter < latency_flusher_count)
+        return;
+    latency_flush_counter = 0;
+    if (avg_write_latency_us > bs->flusher_target_latency_us)
+        latency_flusher_count = latency_flusher_count > 1 ? latency_flusher_count/2 : 1;
+    else if (latency_flusher_count < max_flusher_count)
+        latency_flusher_count++;
+}
+
 bool journal_flusher_t::is_mutated(uint64_t clean_loc)
 {
     for (int i = 0; i < cur_flusher_count; i++)
@@ -240,9 +331,14 @@ void journal_flusher_t::dump_diagnostics()
         trim_wanted, dequeuing, trimming, cur_flusher_count, target_flusher_count,
         active_flushers, syncing_flushers
     );
+    printf(
+        "Flushed: %ju objects, %ju bytes, avg_seek=%ju sequential=%ju avg_latency=%ju us\n",
+        stat_flush_count, stat_flush_bytes, stat_flush_count ? stat_seek_bytes/stat_flush_count : 0,
+        stat_sequential, avg_write_latency_us
+    );
 }
 
-bool journal_flusher_t::try_find_older(std::map<obj_ver_id, dirty_entry>::iterator & dirty_end, obj_ver_id & cur)
+bool journal_flusher_t::try_find_older(blockstore_dirty_db_t::iterator & dirty_end, obj_ver_id & cur)
 {
     bool found = false;
     while (dirty_end != bs->dirty_db.begin())
@@ -264,7 +360,7 @@ bool journal_flusher_t::try_find_older(std::map<obj_ver_id, dirty_entry>::iterat
     return found;
 }
 
-bool journal_flusher_t::try_find_other(std::map<obj_ver_id, dirty_entry>::iterator & dirty_end, obj_ver_id & cur)
+bool journal_flusher_t::try_find_other(blockstore_dirty_db_t::iterator & dirty_end, obj_ver_id & cur)
 {
     int search_left = flush_queue.size() - 1;
 #ifdef BLOCKSTORE_DEBUG
@@ -382,6 +478,7 @@ stop_flusher:
         return true;
     }
     try_trim = true;
+    flusher->pick_nearest_flush();
     cur.oid = flusher->flush_queue.front();
     cur.version = flusher->flush_versions[cur.oid];
     flusher->flush_queue.pop_front();
@@ -510,6 +607,8 @@ resume_2:
             }
         }
         // Submit data writes
+        write_len = 0;
+        clock_gettime(CLOCK_MONOTONIC, &write_start);
         for (it = v.begin(); it != v.end(); it++)
         {
             if (it->copy_flags == COPY_BUF_JOURNAL || it->copy_flags == (COPY_BUF_JOURNAL|COPY_BUF_COALESCED))
@@ -521,13 +620,18 @@ resume_2:
                     sqe, bs->dsk.data_fd, &data->iov, 1, bs->dsk.data_offset + clean_loc + it->offset
                 );
                 wait_count++;
+                write_len += it->len;
             }
         }
+        if (write_len > 0)
+            flusher->add_write_stats(clean_loc, write_len);
         // Wait for data writes and metadata reads
     resume_16:
     resume_17:
         if (!wait_meta_reads(16))
             return false;
+        if (write_len > 0)
+            flusher->add_write_latency(write_start);
         // Sync data before writing metadata
     resume_18:
     resume_19:
@@ -576,6 +680,8 @@ resume_2:
             return false;
         }
         flusher->inflight_meta_sectors.insert(meta_new.sector);
+        // dirty_db iterators are invalidated while we wait, find them again
+        find_dirty_range();
         // Modify the new metadata entry
         update_metadata_entry();
         // Update clean_db - it must be equal to the metadata entry
@@ -602,6 +708,7 @@ resume_2:
         // Free the data block only when metadata is synced
         free_data_blocks();
         // Erase dirty_db entries
+        find_dirty_range();
         bs->erase_dirty(dirty_start, std::next(dirty_end), clean_loc);
 #ifdef BLOCKSTORE_DEBUG
         printf("Flushed %jx:%jx v%ju (%d copies, wr:%d, del:%d), %jd left\n", cur.oid.inode, cur.oid.stripe, cur.version,
@@ -746,6 +853,16 @@ bool journal_flusher_co::write_meta_block(flusher_meta_write_t & meta_block, int
     await_sqe(0);
     data->iov = (struct iovec){ meta_block.buf, (size_t)bs->dsk.meta_block_size };
     data->callback = simple_callback_w;
+    if (!bs->inmemory_meta)
+    {
+        // Write-through
+        bs->meta_cache.write(meta_block.sector, meta_block.buf);
+        data->callback = [this, sector = meta_block.sector](ring_data_t *data)
+        {
+            bs->meta_cache.write_done(sector);
+            simple_callback_w(data);
+        };
+    }
     io_uring_prep_writev(
         sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bs->dsk.meta_block_size + meta_block.sector
     );
@@ -924,6 +1041,15 @@ void journal_flusher_co::calc_block_checksums(uint32_t *new_data_csums, bool ski
                 len -= full_csum_count*bs->dsk.csum_block_size;
                 block_offset += full_csum_count*bs->dsk.csum_block_size;
             }
+            else if (!block_done && !zero)
+            {
+                // Checksum all full blocks at once
+                auto full_csum_count = len/bs->dsk.csum_block_size;
+                crc32c_blocks(new_data_csums + block_offset/bs->dsk.csum_block_size,
+                    (uint8_t*)it->buf+(it->len-len), bs->dsk.csum_block_size, full_csum_count);
+                len -= full_csum_count*bs->dsk.csum_block_size;
+                block_offset += full_csum_count*bs->dsk.csum_block_size;
+            }
             else
             {
                 auto cur_len = bs->dsk.csum_block_size-block_done;
@@ -1108,6 +1234,15 @@ void journal_flusher_co::scan_dirty()
     }
 }
 
+void journal_flusher_co::find_dirty_range()
+{
+    // Flushed versions of <cur.oid> can't be removed by anyone else because we hold
+    // the object in sync_to_repeat, and new versions are only added after them
+    dirty_end = bs->dirty_db.find(cur);
+    assert(dirty_end != bs->dirty_db.end());
+    dirty_start = bs->dirty_db.lower_bound((obj_ver_id){ .oid = cur.oid, .version = 0 });
+}
+
 bool journal_flusher_co::read_dirty(int wait_base)
 {
     if (wait_state == wait_base)        goto resume_0;
@@ -1204,11 +1339,13 @@ resume_0:
     if (meta_new.submitted)
     {
         meta_new.it->second.state = META_BLOCK_READ;
+        bs->meta_cache.put(meta_new.sector, meta_new.buf);
         bs->ringloop->wakeup();
     }
     if (meta_old.submitted)
     {
         meta_old.it->second.state = META_BLOCK_READ;
+        bs->meta_cache.put(meta_old.sector, meta_old.buf);
         bs->ringloop->wakeup();
     }
 resume_1:
@@ -1250,6 +1387,11 @@ bool journal_flusher_co::modify_meta_read(uint64_t meta_loc, flusher_meta_write_
             .buf = wr.buf,
             .usage_count = 1,
         }).first;
+        if (bs->meta_cache.get(wr.sector, wr.buf, 0, bs->dsk.meta_block_size))
+        {
+            wr.it->second.state = META_BLOCK_READ;
+            return true;
+        }
         await_sqe(0);
         data->iov = (struct iovec){ wr.it->second.buf, (size_t)bs->dsk.meta_block_size };
         data->callback = simple_callback_r;
@@ -1276,10 +1418,10 @@ void journal_flusher_co::update_clean_db()
     }
     else
     {
-        clean_db[cur.oid] = {
+        clean_db.set(cur.oid, (struct clean_entry){
             .version = cur.version,
             .location = clean_loc,
-        };
+        });
     }
 }
 
@@ -1299,7 +1441,7 @@ void journal_flusher_co::free_data_blocks()
         if (used)
             uo_it->second.was_freed = true;
         else
-            bs->data_alloc->set(old_clean_loc >> bs->dsk.block_order, false);
+            bs->free_data_block(old_clean_loc >> bs->dsk.block_order);
     }
     if (has_delete)
     {
@@ -1315,7 +1457,7 @@ void journal_flusher_co::free_data_blocks()
         if (used)
             uo_it->second.was_freed = true;
         else
-            bs->data_alloc->set(old_clean_loc >> bs->dsk.block_order, false);
+            bs->free_data_block(old_clean_loc >> bs->dsk.block_order);
     }
 }
 
@@ -1434,6 +1576,7 @@ bool journal_flusher_co::trim_journal(int wait_base)
             {
                 await_sqe(3);
                 io_uring_prep_fsync(sqe, bs->dsk.journal_fd, IORING_FSYNC_DATASYNC);
+                bs->journal.fsyncs++;
                 data->iov = { 0 };
                 data->callback = simple_callback_w;
                 wait_count++;
@@ -56,9 +56,9 @@ class journal_flusher_co
     std::list<flusher_sync_t>::iterator cur_sync;
 
     obj_ver_id cur;
-    std::map<obj_ver_id, dirty_entry>::iterator dirty_it, dirty_start, dirty_end;
+    blockstore_dirty_db_t::iterator dirty_it, dirty_start, dirty_end;
     std::map<object_id, uint64_t>::iterator repeat_it;
-    std::function<void(ring_data_t*)> simple_callback_r, simple_callback_rj, simple_callback_w;
+    callback_t<void(ring_data_t*)> simple_callback_r, simple_callback_rj, simple_callback_w;
 
     bool try_trim = false;
     bool skip_copy, has_delete, has_writes;
@@ -76,9 +76,12 @@ class journal_flusher_co
     uint8_t *new_clean_bitmap;
 
     uint64_t new_trim_pos;
+    uint64_t write_len;
+    timespec write_start;
 
     friend class journal_flusher_t;
     void scan_dirty();
+    void find_dirty_range();
     bool read_dirty(int wait_base);
     bool modify_meta_do_reads(int wait_base);
     bool wait_meta_reads(int wait_base);
@@ -122,15 +125,33 @@ class journal_flusher_t
     std::unordered_map<object_id, uint64_t> flush_versions;
     std::unordered_set<uint64_t> inflight_meta_sectors;
 
-    bool try_find_older(std::map<obj_ver_id, dirty_entry>::iterator & dirty_end, obj_ver_id & cur);
-    bool try_find_other(std::map<obj_ver_id, dirty_entry>::iterator & dirty_end, obj_ver_id & cur);
+    // Data device location of the last flushed object, for the elevator ordering and seek statistics
+    uint64_t last_flush_loc = 0;
+    // Average data write latency in microseconds and flusher count limit derived from it
+    uint64_t avg_write_latency_us = 0;
+    int latency_flusher_count = 1, latency_flush_counter = 0;
+
+    bool try_find_older(blockstore_dirty_db_t::iterator & dirty_end, obj_ver_id & cur);
+    bool try_find_other(blockstore_dirty_db_t::iterator & dirty_end, obj_ver_id & cur);
+    uint64_t get_flush_location(object_id oid, uint64_t version);
+    void pick_nearest_flush();
+    void calc_target_flusher_count();
+    void add_write_stats(uint64_t loc, uint64_t len);
+    void add_write_latency(timespec & start);
 
 public:
+    // Flush statistics: object count and bytes written to the data device, total seek distance
+    // and the number of flushes which continued the previous one sequentially
+    uint64_t stat_flush_count = 0, stat_flush_bytes = 0, stat_seek_bytes = 0, stat_sequential = 0;
+
     journal_flusher_t(blockstore_impl_t *bs);
     ~journal_flusher_t();
     void loop();
     bool is_trim_wanted() { return trim_wanted; }
     bool is_active();
+    size_t get_queue_size() { return flush_queue.size(); }
+    int get_active_flushers() { return active_flushers; }
+    int get_flusher_count() { return cur_flusher_count; }
     void mark_trim_possible();
     void request_trim();
     void release_trim();
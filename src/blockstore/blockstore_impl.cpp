@@ -12,6 +12,7 @@ blockstore_impl_t::blockstore_impl_t(blockstore_config_t & config, ring_loop_t *
     ringloop->register_consumer(&ring_consumer);
     initialized = 0;
     parse_config(config, true);
+    qos.configure(this);
     try
     {
         dsk.open_data();
@@ -20,7 +21,10 @@ blockstore_impl_t::blockstore_impl_t(blockstore_config_t & config, ring_loop_t *
         calc_lengths();
         alloc_dyn_data = dsk.clean_dyn_size > sizeof(void*) || dsk.csum_block_size > 0;
         zero_object = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, dsk.data_block_size);
+        if (read_coalesce_gap)
+            read_gap_buf = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, read_coalesce_gap);
         data_alloc = new allocator_t(dsk.block_count);
+        discard.init(this, online_discard && !readonly);
     }
     catch (std::exception & e)
     {
@@ -32,10 +36,14 @@ blockstore_impl_t::blockstore_impl_t(blockstore_config_t & config, ring_loop_t *
 
 blockstore_impl_t::~blockstore_impl_t()
 {
+    if (journal_batch_timer_id >= 0)
+        tfd->clear_timer(journal_batch_timer_id);
     delete data_alloc;
     delete flusher;
     if (zero_object)
         free(zero_object);
+    if (read_gap_buf)
+        free(read_gap_buf);
     ringloop->unregister_consumer(&ring_consumer);
     dsk.close_all();
     if (metadata_buffer)
@@ -73,9 +81,17 @@ void blockstore_impl_t::loop()
             {
                 delete metadata_init_reader;
                 metadata_init_reader = NULL;
-                journal_init_reader = new blockstore_init_journal(this);
+                if (!journal_init_reader)
+                    journal_init_reader = new blockstore_init_journal(this);
                 initialized = 2;
             }
+            else if (metadata_init_reader->is_header_loaded())
+            {
+                // Start reading the journal in parallel with metadata, it's replayed when metadata is loaded
+                if (!journal_init_reader)
+                    journal_init_reader = new blockstore_init_journal(this);
+                journal_init_reader->loop();
+            }
         }
         if (initialized == 2)
         {
@@ -110,6 +126,10 @@ void blockstore_impl_t::loop()
     }
     else
     {
+        if (qos.queued() > 0)
+        {
+            qos.dispatch();
+        }
         // try to submit ops
         unsigned initial_ring_space = ringloop->space_left();
         // has_writes == 0 - no writes before the current queue item
@@ -125,7 +145,12 @@ void blockstore_impl_t::loop()
             // In all other cases we should stop submission
             if (PRIV(op)->wait_for)
             {
+                int wait_for = PRIV(op)->wait_for;
                 check_wait(op);
+                if (!PRIV(op)->wait_for)
+                {
+                    wait_hist[wait_for].add(bs_now_us() - PRIV(op)->wait_start_us);
+                }
                 if (PRIV(op)->wait_for == WAIT_SQE)
                 {
                     break;
@@ -189,6 +214,11 @@ void blockstore_impl_t::loop()
                 process_list(op);
                 wr_st = 2;
             }
+            if (wr_st == 1 && !PRIV(op)->submit_us)
+            {
+                PRIV(op)->submit_us = bs_now_us();
+                queue_hist[op->opcode].add(PRIV(op)->submit_us - PRIV(op)->enqueue_us);
+            }
             if (wr_st == 2)
             {
                 submit_queue[op_idx] = NULL;
@@ -197,6 +227,10 @@ void blockstore_impl_t::loop()
             if (wr_st == 0)
             {
                 ringloop->restore(prev_sqe_pos);
+                if (PRIV(op)->wait_for)
+                {
+                    PRIV(op)->wait_start_us = bs_now_us();
+                }
                 if (PRIV(op)->wait_for == WAIT_SQE)
                 {
                     // ring is full, stop submission
@@ -216,10 +250,12 @@ void blockstore_impl_t::loop()
             }
             submit_queue.resize(new_idx);
         }
+        submit_journal_batch();
         if (!readonly)
         {
             flusher->loop();
         }
+        discard.loop();
         int ret = ringloop->submit();
         if (ret < 0)
         {
@@ -244,7 +280,7 @@ bool blockstore_impl_t::is_safe_to_stop()
 {
     // It's safe to stop blockstore when there are no in-flight operations,
     // no in-progress syncs and flusher isn't doing anything
-    if (submit_queue.size() > 0 || !readonly && flusher->is_active())
+    if (submit_queue.size() > 0 || qos.queued() > 0 || !readonly && flusher->is_active() || discard.is_active())
     {
         return false;
     }
@@ -329,6 +365,16 @@ void blockstore_impl_t::check_wait(blockstore_op_t *op)
 }
 
 void blockstore_impl_t::enqueue_op(blockstore_op_t *op)
+{
+    if (op->opcode != BS_OP_READ_BITMAP && (qos.enabled() || qos.queued() > 0) && qos.hold(op))
+    {
+        return;
+    }
+    submit_op(op);
+}
+
+// Returns false if the operation is completed immediately with an error
+bool blockstore_impl_t::submit_op(blockstore_op_t *op)
 {
     if (op->opcode < BS_OP_MIN || op->opcode > BS_OP_MAX ||
         ((op->opcode == BS_OP_READ || op->opcode == BS_OP_WRITE || op->opcode == BS_OP_WRITE_STABLE) && (
@@ -336,17 +382,31 @@ void blockstore_impl_t::enqueue_op(blockstore_op_t *op)
             op->len > dsk.data_block_size-op->offset ||
             (op->len % dsk.disk_alignment)
         )) ||
-        readonly && op->opcode != BS_OP_READ && op->opcode != BS_OP_LIST)
+        readonly && op->opcode != BS_OP_READ && op->opcode != BS_OP_LIST && op->opcode != BS_OP_READ_BITMAP)
     {
         // Basic verification not passed
         op->retval = -EINVAL;
-        ringloop->set_immediate([op]() { std::function<void (blockstore_op_t*)>(op->callback)(op); });
-        return;
+        ringloop->set_immediate([op]() { callback_t<void (blockstore_op_t*)>(op->callback)(op); });
+        return false;
+    }
+    if (op->opcode == BS_OP_READ_BITMAP)
+    {
+        // Bitmaps are in memory, so the operation completes immediately
+        init_op(op);
+        read_bitmaps(op);
+        ringloop->set_immediate([this, op]() { FINISH_OP(op); });
+        return true;
+    }
+    if (op->opcode == BS_OP_WRITE_STABLE && write_combine_size > 0 && combine_write(op))
+    {
+        // Completed together with the previous write of the same object
+        init_op(op);
+        return true;
     }
     if ((op->opcode == BS_OP_WRITE || op->opcode == BS_OP_WRITE_STABLE || op->opcode == BS_OP_DELETE) && !enqueue_write(op))
     {
-        ringloop->set_immediate([op]() { std::function<void (blockstore_op_t*)>(op->callback)(op); });
-        return;
+        ringloop->set_immediate([op]() { callback_t<void (blockstore_op_t*)>(op->callback)(op); });
+        return false;
     }
     if (op->opcode == BS_OP_SYNC)
     {
@@ -355,6 +415,7 @@ void blockstore_impl_t::enqueue_op(blockstore_op_t *op)
     init_op(op);
     submit_queue.push_back(op);
     ringloop->wakeup();
+    return true;
 }
 
 void blockstore_impl_t::init_op(blockstore_op_t *op)
@@ -365,6 +426,22 @@ void blockstore_impl_t::init_op(blockstore_op_t *op)
     PRIV(op)->wait_for = 0;
     PRIV(op)->op_state = 0;
     PRIV(op)->pending_ops = 0;
+    PRIV(op)->qos_class = -1;
+    PRIV(op)->enqueue_us = PRIV(op)->exec_start_us = bs_now_us();
+    PRIV(op)->submit_us = 0;
+}
+
+void blockstore_impl_t::account_finish(blockstore_op_t *op)
+{
+    uint64_t now_us = bs_now_us();
+    if (!PRIV(op)->submit_us)
+    {
+        // Completed during the first submission attempt
+        PRIV(op)->submit_us = now_us;
+        queue_hist[op->opcode].add(now_us - PRIV(op)->enqueue_us);
+    }
+    exec_hist[op->opcode].add(now_us - PRIV(op)->submit_us);
+    qos.finish(op, now_us);
 }
 
 static bool replace_stable(object_id oid, uint64_t version, int search_start, int search_end, obj_ver_id* list)
@@ -399,7 +476,16 @@ blockstore_clean_db_t& blockstore_impl_t::clean_db_shard(object_id oid)
         // like map_to_pg()
         pg_num = (oid.stripe / sh_it->second.pg_stripe_size) % sh_it->second.pg_count + 1;
     }
-    return clean_db_shards[(pool_id << (64-POOL_ID_BITS)) | pg_num];
+    auto sh = clean_db_shards.try_emplace((pool_id << (64-POOL_ID_BITS)) | pg_num);
+    if (sh.second)
+        init_clean_db(sh.first->second);
+    return sh.first->second;
+}
+
+void blockstore_impl_t::init_clean_db(blockstore_clean_db_t & clean_db)
+{
+    if (compact_clean_db)
+        clean_db.set_compact(dsk.block_order);
 }
 
 void blockstore_impl_t::reshard_clean_db(pool_id_t pool, uint32_t pg_count, uint32_t pg_stripe_size)
@@ -415,7 +501,10 @@ void blockstore_impl_t::reshard_clean_db(pool_id_t pool, uint32_t pg_count, uint
             // like map_to_pg()
             uint64_t pg_num = (pair.first.stripe / pg_stripe_size) % pg_count + 1;
             uint64_t shard_id = (pool_id << (64-POOL_ID_BITS)) | pg_num;
-            new_shards[shard_id][pair.first] = pair.second;
+            auto new_sh = new_shards.try_emplace(shard_id);
+            if (new_sh.second)
+                init_clean_db(new_sh.first->second);
+            new_sh.first->second.set(pair.first, pair.second);
         }
         clean_db_shards.erase(sh_it++);
     }
@@ -688,6 +777,129 @@ void blockstore_impl_t::dump_diagnostics()
 {
     journal.dump_diagnostics();
     flusher->dump_diagnostics();
+    uint64_t free_extents = 0, max_free_extent = 0;
+    data_alloc->get_free_extents(&free_extents, &max_free_extent);
+    printf(
+        "Data: free blocks=%ju/%ju free_extents=%ju max_free_extent=%ju\n",
+        data_alloc->get_free_count(), dsk.block_count, free_extents, max_free_extent
+    );
+    uint64_t clean_count = 0, clean_compact = 0, clean_bytes = 0;
+    for (auto & sh: clean_db_shards)
+    {
+        clean_count += sh.second.size();
+        clean_compact += sh.second.compact_size();
+        clean_bytes += sh.second.bytes_used();
+    }
+    printf(
+        "Memory: clean_db=%ju entries (%ju compact) %ju KB, dirty_db=%ju entries %ju KB,"
+        " metadata=%ju KB, clean bitmaps=%ju KB, journal=%ju KB\n",
+        clean_count, clean_compact, clean_bytes/1024, dirty_db.size(), dirty_db.bytes_used()/1024,
+        metadata_buffer && inmemory_meta ? dsk.meta_len/1024 : 0,
+        clean_bitmaps ? dsk.block_count * 2 * dsk.clean_entry_bitmap_size / 1024 : 0,
+        journal.inmemory ? journal.len/1024 : 0
+    );
+    if (meta_cache.enabled())
+    {
+        printf(
+            "Metadata cache: %ju KB, hits=%ju misses=%ju evictions=%ju\n",
+            meta_cache.size()/1024, meta_cache.hits, meta_cache.misses, meta_cache.evictions
+        );
+    }
+    if (journal_cache.enabled())
+    {
+        printf(
+            "Journal cache: %ju KB, hits=%ju misses=%ju evictions=%ju\n",
+            journal_cache.size()/1024, journal_cache.hits, journal_cache.misses, journal_cache.evictions
+        );
+    }
+    if (qos.enabled())
+    {
+        qos.dump_diagnostics();
+    }
+    if (write_combine_size > 0)
+    {
+        printf("Write combining: %ju writes, %ju KB combined\n", write_combine_ops, write_combine_bytes/1024);
+    }
+    if (online_discard)
+    {
+        printf(
+            "Online discard: %s, pending=%ju blocks, discarded=%ju KB in %ju requests, errors=%ju\n",
+            discard.enabled() ? "active" : "disabled", discard.pending_count(),
+            discard.discarded_bytes/1024, discard.discard_ops, discard.discard_errors
+        );
+    }
+}
+
+void blockstore_impl_t::get_counters(std::map<std::string, uint64_t> & counters)
+{
+    counters["flush_count"] += flusher->stat_flush_count;
+    counters["flush_bytes"] += flusher->stat_flush_bytes;
+    counters["flush_seek_bytes"] += flusher->stat_seek_bytes;
+    counters["flush_sequential"] += flusher->stat_sequential;
+    counters["flush_queue"] += flusher->get_queue_size();
+    counters["flush_active"] += flusher->get_active_flushers();
+    counters["flusher_count"] += flusher->get_flusher_count();
+    counters["dirty_db_entries"] += dirty_db.size();
+    counters["submit_queue_ops"] += submit_queue.size();
+    counters["write_iodepth"] += write_iodepth;
+    counters["unstable_writes"] += unstable_writes.size();
+    counters["journal_size"] += journal.len;
+    counters["journal_used"] += journal.next_free >= journal.used_start
+        ? journal.next_free-journal.used_start
+        : journal.len-journal.used_start + journal.next_free-journal.block_size;
+    counters["wait_sqe"] += wait_hist[WAIT_SQE].count;
+    counters["wait_journal"] += wait_hist[WAIT_JOURNAL].count;
+    counters["wait_journal_buffer"] += wait_hist[WAIT_JOURNAL_BUFFER].count;
+    counters["wait_free"] += wait_hist[WAIT_FREE].count;
+    if (meta_cache.enabled())
+    {
+        counters["meta_cache_hits"] += meta_cache.hits;
+        counters["meta_cache_misses"] += meta_cache.misses;
+        counters["meta_cache_evictions"] += meta_cache.evictions;
+        counters["meta_cache_bytes"] += meta_cache.size();
+    }
+    if (journal_cache.enabled())
+    {
+        counters["journal_cache_hits"] += journal_cache.hits;
+        counters["journal_cache_misses"] += journal_cache.misses;
+        counters["journal_cache_evictions"] += journal_cache.evictions;
+        counters["journal_cache_bytes"] += journal_cache.size();
+    }
+    if (qos.enabled())
+    {
+        qos.get_counters(counters);
+    }
+    if (write_combine_size > 0)
+    {
+        counters["write_combine_ops"] += write_combine_ops;
+        counters["write_combine_bytes"] += write_combine_bytes;
+    }
+    if (online_discard)
+    {
+        counters["discard_bytes"] += discard.discarded_bytes;
+        counters["discard_ops"] += discard.discard_ops;
+        counters["discard_errors"] += discard.discard_errors;
+        counters["discard_pending_blocks"] += discard.pending_count();
+    }
+}
+
+void blockstore_impl_t::get_histograms(std::map<std::string, blockstore_hist_t> & hists)
+{
+    static const char *wait_names[WAIT_FREE+1] = { NULL, "wait_sqe", NULL, "wait_journal", "wait_journal_buffer", "wait_free" };
+    static const char *op_names[BS_OP_MAX+1] = { NULL, "read", "write", "write_stable", "sync", "stable", "delete", "list", "rollback", "read_bitmap" };
+    for (int i = 0; i <= WAIT_FREE; i++)
+    {
+        if (wait_names[i])
+            hists[wait_names[i]].merge(wait_hist[i]);
+    }
+    for (int i = BS_OP_MIN; i <= BS_OP_MAX; i++)
+    {
+        if (queue_hist[i].count)
+        {
+            hists[std::string("queue_")+op_names[i]].merge(queue_hist[i]);
+            hists[std::string("exec_")+op_names[i]].merge(exec_hist[i]);
+        }
+    }
 }
 
 void blockstore_impl_t::disk_error_abort(const char *op, int retval, int expected)
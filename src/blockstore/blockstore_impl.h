@@ -25,6 +25,11 @@
 
 #include "malloc_or_die.h"
 #include "allocator.h"
+#include "blockstore_clean_db.h"
+#include "blockstore_meta_cache.h"
+#include "blockstore_journal_cache.h"
+#include "blockstore_discard.h"
+#include "blockstore_qos.h"
 
 //#define BLOCKSTORE_DEBUG
 
@@ -122,6 +127,47 @@ struct __attribute__((__packed__)) blockstore_meta_header_v2_t
     uint32_t header_csum;
 };
 
+// "VITAshrd"
+#define BLOCKSTORE_META_SHARDS_MAGIC 0x6472687341544956l
+
+// Shard count of a sharded blockstore, stored in the metadata superblock of each shard right
+// after the header. It's absent in non-sharded blockstores, which means that there's 1 shard
+struct __attribute__((__packed__)) blockstore_meta_shards_t
+{
+    uint64_t magic;
+    uint64_t shard_count;
+};
+
+// "VITAsnap"
+#define BLOCKSTORE_META_SNAPSHOT_MAGIC 0x70616E7341544956l
+#define BLOCKSTORE_META_SNAPSHOT_VERSION 1
+#define BLOCKSTORE_META_SNAPSHOT_BITMAPS 1ul
+
+// Reference to the metadata snapshot file, stored in the last bytes of the metadata superblock.
+// It's only present after a graceful stop and is cleared on startup before metadata is changed
+struct __attribute__((__packed__)) blockstore_meta_snapshot_ref_t
+{
+    uint64_t magic;
+    uint64_t snapshot_id;
+};
+
+// Metadata snapshot file header, followed by <entry_count> varint-encoded clean entries
+// in object ID order (and their bitmaps if BLOCKSTORE_META_SNAPSHOT_BITMAPS is set)
+struct __attribute__((__packed__)) blockstore_meta_snapshot_header_t
+{
+    uint64_t magic;
+    uint64_t version;
+    uint64_t snapshot_id;
+    uint64_t block_count;
+    uint32_t data_block_size;
+    uint32_t clean_entry_bitmap_size;
+    uint64_t flags;
+    uint64_t entry_count;
+    uint64_t data_size;
+    uint32_t data_csum;
+    uint32_t header_csum;
+};
+
 // 32 bytes = 24 bytes + block bitmap (4 bytes by default) + external attributes (also bitmap, 4 bytes by default)
 // per "clean" entry on disk with fixed metadata tables
 struct __attribute__((__packed__)) clean_disk_entry
@@ -134,13 +180,6 @@ struct __attribute__((__packed__)) clean_disk_entry
     // uint32_t entry_csum;
 };
 
-// 32 = 16 + 16 bytes per "clean" entry in memory (object_id => clean_entry)
-struct __attribute__((__packed__)) clean_entry
-{
-    uint64_t version;
-    uint64_t location;
-};
-
 // 64 = 24 + 40 bytes per dirty entry in memory (obj_ver_id => dirty_entry). Plus checksums
 struct __attribute__((__packed__)) dirty_entry
 {
@@ -186,23 +225,42 @@ struct used_clean_obj_t
     bool was_changed; // was changed by a parallel flush?
 };
 
-// https://github.com/algorithm-ninja/cpp-btree
-// https://github.com/greg7mdp/sparsepp/ was used previously, but it was TERRIBLY slow after resizing
-// with sparsepp, random reads dropped to ~700 iops very fast with just as much as ~32k objects in the DB
-typedef btree::btree_map<object_id, clean_entry> blockstore_clean_db_t;
-typedef std::map<obj_ver_id, dirty_entry> blockstore_dirty_db_t;
+// dirty_db is also a B-tree, with larger nodes because its entries are 64 bytes.
+// Its iterators are invalidated by any insert or erase, so code that yields
+// (flusher coroutines) must not keep them and should find entries by key again
+typedef btree::btree_map<obj_ver_id, dirty_entry, std::less<obj_ver_id>,
+    std::allocator<std::pair<const obj_ver_id, dirty_entry>>, 1024> blockstore_dirty_db_t;
 
 #include "blockstore_init.h"
 
 #include "blockstore_flush.h"
 
 #define PRIV(op) ((blockstore_op_private_t*)(op)->private_data)
-#define FINISH_OP(op) PRIV(op)->~blockstore_op_private_t(); std::function<void (blockstore_op_t*)>(op->callback)(op)
+#define FINISH_OP(op) account_finish(op); PRIV(op)->~blockstore_op_private_t(); callback_t<void (blockstore_op_t*)>(op->callback)(op)
+
+// Disk extent of a read operation, planned in fulfill_read_push() and submitted in submit_read_plan()
+struct read_extent_t
+{
+    bool journal;
+    uint64_t offset, len;
+    void *buf;
+};
+
+// Original parameters of a queued small write which absorbed subsequent writes
+struct combined_write_t
+{
+    void *buf;
+    uint32_t offset, len;
+    uint64_t version;
+    std::vector<blockstore_op_t*> ops;
+};
 
 struct blockstore_op_private_t
 {
     // Wait status
     int wait_for;
+    // QoS class if the operation was released by the scheduler, otherwise -1
+    int qos_class;
     uint64_t wait_detail, wait_detail2;
     int pending_ops;
     int op_state;
@@ -210,6 +268,8 @@ struct blockstore_op_private_t
     // Read
     uint64_t clean_block_used;
     std::vector<copy_buffer_t> read_vec;
+    std::vector<read_extent_t> read_plan;
+    std::vector<iovec> read_iov;
 
     // Sync, write
     uint64_t min_flushed_journal_sector, max_flushed_journal_sector;
@@ -218,12 +278,25 @@ struct blockstore_op_private_t
     struct iovec iov_zerofill[3];
     // Warning: must not have a default value here because it's written to before calling constructor in blockstore_write.cpp O_o
     uint64_t real_version;
-    timespec tv_begin;
 
     // Sync
     std::vector<obj_ver_id> sync_big_writes, sync_small_writes;
+
+    // Time when the operation was enqueued (or queued in the QoS scheduler), submitted
+    // and started to wait for the current <wait_for> reason, for latency histograms
+    uint64_t enqueue_us, submit_us, wait_start_us;
+    // Time when the operation was put into the submit queue (after the QoS scheduler),
+    // small write throttling measures execution time from it
+    uint64_t exec_start_us;
 };
 
+inline uint64_t bs_now_us()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec*1000000 + tv.tv_nsec/1000;
+}
+
 typedef uint32_t pool_id_t;
 typedef uint64_t pool_pg_id_t;
 
@@ -252,9 +325,18 @@ class blockstore_impl_t
     // Suitable only for server SSDs with capacitors, requires disabled data and journal fsyncs
     int immediate_commit = IMMEDIATE_NONE;
     bool inmemory_meta = false;
+    // Metadata and journal reads in flight and metadata parsing threads during startup
+    unsigned init_queue_depth = 8;
+    unsigned init_threads = 4;
     // Maximum and minimum flusher count
     unsigned max_flusher_count, min_flusher_count;
     unsigned journal_trim_interval;
+    // Number of first flush queue entries to pick the nearest one from, by data location (0 = FIFO)
+    unsigned flusher_sort_window = 0;
+    // Target flusher data write latency to adjust the flusher count (0 = don't adjust)
+    uint64_t flusher_target_latency_us = 0;
+    // Limit flusher count to min_flusher_count while there are reads from the disk in progress
+    bool flusher_read_backoff = false;
     // Maximum queue depth
     unsigned max_write_iodepth = 128;
     // Enable small (journaled) write throttling, useful for the SSD+HDD case
@@ -267,8 +349,36 @@ class blockstore_impl_t
     int throttle_threshold_us = 50;
     // Maximum writes between automatically added fsync operations
     uint64_t autosync_writes = 128;
+    // Time in microseconds to collect journal entries before writing the journal sector in the immediate_commit mode
+    uint64_t journal_group_commit_us = 0;
     // Log level (0-10)
     int log_level = 0;
+    // Clean metadata snapshot file written on graceful stop to skip metadata scan on the next start
+    std::string meta_snapshot_file;
+    // Maximum gap in bytes between disk extents of a read operation to merge them into one request
+    uint64_t read_coalesce_gap = 8192;
+    // Metadata block cache size in bytes for inmemory_metadata=false
+    uint64_t meta_cache_size = DEFAULT_META_CACHE_SIZE;
+    // Recently written journal data cache size in bytes for inmemory_journal=false
+    uint64_t journal_cache_size = DEFAULT_JOURNAL_CACHE_SIZE;
+    // Store clean_db entries in the compact form (17 instead of 32 bytes per object) when they fit
+    bool compact_clean_db = false;
+    // Discard freed data blocks in the background, with bandwidth and request rate limits
+    bool online_discard = false;
+    uint64_t discard_mbs = DEFAULT_DISCARD_MBS;
+    uint64_t discard_iops = DEFAULT_DISCARD_IOPS;
+    uint64_t max_discard_size = DEFAULT_MAX_DISCARD_SIZE;
+    // QoS scheduler: maximum reads, writes and deletes in progress (0 = disabled), weights and limits of classes
+    uint64_t qos_iodepth = 0;
+    uint64_t qos_client_weight = DEFAULT_QOS_CLIENT_WEIGHT;
+    uint64_t qos_recovery_weight = DEFAULT_QOS_RECOVERY_WEIGHT;
+    uint64_t qos_scrub_weight = DEFAULT_QOS_SCRUB_WEIGHT;
+    uint64_t qos_recovery_iops = 0, qos_recovery_mbs = 0;
+    uint64_t qos_scrub_iops = 0, qos_scrub_mbs = 0;
+    // Give each inode its own client queue
+    bool qos_per_inode = false;
+    // Maximum length of a small write combined from queued overwrites of the same object (0 = disabled)
+    uint64_t write_combine_size = 0;
     /******* END OF OPTIONS *******/
 
     struct ring_consumer_t ring_consumer;
@@ -277,14 +387,23 @@ class blockstore_impl_t
     std::map<pool_pg_id_t, blockstore_clean_db_t> clean_db_shards;
     std::map<uint64_t, int> no_inode_stats;
     uint8_t *clean_bitmaps = NULL;
+    blockstore_meta_cache_t meta_cache;
+    blockstore_journal_cache_t journal_cache;
+    blockstore_discard_t discard;
+    blockstore_qos_t qos;
     blockstore_dirty_db_t dirty_db;
     std::vector<blockstore_op_t*> submit_queue;
     std::vector<obj_ver_id> unsynced_big_writes, unsynced_small_writes;
     int unsynced_big_write_count = 0, unstable_unsynced = 0;
     int unsynced_queued_ops = 0;
+    // Queued small writes which absorbed subsequent writes to the same object
+    std::map<blockstore_op_t*, combined_write_t> combined_writes;
+    uint64_t write_combine_ops = 0, write_combine_bytes = 0;
     allocator_t *data_alloc = NULL;
     uint64_t used_blocks = 0;
     uint8_t *zero_object = NULL;
+    // Sink for gaps between merged read extents, its contents are never used
+    uint8_t *read_gap_buf = NULL;
 
     void *metadata_buffer = NULL;
 
@@ -292,6 +411,10 @@ class blockstore_impl_t
     journal_flusher_t *flusher;
     int big_to_flush = 0;
     int write_iodepth = 0;
+    // Read operations waiting for the disk
+    int inflight_reads = 0;
+    // Latency histograms: waits by WAIT_* reason, queue-to-submit and submit-to-complete by opcode
+    blockstore_hist_t wait_hist[WAIT_FREE+1], queue_hist[BS_OP_MAX+1], exec_hist[BS_OP_MAX+1];
     bool alloc_dyn_data = false;
 
     // clean data blocks referenced by read operations
@@ -302,17 +425,27 @@ class blockstore_impl_t
     timerfd_manager_t *tfd;
 
     bool stop_sync_submitted;
+    int journal_batch_timer_id = -1;
 
     inline struct io_uring_sqe* get_sqe()
     {
         return ringloop->get_sqe();
     }
 
+    // Free a data block and queue it for online discard
+    inline void free_data_block(uint64_t block_num)
+    {
+        data_alloc->set(block_num, false);
+        discard.add(block_num);
+    }
+
     friend class blockstore_init_meta;
     friend class blockstore_init_journal;
     friend struct blockstore_journal_check_t;
     friend class journal_flusher_t;
     friend class journal_flusher_co;
+    friend class blockstore_discard_t;
+    friend class blockstore_qos_t;
 
     void calc_lengths();
     void open_data();
@@ -321,22 +454,31 @@ class blockstore_impl_t
     uint8_t* get_clean_entry_bitmap(uint64_t block_loc, int offset);
 
     blockstore_clean_db_t& clean_db_shard(object_id oid);
+    void init_clean_db(blockstore_clean_db_t & clean_db);
     void reshard_clean_db(pool_id_t pool_id, uint32_t pg_count, uint32_t pg_stripe_size);
     void recalc_inode_space_stats(uint64_t pool_id, bool per_inode);
 
+    // Metadata snapshot
+    bool load_meta_snapshot(uint64_t snapshot_id);
+
     // Journaling
     void prepare_journal_sector_write(int sector, blockstore_op_t *op);
+    void add_to_journal_batch(blockstore_op_t *op);
+    void write_journal_batch();
+    void submit_journal_batch();
     void handle_journal_write(ring_data_t *data, uint64_t flush_id);
     void disk_error_abort(const char *op, int retval, int expected);
 
     // Asynchronous init
     int initialized;
     int metadata_buf_size;
-    blockstore_init_meta* metadata_init_reader;
-    blockstore_init_journal* journal_init_reader;
+    blockstore_init_meta* metadata_init_reader = NULL;
+    blockstore_init_journal* journal_init_reader = NULL;
 
     void check_wait(blockstore_op_t *op);
     void init_op(blockstore_op_t *op);
+    bool submit_op(blockstore_op_t *op);
+    void account_finish(blockstore_op_t *op);
 
     // Read
     int dequeue_read(blockstore_op_t *read_op);
@@ -364,6 +506,7 @@ class blockstore_impl_t
         iovec *iov, int n_iov, std::function<void(uint32_t, uint32_t, uint32_t)> bad_block_cb);
     bool verify_clean_padded_checksums(blockstore_op_t *op, uint64_t clean_loc, uint8_t *dyn_data, bool from_journal,
         iovec *iov, int n_iov, std::function<void(uint32_t, uint32_t, uint32_t)> bad_block_cb);
+    int submit_read_plan(blockstore_op_t *op);
     int fulfill_read_push(blockstore_op_t *op, void *buf, uint64_t offset, uint64_t len,
         uint32_t item_state, uint64_t item_version);
     void handle_read_event(ring_data_t *data, blockstore_op_t *op);
@@ -371,7 +514,10 @@ class blockstore_impl_t
     // Write
     bool enqueue_write(blockstore_op_t *op);
     void cancel_all_writes(blockstore_op_t *op, blockstore_dirty_db_t::iterator dirty_it, int retval);
+    bool combine_write(blockstore_op_t *op);
+    void finish_combined_writes(blockstore_op_t *op, int retval);
     int dequeue_write(blockstore_op_t *op);
+    uint64_t get_alloc_hint(object_id oid);
     int dequeue_del(blockstore_op_t *op);
     int continue_write(blockstore_op_t *op);
     void release_journal_sectors(blockstore_op_t *op);
@@ -426,6 +572,7 @@ public:
 
     // Simplified synchronous operation: get object bitmap & current version
     int read_bitmap(object_id oid, uint64_t target_version, void *bitmap, uint64_t *result_version = NULL);
+    void read_bitmaps(blockstore_op_t *op);
 
     // Unstable writes are added here (map of object_id -> version)
     std::unordered_map<object_id, uint64_t> unstable_writes;
@@ -439,6 +586,14 @@ public:
     // Print diagnostics to stdout
     void dump_diagnostics();
 
+    // Add internal counters to <counters>
+    void get_counters(std::map<std::string, uint64_t> & counters);
+    void get_histograms(std::map<std::string, blockstore_hist_t> & hists);
+
+    // Save clean metadata snapshot if <meta_snapshot_file> is set. Only possible when the
+    // blockstore is idle (is_safe_to_stop() returns true), makes it readonly afterwards
+    bool save_meta_snapshot();
+
     inline uint32_t get_block_size() { return dsk.data_block_size; }
     inline uint64_t get_block_count() { return dsk.block_count; }
     inline uint64_t get_free_block_count() { return dsk.block_count - used_blocks; }
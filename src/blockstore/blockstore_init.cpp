@@ -8,6 +8,9 @@
 #define INIT_META_READ_DONE 2
 #define INIT_META_WRITING 3
 
+// Startup progress is printed every INIT_PROGRESS_INTERVAL seconds
+#define INIT_PROGRESS_INTERVAL 5
+
 #define GET_SQE() \
     sqe = bs->get_sqe();\
     if (!sqe)\
@@ -22,11 +25,52 @@ static bool iszero(uint64_t *buf, int len)
     return true;
 }
 
+static double init_time()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec + tv.tv_nsec/1000000000.0;
+}
+
+static double init_speed(uint64_t bytes, double start_time)
+{
+    double t = init_time() - start_time;
+    return t > 0 ? bytes/t/1024/1024 : 0;
+}
+
+static void report_init_progress(const char *what, uint64_t done, uint64_t total, double start_time, double & last_report)
+{
+    double now = init_time();
+    if (now - last_report < INIT_PROGRESS_INTERVAL)
+        return;
+    last_report = now;
+    if (total)
+        printf("%s: %ju/%ju MB (%ju%%), %.1f MB/s\n", what, done/1024/1024, total/1024/1024, done*100/total, init_speed(done, start_time));
+    else
+        printf("%s: %ju MB, %.1f MB/s\n", what, done/1024/1024, init_speed(done, start_time));
+}
+
+// All versions of an object must go to the same parsing thread
+static inline int meta_part_for(object_id oid, uint32_t block_order, int part_count)
+{
+    return ((oid.inode + (oid.stripe >> block_order)) * 0x9E3779B97F4A7C15ull >> 32) % part_count;
+}
+
 blockstore_init_meta::blockstore_init_meta(blockstore_impl_t *bs)
 {
     this->bs = bs;
 }
 
+blockstore_init_meta::~blockstore_init_meta()
+{
+    stop_parse_threads();
+}
+
+bool blockstore_init_meta::is_header_loaded()
+{
+    return md_offset != 0;
+}
+
 void blockstore_init_meta::handle_event(ring_data_t *data, int buf_num)
 {
     if (data->res < 0)
@@ -54,11 +98,15 @@ int blockstore_init_meta::loop()
     else if (wait_state == 4) goto resume_4;
     else if (wait_state == 5) goto resume_5;
     else if (wait_state == 6) goto resume_6;
+    else if (wait_state == 7) goto resume_7;
+    else if (wait_state == 8) goto resume_8;
     printf("Reading blockstore metadata\n");
+    start_time = last_report = init_time();
+    bufs.resize(bs->init_queue_depth);
     if (bs->inmemory_meta)
         metadata_buffer = bs->metadata_buffer;
     else
-        metadata_buffer = memalign(MEM_ALIGNMENT, 2*bs->metadata_buf_size);
+        metadata_buffer = memalign(MEM_ALIGNMENT, bufs.size()*bs->metadata_buf_size);
     if (!metadata_buffer)
         throw std::runtime_error("Failed to allocate metadata read buffer");
     // Read superblock
@@ -92,6 +140,12 @@ resume_1:
                 hdr->header_csum = 0;
                 hdr->header_csum = crc32c(0, hdr, sizeof(*hdr));
             }
+            if (bs->dsk.shard_count > 1)
+            {
+                blockstore_meta_shards_t *shards = (blockstore_meta_shards_t*)((uint8_t*)metadata_buffer + sizeof(*hdr));
+                shards->magic = BLOCKSTORE_META_SHARDS_MAGIC;
+                shards->shard_count = bs->dsk.shard_count;
+            }
         }
         if (bs->readonly)
         {
@@ -185,83 +239,159 @@ resume_1:
             );
             exit(1);
         }
+        blockstore_meta_shards_t *shards = (blockstore_meta_shards_t*)((uint8_t*)metadata_buffer + sizeof(*hdr));
+        uint64_t stored_shards = shards->magic == BLOCKSTORE_META_SHARDS_MAGIC ? shards->shard_count : 1;
+        if (stored_shards != bs->dsk.shard_count)
+        {
+            printf(
+                "Number of blockstore shards stored in metadata superblock (%ju) differs from OSD configuration (%ju).\n",
+                stored_shards, bs->dsk.shard_count
+            );
+            exit(1);
+        }
+        blockstore_meta_snapshot_ref_t *ref = (blockstore_meta_snapshot_ref_t*)(
+            (uint8_t*)metadata_buffer + bs->dsk.meta_block_size - sizeof(blockstore_meta_snapshot_ref_t));
+        if (ref->magic == BLOCKSTORE_META_SNAPSHOT_MAGIC)
+        {
+            snapshot_id = ref->snapshot_id;
+            // The snapshot is only valid until metadata is changed, so forget it before starting
+            memset(ref, 0, sizeof(blockstore_meta_snapshot_ref_t));
+        }
     }
-    // Skip superblock
-    md_offset = bs->dsk.meta_block_size;
-    next_offset = md_offset;
-    entries_per_block = bs->dsk.meta_block_size / bs->dsk.clean_entry_size;
-    // Read the rest of the metadata
-resume_2:
-    if (next_offset < bs->dsk.meta_len && submitted == 0)
+    if (snapshot_id)
     {
-        // Submit one read
-        for (int i = 0; i < 2; i++)
+        if (bs->meta_snapshot_file != "")
         {
-            if (!bufs[i].state)
+            snapshot_loaded = bs->load_meta_snapshot(snapshot_id);
+        }
+        if (!bs->readonly)
+        {
+            GET_SQE();
+            last_read_offset = 0;
+            data->iov = { metadata_buffer, (size_t)bs->dsk.meta_block_size };
+            data->callback = [this](ring_data_t *data) { handle_event(data, -1); };
+            io_uring_prep_writev(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset);
+            bs->ringloop->submit();
+            submitted++;
+        resume_7:
+            if (submitted > 0)
+            {
+                wait_state = 7;
+                return 1;
+            }
+            if (!bs->disable_meta_fsync)
             {
-                bufs[i].buf = (uint8_t*)metadata_buffer + (bs->inmemory_meta
-                    ? next_offset-md_offset
-                    : i*bs->metadata_buf_size);
-                bufs[i].offset = next_offset;
-                bufs[i].size = bs->dsk.meta_len-next_offset > bs->metadata_buf_size
-                    ? bs->metadata_buf_size : bs->dsk.meta_len-next_offset;
-                bufs[i].state = INIT_META_READING;
-                submitted++;
-                next_offset += bufs[i].size;
                 GET_SQE();
-                assert(bufs[i].size <= 0x7fffffff);
-                data->iov = { bufs[i].buf, (size_t)bufs[i].size };
-                data->callback = [this, i](ring_data_t *data) { handle_event(data, i); };
-                if (!zero_on_init)
-                    io_uring_prep_readv(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bufs[i].offset);
-                else
+                io_uring_prep_fsync(sqe, bs->dsk.meta_fd, IORING_FSYNC_DATASYNC);
+                data->iov = { 0 };
+                data->callback = [this](ring_data_t *data) { handle_event(data, -1); };
+                bs->ringloop->submit();
+                submitted++;
+            resume_8:
+                if (submitted > 0)
                 {
-                    // Fill metadata with zeroes
-                    memset(data->iov.iov_base, 0, data->iov.iov_len);
-                    io_uring_prep_writev(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bufs[i].offset);
+                    wait_state = 8;
+                    return 1;
                 }
-                bs->ringloop->submit();
-                break;
             }
         }
     }
-    for (int i = 0; i < 2; i++)
+    // Skip superblock
+    md_offset = bs->dsk.meta_block_size;
+    next_offset = md_offset;
+    entries_per_block = bs->dsk.meta_block_size / bs->dsk.clean_entry_size;
+    if (snapshot_loaded)
+    {
+        mark_used_blocks();
+        // Without inmemory_metadata, there's nothing to read. Otherwise metadata
+        // is still read into memory, but isn't parsed
+        if (!bs->inmemory_meta)
+            next_offset = bs->dsk.meta_len;
+    }
+    else
     {
-        if (bufs[i].state == INIT_META_READ_DONE)
+        start_parse_threads();
+    }
+    // Read the rest of the metadata with up to <init_queue_depth> requests in flight
+    // and handle buffers in order while the next ones are being read
+resume_2:
+    while (1)
+    {
+        while (next_offset < bs->dsk.meta_len && bufs[submit_buf].state == INIT_META_EMPTY)
         {
-            // Handle result
-            bool changed = false;
-            for (uint64_t sector = 0; sector < bufs[i].size; sector += bs->dsk.meta_block_size)
+            sqe = bs->get_sqe();
+            if (!sqe)
             {
-                // handle <count> entries
-                if (handle_meta_block(bufs[i].buf + sector, entries_per_block,
-                    ((bufs[i].offset + sector - md_offset) / bs->dsk.meta_block_size) * entries_per_block))
-                    changed = true;
-            }
-            if (changed && !bs->inmemory_meta && !bs->readonly)
-            {
-                // write the modified buffer back
-                GET_SQE();
-                assert(bufs[i].size <= 0x7fffffff);
-                data->iov = { bufs[i].buf, (size_t)bufs[i].size };
-                data->callback = [this, i](ring_data_t *data) { handle_event(data, i); };
-                io_uring_prep_writev(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + bufs[i].offset);
-                bs->ringloop->submit();
-                bufs[i].state = INIT_META_WRITING;
-                submitted++;
+                if (!submitted)
+                    throw std::runtime_error("io_uring is full during initialization");
+                break;
             }
+            data = ((ring_data_t*)sqe->user_data);
+            auto & mb = bufs[submit_buf];
+            mb.buf = (uint8_t*)metadata_buffer + (bs->inmemory_meta
+                ? next_offset-md_offset
+                : submit_buf*bs->metadata_buf_size);
+            mb.offset = next_offset;
+            mb.size = bs->dsk.meta_len-next_offset > bs->metadata_buf_size
+                ? bs->metadata_buf_size : bs->dsk.meta_len-next_offset;
+            mb.state = INIT_META_READING;
+            submitted++;
+            next_offset += mb.size;
+            assert(mb.size <= 0x7fffffff);
+            data->iov = { mb.buf, (size_t)mb.size };
+            int buf_num = submit_buf;
+            data->callback = [this, buf_num](ring_data_t *data) { handle_event(data, buf_num); };
+            if (!zero_on_init)
+                io_uring_prep_readv(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + mb.offset);
             else
             {
-                bufs[i].state = 0;
+                // Fill metadata with zeroes
+                memset(data->iov.iov_base, 0, data->iov.iov_len);
+                io_uring_prep_writev(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + mb.offset);
             }
-            bs->ringloop->wakeup();
+            submit_buf = (submit_buf+1) % bufs.size();
+        }
+        bs->ringloop->submit();
+        if (bufs[handle_buf].state != INIT_META_READ_DONE)
+        {
+            break;
+        }
+        auto & mb = bufs[handle_buf];
+        if (snapshot_loaded)
+        {
+            clear_stale_entries(&mb);
+            mb.state = INIT_META_EMPTY;
+        }
+        else if (handle_meta_buf(&mb) && !bs->inmemory_meta && !bs->readonly)
+        {
+            // write the modified buffer back
+            GET_SQE();
+            assert(mb.size <= 0x7fffffff);
+            data->iov = { mb.buf, (size_t)mb.size };
+            int buf_num = handle_buf;
+            data->callback = [this, buf_num](ring_data_t *data) { handle_event(data, buf_num); };
+            io_uring_prep_writev(sqe, bs->dsk.meta_fd, &data->iov, 1, bs->dsk.meta_offset + mb.offset);
+            mb.state = INIT_META_WRITING;
+            submitted++;
+        }
+        else
+        {
+            mb.state = INIT_META_EMPTY;
         }
+        report_init_progress("Reading metadata", mb.offset+mb.size-md_offset, bs->dsk.meta_len-md_offset, start_time, last_report);
+        handle_buf = (handle_buf+1) % bufs.size();
     }
     if (submitted > 0)
     {
         wait_state = 2;
         return 1;
     }
+    if (!snapshot_loaded)
+    {
+        merge_parts();
+        mark_used_blocks();
+    }
+    stop_parse_threads();
     if (entries_to_zero.size() && !bs->inmemory_meta && !bs->readonly)
     {
         std::sort(entries_to_zero.begin(), entries_to_zero.end());
@@ -304,7 +434,11 @@ resume_6:
         entries_to_zero.clear();
     }
     // metadata read finished
-    printf("Metadata entries loaded: %ju, free blocks: %ju / %ju\n", entries_loaded, bs->data_alloc->get_free_count(), bs->dsk.block_count);
+    printf(
+        "Metadata entries loaded: %ju, free blocks: %ju / %ju, %ju MB in %.1f s (%.1f MB/s)\n",
+        entries_loaded, bs->data_alloc->get_free_count(), bs->dsk.block_count,
+        (next_offset-md_offset)/1024/1024, init_time()-start_time, init_speed(next_offset-md_offset, start_time)
+    );
     if (!bs->inmemory_meta)
     {
         free(metadata_buffer);
@@ -329,24 +463,117 @@ resume_6:
     return 0;
 }
 
-bool blockstore_init_meta::handle_meta_block(uint8_t *buf, uint64_t entries_per_block, uint64_t done_cnt)
+void blockstore_init_meta::start_parse_threads()
+{
+    parts.resize(bs->init_threads > 1 ? bs->init_threads : 1);
+    for (auto & part: parts)
+    {
+        bs->init_clean_db(part.clean_db);
+    }
+    for (int n = 1; n < parts.size(); n++)
+    {
+        parse_threads.push_back(std::thread(&blockstore_init_meta::run_parse_thread, this, n));
+    }
+}
+
+void blockstore_init_meta::stop_parse_threads()
+{
+    if (!parse_threads.size())
+    {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lk(parse_mu);
+        parse_stop = true;
+    }
+    parse_cv.notify_all();
+    for (auto & t: parse_threads)
+    {
+        t.join();
+    }
+    parse_threads.clear();
+}
+
+void blockstore_init_meta::run_parse_thread(int part_num)
+{
+    uint64_t seq = 0;
+    std::unique_lock<std::mutex> lk(parse_mu);
+    while (1)
+    {
+        parse_cv.wait(lk, [&]() { return parse_stop || parse_seq != seq; });
+        if (parse_stop)
+        {
+            break;
+        }
+        seq = parse_seq;
+        lk.unlock();
+        handle_meta_part(part_num, parse_buf);
+        lk.lock();
+        if (!--parse_pending)
+        {
+            parse_done_cv.notify_one();
+        }
+    }
+}
+
+// Parse a metadata buffer in all threads, return true if it's modified and should be written back
+bool blockstore_init_meta::handle_meta_buf(blockstore_init_meta_buf *mb)
 {
+    if (parse_threads.size())
+    {
+        std::unique_lock<std::mutex> lk(parse_mu);
+        parse_buf = mb;
+        parse_pending = parse_threads.size();
+        parse_seq++;
+        lk.unlock();
+        parse_cv.notify_all();
+    }
+    handle_meta_part(0, mb);
+    if (parse_threads.size())
+    {
+        std::unique_lock<std::mutex> lk(parse_mu);
+        parse_done_cv.wait(lk, [&]() { return !parse_pending; });
+    }
     bool updated = false;
-    uint64_t max_i = entries_per_block;
-    if (max_i > bs->dsk.block_count-done_cnt)
-        max_i = bs->dsk.block_count-done_cnt;
-    for (uint64_t i = 0; i < max_i; i++)
+    for (auto & part: parts)
     {
-        clean_disk_entry *entry = (clean_disk_entry*)(buf + i*bs->dsk.clean_entry_size);
-        if (entry->oid.inode > 0)
+        updated = updated || part.updated;
+        part.updated = false;
+    }
+    return updated;
+}
+
+// Handle entries from <mb> belonging to <part_num>. Allocator and space statistics are only
+// filled in merge_parts(), so parts don't share anything except the metadata buffers
+void blockstore_init_meta::handle_meta_part(int part_num, blockstore_init_meta_buf *mb)
+{
+    auto & part = parts[part_num];
+    uint64_t done_cnt = ((mb->offset - md_offset) / bs->dsk.meta_block_size) * entries_per_block;
+    for (uint64_t sector = 0; sector < mb->size; sector += bs->dsk.meta_block_size)
+    {
+        uint64_t block_cnt = done_cnt + (sector / bs->dsk.meta_block_size) * entries_per_block;
+        if (block_cnt >= bs->dsk.block_count)
+        {
+            break;
+        }
+        uint64_t max_i = entries_per_block;
+        if (max_i > bs->dsk.block_count-block_cnt)
+            max_i = bs->dsk.block_count-block_cnt;
+        for (uint64_t i = 0; i < max_i; i++)
         {
+            clean_disk_entry *entry = (clean_disk_entry*)(mb->buf + sector + i*bs->dsk.clean_entry_size);
+            if (!entry->oid.inode ||
+                parts.size() > 1 && meta_part_for(entry->oid, bs->dsk.block_order, parts.size()) != part_num)
+            {
+                continue;
+            }
             if (bs->dsk.meta_format >= BLOCKSTORE_META_FORMAT_V2)
             {
                 // Check entry crc32
                 uint32_t *entry_csum = (uint32_t*)((uint8_t*)entry + bs->dsk.clean_entry_size - 4);
                 if (*entry_csum != crc32c(0, entry, bs->dsk.clean_entry_size - 4))
                 {
-                    printf("Metadata entry %ju is corrupt (checksum mismatch: %08x vs %08x), skipping\n", done_cnt+i, *entry_csum, crc32c(0, entry, bs->dsk.clean_entry_size - 4));
+                    printf("Metadata entry %ju is corrupt (checksum mismatch: %08x vs %08x), skipping\n", block_cnt+i, *entry_csum, crc32c(0, entry, bs->dsk.clean_entry_size - 4));
                     // zero out the invalid entry, otherwise we'll hit "tried to overwrite non-zero metadata entry" later
                     if (bs->inmemory_meta)
                     {
@@ -354,16 +581,16 @@ bool blockstore_init_meta::handle_meta_block(uint8_t *buf, uint64_t entries_per_
                     }
                     else
                     {
-                        entries_to_zero.push_back(done_cnt+i);
+                        part.entries_to_zero.push_back(block_cnt+i);
                     }
                     continue;
                 }
             }
             if (!bs->inmemory_meta && bs->dsk.clean_entry_bitmap_size)
             {
-                memcpy(bs->clean_bitmaps + (done_cnt+i) * 2 * bs->dsk.clean_entry_bitmap_size, &entry->bitmap, 2 * bs->dsk.clean_entry_bitmap_size);
+                memcpy(bs->clean_bitmaps + (block_cnt+i) * 2 * bs->dsk.clean_entry_bitmap_size, &entry->bitmap, 2 * bs->dsk.clean_entry_bitmap_size);
             }
-            auto & clean_db = bs->clean_db_shard(entry->oid);
+            auto & clean_db = parts.size() > 1 ? part.clean_db : bs->clean_db_shard(entry->oid);
             auto clean_it = clean_db.find(entry->oid);
             if (clean_it == clean_db.end() || clean_it->second.version < entry->version)
             {
@@ -382,51 +609,134 @@ bool blockstore_init_meta::handle_meta_block(uint8_t *buf, uint64_t entries_per_
                     }
                     else if (old_clean_loc >= done_cnt)
                     {
-                        updated = true;
+                        part.updated = true;
                         uint64_t sector = ((old_clean_loc - done_cnt) / entries_per_block) * bs->dsk.meta_block_size;
                         uint64_t pos = (old_clean_loc % entries_per_block);
-                        clean_disk_entry *old_entry = (clean_disk_entry*)(buf + sector + pos*bs->dsk.clean_entry_size);
+                        clean_disk_entry *old_entry = (clean_disk_entry*)(mb->buf + sector + pos*bs->dsk.clean_entry_size);
                         memset(old_entry, 0, bs->dsk.clean_entry_size);
                     }
                     else
                     {
-                        entries_to_zero.push_back(clean_it->second.location >> bs->dsk.block_order);
+                        part.entries_to_zero.push_back(old_clean_loc);
                     }
 #ifdef BLOCKSTORE_DEBUG
                     printf("Free block %ju from %jx:%jx v%ju (new location is %ju)\n",
                         old_clean_loc,
                         clean_it->first.inode, clean_it->first.stripe, clean_it->second.version,
-                        done_cnt+i);
+                        block_cnt+i);
 #endif
-                    bs->data_alloc->set(old_clean_loc, false);
-                }
-                else
-                {
-                    bs->inode_space_stats[entry->oid.inode] += bs->dsk.data_block_size;
-                    bs->used_blocks++;
                 }
-                entries_loaded++;
+                part.entries_loaded++;
 #ifdef BLOCKSTORE_DEBUG
-                printf("Allocate block (clean entry) %ju: %jx:%jx v%ju\n", done_cnt+i, entry->oid.inode, entry->oid.stripe, entry->version);
+                printf("Allocate block (clean entry) %ju: %jx:%jx v%ju\n", block_cnt+i, entry->oid.inode, entry->oid.stripe, entry->version);
 #endif
-                bs->data_alloc->set(done_cnt+i, true);
-                clean_db[entry->oid] = (struct clean_entry){
+                clean_db.set(entry->oid, (struct clean_entry){
                     .version = entry->version,
-                    .location = (done_cnt+i) << bs->dsk.block_order,
-                };
+                    .location = (block_cnt+i) << bs->dsk.block_order,
+                });
             }
             else
             {
                 // here we also have to zero out the entry
-                updated = true;
+                part.updated = true;
                 memset(entry, 0, bs->dsk.clean_entry_size);
 #ifdef BLOCKSTORE_DEBUG
-                printf("Old clean entry %ju: %jx:%jx v%ju\n", done_cnt+i, entry->oid.inode, entry->oid.stripe, entry->version);
+                printf("Old clean entry %ju: %jx:%jx v%ju\n", block_cnt+i, entry->oid.inode, entry->oid.stripe, entry->version);
 #endif
             }
         }
     }
-    return updated;
+}
+
+// Move objects from all parts to clean_db
+void blockstore_init_meta::merge_parts()
+{
+    if (parts.size() > 1)
+    {
+        // Parts are sorted, so merge them to only append to the end of clean_db shards.
+        // Merged entries are removed on the fly to not keep two copies of the whole clean_db
+        std::vector<blockstore_clean_db_t::iterator> its;
+        for (auto & part: parts)
+        {
+            its.push_back(part.clean_db.begin());
+        }
+        while (1)
+        {
+            int min_part = -1;
+            for (int n = 0; n < parts.size(); n++)
+            {
+                if (its[n] != parts[n].clean_db.end() && (min_part < 0 || its[n]->first < its[min_part]->first))
+                    min_part = n;
+            }
+            if (min_part < 0)
+            {
+                break;
+            }
+            auto & clean_db = bs->clean_db_shard(its[min_part]->first);
+            clean_db.insert(clean_db.end(), *its[min_part]);
+            its[min_part] = parts[min_part].clean_db.erase(its[min_part]);
+        }
+    }
+    for (auto & part: parts)
+    {
+        entries_loaded += part.entries_loaded;
+        entries_to_zero.insert(entries_to_zero.end(), part.entries_to_zero.begin(), part.entries_to_zero.end());
+    }
+    parts.clear();
+}
+
+// Mark blocks of all clean_db entries as used and calculate space statistics
+void blockstore_init_meta::mark_used_blocks()
+{
+    for (auto & sh: bs->clean_db_shards)
+    {
+        uint64_t inode = 0, inode_space = 0;
+        for (auto & pair: sh.second)
+        {
+            bs->data_alloc->set(pair.second.location >> bs->dsk.block_order, true);
+            if (pair.first.inode != inode)
+            {
+                if (inode_space)
+                    bs->inode_space_stats[inode] += inode_space;
+                inode = pair.first.inode;
+                inode_space = 0;
+            }
+            inode_space += bs->dsk.data_block_size;
+        }
+        if (inode_space)
+            bs->inode_space_stats[inode] += inode_space;
+        bs->used_blocks += sh.second.size();
+    }
+    if (snapshot_loaded)
+    {
+        entries_loaded = bs->used_blocks;
+    }
+}
+
+// Zero out entries not referenced by clean_db loaded from the snapshot. They're old versions
+// which were previously only removed from memory, not on disk, in inmemory_metadata mode.
+// Otherwise the flusher would hit "tried to overwrite non-zero metadata entry" later
+void blockstore_init_meta::clear_stale_entries(blockstore_init_meta_buf *mb)
+{
+    uint64_t done_cnt = ((mb->offset - md_offset) / bs->dsk.meta_block_size) * entries_per_block;
+    for (uint64_t sector = 0; sector < mb->size; sector += bs->dsk.meta_block_size)
+    {
+        uint64_t block_cnt = done_cnt + (sector / bs->dsk.meta_block_size) * entries_per_block;
+        for (uint64_t i = 0; i < entries_per_block && block_cnt+i < bs->dsk.block_count; i++)
+        {
+            clean_disk_entry *entry = (clean_disk_entry*)(mb->buf + sector + i*bs->dsk.clean_entry_size);
+            if (!entry->oid.inode)
+            {
+                continue;
+            }
+            auto & clean_db = bs->clean_db_shard(entry->oid);
+            auto clean_it = clean_db.find(entry->oid);
+            if (clean_it == clean_db.end() || clean_it->second.location != ((block_cnt+i) << bs->dsk.block_order))
+            {
+                memset(entry, 0, bs->dsk.clean_entry_size);
+            }
+        }
+    }
 }
 
 blockstore_init_journal::blockstore_init_journal(blockstore_impl_t *bs)
@@ -443,28 +753,66 @@ blockstore_init_journal::blockstore_init_journal(blockstore_impl_t *bs)
     };
 }
 
-void blockstore_init_journal::handle_event(ring_data_t *data1)
+void blockstore_init_journal::handle_event(ring_data_t *data1, void *buf)
 {
-    if (data1->res <= 0)
+    for (auto & rd: reading)
     {
-        throw std::runtime_error(
-            std::string("read journal failed at offset ") + std::to_string(journal_pos) +
-            std::string(": ") + strerror(-data1->res)
-        );
+        if (rd.buf == buf)
+        {
+            if (data1->res != rd.len)
+            {
+                throw std::runtime_error(
+                    std::string("read journal failed at offset ") + std::to_string(rd.pos) +
+                    std::string(": ") + (data1->res < 0 ? strerror(-data1->res) : "short read")
+                );
+            }
+            rd.done = true;
+            break;
+        }
     }
-    done.push_back({
-        .buf = submitted_buf,
-        .pos = journal_pos,
-        .len = (uint64_t)data1->res,
-    });
-    journal_pos += data1->res;
-    if (journal_pos >= bs->journal.len)
+}
+
+// Submit journal reads with up to <init_queue_depth> requests in flight. Journal is only
+// replayed after loading metadata, so until then, also limit the number of unparsed buffers
+void blockstore_init_journal::submit_reads()
+{
+    while (reading.size() < bs->init_queue_depth &&
+        (!bs->metadata_init_reader || bs->journal.inmemory || reading.size()+done.size() < bs->init_queue_depth) &&
+        (!wrapped || journal_pos < bs->journal.used_start))
     {
-        // Continue from the beginning
-        journal_pos = bs->journal.block_size;
-        wrapped = true;
+        sqe = bs->get_sqe();
+        if (!sqe)
+        {
+            if (!reading.size())
+                throw std::runtime_error("io_uring is full while trying to read journal");
+            break;
+        }
+        data = ((ring_data_t*)sqe->user_data);
+        uint64_t end = bs->journal.len;
+        if (journal_pos < bs->journal.used_start)
+            end = bs->journal.used_start;
+        uint64_t len = end - journal_pos < JOURNAL_BUFFER_SIZE ? end - journal_pos : JOURNAL_BUFFER_SIZE;
+        void *buf = bs->journal.inmemory
+            ? (uint8_t*)bs->journal.buffer + journal_pos
+            : memalign_or_die(MEM_ALIGNMENT, JOURNAL_BUFFER_SIZE);
+        reading.push_back((bs_init_journal_read){
+            .buf = buf,
+            .pos = journal_pos,
+            .len = len,
+            .done = false,
+        });
+        data->iov = { buf, (size_t)len };
+        data->callback = [this, buf](ring_data_t *data1) { handle_event(data1, buf); };
+        io_uring_prep_readv(sqe, bs->dsk.journal_fd, &data->iov, 1, bs->journal.offset + journal_pos);
+        journal_pos += len;
+        if (journal_pos >= bs->journal.len)
+        {
+            // Continue from the beginning
+            journal_pos = bs->journal.block_size;
+            wrapped = true;
+        }
     }
-    submitted_buf = NULL;
+    bs->ringloop->submit();
 }
 
 int blockstore_init_journal::loop()
@@ -483,7 +831,10 @@ int blockstore_init_journal::loop()
         goto resume_6;
     else if (wait_state == 7)
         goto resume_7;
+    else if (wait_state == 8)
+        goto resume_8;
     printf("Reading blockstore journal\n");
+    start_time = last_report = init_time();
     if (!bs->journal.inmemory)
         submitted_buf = memalign_or_die(MEM_ALIGNMENT, 2*bs->journal.block_size);
     else
@@ -616,28 +967,21 @@ resume_1:
         while (1)
         {
         resume_2:
-            if (submitted_buf)
+            // Move completed reads to <done> in journal order
+            while (reading.size() && reading.front().done)
             {
-                wait_state = 2;
-                return 1;
+                auto & rd = reading.front();
+                done.push_back((bs_init_journal_done){ .buf = rd.buf, .pos = rd.pos, .len = rd.len });
+                bytes_read += rd.len;
+                reading.pop_front();
             }
-            if (!wrapped || journal_pos < bs->journal.used_start)
+            submit_reads();
+            report_init_progress("Reading journal", bytes_read, 0, start_time, last_report);
+            if (bs->metadata_init_reader)
             {
-                GET_SQE();
-                uint64_t end = bs->journal.len;
-                if (journal_pos < bs->journal.used_start)
-                    end = bs->journal.used_start;
-                if (!bs->journal.inmemory)
-                    submitted_buf = memalign_or_die(MEM_ALIGNMENT, JOURNAL_BUFFER_SIZE);
-                else
-                    submitted_buf = (uint8_t*)bs->journal.buffer + journal_pos;
-                data->iov = {
-                    submitted_buf,
-                    (size_t)(end - journal_pos < JOURNAL_BUFFER_SIZE ? end - journal_pos : JOURNAL_BUFFER_SIZE),
-                };
-                data->callback = [this](ring_data_t *data1) { handle_event(data1); };
-                io_uring_prep_readv(sqe, bs->dsk.journal_fd, &data->iov, 1, bs->journal.offset + journal_pos);
-                bs->ringloop->submit();
+                // Wait until metadata is loaded
+                wait_state = 2;
+                return 1;
             }
             while (done.size() > 0)
             {
@@ -676,18 +1020,26 @@ resume_1:
                             return 1;
                         }
                     }
-                    // wait for the next read to complete, then stop
+                    // wait for the remaining reads to complete, then stop
                 resume_3:
-                    if (submitted_buf)
+                    for (auto & rd: reading)
                     {
-                        wait_state = 3;
-                        return 1;
+                        if (!rd.done)
+                        {
+                            wait_state = 3;
+                            return 1;
+                        }
                     }
                     // free buffers
                     if (!bs->journal.inmemory)
+                    {
                         for (auto & e: done)
                             free(e.buf);
+                        for (auto & rd: reading)
+                            free(rd.buf);
+                    }
                     done.clear();
+                    reading.clear();
                     break;
                 }
                 else if (handle_res == 1)
@@ -705,12 +1057,21 @@ resume_1:
                     break;
                 }
             }
-            if (!submitted_buf)
+            if (!reading.size())
             {
                 break;
             }
+            wait_state = 2;
+            return 1;
         }
     }
+resume_8:
+    if (bs->metadata_init_reader)
+    {
+        // The journal is empty, but metadata is still being loaded
+        wait_state = 8;
+        return 1;
+    }
     for (auto ov: double_allocs)
     {
         auto dirty_it = bs->dirty_db.find(ov);
@@ -726,13 +1087,15 @@ resume_1:
     bs->flusher->mark_trim_possible();
     bs->journal.dirty_start = bs->journal.next_free;
     printf(
-        "Journal entries loaded: %ju, free journal space: %ju bytes (%08jx..%08jx is used), free blocks: %ju / %ju\n",
+        "Journal entries loaded: %ju, free journal space: %ju bytes (%08jx..%08jx is used), free blocks: %ju / %ju,"
+        " %ju MB read in %.1f s (%.1f MB/s)\n",
         entries_loaded,
         (bs->journal.next_free >= bs->journal.used_start
             ? bs->journal.len-bs->journal.block_size - (bs->journal.next_free-bs->journal.used_start)
             : bs->journal.used_start - bs->journal.next_free),
         bs->journal.used_start, bs->journal.next_free,
-        bs->data_alloc->get_free_count(), bs->dsk.block_count
+        bs->data_alloc->get_free_count(), bs->dsk.block_count,
+        bytes_read/1024/1024, init_time()-start_time, init_speed(bytes_read, start_time)
     );
     bs->journal.crc32_last = crc32_last;
     return 0;
@@ -971,7 +1334,7 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                         *((int*)dyn) = 1;
                         memcpy((uint8_t*)dyn+sizeof(int), dyn_from, dyn_size);
                     }
-                    bs->dirty_db.emplace(ov, (dirty_entry){
+                    bs->dirty_db.insert(std::make_pair(ov, (dirty_entry){
                         .state = (BS_ST_SMALL_WRITE | BS_ST_SYNCED),
                         .flags = 0,
                         .location = location,
@@ -979,7 +1342,7 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                         .len = je->small_write.len,
                         .journal_sector = proc_pos,
                         .dyn_data = dyn,
-                    });
+                    }));
                     bs->journal.used_sectors[proc_pos]++;
 #ifdef BLOCKSTORE_DEBUG
                     printf(
@@ -1055,7 +1418,7 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                         *((int*)dyn) = 1;
                         memcpy((uint8_t*)dyn+sizeof(int), dyn_from, dyn_size);
                     }
-                    auto dirty_it = bs->dirty_db.emplace(ov, (dirty_entry){
+                    auto dirty_it = bs->dirty_db.insert(std::make_pair(ov, (dirty_entry){
                         .state = (BS_ST_BIG_WRITE | BS_ST_SYNCED),
                         .flags = 0,
                         .location = je->big_write.location,
@@ -1063,7 +1426,7 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                         .len = je->big_write.len,
                         .journal_sector = proc_pos,
                         .dyn_data = dyn,
-                    }).first;
+                    })).first;
                     if (bs->data_alloc->get(je->big_write.location >> bs->dsk.block_order))
                     {
                         // This is probably a big_write that's already flushed and freed, but it may
@@ -1154,14 +1517,14 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                         .oid = je->del.oid,
                         .version = je->del.version,
                     };
-                    bs->dirty_db.emplace(ov, (dirty_entry){
+                    bs->dirty_db.insert(std::make_pair(ov, (dirty_entry){
                         .state = (BS_ST_DELETE | BS_ST_SYNCED),
                         .flags = 0,
                         .location = 0,
                         .offset = 0,
                         .len = 0,
                         .journal_sector = proc_pos,
-                    });
+                    }));
                     bs->journal.used_sectors[proc_pos]++;
                     // Deletions are treated as immediately stable, because
                     // "2-phase commit" (write->stabilize) isn't sufficient for them anyway
@@ -3,6 +3,10 @@
 
 #pragma once
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 struct blockstore_init_meta_buf
 {
     uint8_t *buf = NULL;
@@ -11,13 +15,24 @@ struct blockstore_init_meta_buf
     int state = 0;
 };
 
+// Objects handled by one metadata parsing thread
+struct blockstore_init_meta_part
+{
+    // Only used with more than 1 thread, otherwise entries are added to bs->clean_db_shards directly
+    blockstore_clean_db_t clean_db;
+    std::vector<uint64_t> entries_to_zero;
+    uint64_t entries_loaded = 0;
+    bool updated = false;
+};
+
 class blockstore_init_meta
 {
     blockstore_impl_t *bs;
     int wait_state = 0;
     bool zero_on_init = false;
     void *metadata_buffer = NULL;
-    blockstore_init_meta_buf bufs[2] = {};
+    std::vector<blockstore_init_meta_buf> bufs;
+    int submit_buf = 0, handle_buf = 0;
     int submitted = 0;
     struct io_uring_sqe *sqe;
     struct ring_data_t *data;
@@ -28,10 +43,33 @@ class blockstore_init_meta
     unsigned entries_per_block = 0;
     int i = 0, j = 0;
     std::vector<uint64_t> entries_to_zero;
-    bool handle_meta_block(uint8_t *buf, uint64_t count, uint64_t done_cnt);
+    double start_time = 0, last_report = 0;
+    // Parsing threads. Part 0 is always handled by the event loop thread itself
+    std::vector<blockstore_init_meta_part> parts;
+    std::vector<std::thread> parse_threads;
+    std::mutex parse_mu;
+    std::condition_variable parse_cv, parse_done_cv;
+    blockstore_init_meta_buf *parse_buf = NULL;
+    uint64_t parse_seq = 0;
+    int parse_pending = 0;
+    bool parse_stop = false;
+    // Metadata snapshot referenced by the superblock
+    uint64_t snapshot_id = 0;
+    bool snapshot_loaded = false;
+    void start_parse_threads();
+    void stop_parse_threads();
+    void run_parse_thread(int part_num);
+    bool handle_meta_buf(blockstore_init_meta_buf *mb);
+    void handle_meta_part(int part_num, blockstore_init_meta_buf *mb);
+    void merge_parts();
+    void mark_used_blocks();
+    void clear_stale_entries(blockstore_init_meta_buf *mb);
     void handle_event(ring_data_t *data, int buf_num);
 public:
     blockstore_init_meta(blockstore_impl_t *bs);
+    ~blockstore_init_meta();
+    // Metadata superblock is checked and disk layout is final, so the journal can be read
+    bool is_header_loaded();
     int loop();
 };
 
@@ -41,6 +79,13 @@ struct bs_init_journal_done
     uint64_t pos, len;
 };
 
+struct bs_init_journal_read
+{
+    void *buf;
+    uint64_t pos, len;
+    bool done;
+};
+
 class blockstore_init_journal
 {
     blockstore_impl_t *bs;
@@ -58,12 +103,17 @@ class blockstore_init_journal
     uint64_t init_write_sector = 0;
     bool wrapped = false;
     void *submitted_buf;
+    // Reads in progress, in journal order
+    std::deque<bs_init_journal_read> reading;
+    uint64_t bytes_read = 0;
+    double start_time = 0, last_report = 0;
     struct io_uring_sqe *sqe;
     struct ring_data_t *data;
     journal_entry_start *je_start;
-    std::function<void(ring_data_t*)> simple_callback;
+    callback_t<void(ring_data_t*)> simple_callback;
+    void submit_reads();
     int handle_journal_part(void *buf, uint64_t done_pos, uint64_t len);
-    void handle_event(ring_data_t *data);
+    void handle_event(ring_data_t *data, void *buf);
     void erase_dirty_object(blockstore_dirty_db_t::iterator dirty_it);
 public:
     blockstore_init_journal(blockstore_impl_t* bs);
@@ -166,14 +166,21 @@ journal_entry* prefill_single_journal_entry(journal_t & journal, uint16_t type,
     je->size = size;
     je->crc32_prev = journal.crc32_last;
     journal.sector_info[journal.cur_sector].dirty = true;
+    journal.entries_written++;
     return je;
 }
 
 void blockstore_impl_t::prepare_journal_sector_write(int cur_sector, blockstore_op_t *op)
 {
+    if (journal.batch_ops.size() && cur_sector == journal.cur_sector)
+    {
+        // Batched entries are in the same sector, write them together
+        write_journal_batch();
+    }
     // Don't submit the same sector twice in the same batch
     if (!journal.sector_info[cur_sector].submit_id)
     {
+        journal.sector_writes++;
         io_uring_sqe *sqe = get_sqe();
         // Caller must ensure availability of an SQE
         assert(sqe != NULL);
@@ -209,6 +216,68 @@ void blockstore_impl_t::prepare_journal_sector_write(int cur_sector, blockstore_
     priv->max_flushed_journal_sector = 1+cur_sector;
 }
 
+// Group commit: in the immediate_commit mode, operations don't write the current journal sector
+// themselves. Instead, they wait for it to be written once at the end of the loop() iteration,
+// or after <journal_group_commit_us>, together with entries of all other operations
+void blockstore_impl_t::add_to_journal_batch(blockstore_op_t *op)
+{
+    if (!journal.batch_ops.size())
+    {
+        timespec tv;
+        clock_gettime(CLOCK_MONOTONIC, &tv);
+        journal.batch_start_us = tv.tv_sec*1000000 + tv.tv_nsec/1000;
+    }
+    journal.batch_ops.push_back(op);
+    // Don't let the operation complete until the sector is written
+    PRIV(op)->pending_ops++;
+}
+
+// Write the current sector for all batched operations. Caller must ensure availability of an SQE
+void blockstore_impl_t::write_journal_batch()
+{
+    std::vector<blockstore_op_t*> ops;
+    ops.swap(journal.batch_ops);
+    for (auto op: ops)
+    {
+        PRIV(op)->pending_ops--;
+        prepare_journal_sector_write(journal.cur_sector, op);
+    }
+}
+
+void blockstore_impl_t::submit_journal_batch()
+{
+    if (!journal.batch_ops.size())
+    {
+        return;
+    }
+    if (journal_group_commit_us > 0 &&
+        journal.entry_fits(sizeof(journal_entry_small_write) + dsk.clean_dyn_size))
+    {
+        // Wait for more entries while the sector isn't full
+        timespec tv;
+        clock_gettime(CLOCK_MONOTONIC, &tv);
+        uint64_t elapsed = tv.tv_sec*1000000 + tv.tv_nsec/1000 - journal.batch_start_us;
+        if (elapsed < journal_group_commit_us)
+        {
+            if (journal_batch_timer_id < 0)
+            {
+                journal_batch_timer_id = tfd->set_timer_us(journal_group_commit_us - elapsed, false, [this](int timer_id)
+                {
+                    journal_batch_timer_id = -1;
+                    ringloop->wakeup();
+                });
+            }
+            return;
+        }
+    }
+    if (!journal.sector_info[journal.cur_sector].submit_id && ringloop->sqes_left() < 1)
+    {
+        // Retry when some SQEs are freed
+        return;
+    }
+    write_journal_batch();
+}
+
 void blockstore_impl_t::handle_journal_write(ring_data_t *data, uint64_t flush_id)
 {
     live = true;
@@ -325,4 +394,19 @@ void journal_t::dump_diagnostics()
         journal_used_it == used_sectors.end() ? 0 : journal_used_it->first,
         journal_used_it == used_sectors.end() ? 0 : journal_used_it->second
     );
+    // Rates are calculated since the previous call
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = prev_stats_time.tv_sec
+        ? (now.tv_sec - prev_stats_time.tv_sec) + (now.tv_nsec - prev_stats_time.tv_nsec)/1000000000.0 : 0;
+    printf(
+        "Journal writes: entries=%ju sector_writes=%ju entries/sector=%.2f (recent %.2f) fsyncs=%ju fsyncs/s=%.1f\n",
+        entries_written, sector_writes, sector_writes ? (double)entries_written/sector_writes : 0,
+        sector_writes > prev_sector_writes ? (double)(entries_written-prev_entries_written)/(sector_writes-prev_sector_writes) : 0,
+        fsyncs, elapsed > 0 ? (fsyncs-prev_fsyncs)/elapsed : 0
+    );
+    prev_entries_written = entries_written;
+    prev_sector_writes = sector_writes;
+    prev_fsyncs = fsyncs;
+    prev_stats_time = now;
 }
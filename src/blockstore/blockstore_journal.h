@@ -188,6 +188,13 @@ struct journal_t
     std::vector<int> submitting_sectors;
     std::multimap<uint64_t, pending_journaling_t> flushing_ops;
     uint64_t submit_id = 0;
+    // Operations with entries in the current sector waiting for it to be written (group commit)
+    std::vector<blockstore_op_t*> batch_ops;
+    uint64_t batch_start_us = 0;
+    // Statistics: journal entries, sector writes and fsyncs, and their values at the previous dump
+    uint64_t entries_written = 0, sector_writes = 0, fsyncs = 0;
+    uint64_t prev_entries_written = 0, prev_sector_writes = 0, prev_fsyncs = 0;
+    timespec prev_stats_time = {};
 
     // Used sector map
     // May use ~ 80 MB per 1 GB of used journal space in the worst case
@@ -0,0 +1,96 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "malloc_or_die.h"
+#include "blockstore_journal_cache.h"
+
+blockstore_journal_cache_t::~blockstore_journal_cache_t()
+{
+    if (buffer)
+    {
+        free(buffer);
+        buffer = NULL;
+    }
+}
+
+void blockstore_journal_cache_t::init(uint64_t cache_size)
+{
+    capacity = cache_size;
+    if (capacity > 0)
+    {
+        buffer = (uint8_t*)malloc_or_die(capacity);
+    }
+}
+
+void blockstore_journal_cache_t::erase_overlapping(uint64_t offset, uint64_t len)
+{
+    auto it = index.lower_bound(offset);
+    if (it != index.begin())
+    {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second.len > offset)
+            it = prev;
+    }
+    while (it != index.end() && it->first < offset+len)
+    {
+        index.erase(it++);
+    }
+}
+
+void blockstore_journal_cache_t::put(uint64_t offset, const void *buf, uint64_t len)
+{
+    if (!capacity || !len)
+    {
+        return;
+    }
+    erase_overlapping(offset, len);
+    if (len > capacity)
+    {
+        return;
+    }
+    // Entries are contiguous in the buffer, so skip the tail if the entry doesn't fit there
+    if (write_pos % capacity + len > capacity)
+    {
+        write_pos += capacity - write_pos % capacity;
+    }
+    uint64_t pos = write_pos;
+    write_pos += len;
+    // Evict entries overwritten by the new one
+    while (order.size() && order.front().second + capacity < write_pos)
+    {
+        auto it = index.find(order.front().first);
+        if (it != index.end() && it->second.pos == order.front().second)
+        {
+            index.erase(it);
+            evictions++;
+        }
+        order.pop_front();
+    }
+    memcpy(buffer + pos % capacity, buf, len);
+    index[offset] = (entry_t){ .pos = pos, .len = len };
+    order.push_back(std::make_pair(offset, pos));
+}
+
+bool blockstore_journal_cache_t::get(uint64_t offset, void *buf, uint64_t len)
+{
+    if (!capacity)
+    {
+        return false;
+    }
+    auto it = index.upper_bound(offset);
+    if (it != index.begin())
+    {
+        it--;
+    }
+    if (it == index.end() || it->first > offset || it->first + it->second.len < offset + len)
+    {
+        misses++;
+        return false;
+    }
+    hits++;
+    memcpy(buf, buffer + it->second.pos % capacity + (offset - it->first), len);
+    return true;
+}
@@ -0,0 +1,48 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <deque>
+
+#define DEFAULT_JOURNAL_CACHE_SIZE (16*1024*1024)
+
+// Ring buffer of recently written small write data for inmemory_journal=false.
+// Data is appended in the order of journal writes and indexed by its journal offset,
+// so reads of recently written data may be served from memory instead of the journal device.
+// The oldest data is evicted when the ring wraps around. Entries are never stale because
+// every new journal write at the same offset replaces them.
+class blockstore_journal_cache_t
+{
+    struct entry_t
+    {
+        uint64_t pos;
+        uint64_t len;
+    };
+
+    uint8_t *buffer = NULL;
+    uint64_t capacity = 0;
+    // Total bytes appended to the ring, position in the buffer is write_pos % capacity
+    uint64_t write_pos = 0;
+    // Journal offset => position in the ring
+    std::map<uint64_t, entry_t> index;
+    // Journal offsets and ring positions in the order of appending, for eviction
+    std::deque<std::pair<uint64_t, uint64_t>> order;
+
+    void erase_overlapping(uint64_t offset, uint64_t len);
+
+public:
+    uint64_t hits = 0, misses = 0, evictions = 0;
+
+    ~blockstore_journal_cache_t();
+    void init(uint64_t cache_size);
+    bool enabled() { return capacity > 0; }
+    uint64_t size() { return capacity; }
+    // Remember <len> bytes written to the journal at <offset>
+    void put(uint64_t offset, const void *buf, uint64_t len);
+    // Copy <len> bytes from journal <offset> to <buf>. Returns false if they aren't cached
+    bool get(uint64_t offset, void *buf, uint64_t len);
+};
@@ -0,0 +1,124 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "malloc_or_die.h"
+#include "blockstore_meta_cache.h"
+
+blockstore_meta_cache_t::~blockstore_meta_cache_t()
+{
+    if (buffer)
+    {
+        free(buffer);
+        buffer = NULL;
+    }
+}
+
+void blockstore_meta_cache_t::init(uint64_t cache_size, uint32_t block_size)
+{
+    this->block_size = block_size;
+    this->capacity = block_size ? cache_size / block_size : 0;
+    if (capacity > 0)
+    {
+        buffer = (uint8_t*)malloc_or_die((uint64_t)capacity * block_size);
+        slots.reserve(capacity);
+        index.reserve(capacity);
+    }
+}
+
+uint8_t *blockstore_meta_cache_t::alloc_slot(uint64_t sector)
+{
+    uint32_t pos;
+    if (slots.size() < capacity)
+    {
+        pos = slots.size();
+        slots.push_back((slot_t){ .sector = sector, .referenced = false });
+    }
+    else
+    {
+        // CLOCK: evict the first block not referenced since the previous pass of the hand
+        while (slots[clock_hand].referenced)
+        {
+            slots[clock_hand].referenced = false;
+            clock_hand = (clock_hand+1) % capacity;
+        }
+        pos = clock_hand;
+        clock_hand = (clock_hand+1) % capacity;
+        index.erase(slots[pos].sector);
+        slots[pos].sector = sector;
+        evictions++;
+    }
+    index[sector] = pos;
+    return buffer + (uint64_t)pos*block_size;
+}
+
+bool blockstore_meta_cache_t::get(uint64_t sector, void *buf, uint32_t offset, uint32_t len)
+{
+    if (!capacity)
+    {
+        return false;
+    }
+    auto it = index.find(sector);
+    if (it == index.end())
+    {
+        misses++;
+        return false;
+    }
+    hits++;
+    slots[it->second].referenced = true;
+    memcpy(buf, buffer + (uint64_t)it->second*block_size + offset, len);
+    return true;
+}
+
+void blockstore_meta_cache_t::put(uint64_t sector, const void *buf)
+{
+    if (!capacity)
+    {
+        return;
+    }
+    auto it = index.find(sector);
+    uint8_t *block = it != index.end() ? buffer + (uint64_t)it->second*block_size : alloc_slot(sector);
+    memcpy(block, buf, block_size);
+}
+
+uint64_t blockstore_meta_cache_t::get_gen(uint64_t sector)
+{
+    if (!capacity)
+    {
+        return 0;
+    }
+    return write_gen[(sector / block_size) % META_CACHE_GENERATIONS];
+}
+
+void blockstore_meta_cache_t::put_if_unchanged(uint64_t sector, const void *buf, uint64_t gen)
+{
+    if (capacity && !write_inflight[(sector / block_size) % META_CACHE_GENERATIONS] &&
+        get_gen(sector) == gen && index.find(sector) == index.end())
+    {
+        put(sector, buf);
+    }
+}
+
+void blockstore_meta_cache_t::write(uint64_t sector, const void *buf)
+{
+    if (!capacity)
+    {
+        return;
+    }
+    write_gen[(sector / block_size) % META_CACHE_GENERATIONS]++;
+    write_inflight[(sector / block_size) % META_CACHE_GENERATIONS]++;
+    put(sector, buf);
+}
+
+void blockstore_meta_cache_t::write_done(uint64_t sector)
+{
+    if (!capacity)
+    {
+        return;
+    }
+    // Reads submitted before the write completed may still return the old block
+    write_gen[(sector / block_size) % META_CACHE_GENERATIONS]++;
+    write_inflight[(sector / block_size) % META_CACHE_GENERATIONS]--;
+}
@@ -0,0 +1,56 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+#include <unordered_map>
+
+#define DEFAULT_META_CACHE_SIZE (64*1024*1024)
+#define META_CACHE_GENERATIONS 256
+
+// Bounded cache of metadata blocks for inmemory_metadata=false, evicted with the CLOCK algorithm.
+// The flusher writes modified blocks through the cache, so cached blocks are always
+// the latest version of metadata and may be used instead of reading it from the disk.
+// Each blockstore shard has its own cache, so no locking is required.
+class blockstore_meta_cache_t
+{
+    struct slot_t
+    {
+        uint64_t sector;
+        bool referenced;
+    };
+
+    uint32_t block_size = 0;
+    uint8_t *buffer = NULL;
+    std::vector<slot_t> slots;
+    uint32_t capacity = 0, clock_hand = 0;
+    std::unordered_map<uint64_t, uint32_t> index;
+    // Write counters, used to detect blocks modified while being read from the disk.
+    // Reads aren't ordered with writes, so a read submitted while a write of the same
+    // block is in flight may return the old block, and such reads are never cached
+    uint64_t write_gen[META_CACHE_GENERATIONS] = { 0 };
+    uint32_t write_inflight[META_CACHE_GENERATIONS] = { 0 };
+
+    uint8_t *alloc_slot(uint64_t sector);
+
+public:
+    uint64_t hits = 0, misses = 0, evictions = 0;
+
+    ~blockstore_meta_cache_t();
+    void init(uint64_t cache_size, uint32_t block_size);
+    bool enabled() { return capacity > 0; }
+    uint64_t size() { return (uint64_t)slots.size() * block_size; }
+    // Copy <len> bytes from <offset> of the cached block to <buf>. Returns false if it's not cached
+    bool get(uint64_t sector, void *buf, uint32_t offset, uint32_t len);
+    // Remember the block read from the disk
+    void put(uint64_t sector, const void *buf);
+    // Remember the block read from the disk if it wasn't written after get_gen() was called
+    uint64_t get_gen(uint64_t sector);
+    void put_if_unchanged(uint64_t sector, const void *buf, uint64_t gen);
+    // Update the block written by the flusher. write_done() must be called when the write completes
+    void write(uint64_t sector, const void *buf);
+    void write_done(uint64_t sector);
+};
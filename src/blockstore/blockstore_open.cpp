@@ -15,6 +15,9 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config, bool init)
     min_flusher_count = strtoull(config["min_flusher_count"].c_str(), NULL, 10);
     journal_trim_interval = strtoull(config["journal_trim_interval"].c_str(), NULL, 10);
     max_write_iodepth = strtoull(config["max_write_iodepth"].c_str(), NULL, 10);
+    flusher_sort_window = strtoull(config["flusher_sort_window"].c_str(), NULL, 10);
+    flusher_target_latency_us = strtoull(config["flusher_target_latency_us"].c_str(), NULL, 10);
+    flusher_read_backoff = config["flusher_read_backoff"] == "true" || config["flusher_read_backoff"] == "1" || config["flusher_read_backoff"] == "yes";
     throttle_small_writes = config["throttle_small_writes"] == "true" || config["throttle_small_writes"] == "1" || config["throttle_small_writes"] == "yes";
     throttle_target_iops = strtoull(config["throttle_target_iops"].c_str(), NULL, 10);
     throttle_target_mbs = strtoull(config["throttle_target_mbs"].c_str(), NULL, 10);
@@ -56,8 +59,22 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config, bool init)
     {
         throttle_threshold_us = 50;
     }
+    qos_iodepth = strtoull(config["qos_iodepth"].c_str(), NULL, 10);
+    qos_client_weight = config["qos_client_weight"] != ""
+        ? strtoull(config["qos_client_weight"].c_str(), NULL, 10) : DEFAULT_QOS_CLIENT_WEIGHT;
+    qos_recovery_weight = config["qos_recovery_weight"] != ""
+        ? strtoull(config["qos_recovery_weight"].c_str(), NULL, 10) : DEFAULT_QOS_RECOVERY_WEIGHT;
+    qos_scrub_weight = config["qos_scrub_weight"] != ""
+        ? strtoull(config["qos_scrub_weight"].c_str(), NULL, 10) : DEFAULT_QOS_SCRUB_WEIGHT;
+    qos_recovery_iops = strtoull(config["qos_recovery_iops"].c_str(), NULL, 10);
+    qos_recovery_mbs = strtoull(config["qos_recovery_mbs"].c_str(), NULL, 10);
+    qos_scrub_iops = strtoull(config["qos_scrub_iops"].c_str(), NULL, 10);
+    qos_scrub_mbs = strtoull(config["qos_scrub_mbs"].c_str(), NULL, 10);
+    qos_per_inode = config["qos_per_inode"] == "true" || config["qos_per_inode"] == "1" || config["qos_per_inode"] == "yes";
+    write_combine_size = strtoull(config["write_combine_size"].c_str(), NULL, 10);
     if (!init)
     {
+        qos.configure(this);
         return;
     }
     // Offline-configurable options:
@@ -96,12 +113,34 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config, bool init)
     metadata_buf_size = strtoull(config["meta_buf_size"].c_str(), NULL, 10);
     inmemory_meta = config["inmemory_metadata"] != "false" && config["inmemory_metadata"] != "0" &&
         config["inmemory_metadata"] != "no";
+    if (config["init_queue_depth"] != "")
+        init_queue_depth = strtoull(config["init_queue_depth"].c_str(), NULL, 10);
+    if (config["init_threads"] != "")
+        init_threads = strtoull(config["init_threads"].c_str(), NULL, 10);
     journal.sector_count = strtoull(config["journal_sector_buffer_count"].c_str(), NULL, 10);
     journal.no_same_sector_overwrites = config["journal_no_same_sector_overwrites"] == "true" ||
         config["journal_no_same_sector_overwrites"] == "1" || config["journal_no_same_sector_overwrites"] == "yes";
     journal.inmemory = config["inmemory_journal"] != "false" && config["inmemory_journal"] != "0" &&
         config["inmemory_journal"] != "no";
+    journal_group_commit_us = strtoull(config["journal_group_commit_us"].c_str(), NULL, 10);
     log_level = strtoull(config["log_level"].c_str(), NULL, 10);
+    meta_snapshot_file = config["meta_snapshot_file"];
+    if (config["meta_cache_size"] != "")
+        meta_cache_size = strtoull(config["meta_cache_size"].c_str(), NULL, 10);
+    if (config["journal_cache_size"] != "")
+        journal_cache_size = strtoull(config["journal_cache_size"].c_str(), NULL, 10);
+    if (config["read_coalesce_gap"] != "")
+        read_coalesce_gap = strtoull(config["read_coalesce_gap"].c_str(), NULL, 10);
+    compact_clean_db = config["compact_clean_db"] == "true" || config["compact_clean_db"] == "1" ||
+        config["compact_clean_db"] == "yes";
+    online_discard = config["online_discard"] == "true" || config["online_discard"] == "1" ||
+        config["online_discard"] == "yes";
+    if (config["discard_mbs"] != "")
+        discard_mbs = strtoull(config["discard_mbs"].c_str(), NULL, 10);
+    if (config["discard_iops"] != "")
+        discard_iops = strtoull(config["discard_iops"].c_str(), NULL, 10);
+    if (config["max_discard_size"] != "")
+        max_discard_size = strtoull(config["max_discard_size"].c_str(), NULL, 10);
     // Validate
     if (journal.sector_count < 2)
     {
@@ -111,6 +150,10 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config, bool init)
     {
         metadata_buf_size = 4*1024*1024;
     }
+    if (!init_queue_depth)
+    {
+        init_queue_depth = 1;
+    }
     if (dsk.meta_device == dsk.data_device)
     {
         disable_meta_fsync = disable_data_fsync;
@@ -158,6 +201,10 @@ void blockstore_impl_t::calc_lengths()
             );
         }
     }
+    if (!inmemory_meta)
+    {
+        meta_cache.init(meta_cache_size, dsk.meta_block_size);
+    }
     if (journal.inmemory)
     {
         journal.buffer = memalign(MEM_ALIGNMENT, journal.len);
@@ -169,6 +216,7 @@ void blockstore_impl_t::calc_lengths()
         journal.sector_buf = (uint8_t*)memalign(MEM_ALIGNMENT, journal.sector_count * dsk.journal_block_size);
         if (!journal.sector_buf)
             throw std::bad_alloc();
+        journal_cache.init(journal_cache_size < journal.len ? journal_cache_size : journal.len);
     }
     journal.sector_info = (journal_sector_info_t*)calloc(journal.sector_count, sizeof(journal_sector_info_t));
     if (!journal.sector_info)
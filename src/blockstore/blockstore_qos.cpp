@@ -0,0 +1,217 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include "blockstore_impl.h"
+
+static const char *qos_class_names[BS_QOS_CLASSES] = { "client", "recovery", "scrub" };
+
+blockstore_qos_t::~blockstore_qos_t()
+{
+    if (timer_id >= 0)
+        bs->tfd->clear_timer(timer_id);
+}
+
+void blockstore_qos_t::configure(blockstore_impl_t *bs)
+{
+    this->bs = bs;
+    classes[BS_QOS_CLIENT].weight = bs->qos_client_weight;
+    classes[BS_QOS_RECOVERY].weight = bs->qos_recovery_weight;
+    classes[BS_QOS_RECOVERY].iops_limit = bs->qos_recovery_iops;
+    classes[BS_QOS_RECOVERY].mbs_limit = bs->qos_recovery_mbs;
+    classes[BS_QOS_SCRUB].weight = bs->qos_scrub_weight;
+    classes[BS_QOS_SCRUB].iops_limit = bs->qos_scrub_iops;
+    classes[BS_QOS_SCRUB].mbs_limit = bs->qos_scrub_mbs;
+    for (int i = 0; i < BS_QOS_CLASSES; i++)
+    {
+        if (!classes[i].weight)
+            classes[i].weight = 1;
+    }
+}
+
+bool blockstore_qos_t::enabled()
+{
+    return bs && bs->qos_iodepth > 0;
+}
+
+bool blockstore_qos_t::hold(blockstore_op_t *op)
+{
+    if (op->opcode == BS_OP_LIST)
+    {
+        // LIST doesn't depend on other operations
+        return false;
+    }
+    blockstore_qos_entry_t e = { .op = op, .seq = next_seq++, .start_tag = 0, .enqueue_us = bs_now_us() };
+    if (op->opcode == BS_OP_SYNC || op->opcode == BS_OP_STABLE || op->opcode == BS_OP_ROLLBACK)
+    {
+        if (!total_queued && !barriers.size())
+        {
+            return false;
+        }
+        barriers.push_back(e);
+        dispatch();
+        return true;
+    }
+    int qos_class = op->qos_class >= 0 && op->qos_class < BS_QOS_CLASSES ? op->qos_class : BS_QOS_CLIENT;
+    auto & cls = classes[qos_class];
+    auto & q = queues[std::make_pair(qos_class, qos_class == BS_QOS_CLIENT && bs->qos_per_inode ? op->oid.inode : 0)];
+    uint64_t cost = QOS_OP_COST + (op->opcode == BS_OP_DELETE ? 0 : op->len);
+    e.start_tag = q.last_finish_tag > virtual_time ? q.last_finish_tag : virtual_time;
+    q.last_finish_tag = e.start_tag + cost*1024/cls.weight;
+    q.ops.push_back(e);
+    cls.queued++;
+    total_queued++;
+    dispatch();
+    return true;
+}
+
+bool blockstore_qos_t::has_tokens(blockstore_qos_class_t & cls, uint64_t now_us)
+{
+    if (!cls.iops_limit && !cls.mbs_limit)
+        return true;
+    if (cls.last_refill_us && now_us > cls.last_refill_us)
+    {
+        // Bucket size is one second worth of tokens
+        uint64_t elapsed = now_us-cls.last_refill_us;
+        cls.op_tokens += elapsed * cls.iops_limit;
+        if (cls.op_tokens > (int64_t)(cls.iops_limit*1000000))
+            cls.op_tokens = cls.iops_limit*1000000;
+        cls.byte_tokens += elapsed * cls.mbs_limit*1024*1024 / 1000000;
+        if (cls.byte_tokens > (int64_t)(cls.mbs_limit*1024*1024))
+            cls.byte_tokens = cls.mbs_limit*1024*1024;
+    }
+    else if (!cls.last_refill_us)
+    {
+        cls.op_tokens = cls.iops_limit*1000000;
+        cls.byte_tokens = cls.mbs_limit*1024*1024;
+    }
+    cls.last_refill_us = now_us;
+    return (!cls.iops_limit || cls.op_tokens >= 1000000) && (!cls.mbs_limit || cls.byte_tokens > 0);
+}
+
+void blockstore_qos_t::release(blockstore_qos_entry_t & e, int qos_class, uint64_t now_us)
+{
+    auto & cls = classes[qos_class];
+    cls.queued--;
+    total_queued--;
+    if (cls.iops_limit)
+        cls.op_tokens -= 1000000;
+    if (cls.mbs_limit)
+        cls.byte_tokens -= e.op->len;
+    cls.wait_us += now_us-e.enqueue_us;
+    virtual_time = e.start_tag;
+    blockstore_op_t *op = e.op;
+    if (bs->submit_op(op))
+    {
+        PRIV(op)->qos_class = qos_class;
+        PRIV(op)->enqueue_us = e.enqueue_us;
+        cls.inflight++;
+        total_inflight++;
+    }
+}
+
+void blockstore_qos_t::dispatch()
+{
+    uint64_t now_us = bs_now_us();
+    bool active = enabled();
+    bool limited = false;
+    while (total_queued > 0 || barriers.size() > 0)
+    {
+        uint64_t barrier_seq = barriers.size() ? barriers.front().seq : UINT64_MAX;
+        // Pick the head with the smallest start tag, but don't pass the first barrier
+        auto best = queues.end();
+        bool before_barrier = false;
+        for (auto it = queues.begin(); it != queues.end(); it++)
+        {
+            auto & e = it->second.ops.front();
+            if (e.seq > barrier_seq)
+                continue;
+            before_barrier = true;
+            if (active && !has_tokens(classes[it->first.first], now_us))
+            {
+                limited = true;
+                continue;
+            }
+            if (best == queues.end() || e.start_tag < best->second.ops.front().start_tag)
+                best = it;
+        }
+        if (!before_barrier)
+        {
+            // All operations before the barrier are released
+            blockstore_op_t *op = barriers.front().op;
+            barriers.pop_front();
+            bs->submit_op(op);
+            continue;
+        }
+        if (best == queues.end() || active && total_inflight >= bs->qos_iodepth)
+        {
+            break;
+        }
+        blockstore_qos_entry_t e = best->second.ops.front();
+        best->second.ops.pop_front();
+        int qos_class = best->first.first;
+        if (!best->second.ops.size())
+            queues.erase(best);
+        release(e, qos_class, now_us);
+    }
+    if (limited && total_inflight < bs->qos_iodepth && timer_id < 0)
+    {
+        // Wake up when limited classes get new tokens
+        uint64_t wait_us = 1000;
+        for (int i = 0; i < BS_QOS_CLASSES; i++)
+        {
+            auto & cls = classes[i];
+            if (cls.iops_limit && cls.op_tokens < 1000000 && (1000000-cls.op_tokens)/cls.iops_limit > wait_us)
+                wait_us = (1000000-cls.op_tokens)/cls.iops_limit;
+            if (cls.mbs_limit && cls.byte_tokens <= 0 && (1-cls.byte_tokens)*1000000/(cls.mbs_limit*1024*1024) > wait_us)
+                wait_us = (1-cls.byte_tokens)*1000000/(cls.mbs_limit*1024*1024);
+        }
+        timer_id = bs->tfd->set_timer_us(wait_us, false, [this](int timer_id)
+        {
+            this->timer_id = -1;
+            bs->ringloop->wakeup();
+        });
+    }
+}
+
+void blockstore_qos_t::finish(blockstore_op_t *op, uint64_t now_us)
+{
+    if (PRIV(op)->qos_class < 0)
+        return;
+    auto & cls = classes[PRIV(op)->qos_class];
+    cls.inflight--;
+    total_inflight--;
+    cls.ops++;
+    cls.bytes += op->opcode == BS_OP_DELETE ? 0 : op->len;
+    cls.latency_us += now_us-PRIV(op)->enqueue_us;
+    if (total_queued > 0)
+        bs->ringloop->wakeup();
+}
+
+void blockstore_qos_t::get_counters(std::map<std::string, uint64_t> & counters)
+{
+    for (int i = 0; i < BS_QOS_CLASSES; i++)
+    {
+        auto & cls = classes[i];
+        std::string prefix = std::string("qos_")+qos_class_names[i];
+        counters[prefix+"_queued"] += cls.queued;
+        counters[prefix+"_inflight"] += cls.inflight;
+        counters[prefix+"_ops"] += cls.ops;
+        counters[prefix+"_bytes"] += cls.bytes;
+        counters[prefix+"_wait_us"] += cls.wait_us;
+        counters[prefix+"_latency_us"] += cls.latency_us;
+    }
+}
+
+void blockstore_qos_t::dump_diagnostics()
+{
+    printf("QoS: queues=%zu barriers=%zu inflight=%ju\n", queues.size(), barriers.size(), total_inflight);
+    for (int i = 0; i < BS_QOS_CLASSES; i++)
+    {
+        auto & cls = classes[i];
+        printf(
+            "QoS %s: weight=%ju queued=%ju inflight=%ju ops=%ju avg_wait=%ju us avg_latency=%ju us\n",
+            qos_class_names[i], cls.weight, cls.queued, cls.inflight, cls.ops,
+            cls.ops ? cls.wait_us/cls.ops : 0, cls.ops ? cls.latency_us/cls.ops : 0
+        );
+    }
+}
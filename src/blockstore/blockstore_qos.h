@@ -0,0 +1,86 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <map>
+#include <deque>
+
+#include "blockstore.h"
+
+#define DEFAULT_QOS_CLIENT_WEIGHT 100
+#define DEFAULT_QOS_RECOVERY_WEIGHT 20
+#define DEFAULT_QOS_SCRUB_WEIGHT 5
+// Fixed cost of an operation in bytes, added to its length
+#define QOS_OP_COST 4096
+
+class blockstore_impl_t;
+struct blockstore_op_t;
+
+struct blockstore_qos_entry_t
+{
+    blockstore_op_t *op;
+    uint64_t seq;
+    uint64_t start_tag;
+    uint64_t enqueue_us;
+};
+
+struct blockstore_qos_queue_t
+{
+    uint64_t last_finish_tag = 0;
+    std::deque<blockstore_qos_entry_t> ops;
+};
+
+struct blockstore_qos_class_t
+{
+    uint64_t weight = 1;
+    // Limits, 0 = unlimited
+    uint64_t iops_limit = 0, mbs_limit = 0;
+    // Token bucket, may go below zero after a large operation. Request tokens are in millionths
+    int64_t op_tokens = 0, byte_tokens = 0;
+    uint64_t last_refill_us = 0;
+    // Statistics
+    uint64_t queued = 0, inflight = 0;
+    uint64_t ops = 0, bytes = 0, wait_us = 0, latency_us = 0;
+};
+
+// Start-time fair queueing scheduler in front of the blockstore submit queue.
+// Reads, writes and deletes are held in per-class FIFO queues (client, recovery, scrub,
+// with an optional client queue per inode) and released into the submit queue by the
+// smallest start tag while less than <qos_iodepth> of them are in progress. The tag of
+// an operation grows by its cost divided by the weight of its class, so under contention
+// classes get I/O in proportion to their weights. Recovery and scrub may also be limited
+// by iops and bandwidth. SYNC, STABLE and ROLLBACK act as barriers: they're released only
+// after all operations queued before them, so they still cover all previous writes.
+class blockstore_qos_t
+{
+    blockstore_impl_t *bs = NULL;
+    blockstore_qos_class_t classes[BS_QOS_CLASSES];
+    // (class, inode or 0) => queue
+    std::map<std::pair<int, uint64_t>, blockstore_qos_queue_t> queues;
+    std::deque<blockstore_qos_entry_t> barriers;
+    uint64_t next_seq = 1;
+    uint64_t virtual_time = 0;
+    uint64_t total_queued = 0, total_inflight = 0;
+    int timer_id = -1;
+
+    bool has_tokens(blockstore_qos_class_t & cls, uint64_t now_us);
+    void release(blockstore_qos_entry_t & e, int qos_class, uint64_t now_us);
+
+public:
+    ~blockstore_qos_t();
+    void configure(blockstore_impl_t *bs);
+    bool enabled();
+    uint64_t queued() { return total_queued + barriers.size(); }
+    // Hold the operation in the scheduler. Returns false if it should be submitted directly
+    bool hold(blockstore_op_t *op);
+    // Release operations into the submit queue
+    void dispatch();
+    // Account completion of an operation
+    void finish(blockstore_op_t *op, uint64_t now_us);
+    void get_counters(std::map<std::string, uint64_t> & counters);
+    void dump_diagnostics();
+};
@@ -2,6 +2,7 @@
 // License: VNPL-1.1 (see README.md for details)
 
 #include <limits.h>
+#include <algorithm>
 #include "blockstore_impl.h"
 
 int blockstore_impl_t::fulfill_read_push(blockstore_op_t *op, void *buf, uint64_t offset, uint64_t len,
@@ -24,16 +25,75 @@ int blockstore_impl_t::fulfill_read_push(blockstore_op_t *op, void *buf, uint64_
         memcpy(buf, (uint8_t*)journal.buffer + offset, len);
         return 1;
     }
-    BS_SUBMIT_GET_SQE(sqe, data);
-    data->iov = (struct iovec){ buf, (size_t)len };
-    PRIV(op)->pending_ops++;
-    io_uring_prep_readv(
-        sqe,
-        IS_JOURNAL(item_state) ? dsk.journal_fd : dsk.data_fd,
-        &data->iov, 1,
-        (IS_JOURNAL(item_state) ? dsk.journal_offset : dsk.data_offset) + offset
-    );
-    data->callback = [this, op](ring_data_t *data) { handle_read_event(data, op); };
+    if (IS_JOURNAL(item_state) && journal_cache.get(offset, buf, len))
+    {
+        return 1;
+    }
+    // Disk reads are submitted later by submit_read_plan() to merge adjacent extents
+    PRIV(op)->read_plan.push_back((read_extent_t){
+        .journal = IS_JOURNAL(item_state),
+        .offset = offset,
+        .len = len,
+        .buf = buf,
+    });
+    return 1;
+}
+
+// Submit planned disk reads, merging extents on the same device which are
+// separated by at most <read_coalesce_gap> bytes into one vectored read.
+// Gaps are read into a scratch buffer
+int blockstore_impl_t::submit_read_plan(blockstore_op_t *op)
+{
+    auto & plan = PRIV(op)->read_plan;
+    if (!plan.size())
+    {
+        return 1;
+    }
+    if (plan.size() > 1)
+    {
+        std::sort(plan.begin(), plan.end(), [](const read_extent_t & a, const read_extent_t & b)
+        {
+            return a.journal < b.journal || a.journal == b.journal && a.offset < b.offset;
+        });
+    }
+    // iovecs must stay in place until the reads complete, so reserve the maximum count here
+    auto & iov = PRIV(op)->read_iov;
+    iov.clear();
+    iov.reserve(plan.size()*2);
+    for (int i = 0; i < plan.size(); )
+    {
+        int iov_start = iov.size();
+        uint64_t end = plan[i].offset + plan[i].len;
+        iov.push_back((struct iovec){ plan[i].buf, (size_t)plan[i].len });
+        int j = i+1;
+        for (; j < plan.size() && plan[j].journal == plan[i].journal &&
+            plan[j].offset >= end && plan[j].offset-end <= read_coalesce_gap &&
+            iov.size()-iov_start < IOV_MAX-1; j++)
+        {
+            if (plan[j].offset > end)
+                iov.push_back((struct iovec){ read_gap_buf, (size_t)(plan[j].offset-end) });
+            iov.push_back((struct iovec){ plan[j].buf, (size_t)plan[j].len });
+            end = plan[j].offset + plan[j].len;
+        }
+        BS_SUBMIT_GET_SQE(sqe, data);
+        int n_iov = iov.size()-iov_start;
+        data->iov = iov[iov_start];
+        if (n_iov > 1)
+        {
+            // handle_read_event() compares the result with iov_len
+            data->iov.iov_len = end - plan[i].offset;
+        }
+        PRIV(op)->pending_ops++;
+        io_uring_prep_readv(
+            sqe,
+            plan[i].journal ? dsk.journal_fd : dsk.data_fd,
+            n_iov > 1 ? iov.data()+iov_start : &data->iov, n_iov,
+            (plan[i].journal ? dsk.journal_offset : dsk.data_offset) + plan[i].offset
+        );
+        data->callback = [this, op](ring_data_t *data) { handle_read_event(data, op); };
+        i = j;
+    }
+    plan.clear();
     return 1;
 }
 
@@ -444,7 +504,7 @@ int blockstore_impl_t::dequeue_read(blockstore_op_t *read_op)
                     // Copy from memory or read from journal, possibly checking checksums
                     if (!fulfill_read(read_op, fulfilled, dirty.offset, dirty.offset + dirty.len,
                         dirty.state, dirty_it->first.version, dirty.location, dirty.journal_sector+1,
-                        journal.inmemory ? NULL : bmp_ptr+dsk.clean_entry_bitmap_size, dyn_data))
+                        journal.inmemory || !dsk.csum_block_size ? NULL : bmp_ptr+dsk.clean_entry_bitmap_size, dyn_data))
                     {
                         goto undo_read;
                     }
@@ -486,6 +546,10 @@ int blockstore_impl_t::dequeue_read(blockstore_op_t *read_op)
         return 2;
     }
     assert(fulfilled == read_op->len);
+    if (!submit_read_plan(read_op))
+    {
+        goto undo_read;
+    }
     read_op->version = result_version;
     if (!PRIV(read_op)->pending_ops)
     {
@@ -509,6 +573,7 @@ int blockstore_impl_t::dequeue_read(blockstore_op_t *read_op)
         }
     }
     read_op->retval = 0;
+    inflight_reads++;
     return 2;
 undo_read:
     // need to wait. undo added requests, don't dequeue op
@@ -529,6 +594,7 @@ undo_read:
         }
     }
     rv.clear();
+    PRIV(read_op)->read_plan.clear();
     return 0;
 }
 
@@ -694,11 +760,20 @@ uint8_t* blockstore_impl_t::read_clean_meta_block(blockstore_op_t *op, uint64_t
     auto sector = ((clean_loc >> dsk.block_order) / (dsk.meta_block_size / dsk.clean_entry_size)) * dsk.meta_block_size;
     auto pos = ((clean_loc >> dsk.block_order) % (dsk.meta_block_size / dsk.clean_entry_size)) * dsk.clean_entry_size;
     uint8_t *buf = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, dsk.meta_block_size);
+    // Metadata blocks read from the disk are added to the cache after completion,
+    // <len> holds the cache generation to check that the block wasn't modified meanwhile
+    bool cached = meta_cache.get(sector, buf + pos, pos, dsk.clean_entry_size);
     rv.insert(rv.begin()+rv_pos, (copy_buffer_t){
         .copy_flags = COPY_BUF_META_BLOCK|COPY_BUF_CSUM_FILL,
         .offset = pos,
+        .len = cached ? UINT64_MAX : meta_cache.get_gen(sector),
+        .disk_offset = sector,
         .buf = buf,
     });
+    if (cached)
+    {
+        return buf + pos + sizeof(clean_disk_entry);
+    }
     BS_SUBMIT_GET_SQE(sqe, data);
     data->iov = (struct iovec){ buf, (size_t)dsk.meta_block_size };
     PRIV(op)->pending_ops++;
@@ -826,6 +901,7 @@ void blockstore_impl_t::handle_read_event(ring_data_t *data, blockstore_op_t *op
     }
     if (PRIV(op)->pending_ops == 0)
     {
+        inflight_reads--;
         if (dsk.csum_block_size)
         {
             // verify checksums if required
@@ -841,6 +917,8 @@ void blockstore_impl_t::handle_read_event(ring_data_t *data, blockstore_op_t *op
                         assert(!meta_block);
                         meta_block = rv[i].buf;
                         rv[i].buf = NULL;
+                        if (op->retval == 0 && rv[i].len != UINT64_MAX)
+                            meta_cache.put_if_unchanged(rv[i].disk_offset, meta_block, rv[i].len);
                         continue;
                     }
                     struct iovec *iov = (struct iovec*)((uint8_t*)rv[i].buf + (rv[i].len & 0xFFFFFFFF));
@@ -907,24 +985,36 @@ void blockstore_impl_t::handle_read_event(ring_data_t *data, blockstore_op_t *op
                         assert(!meta_block);
                         meta_block = vec.buf;
                         vec.buf = NULL;
+                        if (op->retval == 0 && vec.len != UINT64_MAX)
+                            meta_cache.put_if_unchanged(vec.disk_offset, meta_block, vec.len);
                         continue;
                     }
                     if (vec.csum_buf)
                     {
                         uint32_t *csum = (uint32_t*)vec.csum_buf;
-                        for (size_t p = 0; p < vec.len; p += dsk.csum_block_size, csum++)
+                        uint32_t calc[32];
+                        bool bad = false;
+                        for (size_t p = 0; p < vec.len && !bad; )
                         {
-                            if (crc32c(0, (uint8_t*)op->buf + vec.offset - op->offset + p, dsk.csum_block_size) != *csum)
+                            // Checksum up to 32 blocks at once
+                            size_t n = (vec.len-p) / dsk.csum_block_size;
+                            n = n > 32 ? 32 : n;
+                            crc32c_blocks(calc, (uint8_t*)op->buf + vec.offset - op->offset + p, dsk.csum_block_size, n);
+                            for (size_t i = 0; i < n; i++, p += dsk.csum_block_size, csum++)
                             {
-                                // checksum error
-                                printf(
-                                    "Checksum mismatch in object %jx:%jx v%ju in %s area at offset 0x%jx+0x%zx: %08x vs %08x\n",
-                                    op->oid.inode, op->oid.stripe, op->version,
-                                    (vec.copy_flags & COPY_BUF_JOURNAL) ? "journal" : "data", vec.disk_offset, p,
-                                    crc32c(0, (uint8_t*)op->buf + vec.offset - op->offset + p, dsk.csum_block_size), *csum
-                                );
-                                op->retval = -EDOM;
-                                break;
+                                if (calc[i] != *csum)
+                                {
+                                    // checksum error
+                                    printf(
+                                        "Checksum mismatch in object %jx:%jx v%ju in %s area at offset 0x%jx+0x%zx: %08x vs %08x\n",
+                                        op->oid.inode, op->oid.stripe, op->version,
+                                        (vec.copy_flags & COPY_BUF_JOURNAL) ? "journal" : "data", vec.disk_offset, p,
+                                        calc[i], *csum
+                                    );
+                                    op->retval = -EDOM;
+                                    bad = true;
+                                    break;
+                                }
                             }
                         }
                     }
@@ -953,7 +1043,7 @@ void blockstore_impl_t::handle_read_event(ring_data_t *data, blockstore_op_t *op
                 {
                     if (uo_it->second.was_freed)
                     {
-                        data_alloc->set(PRIV(op)->clean_block_used, false);
+                        free_data_block(PRIV(op)->clean_block_used >> dsk.block_order);
                     }
                     used_clean_objects.erase(uo_it);
                 }
@@ -1030,3 +1120,15 @@ int blockstore_impl_t::read_bitmap(object_id oid, uint64_t target_version, void
         memset(bitmap, 0, dsk.clean_entry_bitmap_size);
     return -ENOENT;
 }
+
+void blockstore_impl_t::read_bitmaps(blockstore_op_t *op)
+{
+    obj_ver_id *ov = (obj_ver_id*)op->buf;
+    uint8_t *cur = (uint8_t*)op->bitmap;
+    for (uint32_t i = 0; i < op->len; i++)
+    {
+        read_bitmap(ov[i].oid, ov[i].version, cur + sizeof(uint64_t), (uint64_t*)cur);
+        cur += sizeof(uint64_t) + dsk.clean_entry_bitmap_size;
+    }
+    op->retval = 0;
+}
@@ -0,0 +1,829 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "blockstore_shards.h"
+
+blockstore_sharded_t::blockstore_sharded_t(blockstore_config_t & config, ring_loop_t *ringloop, int shard_count)
+{
+    this->ringloop = ringloop;
+    auto shard_configs = split_config(config, shard_count);
+    completion_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    if (completion_fd < 0)
+    {
+        throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+    }
+    try
+    {
+        for (int i = 0; i < shard_count; i++)
+        {
+            auto shard = new blockstore_shard_t;
+            shards.push_back(shard);
+            shard->parent = this;
+            shard->shard_num = i;
+            shard->ringloop = new ring_loop_t(RINGLOOP_DEFAULT_SIZE);
+            shard->epmgr = new epoll_manager_t(shard->ringloop);
+            shard->impl = new blockstore_impl_t(shard_configs[i], shard->ringloop, shard->epmgr->tfd);
+            shard->wakeup_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+            if (shard->wakeup_fd < 0)
+            {
+                throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+            }
+            shard->consumer.loop = [shard]()
+            {
+                if (shard->wakeup_pending)
+                    shard->arm_wakeup();
+            };
+            shard->ringloop->register_consumer(&shard->consumer);
+            shard->arm_wakeup();
+        }
+    }
+    catch (std::exception & e)
+    {
+        for (auto shard: shards)
+        {
+            if (shard->impl)
+                delete shard->impl;
+            if (shard->epmgr)
+                delete shard->epmgr;
+            if (shard->ringloop)
+                delete shard->ringloop;
+            if (shard->wakeup_fd >= 0)
+                close(shard->wakeup_fd);
+            delete shard;
+        }
+        close(completion_fd);
+        throw;
+    }
+    for (auto shard: shards)
+    {
+        shard->thread = std::thread(&blockstore_shard_t::run, shard);
+    }
+    consumer.loop = [this]()
+    {
+        if (completion_pending)
+            arm_completion_poll();
+    };
+    ringloop->register_consumer(&consumer);
+    arm_completion_poll();
+}
+
+blockstore_sharded_t::~blockstore_sharded_t()
+{
+    for (auto shard: shards)
+    {
+        shard->mu.lock();
+        shard->stopped = true;
+        shard->mu.unlock();
+        shard->wakeup();
+        shard->thread.join();
+        shard->ringloop->unregister_consumer(&shard->consumer);
+        delete shard->impl;
+        delete shard->epmgr;
+        delete shard->ringloop;
+        close(shard->wakeup_fd);
+        delete shard;
+    }
+    shards.clear();
+    ringloop->unregister_consumer(&consumer);
+    if (completion_data)
+    {
+        completion_data->callback = [](ring_data_t*){};
+    }
+    close(completion_fd);
+}
+
+// Split data, metadata and journal areas into <shard_count> equal parts.
+// The layout only depends on the device sizes and on the configuration,
+// so the number of shards must never be changed after creating the OSD.
+std::vector<blockstore_config_t> blockstore_sharded_t::split_config(blockstore_config_t & config, int shard_count)
+{
+    blockstore_disk_t dsk;
+    uint64_t shard_data_size, shard_meta_size, shard_journal_size;
+    try
+    {
+        dsk.parse_config(config);
+        dsk.open_data();
+        dsk.open_meta();
+        dsk.open_journal();
+        dsk.calc_lengths(true);
+        check_stored_shards(dsk, shard_count);
+        shard_data_size = dsk.data_len / shard_count / dsk.data_block_size * dsk.data_block_size;
+        shard_journal_size = dsk.journal_len / shard_count / dsk.journal_block_size * dsk.journal_block_size;
+        if (!shard_data_size)
+        {
+            throw std::runtime_error("Data area is too small for "+std::to_string(shard_count)+" blockstore shards");
+        }
+        // Calculate metadata size for a single shard
+        dsk.cfg_data_size = shard_data_size;
+        dsk.cfg_journal_size = shard_journal_size;
+        dsk.calc_lengths(true);
+        shard_meta_size = dsk.meta_len;
+        // Check that areas of all shards fit into their devices and don't overlap
+        struct
+        {
+            const char *name;
+            std::string device;
+            uint64_t offset, len;
+        } areas[3] = {
+            { "data", dsk.data_device, dsk.data_offset, shard_data_size*shard_count },
+            { "metadata", dsk.meta_device, dsk.meta_offset, shard_meta_size*shard_count },
+            { "journal", dsk.journal_device, dsk.journal_offset, shard_journal_size*shard_count },
+        };
+        for (int i = 0; i < 3; i++)
+        {
+            uint64_t device_size = areas[i].device == dsk.data_device ? dsk.data_device_size
+                : (areas[i].device == dsk.meta_device ? dsk.meta_device_size : dsk.journal_device_size);
+            if (areas[i].offset+areas[i].len > device_size)
+            {
+                throw std::runtime_error(std::string(areas[i].name)+" areas of "+std::to_string(shard_count)+
+                    " blockstore shards ("+std::to_string(areas[i].len)+" bytes) don't fit into the device");
+            }
+            for (int j = 0; j < i; j++)
+            {
+                if (areas[i].device == areas[j].device &&
+                    areas[i].offset < areas[j].offset+areas[j].len &&
+                    areas[j].offset < areas[i].offset+areas[i].len)
+                {
+                    throw std::runtime_error(std::string(areas[i].name)+" and "+areas[j].name+" areas of "+
+                        std::to_string(shard_count)+" blockstore shards overlap");
+                }
+            }
+        }
+    }
+    catch (std::exception & e)
+    {
+        dsk.close_all();
+        throw;
+    }
+    dsk.close_all();
+    std::vector<blockstore_config_t> shard_configs;
+    for (int i = 0; i < shard_count; i++)
+    {
+        blockstore_config_t shard_config = config;
+        shard_config["data_offset"] = std::to_string(dsk.data_offset + i*shard_data_size);
+        shard_config["data_size"] = std::to_string(shard_data_size);
+        shard_config["meta_offset"] = std::to_string(dsk.meta_offset + i*shard_meta_size);
+        shard_config["journal_offset"] = std::to_string(dsk.journal_offset + i*shard_journal_size);
+        shard_config["journal_size"] = std::to_string(shard_journal_size);
+        // Metadata and journal caches are divided between shards
+        uint64_t meta_cache_size = config["meta_cache_size"] != ""
+            ? strtoull(config["meta_cache_size"].c_str(), NULL, 10) : DEFAULT_META_CACHE_SIZE;
+        shard_config["meta_cache_size"] = std::to_string(meta_cache_size / shard_count);
+        uint64_t journal_cache_size = config["journal_cache_size"] != ""
+            ? strtoull(config["journal_cache_size"].c_str(), NULL, 10) : DEFAULT_JOURNAL_CACHE_SIZE;
+        shard_config["journal_cache_size"] = std::to_string(journal_cache_size / shard_count);
+        split_rate_limits(config, shard_config, shard_count);
+        if (config["meta_snapshot_file"] != "")
+        {
+            shard_config["meta_snapshot_file"] = config["meta_snapshot_file"]+"."+std::to_string(i);
+        }
+        if (i > 0)
+        {
+            // Devices are already locked by the first shard
+            shard_config["disable_device_lock"] = "true";
+        }
+        shard_configs.push_back(shard_config);
+    }
+    return shard_configs;
+}
+
+// Check the shard count stored in the metadata superblock of the first shard before starting
+// any shards, because other shards would initialize their metadata over an existing one
+void blockstore_sharded_t::check_stored_shards(blockstore_disk_t & dsk, uint64_t shard_count)
+{
+    uint8_t *sb = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, dsk.meta_block_size);
+    if (pread(dsk.meta_fd, sb, dsk.meta_block_size, dsk.meta_offset) != dsk.meta_block_size)
+    {
+        free(sb);
+        throw std::runtime_error(std::string("Failed to read metadata superblock: ") + strerror(errno));
+    }
+    blockstore_meta_header_v2_t *hdr = (blockstore_meta_header_v2_t *)sb;
+    blockstore_meta_shards_t *shards = (blockstore_meta_shards_t*)(sb + sizeof(*hdr));
+    uint64_t stored_shards = hdr->magic != BLOCKSTORE_META_MAGIC_V1 ? shard_count
+        : (shards->magic == BLOCKSTORE_META_SHARDS_MAGIC ? shards->shard_count : 1);
+    free(sb);
+    if (stored_shards != shard_count)
+    {
+        throw std::runtime_error(
+            "Number of blockstore shards stored in metadata superblock ("+std::to_string(stored_shards)+
+            ") differs from OSD configuration ("+std::to_string(shard_count)+")"
+        );
+    }
+}
+
+void blockstore_shard_t::arm_wakeup()
+{
+    io_uring_sqe *sqe = ringloop->get_sqe();
+    if (!sqe)
+    {
+        // Retry from the consumer after some SQEs are completed
+        wakeup_pending = true;
+        return;
+    }
+    wakeup_pending = false;
+    ring_data_t *data = ((ring_data_t*)sqe->user_data);
+    io_uring_prep_poll_add(sqe, wakeup_fd, POLLIN);
+    data->callback = [this](ring_data_t *data)
+    {
+        if (data->res < 0)
+        {
+            throw std::runtime_error(std::string("eventfd poll failed: ") + strerror(-data->res));
+        }
+        uint64_t ctr = 0;
+        if (read(wakeup_fd, &ctr, 8) < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            throw std::runtime_error(std::string("error reading eventfd: ") + strerror(errno));
+        }
+        arm_wakeup();
+        ringloop->wakeup();
+    };
+    ringloop->submit();
+}
+
+void blockstore_shard_t::wakeup()
+{
+    uint64_t ctr = 1;
+    if (write(wakeup_fd, &ctr, 8) < 0)
+    {
+        throw std::runtime_error(std::string("error writing to eventfd: ") + strerror(errno));
+    }
+}
+
+// Run <fn> in the shard thread and wait until it returns
+void blockstore_shard_t::call(std::function<void()> fn)
+{
+    std::unique_lock<std::mutex> lk(mu);
+    calls.push_back(&fn);
+    uint64_t seq = ++calls_submitted;
+    lk.unlock();
+    wakeup();
+    lk.lock();
+    call_cv.wait(lk, [&]() { return calls_done >= seq; });
+}
+
+void blockstore_shard_t::run()
+{
+    char name[16];
+    snprintf(name, sizeof(name), "bs_shard%d", shard_num);
+    pthread_setname_np(pthread_self(), name);
+    std::vector<blockstore_op_t*> ops;
+    std::vector<std::function<void()>*> run_calls;
+    std::unique_lock<std::mutex> lk(mu);
+    while (!stopped)
+    {
+        ops.swap(queue);
+        run_calls.swap(calls);
+        lk.unlock();
+        for (auto op: ops)
+            impl->enqueue_op(op);
+        ops.clear();
+        for (auto fn: run_calls)
+            (*fn)();
+        ringloop->loop();
+        bool impl_started = impl->is_started();
+        lk.lock();
+        if (run_calls.size())
+        {
+            calls_done += run_calls.size();
+            run_calls.clear();
+            call_cv.notify_all();
+        }
+        // Wake up the main thread if it has something to do
+        bool notify = completed.size() > 0 || !started && impl_started;
+        started = impl_started;
+        lk.unlock();
+        if (notify)
+            parent->notify();
+        ringloop->wait();
+        lk.lock();
+    }
+}
+
+void blockstore_sharded_t::notify()
+{
+    uint64_t ctr = 1;
+    if (write(completion_fd, &ctr, 8) < 0)
+    {
+        throw std::runtime_error(std::string("error writing to eventfd: ") + strerror(errno));
+    }
+}
+
+void blockstore_sharded_t::arm_completion_poll()
+{
+    io_uring_sqe *sqe = ringloop->get_sqe();
+    if (!sqe)
+    {
+        completion_pending = true;
+        return;
+    }
+    completion_pending = false;
+    completion_data = ((ring_data_t*)sqe->user_data);
+    io_uring_prep_poll_add(sqe, completion_fd, POLLIN);
+    completion_data->callback = [this](ring_data_t *data)
+    {
+        if (data->res < 0)
+        {
+            throw std::runtime_error(std::string("eventfd poll failed: ") + strerror(-data->res));
+        }
+        completion_data = NULL;
+        arm_completion_poll();
+        handle_completions();
+    };
+    ringloop->submit();
+}
+
+void blockstore_sharded_t::handle_completions()
+{
+    uint64_t ctr = 0;
+    if (read(completion_fd, &ctr, 8) < 0 && errno != EAGAIN && errno != EINTR)
+    {
+        throw std::runtime_error(std::string("error reading eventfd: ") + strerror(errno));
+    }
+    for (auto shard: shards)
+    {
+        shard->mu.lock();
+        done.swap(shard->completed);
+        shard->mu.unlock();
+        for (auto op: done)
+        {
+            // Callback may delete the operation, so copy it
+            callback_t<void (blockstore_op_t*)>(op->callback)(op);
+        }
+        done.clear();
+    }
+    // Operations may be submitted from callbacks or state may change (for example, the blockstore may start)
+    ringloop->wakeup();
+}
+
+blockstore_shard_t *blockstore_sharded_t::shard_for(object_id oid)
+{
+    // All parts of the same data block go to the same shard
+    uint64_t h = (oid.inode ^ (oid.stripe / shards[0]->impl->get_block_size())) * 0x9E3779B97F4A7C15ull;
+    return shards[(h >> 32) % shards.size()];
+}
+
+// Original callbacks of operations submitted to shards are kept at the end of their private data,
+// after blockstore_op_private_t, so that the wrapping callback fits into the inline storage
+typedef callback_t<void (blockstore_op_t*)> shard_op_callback_t;
+#define SHARD_OP_CALLBACK(op) ((shard_op_callback_t*)((op)->private_data + BS_OP_PRIVATE_DATA_SIZE - sizeof(shard_op_callback_t)))
+static_assert(sizeof(blockstore_op_private_t) + sizeof(shard_op_callback_t) <= BS_OP_PRIVATE_DATA_SIZE,
+    "BS_OP_PRIVATE_DATA_SIZE is too small for the original callback of sharded operations");
+
+void blockstore_sharded_t::enqueue_shard(blockstore_shard_t *shard, blockstore_op_t *op)
+{
+    // Operations complete in the shard thread, so remember the original callback
+    // and move completed operations to the queue handled in the main thread
+    new ((void*)SHARD_OP_CALLBACK(op)) shard_op_callback_t(std::move(op->callback));
+    op->callback = [shard](blockstore_op_t *op)
+    {
+        // Restoring the callback overwrites this lambda, so don't use captures after it
+        auto sh = shard;
+        op->callback = std::move(*SHARD_OP_CALLBACK(op));
+        SHARD_OP_CALLBACK(op)->~shard_op_callback_t();
+        std::lock_guard<std::mutex> lk(sh->mu);
+        sh->completed.push_back(op);
+    };
+    shard->mu.lock();
+    shard->queue.push_back(op);
+    shard->mu.unlock();
+    shard->wakeup();
+}
+
+void blockstore_sharded_t::enqueue_op(blockstore_op_t *op)
+{
+    if (op->opcode == BS_OP_SYNC || op->opcode == BS_OP_LIST)
+        enqueue_all(op);
+    else if (op->opcode == BS_OP_STABLE || op->opcode == BS_OP_ROLLBACK)
+        enqueue_split(op);
+    else if (op->opcode == BS_OP_READ_BITMAP)
+        enqueue_read_bitmap(op);
+    else if (op->opcode >= BS_OP_MIN && op->opcode <= BS_OP_MAX)
+        enqueue_shard(shard_for(op->oid), op);
+    else
+        // Let the first shard return an error
+        enqueue_shard(shards[0], op);
+}
+
+void blockstore_sharded_t::enqueue_all(blockstore_op_t *op)
+{
+    int *pending = new int(shards.size());
+    auto subops = new std::vector<blockstore_op_t*>(shards.size());
+    for (int i = 0; i < shards.size(); i++)
+    {
+        blockstore_op_t *subop = new blockstore_op_t;
+        subop->opcode = op->opcode;
+        if (op->opcode == BS_OP_LIST)
+        {
+            subop->min_oid = op->min_oid;
+            subop->max_oid = op->max_oid;
+            subop->pg_alignment = op->pg_alignment;
+            subop->pg_count = op->pg_count;
+            subop->pg_number = op->pg_number;
+            subop->list_stable_limit = op->list_stable_limit;
+        }
+        subop->callback = [this, op, pending, subops](blockstore_op_t *subop)
+        {
+            (*pending)--;
+            if (*pending > 0)
+            {
+                return;
+            }
+            op->retval = 0;
+            for (auto subop: *subops)
+            {
+                if (subop->retval < 0 && op->retval == 0)
+                    op->retval = subop->retval;
+            }
+            if (op->opcode == BS_OP_LIST)
+            {
+                merge_list(op, *subops);
+            }
+            for (auto subop: *subops)
+            {
+                delete subop;
+            }
+            delete subops;
+            delete pending;
+            callback_t<void (blockstore_op_t*)>(op->callback)(op);
+        };
+        (*subops)[i] = subop;
+    }
+    for (int i = 0; i < shards.size(); i++)
+    {
+        enqueue_shard(shards[i], (*subops)[i]);
+    }
+}
+
+void blockstore_sharded_t::merge_list(blockstore_op_t *op, std::vector<blockstore_op_t*> & subops)
+{
+    uint64_t stable_count = 0, unstable_count = 0;
+    for (auto subop: subops)
+    {
+        if (subop->retval >= 0)
+        {
+            stable_count += subop->version;
+            unstable_count += subop->retval-subop->version;
+        }
+    }
+    obj_ver_id *list = NULL;
+    if (op->retval == 0)
+    {
+        list = (obj_ver_id*)malloc(sizeof(obj_ver_id) * (stable_count+unstable_count > 0 ? stable_count+unstable_count : 1));
+        if (!list)
+            op->retval = -ENOMEM;
+    }
+    if (op->retval < 0)
+    {
+        for (auto subop: subops)
+        {
+            if (subop->retval >= 0 && subop->buf)
+                free(subop->buf);
+        }
+        op->buf = NULL;
+        return;
+    }
+    // Stable entries come first
+    bool limited = false;
+    object_id max_oid = {};
+    uint64_t pos = 0, unstable_pos = stable_count;
+    for (auto subop: subops)
+    {
+        obj_ver_id *sub_list = (obj_ver_id*)subop->buf;
+        uint64_t sub_stable = subop->version;
+        memcpy(list+pos, sub_list, sizeof(obj_ver_id) * sub_stable);
+        memcpy(list+unstable_pos, sub_list+sub_stable, sizeof(obj_ver_id) * (subop->retval-sub_stable));
+        pos += sub_stable;
+        unstable_pos += subop->retval-sub_stable;
+        if (op->list_stable_limit > 0 && sub_stable >= op->list_stable_limit)
+        {
+            // This shard only listed objects up to its last stable object,
+            // so other shards' results must be limited by it too
+            object_id sub_max = std::max_element(sub_list, sub_list+sub_stable)->oid;
+            if (!limited || sub_max < max_oid)
+                max_oid = sub_max;
+            limited = true;
+        }
+        free(subop->buf);
+    }
+    std::sort(list, list+stable_count);
+    std::sort(list+stable_count, list+stable_count+unstable_count);
+    if (op->list_stable_limit > 0 && stable_count > op->list_stable_limit &&
+        (!limited || list[op->list_stable_limit-1].oid < max_oid))
+    {
+        max_oid = list[op->list_stable_limit-1].oid;
+        limited = true;
+    }
+    if (limited)
+    {
+        uint64_t new_stable = 0, new_unstable = 0;
+        while (new_stable < stable_count && !(max_oid < list[new_stable].oid))
+            new_stable++;
+        for (uint64_t i = stable_count; i < stable_count+unstable_count; i++)
+        {
+            if (!(max_oid < list[i].oid))
+                list[new_stable + new_unstable++] = list[i];
+        }
+        stable_count = new_stable;
+        unstable_count = new_unstable;
+    }
+    op->version = stable_count;
+    op->retval = stable_count+unstable_count;
+    op->buf = list;
+}
+
+void blockstore_sharded_t::enqueue_split(blockstore_op_t *op)
+{
+    obj_ver_id *list = (obj_ver_id*)op->buf;
+    std::vector<std::vector<obj_ver_id>> lists(shards.size());
+    int used_shards = 0;
+    blockstore_shard_t *last_shard = shards[0];
+    for (int i = 0; i < op->len; i++)
+    {
+        auto shard = shard_for(list[i].oid);
+        if (!lists[shard->shard_num].size())
+        {
+            used_shards++;
+            last_shard = shard;
+        }
+        lists[shard->shard_num].push_back(list[i]);
+    }
+    if (used_shards <= 1)
+    {
+        enqueue_shard(last_shard, op);
+        return;
+    }
+    int *pending = new int(used_shards);
+    int *retval = new int(0);
+    std::vector<std::pair<blockstore_shard_t*, blockstore_op_t*>> subops;
+    for (int i = 0; i < shards.size(); i++)
+    {
+        if (!lists[i].size())
+        {
+            continue;
+        }
+        blockstore_op_t *subop = new blockstore_op_t;
+        subop->opcode = op->opcode;
+        subop->len = lists[i].size();
+        subop->buf = malloc_or_die(sizeof(obj_ver_id) * lists[i].size());
+        memcpy(subop->buf, lists[i].data(), sizeof(obj_ver_id) * lists[i].size());
+        subop->callback = [op, pending, retval](blockstore_op_t *subop)
+        {
+            if (subop->retval < 0 && *retval == 0)
+                *retval = subop->retval;
+            free(subop->buf);
+            delete subop;
+            (*pending)--;
+            if (*pending > 0)
+            {
+                return;
+            }
+            op->retval = *retval;
+            delete pending;
+            delete retval;
+            callback_t<void (blockstore_op_t*)>(op->callback)(op);
+        };
+        subops.push_back(std::make_pair(shards[i], subop));
+    }
+    for (auto & sub: subops)
+    {
+        enqueue_shard(sub.first, sub.second);
+    }
+}
+
+void blockstore_sharded_t::enqueue_read_bitmap(blockstore_op_t *op)
+{
+    obj_ver_id *list = (obj_ver_id*)op->buf;
+    std::vector<std::vector<uint32_t>> positions(shards.size());
+    int used_shards = 0;
+    blockstore_shard_t *last_shard = shards[0];
+    for (uint32_t i = 0; i < op->len; i++)
+    {
+        auto shard = shard_for(list[i].oid);
+        if (!positions[shard->shard_num].size())
+        {
+            used_shards++;
+            last_shard = shard;
+        }
+        positions[shard->shard_num].push_back(i);
+    }
+    if (used_shards <= 1)
+    {
+        enqueue_shard(last_shard, op);
+        return;
+    }
+    // Each shard fills its own buffer, results are copied back to their places
+    // in the original bitmap buffer when the subop completes
+    const uint64_t entry_size = sizeof(uint64_t) +
+        shards[0]->impl->get_block_size() / shards[0]->impl->get_bitmap_granularity() / 8;
+    int *pending = new int(used_shards);
+    std::vector<std::pair<blockstore_shard_t*, blockstore_op_t*>> subops;
+    for (int i = 0; i < shards.size(); i++)
+    {
+        if (!positions[i].size())
+        {
+            continue;
+        }
+        blockstore_op_t *subop = new blockstore_op_t;
+        subop->opcode = op->opcode;
+        subop->len = positions[i].size();
+        subop->buf = malloc_or_die(sizeof(obj_ver_id) * subop->len);
+        subop->bitmap = malloc_or_die(entry_size * subop->len);
+        for (uint32_t j = 0; j < subop->len; j++)
+        {
+            ((obj_ver_id*)subop->buf)[j] = list[positions[i][j]];
+        }
+        subop->callback = [op, pending, entry_size, pos = std::move(positions[i])](blockstore_op_t *subop)
+        {
+            for (uint32_t j = 0; j < subop->len; j++)
+            {
+                memcpy((uint8_t*)op->bitmap + entry_size*pos[j], (uint8_t*)subop->bitmap + entry_size*j, entry_size);
+            }
+            free(subop->buf);
+            free(subop->bitmap);
+            delete subop;
+            (*pending)--;
+            if (*pending > 0)
+            {
+                return;
+            }
+            op->retval = 0;
+            delete pending;
+            callback_t<void (blockstore_op_t*)>(op->callback)(op);
+        };
+        subops.push_back(std::make_pair(shards[i], subop));
+    }
+    for (auto & sub: subops)
+    {
+        enqueue_shard(sub.first, sub.second);
+    }
+}
+
+// Rate limits of online discard and QoS classes are divided between shards
+void blockstore_sharded_t::split_rate_limits(blockstore_config_t & config, blockstore_config_t & shard_config, int shard_count)
+{
+    uint64_t discard_mbs = config["discard_mbs"] != ""
+        ? strtoull(config["discard_mbs"].c_str(), NULL, 10) : DEFAULT_DISCARD_MBS;
+    shard_config["discard_mbs"] = std::to_string(discard_mbs && discard_mbs < shard_count ? 1 : discard_mbs / shard_count);
+    uint64_t discard_iops = config["discard_iops"] != ""
+        ? strtoull(config["discard_iops"].c_str(), NULL, 10) : DEFAULT_DISCARD_IOPS;
+    shard_config["discard_iops"] = std::to_string(discard_iops && discard_iops < shard_count ? 1 : discard_iops / shard_count);
+    for (auto key: { "qos_recovery_iops", "qos_recovery_mbs", "qos_scrub_iops", "qos_scrub_mbs" })
+    {
+        uint64_t limit = strtoull(config[key].c_str(), NULL, 10);
+        if (limit)
+            shard_config[key] = std::to_string(limit < shard_count ? 1 : limit / shard_count);
+    }
+}
+
+void blockstore_sharded_t::parse_config(blockstore_config_t & config)
+{
+    blockstore_config_t shard_config = config;
+    split_rate_limits(config, shard_config, shards.size());
+    for (auto shard: shards)
+    {
+        shard->call([&]() { shard->impl->parse_config(shard_config, false); });
+    }
+}
+
+bool blockstore_sharded_t::is_started()
+{
+    bool started = true;
+    for (auto shard: shards)
+    {
+        shard->mu.lock();
+        started = started && shard->started;
+        shard->mu.unlock();
+    }
+    return started;
+}
+
+bool blockstore_sharded_t::is_stalled()
+{
+    bool stalled = false;
+    for (auto shard: shards)
+    {
+        shard->call([&]() { stalled = shard->impl->is_stalled() || stalled; });
+    }
+    return stalled;
+}
+
+bool blockstore_sharded_t::is_safe_to_stop()
+{
+    // Ask all shards because is_safe_to_stop() starts the final sync
+    bool safe = true;
+    for (auto shard: shards)
+    {
+        shard->call([&]() { safe = shard->impl->is_safe_to_stop() && safe; });
+    }
+    return safe;
+}
+
+int blockstore_sharded_t::read_bitmap(object_id oid, uint64_t target_version, void *bitmap, uint64_t *result_version)
+{
+    auto shard = shard_for(oid);
+    int r = 0;
+    shard->call([&]() { r = shard->impl->read_bitmap(oid, target_version, bitmap, result_version); });
+    return r;
+}
+
+std::map<uint64_t, uint64_t> & blockstore_sharded_t::get_inode_space_stats()
+{
+    inode_space_stats.clear();
+    for (auto shard: shards)
+    {
+        shard->call([&]()
+        {
+            for (auto & sp: shard->impl->inode_space_stats)
+            {
+                inode_space_stats[sp.first] += sp.second;
+            }
+        });
+    }
+    return inode_space_stats;
+}
+
+void blockstore_sharded_t::set_no_inode_stats(const std::vector<uint64_t> & pool_ids)
+{
+    for (auto shard: shards)
+    {
+        shard->call([&]() { shard->impl->set_no_inode_stats(pool_ids); });
+    }
+}
+
+void blockstore_sharded_t::dump_diagnostics()
+{
+    for (auto shard: shards)
+    {
+        printf("[Shard %d]\n", shard->shard_num);
+        shard->call([&]() { shard->impl->dump_diagnostics(); });
+    }
+}
+
+void blockstore_sharded_t::get_counters(std::map<std::string, uint64_t> & counters)
+{
+    for (auto shard: shards)
+    {
+        shard->call([&]() { shard->impl->get_counters(counters); });
+    }
+}
+
+void blockstore_sharded_t::get_histograms(std::map<std::string, blockstore_hist_t> & hists)
+{
+    for (auto shard: shards)
+    {
+        shard->call([&]() { shard->impl->get_histograms(hists); });
+    }
+}
+
+bool blockstore_sharded_t::save_meta_snapshot()
+{
+    bool ok = true;
+    for (auto shard: shards)
+    {
+        shard->call([&]() { ok = shard->impl->save_meta_snapshot() && ok; });
+    }
+    return ok;
+}
+
+uint32_t blockstore_sharded_t::get_block_size()
+{
+    return shards[0]->impl->get_block_size();
+}
+
+uint64_t blockstore_sharded_t::get_block_count()
+{
+    uint64_t count = 0;
+    for (auto shard: shards)
+    {
+        count += shard->impl->get_block_count();
+    }
+    return count;
+}
+
+uint64_t blockstore_sharded_t::get_free_block_count()
+{
+    uint64_t count = 0;
+    for (auto shard: shards)
+    {
+        shard->call([&]() { count += shard->impl->get_free_block_count(); });
+    }
+    return count;
+}
+
+// Journal size of a single shard, because each shard has its own journal
+uint64_t blockstore_sharded_t::get_journal_size()
+{
+    return shards[0]->impl->get_journal_size();
+}
+
+uint32_t blockstore_sharded_t::get_bitmap_granularity()
+{
+    return shards[0]->impl->get_bitmap_granularity();
+}
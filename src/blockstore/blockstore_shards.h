@@ -0,0 +1,98 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "blockstore_impl.h"
+#include "epoll_manager.h"
+
+class blockstore_sharded_t;
+
+// One shard of a multi-threaded blockstore: a separate part of data, metadata and journal
+// areas handled by its own blockstore_impl_t with its own ring_loop_t in its own thread
+struct blockstore_shard_t
+{
+    blockstore_sharded_t *parent = NULL;
+    int shard_num = 0;
+    ring_loop_t *ringloop = NULL;
+    epoll_manager_t *epmgr = NULL;
+    blockstore_impl_t *impl = NULL;
+    ring_consumer_t consumer;
+    // <impl> and <ringloop> are only used by the shard thread after it's started.
+    // The main thread passes operations to it through <queue> and runs everything
+    // else in it with call(). <mu> only protects the queues and flags below and
+    // is never held while the shard runs its event loop
+    std::mutex mu;
+    std::condition_variable call_cv;
+    std::thread thread;
+    int wakeup_fd = -1;
+    bool wakeup_pending = false;
+    bool started = false, stopped = false;
+    // Operations submitted by the main thread
+    std::vector<blockstore_op_t*> queue;
+    // Functions waiting to be run in the shard thread
+    std::vector<std::function<void()>*> calls;
+    uint64_t calls_submitted = 0, calls_done = 0;
+    // Completed operations waiting to be returned to the main thread
+    std::vector<blockstore_op_t*> completed;
+
+    void arm_wakeup();
+    void wakeup();
+    void call(std::function<void()> fn);
+    void run();
+};
+
+// Multi-threaded blockstore: splits devices into <blockstore_shards> independent parts,
+// routes operations to them by object ID and returns completions to the main ring_loop_t.
+// SYNC and LIST operations are sent to all shards, STABLE and ROLLBACK are split between them.
+class blockstore_sharded_t
+{
+    ring_loop_t *ringloop;
+    ring_consumer_t consumer;
+    std::vector<blockstore_shard_t*> shards;
+    int completion_fd = -1;
+    ring_data_t *completion_data = NULL;
+    bool completion_pending = false;
+    std::vector<blockstore_op_t*> done;
+    std::map<uint64_t, uint64_t> inode_space_stats;
+
+    std::vector<blockstore_config_t> split_config(blockstore_config_t & config, int shard_count);
+    void check_stored_shards(blockstore_disk_t & dsk, uint64_t shard_count);
+    void split_rate_limits(blockstore_config_t & config, blockstore_config_t & shard_config, int shard_count);
+    void arm_completion_poll();
+    void handle_completions();
+    blockstore_shard_t *shard_for(object_id oid);
+    void enqueue_shard(blockstore_shard_t *shard, blockstore_op_t *op);
+    void enqueue_all(blockstore_op_t *op);
+    void enqueue_split(blockstore_op_t *op);
+    void enqueue_read_bitmap(blockstore_op_t *op);
+    void merge_list(blockstore_op_t *op, std::vector<blockstore_op_t*> & subops);
+public:
+    blockstore_sharded_t(blockstore_config_t & config, ring_loop_t *ringloop, int shard_count);
+    ~blockstore_sharded_t();
+
+    void notify();
+
+    void parse_config(blockstore_config_t & config);
+    bool is_started();
+    bool is_stalled();
+    bool is_safe_to_stop();
+    void enqueue_op(blockstore_op_t *op);
+    int read_bitmap(object_id oid, uint64_t target_version, void *bitmap, uint64_t *result_version);
+    std::map<uint64_t, uint64_t> & get_inode_space_stats();
+    void set_no_inode_stats(const std::vector<uint64_t> & pool_ids);
+    void dump_diagnostics();
+    void get_counters(std::map<std::string, uint64_t> & counters);
+    void get_histograms(std::map<std::string, blockstore_hist_t> & hists);
+    bool save_meta_snapshot();
+    uint32_t get_block_size();
+    uint64_t get_block_count();
+    uint64_t get_free_block_count();
+    uint64_t get_journal_size();
+    uint32_t get_bitmap_granularity();
+};
@@ -0,0 +1,341 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// Clean metadata snapshot: saved on graceful stop and loaded instead of scanning
+// the whole metadata area on the next start if the superblock still references it
+
+#include <queue>
+#include <libgen.h>
+#include "blockstore_impl.h"
+#include "rw_blocking.h"
+
+#define SNAPSHOT_BUF_SIZE 4*1024*1024
+
+struct snapshot_writer_t
+{
+    int fd = -1;
+    uint8_t *buf = NULL;
+    uint64_t buf_pos = 0;
+    uint64_t data_size = 0;
+    uint32_t data_csum = 0;
+    bool error = false;
+
+    void flush()
+    {
+        if (buf_pos > 0 && !error)
+        {
+            data_csum = crc32c(data_csum, buf, buf_pos);
+            if (write_blocking(fd, buf, buf_pos) != buf_pos)
+                error = true;
+            data_size += buf_pos;
+        }
+        buf_pos = 0;
+    }
+
+    inline void reserve(uint64_t len)
+    {
+        if (buf_pos + len > SNAPSHOT_BUF_SIZE)
+            flush();
+    }
+
+    inline void put_varint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            buf[buf_pos++] = (value & 0x7F) | 0x80;
+            value >>= 7;
+        }
+        buf[buf_pos++] = value;
+    }
+
+    inline void put(const void *data, uint64_t len)
+    {
+        memcpy(buf + buf_pos, data, len);
+        buf_pos += len;
+    }
+};
+
+struct snapshot_reader_t
+{
+    int fd = -1;
+    uint8_t *buf = NULL;
+    uint64_t buf_pos = 0, buf_len = 0;
+    uint64_t remaining = 0;
+    uint32_t data_csum = 0;
+
+    // Make sure that at least <len> bytes are available in the buffer, if the file has them
+    bool fill(uint64_t len)
+    {
+        if (buf_len - buf_pos >= len)
+            return true;
+        memmove(buf, buf + buf_pos, buf_len - buf_pos);
+        buf_len -= buf_pos;
+        buf_pos = 0;
+        uint64_t to_read = SNAPSHOT_BUF_SIZE - buf_len;
+        if (to_read > remaining)
+            to_read = remaining;
+        if (to_read > 0)
+        {
+            if (read_blocking(fd, buf + buf_len, to_read) != to_read)
+                return false;
+            data_csum = crc32c(data_csum, buf + buf_len, to_read);
+            buf_len += to_read;
+            remaining -= to_read;
+        }
+        return buf_len >= len;
+    }
+
+    inline bool get_varint(uint64_t & value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (buf_pos >= buf_len)
+                return false;
+            uint8_t b = buf[buf_pos++];
+            value |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                return true;
+        }
+        return false;
+    }
+};
+
+static int open_snapshot_dir(const std::string & filename)
+{
+    std::string dir = filename;
+    return open(dirname((char*)dir.c_str()), O_RDONLY);
+}
+
+bool blockstore_impl_t::save_meta_snapshot()
+{
+    if (meta_snapshot_file == "" || readonly || !is_started() || !is_safe_to_stop())
+    {
+        return false;
+    }
+    // Generate a random snapshot ID so that a stale snapshot file is never
+    // accepted after metadata is changed and saved again
+    uint64_t snapshot_id = 0;
+    {
+        timespec tv;
+        clock_gettime(CLOCK_REALTIME, &tv);
+        snapshot_id = (((uint64_t)tv.tv_sec << 32) ^ tv.tv_nsec ^ ((uint64_t)getpid() << 16)) * 0x9E3779B97F4A7C15ull;
+        if (!snapshot_id)
+            snapshot_id = 1;
+    }
+    std::string tmp_file = meta_snapshot_file+".tmp";
+    snapshot_writer_t w;
+    w.fd = open(tmp_file.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    if (w.fd < 0)
+    {
+        printf("Failed to create metadata snapshot %s: %s\n", tmp_file.c_str(), strerror(errno));
+        return false;
+    }
+    w.buf = (uint8_t*)malloc_or_die(SNAPSHOT_BUF_SIZE);
+    // Header is written last, after all data is written and its checksum is known
+    blockstore_meta_snapshot_header_t hdr = {
+        .magic = BLOCKSTORE_META_SNAPSHOT_MAGIC,
+        .version = BLOCKSTORE_META_SNAPSHOT_VERSION,
+        .snapshot_id = snapshot_id,
+        .block_count = dsk.block_count,
+        .data_block_size = dsk.data_block_size,
+        .clean_entry_bitmap_size = dsk.clean_entry_bitmap_size,
+        .flags = inmemory_meta ? 0ul : BLOCKSTORE_META_SNAPSHOT_BITMAPS,
+    };
+    if (lseek(w.fd, sizeof(hdr), SEEK_SET) != sizeof(hdr))
+    {
+        w.error = true;
+    }
+    // Merge clean_db shards to write all entries in object ID order
+    std::vector<std::pair<blockstore_clean_db_t::iterator, blockstore_clean_db_t::iterator>> its;
+    for (auto & sh: clean_db_shards)
+    {
+        if (sh.second.size())
+            its.push_back({ sh.second.begin(), sh.second.end() });
+    }
+    auto cmp = [&its](int a, int b) { return its[b].first->first < its[a].first->first; };
+    std::priority_queue<int, std::vector<int>, decltype(cmp)> queue(cmp);
+    for (int i = 0; i < its.size(); i++)
+    {
+        queue.push(i);
+    }
+    object_id prev = {};
+    while (queue.size() && !w.error)
+    {
+        int i = queue.top();
+        queue.pop();
+        auto & oid = its[i].first->first;
+        auto & entry = its[i].first->second;
+        w.reserve(4*10 + 2*dsk.clean_entry_bitmap_size);
+        w.put_varint(oid.inode - prev.inode);
+        w.put_varint(oid.inode == prev.inode ? oid.stripe - prev.stripe : oid.stripe);
+        w.put_varint(entry.version);
+        w.put_varint(entry.location >> dsk.block_order);
+        if (!inmemory_meta && dsk.clean_entry_bitmap_size)
+        {
+            w.put(clean_bitmaps + (entry.location >> dsk.block_order)*2*dsk.clean_entry_bitmap_size, 2*dsk.clean_entry_bitmap_size);
+        }
+        prev = oid;
+        hdr.entry_count++;
+        its[i].first++;
+        if (its[i].first != its[i].second)
+            queue.push(i);
+    }
+    w.flush();
+    free(w.buf);
+    hdr.data_size = w.data_size;
+    hdr.data_csum = w.data_csum;
+    hdr.header_csum = 0;
+    hdr.header_csum = crc32c(0, &hdr, sizeof(hdr));
+    if (!w.error && (pwrite(w.fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || fsync(w.fd) < 0))
+    {
+        w.error = true;
+    }
+    close(w.fd);
+    if (w.error || rename(tmp_file.c_str(), meta_snapshot_file.c_str()) < 0)
+    {
+        printf("Failed to write metadata snapshot %s: %s\n", tmp_file.c_str(), strerror(errno));
+        unlink(tmp_file.c_str());
+        return false;
+    }
+    int dir_fd = open_snapshot_dir(meta_snapshot_file);
+    if (dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    // Now reference the snapshot from the metadata superblock
+    uint8_t *sb = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, dsk.meta_block_size);
+    bool ok = pread(dsk.meta_fd, sb, dsk.meta_block_size, dsk.meta_offset) == dsk.meta_block_size;
+    if (ok)
+    {
+        blockstore_meta_snapshot_ref_t *ref = (blockstore_meta_snapshot_ref_t*)(sb + dsk.meta_block_size - sizeof(blockstore_meta_snapshot_ref_t));
+        ref->magic = BLOCKSTORE_META_SNAPSHOT_MAGIC;
+        ref->snapshot_id = snapshot_id;
+        ok = pwrite(dsk.meta_fd, sb, dsk.meta_block_size, dsk.meta_offset) == dsk.meta_block_size &&
+            fsync(dsk.meta_fd) == 0;
+    }
+    free(sb);
+    if (!ok)
+    {
+        printf("Failed to reference metadata snapshot from the superblock: %s\n", strerror(errno));
+        return false;
+    }
+    // Metadata must not change after saving the snapshot
+    readonly = true;
+    printf(
+        "Metadata snapshot saved to %s: %ju entries, %ju KB\n",
+        meta_snapshot_file.c_str(), hdr.entry_count, hdr.data_size/1024
+    );
+    return true;
+}
+
+// Load clean_db (and clean entry bitmaps) from the snapshot. On any error, clean_db is left empty
+// and false is returned, so that the caller may fall back to the full metadata scan.
+// The allocator isn't filled here, it's filled from clean_db entries by the caller
+bool blockstore_impl_t::load_meta_snapshot(uint64_t snapshot_id)
+{
+    const char *err = NULL;
+    blockstore_meta_snapshot_header_t hdr;
+    snapshot_reader_t r;
+    uint64_t entry_count = 0;
+    object_id prev = {};
+    allocator_t *loaded = NULL;
+    r.fd = open(meta_snapshot_file.c_str(), O_RDONLY);
+    if (r.fd < 0)
+    {
+        printf("Failed to open metadata snapshot %s: %s, falling back to full metadata scan\n", meta_snapshot_file.c_str(), strerror(errno));
+        return false;
+    }
+    if (read_blocking(r.fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+    {
+        err = "file is too short";
+        goto fail;
+    }
+    {
+        uint32_t csum = hdr.header_csum;
+        hdr.header_csum = 0;
+        if (hdr.magic != BLOCKSTORE_META_SNAPSHOT_MAGIC || hdr.version != BLOCKSTORE_META_SNAPSHOT_VERSION ||
+            crc32c(0, &hdr, sizeof(hdr)) != csum)
+        {
+            err = "header is corrupt";
+            goto fail;
+        }
+    }
+    if (hdr.snapshot_id != snapshot_id)
+    {
+        err = "it doesn't match the metadata superblock";
+        goto fail;
+    }
+    if (hdr.block_count != dsk.block_count || hdr.data_block_size != dsk.data_block_size ||
+        hdr.clean_entry_bitmap_size != dsk.clean_entry_bitmap_size ||
+        hdr.flags != (inmemory_meta ? 0 : BLOCKSTORE_META_SNAPSHOT_BITMAPS))
+    {
+        err = "it was saved with different configuration";
+        goto fail;
+    }
+    r.buf = (uint8_t*)malloc_or_die(SNAPSHOT_BUF_SIZE);
+    r.remaining = hdr.data_size;
+    // Track blocks separately to detect duplicates without touching the real allocator
+    loaded = new allocator_t(dsk.block_count);
+    for (; entry_count < hdr.entry_count; entry_count++)
+    {
+        uint64_t inode_delta, stripe, version, block;
+        if (!r.fill(4*10 + 2*dsk.clean_entry_bitmap_size) && r.buf_pos >= r.buf_len ||
+            !r.get_varint(inode_delta) || !r.get_varint(stripe) || !r.get_varint(version) || !r.get_varint(block))
+        {
+            err = "entry data is truncated";
+            goto fail;
+        }
+        object_id oid = {
+            .inode = prev.inode + inode_delta,
+            .stripe = inode_delta ? stripe : prev.stripe + stripe,
+        };
+        if (!oid.inode || entry_count > 0 && !(prev < oid) || block >= dsk.block_count || loaded->get(block))
+        {
+            err = "entries are invalid";
+            goto fail;
+        }
+        loaded->set(block, true);
+        if (hdr.flags & BLOCKSTORE_META_SNAPSHOT_BITMAPS)
+        {
+            if (r.buf_len - r.buf_pos < 2*dsk.clean_entry_bitmap_size)
+            {
+                err = "entry data is truncated";
+                goto fail;
+            }
+            memcpy(clean_bitmaps + block*2*dsk.clean_entry_bitmap_size, r.buf + r.buf_pos, 2*dsk.clean_entry_bitmap_size);
+            r.buf_pos += 2*dsk.clean_entry_bitmap_size;
+        }
+        auto & clean_db = clean_db_shard(oid);
+        clean_db.insert(clean_db.end(), std::make_pair(oid, (clean_entry){
+            .version = version,
+            .location = block << dsk.block_order,
+        }));
+        prev = oid;
+    }
+    if (r.remaining > 0 || r.buf_pos < r.buf_len)
+    {
+        err = "it has extra data after entries";
+        goto fail;
+    }
+    if (r.data_csum != hdr.data_csum)
+    {
+        err = "data checksum mismatch";
+        goto fail;
+    }
+    delete loaded;
+    free(r.buf);
+    close(r.fd);
+    printf("Loaded %ju entries from metadata snapshot %s\n", entry_count, meta_snapshot_file.c_str());
+    return true;
+fail:
+    printf("Metadata snapshot %s is invalid: %s, falling back to full metadata scan\n", meta_snapshot_file.c_str(), err);
+    if (loaded)
+        delete loaded;
+    if (r.buf)
+        free(r.buf);
+    close(r.fd);
+    clean_db_shards.clear();
+    return false;
+}
@@ -83,7 +83,9 @@ int blockstore_impl_t::continue_sync(blockstore_op_t *op)
             for (auto & sbw: PRIV(op)->sync_big_writes)
             {
                 left--;
-                auto & dirty_entry = dirty_db.at(sbw);
+                auto dirty_it = dirty_db.find(sbw);
+                assert(dirty_it != dirty_db.end());
+                auto & dirty_entry = dirty_it->second;
                 uint64_t dyn_size = dsk.dirty_dyn_size(dirty_entry.offset, dirty_entry.len);
                 if (!space_check.check_available(op, 1, sizeof(journal_entry_big_write) + dyn_size, 0))
                 {
@@ -103,7 +105,9 @@ int blockstore_impl_t::continue_sync(blockstore_op_t *op)
         int s = 0;
         while (it != PRIV(op)->sync_big_writes.end())
         {
-            auto & dirty_entry = dirty_db.at(*it);
+            auto dirty_it = dirty_db.find(*it);
+            assert(dirty_it != dirty_db.end());
+            auto & dirty_entry = dirty_it->second;
             uint64_t dyn_size = dsk.dirty_dyn_size(dirty_entry.offset, dirty_entry.len);
             if (!journal.entry_fits(sizeof(journal_entry_big_write) + dyn_size) &&
                 journal.sector_info[journal.cur_sector].dirty)
@@ -150,6 +154,7 @@ int blockstore_impl_t::continue_sync(blockstore_op_t *op)
         {
             BS_SUBMIT_GET_SQE(sqe, data);
             io_uring_prep_fsync(sqe, dsk.journal_fd, IORING_FSYNC_DATASYNC);
+            journal.fsyncs++;
             data->iov = { 0 };
             data->callback = [this, op](ring_data_t *data) { handle_write_event(data, op); };
             PRIV(op)->min_flushed_journal_sector = PRIV(op)->max_flushed_journal_sector = 0;
@@ -29,7 +29,9 @@ bool blockstore_impl_t::enqueue_write(blockstore_op_t *op)
             .oid = op->oid,
             .version = UINT64_MAX,
         });
-        dirty_it--; // segfaults when dirty_db is empty
+        // B-tree iterators can't be decremented from begin(), unlike std::map ones
+        if (dirty_it != dirty_db.begin())
+            dirty_it--;
         if (dirty_it != dirty_db.end() && dirty_it->first.oid == op->oid)
         {
             found = true;
@@ -158,8 +160,6 @@ bool blockstore_impl_t::enqueue_write(blockstore_op_t *op)
     else
     {
         state = (op->len == dsk.data_block_size || deleted ? BS_ST_BIG_WRITE : BS_ST_SMALL_WRITE);
-        if (state == BS_ST_SMALL_WRITE && throttle_small_writes)
-            clock_gettime(CLOCK_REALTIME, &PRIV(op)->tv_begin);
         if (wait_del)
             state |= BS_ST_WAIT_DEL;
         else if (state == BS_ST_SMALL_WRITE && wait_big)
@@ -180,14 +180,14 @@ bool blockstore_impl_t::enqueue_write(blockstore_op_t *op)
         uint32_t end = (op->offset+op->len-1) / dsk.csum_block_size;
         auto fn = state & BS_ST_BIG_WRITE ? crc32c_pad : crc32c_nopad;
         if (start == end)
-            data_csums[0] = fn(0, op->buf, op->len, op->offset - start*dsk.csum_block_size, end*dsk.csum_block_size - (op->offset+op->len));
+            data_csums[0] = fn(0, op->buf, op->len, op->offset - start*dsk.csum_block_size, (end+1)*dsk.csum_block_size - (op->offset+op->len));
         else
         {
             // First block
             data_csums[0] = fn(0, op->buf, dsk.csum_block_size*(start+1)-op->offset, op->offset - start*dsk.csum_block_size, 0);
             // Intermediate blocks
-            for (uint32_t i = start+1; i < end; i++)
-                data_csums[i-start] = crc32c(0, (uint8_t*)op->buf + dsk.csum_block_size*i-op->offset, dsk.csum_block_size);
+            if (end > start+1)
+                crc32c_blocks(data_csums+1, (uint8_t*)op->buf + dsk.csum_block_size*(start+1)-op->offset, dsk.csum_block_size, end-start-1);
             // Last block
             data_csums[end-start] = fn(
                 0, (uint8_t*)op->buf + end*dsk.csum_block_size - op->offset,
@@ -196,7 +196,7 @@ bool blockstore_impl_t::enqueue_write(blockstore_op_t *op)
             );
         }
     }
-    dirty_db.emplace((obj_ver_id){
+    dirty_db.insert(std::make_pair((obj_ver_id){
         .oid = op->oid,
         .version = op->version,
     }, (dirty_entry){
@@ -207,16 +207,142 @@ bool blockstore_impl_t::enqueue_write(blockstore_op_t *op)
         .len = is_del ? 0 : op->len,
         .journal_sector = 0,
         .dyn_data = dyn,
+    }));
+    return true;
+}
+
+// Try to merge a small WRITE_STABLE into the previous write of the same object if it's still
+// waiting in the submit queue and their ranges overlap or touch. The queued write then covers
+// both ranges with the new version, the older version never reaches the journal, and <op>
+// completes together with it. Not done across SYNC, STABLE and ROLLBACK, not done if any other
+// operation on the same object is queued after the previous write, and not done with data
+// checksums because they would have to be recalculated for the combined range.
+bool blockstore_impl_t::combine_write(blockstore_op_t *op)
+{
+    if (dsk.csum_block_size || op->len == 0 || op->len >= dsk.data_block_size || !dirty_db.size())
+    {
+        return false;
+    }
+    auto dirty_it = dirty_db.upper_bound((obj_ver_id){
+        .oid = op->oid,
+        .version = UINT64_MAX,
     });
+    if (dirty_it == dirty_db.begin())
+    {
+        return false;
+    }
+    dirty_it--;
+    if (dirty_it->first.oid != op->oid ||
+        dirty_it->second.state != (BS_ST_SMALL_WRITE | BS_ST_IN_FLIGHT | BS_ST_INSTANT) ||
+        op->version != 0 && op->version <= dirty_it->first.version)
+    {
+        return false;
+    }
+    uint32_t start = dirty_it->second.offset < op->offset ? dirty_it->second.offset : op->offset;
+    uint32_t end = dirty_it->second.offset+dirty_it->second.len > op->offset+op->len
+        ? dirty_it->second.offset+dirty_it->second.len : op->offset+op->len;
+    if (op->offset > dirty_it->second.offset+dirty_it->second.len ||
+        dirty_it->second.offset > op->offset+op->len ||
+        end-start > write_combine_size || end-start >= dsk.data_block_size)
+    {
+        return false;
+    }
+    // Find the previous write in the submit queue
+    blockstore_op_t *prev_op = NULL;
+    for (int i = submit_queue.size()-1; i >= 0 && !prev_op; i--)
+    {
+        auto other_op = submit_queue[i];
+        if (!other_op)
+            continue;
+        if (other_op->opcode == BS_OP_SYNC || other_op->opcode == BS_OP_STABLE || other_op->opcode == BS_OP_ROLLBACK)
+            return false;
+        if (other_op->opcode == BS_OP_LIST || other_op->oid != op->oid)
+            continue;
+        if (other_op->opcode != BS_OP_WRITE_STABLE || other_op->version != dirty_it->first.version ||
+            PRIV(other_op)->op_state || PRIV(other_op)->real_version)
+            return false;
+        prev_op = other_op;
+    }
+    if (!prev_op)
+    {
+        return false;
+    }
+    uint8_t *buf = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, end-start);
+    memcpy(buf + prev_op->offset-start, prev_op->buf, prev_op->len);
+    memcpy(buf + op->offset-start, op->buf, op->len);
+    auto cw_it = combined_writes.find(prev_op);
+    if (cw_it == combined_writes.end())
+    {
+        cw_it = combined_writes.emplace(prev_op, (combined_write_t){
+            .buf = prev_op->buf,
+            .offset = prev_op->offset,
+            .len = prev_op->len,
+            .version = prev_op->version,
+        }).first;
+    }
+    else
+    {
+        free(prev_op->buf);
+    }
+    cw_it->second.ops.push_back(op);
+    if (op->version == 0)
+    {
+        op->version = dirty_it->first.version+1;
+    }
+#ifdef BLOCKSTORE_DEBUG
+    printf("Combine write %jx:%jx v%ju offset=%u len=%u into v%ju\n", op->oid.inode, op->oid.stripe,
+        op->version, op->offset, op->len, dirty_it->first.version);
+#endif
+    prev_op->buf = buf;
+    prev_op->offset = start;
+    prev_op->len = end-start;
+    prev_op->version = op->version;
+    // Move the dirty entry to the new version
+    dirty_entry e = dirty_it->second;
+    e.offset = start;
+    e.len = end-start;
+    if (op->bitmap)
+    {
+        memcpy((alloc_dyn_data ? (uint8_t*)e.dyn_data+sizeof(int) : (uint8_t*)&e.dyn_data), op->bitmap, dsk.clean_entry_bitmap_size);
+    }
+    dirty_db.erase(dirty_it);
+    dirty_db.insert(std::make_pair((obj_ver_id){
+        .oid = op->oid,
+        .version = op->version,
+    }, e));
+    write_combine_ops++;
+    write_combine_bytes += op->len;
     return true;
 }
 
+// Restore the original parameters of a write which absorbed other writes and complete them
+void blockstore_impl_t::finish_combined_writes(blockstore_op_t *op, int retval)
+{
+    auto cw_it = combined_writes.find(op);
+    if (cw_it == combined_writes.end())
+    {
+        return;
+    }
+    free(op->buf);
+    op->buf = cw_it->second.buf;
+    op->offset = cw_it->second.offset;
+    op->len = cw_it->second.len;
+    op->version = cw_it->second.version;
+    auto ops = std::move(cw_it->second.ops);
+    combined_writes.erase(cw_it);
+    for (auto other_op: ops)
+    {
+        other_op->retval = retval < 0 ? retval : other_op->len;
+        FINISH_OP(other_op);
+    }
+}
+
 void blockstore_impl_t::cancel_all_writes(blockstore_op_t *op, blockstore_dirty_db_t::iterator dirty_it, int retval)
 {
     while (dirty_it != dirty_db.end() && dirty_it->first.oid == op->oid)
     {
         free_dirty_dyn_data(dirty_it->second);
-        dirty_db.erase(dirty_it++);
+        dirty_it = dirty_db.erase(dirty_it);
     }
     bool found = false;
     for (auto other_op: submit_queue)
@@ -242,6 +368,46 @@ void blockstore_impl_t::cancel_all_writes(blockstore_op_t *op, blockstore_dirty_
     FINISH_OP(op);
 }
 
+// Try to place the block right after the previous block of the same inode,
+// so that sequential writes stay sequential on the disk (this matters for HDDs)
+uint64_t blockstore_impl_t::get_alloc_hint(object_id oid)
+{
+    if (oid.stripe < dsk.data_block_size)
+    {
+        return 0;
+    }
+    object_id prev_oid = { .inode = oid.inode, .stripe = oid.stripe - dsk.data_block_size };
+    // The previous block may be just written and not flushed yet
+    auto dirty_it = dirty_db.upper_bound((obj_ver_id){ .oid = prev_oid, .version = UINT64_MAX });
+    if (dirty_it != dirty_db.begin())
+    {
+        dirty_it--;
+        if (dirty_it->first.oid == prev_oid && IS_BIG_WRITE(dirty_it->second.state) &&
+            (dirty_it->second.state & BS_ST_WORKFLOW_MASK) >= BS_ST_SUBMITTED)
+        {
+            return (dirty_it->second.location >> dsk.block_order) + 1;
+        }
+    }
+    // Don't use clean_db_shard() here because it creates missing shards
+    uint64_t pg_num = 0;
+    uint64_t pool_id = (prev_oid.inode >> (64-POOL_ID_BITS));
+    auto sh_it = clean_db_settings.find(pool_id);
+    if (sh_it != clean_db_settings.end())
+    {
+        pg_num = (prev_oid.stripe / sh_it->second.pg_stripe_size) % sh_it->second.pg_count + 1;
+    }
+    auto shard_it = clean_db_shards.find((pool_id << (64-POOL_ID_BITS)) | pg_num);
+    if (shard_it != clean_db_shards.end())
+    {
+        auto clean_it = shard_it->second.find(prev_oid);
+        if (clean_it != shard_it->second.end())
+        {
+            return (clean_it->second.location >> dsk.block_order) + 1;
+        }
+    }
+    return 0;
+}
+
 // First step of the write algorithm: dequeue operation and submit initial write(s)
 int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
 {
@@ -264,6 +430,7 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
         if (PRIV(op)->real_version == UINT64_MAX)
         {
             // This is the flag value used to cancel operations
+            finish_combined_writes(op, op->retval);
             FINISH_OP(op);
             return 2;
         }
@@ -289,10 +456,10 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
         PRIV(op)->real_version = 0;
         dirty_entry e = dirty_it->second;
         dirty_db.erase(dirty_it);
-        dirty_it = dirty_db.emplace((obj_ver_id){
+        dirty_it = dirty_db.insert(std::make_pair((obj_ver_id){
             .oid = op->oid,
             .version = op->version,
-        }, e).first;
+        }, e)).first;
     }
     if (write_iodepth >= max_write_iodepth)
     {
@@ -308,7 +475,7 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
             return 0;
         }
         // Big (redirect) write
-        uint64_t loc = data_alloc->find_free();
+        uint64_t loc = data_alloc->find_free(get_alloc_hint(op->oid));
         if (loc == UINT64_MAX)
         {
             // no space
@@ -408,10 +575,12 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
         );
         write_iodepth++;
         // Got SQEs. Prepare previous journal sector write if required
-        if (immediate_commit == IMMEDIATE_NONE &&
-            !journal.entry_fits(sizeof(journal_entry_small_write) + dyn_size))
+        if (!journal.entry_fits(sizeof(journal_entry_small_write) + dyn_size))
         {
-            prepare_journal_sector_write(journal.cur_sector, op);
+            if (immediate_commit == IMMEDIATE_NONE)
+                prepare_journal_sector_write(journal.cur_sector, op);
+            else
+                write_journal_batch();
         }
         // Then pre-fill journal entry
         journal_entry_small_write *je = (journal_entry_small_write*)prefill_single_journal_entry(
@@ -471,7 +640,7 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
         journal.crc32_last = je->crc32;
         if (immediate_commit != IMMEDIATE_NONE)
         {
-            prepare_journal_sector_write(journal.cur_sector, op);
+            add_to_journal_batch(op);
         }
         if (op->len > 0)
         {
@@ -481,6 +650,11 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
                 // Copy data
                 memcpy((uint8_t*)journal.buffer + journal.next_free, op->buf, op->len);
             }
+            else
+            {
+                // Keep a copy for reads of recently written data
+                journal_cache.put(journal.next_free, op->buf, op->len);
+            }
             BS_SUBMIT_GET_SQE(sqe2, data2);
             data2->iov = (struct iovec){ op->buf, op->len };
             ++journal.submit_id;
@@ -556,6 +730,10 @@ resume_2:
             return 0;
         }
         BS_SUBMIT_CHECK_SQES(1);
+        if (!journal.entry_fits(sizeof(journal_entry_big_write) + dyn_size))
+        {
+            write_journal_batch();
+        }
         journal_entry_big_write *je = (journal_entry_big_write*)prefill_single_journal_entry(
             journal, op->opcode == BS_OP_WRITE_STABLE ? JE_BIG_WRITE_INSTANT : JE_BIG_WRITE,
             sizeof(journal_entry_big_write) + dyn_size
@@ -590,7 +768,7 @@ resume_2:
             ? (uint8_t*)dirty_it->second.dyn_data+sizeof(int) : (uint8_t*)&dirty_it->second.dyn_data), dyn_size);
         je->crc32 = je_crc32((journal_entry*)je);
         journal.crc32_last = je->crc32;
-        prepare_journal_sector_write(journal.cur_sector, op);
+        add_to_journal_batch(op);
         PRIV(op)->op_state = 3;
         return 1;
     }
@@ -661,11 +839,7 @@ resume_4:
         if (!is_big && throttle_small_writes)
         {
             // Apply throttling
-            timespec tv_end;
-            clock_gettime(CLOCK_REALTIME, &tv_end);
-            uint64_t exec_us =
-                (tv_end.tv_sec - PRIV(op)->tv_begin.tv_sec)*1000000 +
-                (tv_end.tv_nsec - PRIV(op)->tv_begin.tv_nsec)/1000;
+            uint64_t exec_us = bs_now_us() - PRIV(op)->exec_start_us;
             // Compare with target execution time
             // 100% free -> target time = 0
             // 0% free -> target time = iodepth/parallelism * (iops + size/bw) / write per second
@@ -694,6 +868,7 @@ resume_4:
     }
 resume_6:
     // Acknowledge write
+    finish_combined_writes(op, 0);
     op->retval = op->len;
     write_iodepth--;
     FINISH_OP(op);
@@ -782,11 +957,13 @@ int blockstore_impl_t::dequeue_del(blockstore_op_t *op)
     }
     write_iodepth++;
     // Prepare journal sector write
-    if (immediate_commit == IMMEDIATE_NONE &&
-        (dsk.journal_block_size - journal.in_sector_pos) < sizeof(journal_entry_del) &&
+    if ((dsk.journal_block_size - journal.in_sector_pos) < sizeof(journal_entry_del) &&
         journal.sector_info[journal.cur_sector].dirty)
     {
-        prepare_journal_sector_write(journal.cur_sector, op);
+        if (immediate_commit == IMMEDIATE_NONE)
+            prepare_journal_sector_write(journal.cur_sector, op);
+        else
+            write_journal_batch();
     }
     // Pre-fill journal entry
     journal_entry_del *je = (journal_entry_del*)prefill_single_journal_entry(
@@ -808,7 +985,7 @@ int blockstore_impl_t::dequeue_del(blockstore_op_t *op)
     dirty_it->second.state = BS_ST_DELETE | BS_ST_SUBMITTED;
     if (immediate_commit != IMMEDIATE_NONE)
     {
-        prepare_journal_sector_write(journal.cur_sector, op);
+        add_to_journal_batch(op);
     }
     if (!PRIV(op)->pending_ops)
     {
@@ -23,6 +23,14 @@
 //
 // fio -thread -ioengine=./libfio_blockstore.so -name=test -bs=4k -direct=1 -iodepth=32 -rw=randread \
 //     -bs_config='{"data_device":"./test_data.bin"}' -size=1000M
+//
+// Trims delete whole objects, so -rw=randtrim -bs=128k runs a delete storm.
+//
+// -bs_stats=stats.json dumps blockstore counters (dirty_db size, flusher activity,
+// journal usage, WAIT_* counts and so on) as JSON at the end of the run.
+// tests/bench_blockstore.sh runs a standard set of such benchmarks.
+
+#include <stdio.h>
 
 #include "blockstore.h"
 #include "epoll_manager.h"
@@ -46,6 +54,7 @@ struct bs_options
     int __pad;
     char *json_config = NULL;
     int trace = 0;
+    char *stats_file = NULL;
 };
 
 static struct fio_option options[] = {
@@ -68,6 +77,15 @@ static struct fio_option options[] = {
         .category = FIO_OPT_C_ENGINE,
         .group  = FIO_OPT_G_FILENAME,
     },
+    {
+        .name   = "bs_stats",
+        .lname  = "Blockstore statistics file",
+        .type   = FIO_OPT_STR_STORE,
+        .off1   = offsetof(struct bs_options, stats_file),
+        .help   = "Dump blockstore counters as JSON to this file at the end of the run",
+        .category = FIO_OPT_C_ENGINE,
+        .group  = FIO_OPT_G_FILENAME,
+    },
     {
         .name = NULL,
     },
@@ -103,11 +121,37 @@ static int bs_setup(struct thread_data *td)
     return 0;
 }
 
+static void bs_dump_stats(bs_data *bsd, const char *stats_file)
+{
+    json11::Json::object counters;
+    for (auto & cp: bsd->bs->get_counters())
+        counters[cp.first] = cp.second;
+    std::string json = json11::Json(json11::Json::object {
+        { "block_size", (uint64_t)bsd->bs->get_block_size() },
+        { "block_count", bsd->bs->get_block_count() },
+        { "free_blocks", bsd->bs->get_free_block_count() },
+        { "journal_size", bsd->bs->get_journal_size() },
+        { "ops", bsd->op_n },
+        { "counters", counters },
+    }).dump()+"\n";
+    FILE *fp = fopen(stats_file, "w");
+    if (!fp || fwrite(json.data(), json.size(), 1, fp) != 1)
+        log_err("fio: failed to write blockstore statistics to %s: %s\n", stats_file, strerror(errno));
+    if (fp)
+        fclose(fp);
+}
+
 static void bs_cleanup(struct thread_data *td)
 {
+    bs_options *o = (bs_options*)td->eo;
     bs_data *bsd = (bs_data*)td->io_ops_data;
     if (bsd)
     {
+        if (o->stats_file && bsd->bs)
+        {
+            // Dump the state at the end of the run, before the final sync
+            bs_dump_stats(bsd, o->stats_file);
+        }
         while (1)
         {
             do
@@ -224,6 +268,25 @@ static enum fio_q_status bs_queue(struct thread_data *td, struct io_u *io)
         };
         bsd->last_sync = false;
         break;
+    case DDIR_TRIM:
+        op->opcode = BS_OP_DELETE;
+        op->oid = {
+            .inode = 1,
+            .stripe = io->offset / bsd->bs->get_block_size(),
+        };
+        op->version = 0; // assign automatically
+        op->callback = [io, n = bsd->op_n](blockstore_op_t *op)
+        {
+            io->error = op->retval < 0 ? -op->retval : 0;
+            bs_data *bsd = (bs_data*)io->engine_data;
+            bsd->inflight--;
+            bsd->completed.push_back(io);
+            if (bsd->trace)
+                printf("--- OP_DELETE %zx n=%d retval=%d\n", (size_t)op, n, op->retval);
+            delete op;
+        };
+        bsd->last_sync = false;
+        break;
     case DDIR_SYNC:
         op->opcode = BS_OP_SYNC;
         op->callback = [io, n = bsd->op_n](blockstore_op_t *op)
@@ -245,7 +308,8 @@ static enum fio_q_status bs_queue(struct thread_data *td, struct io_u *io)
     }
 
     if (bsd->trace)
-        printf("+++ %s %zx n=%d\n", op->opcode == BS_OP_READ ? "OP_READ" : (op->opcode == BS_OP_WRITE_STABLE ? "OP_WRITE" : "OP_SYNC"), (size_t)op, bsd->op_n);
+        printf("+++ %s %zx n=%d\n", op->opcode == BS_OP_READ ? "OP_READ" : (op->opcode == BS_OP_WRITE_STABLE ? "OP_WRITE"
+            : (op->opcode == BS_OP_DELETE ? "OP_DELETE" : "OP_SYNC")), (size_t)op, bsd->op_n);
     io->error = 0;
     bsd->inflight++;
     bsd->bs->enqueue_op(op);
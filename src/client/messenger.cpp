@@ -11,6 +11,7 @@
 
 #include "addr_util.h"
 #include "messenger.h"
+#include "msgr_reactor.h"
 #ifdef WITH_RDMA
 #include "msgr_rdma.h"
 #endif
@@ -188,9 +189,11 @@ void osd_messenger_t::init()
             auto cl = cl_it->second;
             cl_it++;
             auto peer_fd = cl->peer_fd;
-            if (!cl->osd_num && !cl->in_osd_num || cl->peer_state != PEER_CONNECTED && cl->peer_state != PEER_RDMA)
+            if (!cl->osd_num && !cl->in_osd_num || cl->peer_state != PEER_CONNECTED && cl->peer_state != PEER_RDMA ||
+                cl->reactor >= 0)
             {
-                // Do not run keepalive on regular clients
+                // Do not run keepalive on regular clients. Connections handled by reactors
+                // are checked by the reactor, it stops the connection if the ping fails
                 continue;
             }
             if (cl->ping_time_remaining > 0)
@@ -265,6 +268,11 @@ osd_messenger_t::~osd_messenger_t()
     {
         stop_client(clients.begin()->first, true, true);
     }
+    if (reactors)
+    {
+        delete reactors;
+        reactors = NULL;
+    }
     if (iothreads.size())
     {
         for (auto iot: iothreads)
@@ -273,6 +281,7 @@ osd_messenger_t::~osd_messenger_t()
         }
         iothreads.clear();
     }
+    free_multishot_recv();
 #ifdef WITH_RDMA
     for (auto rdma_context: rdma_contexts)
     {
@@ -327,11 +336,30 @@ void osd_messenger_t::parse_config(const json11::Json & config)
         this->iothread_count = (uint32_t)config["client_iothread_count"].uint64_value();
     else
         this->iothread_count = (uint32_t)config["osd_iothread_count"].uint64_value();
+    if (osd_num && !reactors)
+    {
+        // Reactors are only started once
+        this->reactor_count = (uint32_t)config["osd_reactor_count"].uint64_value();
+        this->reactor_config = config;
+    }
     this->receive_buffer_size = (uint32_t)config["tcp_header_buffer_size"].uint64_value();
     if (!this->receive_buffer_size || this->receive_buffer_size > 1024*1024*1024)
         this->receive_buffer_size = 65536;
     this->use_sync_send_recv = config["use_sync_send_recv"].bool_value() ||
         config["use_sync_send_recv"].uint64_value();
+    this->use_multishot_recv = config["use_multishot_recv"].bool_value() ||
+        config["use_multishot_recv"].uint64_value();
+    this->multishot_recv_buffers = config["multishot_recv_buffers"].uint64_value();
+    if (!this->multishot_recv_buffers)
+        this->multishot_recv_buffers = DEFAULT_MULTISHOT_RECV_BUFFERS;
+    else if (this->multishot_recv_buffers > 32768)
+        this->multishot_recv_buffers = 32768;
+    // Buffer ring size must be a power of 2
+    while (this->multishot_recv_buffers & (this->multishot_recv_buffers-1))
+        this->multishot_recv_buffers += this->multishot_recv_buffers & -this->multishot_recv_buffers;
+    this->op_batch_size = config["op_batch_size"].uint64_value();
+    if (this->op_batch_size > OSD_BATCH_MAX_OPS)
+        this->op_batch_size = OSD_BATCH_MAX_OPS;
     this->min_zerocopy_send_size = config["min_zerocopy_send_size"].is_null()
         ? DEFAULT_MIN_ZEROCOPY_SEND_SIZE
         : (int)config["min_zerocopy_send_size"].int64_value();
@@ -502,7 +530,8 @@ void osd_messenger_t::try_connect_peer_tcp(osd_num_t peer_osd, const char *peer_
     clients[peer_fd]->peer_state = PEER_CONNECTING;
     clients[peer_fd]->connect_timeout_id = -1;
     clients[peer_fd]->osd_num = peer_osd;
-    clients[peer_fd]->in_buf = malloc_or_die(receive_buffer_size);
+    if (!recv_buf_ring)
+        clients[peer_fd]->in_buf = malloc_or_die(receive_buffer_size);
     tfd->set_fd_handler(peer_fd, true, [this](int peer_fd, int epoll_events)
     {
         // Either OUT (connected) or HUP
@@ -568,6 +597,11 @@ void osd_messenger_t::handle_peer_epoll(int peer_fd, int epoll_events)
     {
         // Mark client as ready (i.e. some data is available)
         auto cl = clients[peer_fd];
+        if (cl->recv_data)
+        {
+            // Data is received by the armed multishot request
+            return;
+        }
         cl->read_ready++;
         if (cl->read_ready == 1)
         {
@@ -638,7 +672,7 @@ void osd_messenger_t::check_peer_config(osd_client_t *cl)
         // Inform that we're OSD <osd_num>
         payload["osd_num"] = osd_num;
     }
-    payload["features"] = json11::Json::object{ { "check_sequencing", true } };
+    payload["features"] = json11::Json::object{ { "check_sequencing", true }, { "op_batching", true } };
 #ifdef WITH_RDMA
     if (!use_rdmacm && rdma_contexts.size())
     {
@@ -713,6 +747,7 @@ void osd_messenger_t::check_peer_config(osd_client_t *cl)
             delete op;
             return;
         }
+        cl->accepts_batches = config["features"]["op_batching"].bool_value();
 #ifdef WITH_RDMA
         if (!use_rdmacm && cl->rdma_conn && config["rdma_address"].is_string())
         {
@@ -773,20 +808,7 @@ void osd_messenger_t::accept_connections(int listen_fd)
         fcntl(peer_fd, F_SETFL, fcntl(peer_fd, F_GETFL, 0) | O_NONBLOCK);
         int one = 1;
         setsockopt(peer_fd, SOL_TCP, TCP_NODELAY, &one, sizeof(one));
-        auto cl = new osd_client_t();
-        clients[peer_fd] = cl;
-        cl->is_incoming = true;
-        cl->peer_addr = addr;
-        cl->peer_addr = addr;
-        cl->peer_port = ntohs(((sockaddr_in*)&addr)->sin_port);
-        cl->peer_fd = peer_fd;
-        cl->peer_state = PEER_CONNECTED;
-        cl->in_buf = malloc_or_die(receive_buffer_size);
-        // Add FD to epoll
-        tfd->set_fd_handler(peer_fd, false, [this](int peer_fd, int epoll_events)
-        {
-            handle_peer_epoll(peer_fd, epoll_events);
-        });
+        add_incoming_client(peer_fd, addr);
         // Try to accept next connection
         peer_addr_size = sizeof(addr);
     }
@@ -796,6 +818,41 @@ void osd_messenger_t::accept_connections(int listen_fd)
     }
 }
 
+void osd_messenger_t::add_incoming_client(int peer_fd, const sockaddr_storage & addr)
+{
+    auto cl = new osd_client_t();
+    clients[peer_fd] = cl;
+    cl->is_incoming = true;
+    cl->peer_addr = addr;
+    cl->peer_port = ntohs(((sockaddr_in*)&addr)->sin_port);
+    cl->peer_fd = peer_fd;
+    cl->peer_state = PEER_CONNECTED;
+    if (!reactors && reactor_count > 0 && ringloop)
+    {
+        // Reactors are started on the first connection, because OSDs only
+        // accept connections after loading the global configuration from etcd
+        reactors = new msgr_reactor_pool_t(this, reactor_count, reactor_config);
+        fprintf(
+            stderr, "[OSD %ju] Started %u experimental reactor threads, operations are still executed by the main thread\n",
+            osd_num, reactor_count
+        );
+    }
+    if (reactors)
+    {
+        // The socket is handled by a reactor thread, and the client is only a proxy
+        cl->reactor = reactors->add_client(peer_fd);
+        cl->keep_fd = true;
+        return;
+    }
+    if (!recv_buf_ring)
+        cl->in_buf = malloc_or_die(receive_buffer_size);
+    // Add FD to epoll
+    tfd->set_fd_handler(peer_fd, false, [this](int peer_fd, int epoll_events)
+    {
+        handle_peer_epoll(peer_fd, epoll_events);
+    });
+}
+
 #ifdef WITH_RDMA
 msgr_rdma_context_t* osd_messenger_t::choose_rdma_context(osd_client_t *cl)
 {
@@ -17,11 +17,14 @@
 #include "msgr_op.h"
 #include "timerfd_manager.h"
 #include "addr_util.h"
+#include "op_slot_table.h"
 #include <ringloop.h>
 
 #define CL_READ_HDR 1
 #define CL_READ_DATA 2
 #define CL_READ_REPLY_DATA 3
+#define CL_READ_BATCH_ID 4
+#define CL_READ_BATCH_HDR 5
 #define CL_WRITE_READY 1
 
 #define PEER_CONNECTING 1
@@ -34,6 +37,8 @@
 
 #define DEFAULT_MIN_ZEROCOPY_SEND_SIZE 32*1024
 
+#define DEFAULT_MULTISHOT_RECV_BUFFERS 256
+
 #define MSGR_SENDP_HDR 1
 #define MSGR_SENDP_FREE 2
 
@@ -48,6 +53,10 @@ struct msgr_rdma_connection_t;
 struct msgr_rdma_context_t;
 #endif
 
+struct ring_data_t;
+struct io_uring_buf_ring;
+class msgr_reactor_pool_t;
+
 struct osd_client_t
 {
     int refs = 0;
@@ -62,6 +71,10 @@ struct osd_client_t
     osd_num_t osd_num = 0;
     osd_num_t in_osd_num = 0;
     bool is_incoming = false;
+    // Number of the reactor thread which handles the socket, -1 if it's handled by this messenger
+    int reactor = -1;
+    // The socket is closed by its owner, not when the client is destroyed
+    bool keep_fd = false;
 
     void *in_buf = NULL;
 
@@ -71,6 +84,10 @@ struct osd_client_t
 
     // Read state
     int read_ready = 0;
+    // Multishot receive request, non-NULL while it's armed
+    ring_data_t *recv_data = NULL;
+    // Multishot receive request is being canceled to receive a large payload directly
+    bool recv_direct = false;
     osd_op_t *read_op = NULL;
     iovec read_iov = { 0 };
     msghdr read_msg = { 0 };
@@ -80,12 +97,17 @@ struct osd_client_t
     uint64_t read_op_id = 1;
     bool check_sequencing = false;
     bool enable_pg_locks = false;
+    // Number of items left in the batch being received, and whether they're replies
+    uint32_t read_batch_left = 0;
+    bool read_batch_reply = false;
+    // Peer supports receiving batches of operations and replies
+    bool accepts_batches = false;
 
     // Incoming operations
     std::vector<osd_op_t*> received_ops;
 
     // Outbound operations
-    std::map<uint64_t, osd_op_t*> sent_ops;
+    op_slot_table_t<osd_op_t> sent_ops;
     uint64_t send_op_id = 0;
 
     // PGs dirtied by this client's primary-writes
@@ -96,6 +118,10 @@ struct osd_client_t
     int write_state = 0;
     std::vector<iovec> send_list, next_send_list;
     std::vector<msgr_sendp_t> outbox, next_outbox;
+    // Header of the batch being filled in next_send_list, or the position of the header
+    // of the last operation in next_send_list which may become the first item of a batch
+    osd_op_t *send_batch = NULL;
+    int send_batch_pos = -1;
     std::vector<osd_op_t*> zc_free_list;
 
     ~osd_client_t();
@@ -188,6 +214,25 @@ protected:
     bool use_sync_send_recv = false;
     int min_zerocopy_send_size = DEFAULT_MIN_ZEROCOPY_SEND_SIZE;
     int iothread_count = 0;
+    bool use_multishot_recv = false;
+    bool multishot_recv_checked = false;
+    uint32_t multishot_recv_buffers = 0;
+    uint32_t op_batch_size = 0;
+
+    // Provided buffer ring shared by multishot receive requests of all clients.
+    // Its size is fixed when it's set up and isn't changed by configuration reloads
+    io_uring_buf_ring *recv_buf_ring = NULL;
+    uint8_t *recv_buffers = NULL;
+    uint32_t recv_buf_count = 0, recv_buf_size = 0;
+    int recv_buf_group = -1;
+    // Canceled multishot requests of stopped clients which didn't complete yet
+    std::set<ring_data_t*> recv_canceled;
+    // Canceled requests which didn't get an SQE for the cancel request, retried in read_requests()
+    std::vector<ring_data_t*> recv_cancel_queue;
+
+    int reactor_count = 0;
+    json11::Json reactor_config;
+    msgr_reactor_pool_t *reactors = NULL;
 
 #ifdef WITH_RDMA
     bool use_rdma = true;
@@ -239,9 +284,11 @@ public:
     std::function<void(osd_num_t)> repeer_pgs;
     std::function<void(osd_num_t)> break_pg_locks;
     std::function<bool(osd_client_t*, json11::Json)> check_config_hook;
+    std::function<void(int)> client_stopped_hook;
     void read_requests();
     void send_replies();
     void accept_connections(int listen_fd);
+    void add_incoming_client(int peer_fd, const sockaddr_storage & addr);
     ~osd_messenger_t();
 
     static json11::Json::object read_config(const json11::Json & config);
@@ -274,11 +321,25 @@ protected:
     void cancel_op(osd_op_t *op);
 
     bool try_send(osd_client_t *cl);
+    uint32_t batch_hdr_size(osd_op_t *cur_op);
+    void push_batched_hdr(osd_client_t *cl, osd_op_t *cur_op);
     void handle_send(int result, bool prev, bool more, osd_client_t *cl);
 
     bool handle_read(int result, osd_client_t *cl);
+    void init_multishot_recv();
+    void free_multishot_recv();
+    bool arm_multishot_recv(osd_client_t *cl);
+    void cancel_multishot_recv(osd_client_t *cl);
+    bool submit_recv_cancel(ring_data_t *data);
+    void submit_recv_cancel_queue();
+    void handle_multishot_recv(ring_data_t *data, osd_client_t *cl);
+    void recycle_recv_buffer(ring_data_t *data);
     bool handle_read_buffer(osd_client_t *cl, void *curbuf, int remain);
     bool handle_finished_read(osd_client_t *cl);
+    void expect_header(osd_client_t *cl);
+    bool handle_hdr(osd_client_t *cl);
+    bool handle_batch_hdr(osd_client_t *cl);
+    bool handle_batch_item_id(osd_client_t *cl);
     void handle_op_hdr(osd_client_t *cl);
     bool handle_reply_hdr(osd_client_t *cl);
     void handle_reply_ready(osd_op_t *op);
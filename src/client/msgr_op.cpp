@@ -11,17 +11,17 @@ osd_op_t::~osd_op_t()
     assert(!op_data);
     if (bitmap_buf)
     {
-        free(bitmap_buf);
+        pool_free(bitmap_buf);
     }
     if (rmw_buf)
     {
-        free(rmw_buf);
+        pool_free(rmw_buf);
     }
     if (buf)
     {
         // Note: reusing osd_op_t WILL currently lead to memory leaks
         // So we don't reuse it, but free it every time
-        free(buf);
+        pool_free(buf);
     }
 }
 
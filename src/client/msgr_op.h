@@ -10,6 +10,8 @@
 #include <stdlib.h>
 
 #include "osd_ops.h"
+#include "mem_pool.h"
+#include "callback.h"
 
 #define OSD_OP_IN 0
 #define OSD_OP_OUT 1
@@ -168,12 +170,18 @@ struct __attribute__((visibility("default"))) osd_op_t
     void *bitmap_buf = NULL;
     void *rmw_buf = NULL;
     osd_primary_op_data_t* op_data = NULL;
-    std::function<void(osd_op_t*)> callback;
+    callback_t<void(osd_op_t*)> callback;
 
     osd_op_buf_list_t iov;
 
     ~osd_op_t();
     void cancel();
 
+    // Operations are allocated from the memory pool
+    static void* operator new(size_t size) { return pool_alloc(size); }
+    static void* operator new[](size_t size) { return pool_alloc(size); }
+    static void operator delete(void *ptr) { pool_free(ptr); }
+    static void operator delete[](void *ptr) { pool_free(ptr); }
+
     bool is_recovery_related();
 };
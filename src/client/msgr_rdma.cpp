@@ -538,6 +538,11 @@ bool osd_messenger_t::connect_rdma(int peer_fd, std::string rdma_address, uint64
             client_max_msg = rdma_max_msg;
         }
         auto cl = clients.at(peer_fd);
+        if (cl->reactor >= 0)
+        {
+            // Connections handled by reactor threads only use TCP
+            return false;
+        }
         msgr_rdma_context_t *selected_ctx = choose_rdma_context(cl);
         if (!selected_ctx)
         {
@@ -0,0 +1,429 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "msgr_reactor.h"
+
+msgr_reactor_t::msgr_reactor_t(msgr_reactor_pool_t *pool, int num, osd_num_t osd_num, const json11::Json & config):
+    inbox(MSGR_REACTOR_QUEUE_SIZE), outbox(MSGR_REACTOR_QUEUE_SIZE)
+{
+    this->pool = pool;
+    this->num = num;
+    stopped = false;
+    inbox_blocked = false;
+    outbox_blocked = false;
+    wakeup_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    if (wakeup_fd < 0)
+    {
+        throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+    }
+    ringloop = new ring_loop_t(RINGLOOP_DEFAULT_SIZE);
+    epmgr = new epoll_manager_t(ringloop);
+    msgr = new osd_messenger_t();
+    msgr->osd_num = osd_num;
+    msgr->tfd = epmgr->tfd;
+    msgr->ringloop = ringloop;
+    msgr->parse_config(config);
+    msgr->exec_op = [this](osd_op_t *op)
+    {
+        post_main((msgr_reactor_msg_t){ .type = MSGR_REACTOR_OP, .peer_fd = op->peer_fd, .op = op });
+    };
+    msgr->client_stopped_hook = [this](int peer_fd)
+    {
+        closed_fds.push_back(peer_fd);
+    };
+    msgr->init();
+    consumer.loop = [this]() { loop(); };
+    ringloop->register_consumer(&consumer);
+    arm_wakeup();
+    thread = std::thread(&msgr_reactor_t::run, this);
+}
+
+msgr_reactor_t::~msgr_reactor_t()
+{
+    stopped = true;
+    wakeup();
+    thread.join();
+    ringloop->unregister_consumer(&consumer);
+    delete msgr;
+    msgr = NULL;
+    // Close sockets of connections stopped by the messenger destructor
+    // and drop operations which weren't picked up by the main thread
+    for (int peer_fd: closed_fds)
+    {
+        close(peer_fd);
+    }
+    closed_fds.clear();
+    msgr_reactor_msg_t msg;
+    while (outbox.pop(msg))
+    {
+        outbox_backlog.push_back(msg);
+    }
+    for (auto & msg: outbox_backlog)
+    {
+        if (msg.type == MSGR_REACTOR_CLOSED)
+            close(msg.peer_fd);
+        else if (msg.type == MSGR_REACTOR_OP)
+            delete msg.op;
+    }
+    outbox_backlog.clear();
+    delete epmgr;
+    delete ringloop;
+    close(wakeup_fd);
+}
+
+void msgr_reactor_t::run()
+{
+    char name[16];
+    snprintf(name, sizeof(name), "msgr_reactor%d", num);
+    pthread_setname_np(pthread_self(), name);
+    while (!stopped)
+    {
+        ringloop->loop();
+        ringloop->wait();
+    }
+}
+
+void msgr_reactor_t::loop()
+{
+    handle_inbox();
+    msgr->read_requests();
+    msgr->send_replies();
+    if (wakeup_pending)
+    {
+        arm_wakeup();
+    }
+    ringloop->submit();
+    // Report stopped connections only after submitting all requests which may still use their FDs,
+    // the main thread closes them and the FD number may be reused right after that
+    for (int peer_fd: closed_fds)
+    {
+        post_main((msgr_reactor_msg_t){ .type = MSGR_REACTOR_CLOSED, .peer_fd = peer_fd });
+    }
+    closed_fds.clear();
+    flush_outbox();
+    if (outbox_notify)
+    {
+        outbox_notify = false;
+        pool->notify();
+    }
+}
+
+void msgr_reactor_t::arm_wakeup()
+{
+    io_uring_sqe *sqe = ringloop->get_sqe();
+    if (!sqe)
+    {
+        // Retry from the consumer after some SQEs are completed
+        wakeup_pending = true;
+        return;
+    }
+    wakeup_pending = false;
+    ring_data_t *data = ((ring_data_t*)sqe->user_data);
+    io_uring_prep_poll_add(sqe, wakeup_fd, POLLIN);
+    data->callback = [this](ring_data_t *data)
+    {
+        if (data->res < 0)
+        {
+            throw std::runtime_error(std::string("eventfd poll failed: ") + strerror(-data->res));
+        }
+        uint64_t ctr = 0;
+        if (read(wakeup_fd, &ctr, 8) < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            throw std::runtime_error(std::string("error reading eventfd: ") + strerror(errno));
+        }
+        arm_wakeup();
+        ringloop->wakeup();
+    };
+    ringloop->submit();
+}
+
+void msgr_reactor_t::wakeup()
+{
+    uint64_t ctr = 1;
+    if (write(wakeup_fd, &ctr, 8) < 0)
+    {
+        throw std::runtime_error(std::string("error writing to eventfd: ") + strerror(errno));
+    }
+}
+
+void msgr_reactor_t::handle_inbox()
+{
+    msgr_reactor_msg_t msg;
+    while (inbox.pop(msg))
+    {
+        if (msg.type == MSGR_REACTOR_NEW_CLIENT)
+        {
+            sockaddr_storage addr = {};
+            socklen_t addr_size = sizeof(addr);
+            getpeername(msg.peer_fd, (sockaddr*)&addr, &addr_size);
+            msgr->add_incoming_client(msg.peer_fd, addr);
+            // The socket is closed by the main thread
+            msgr->clients.at(msg.peer_fd)->keep_fd = true;
+        }
+        else if (msg.type == MSGR_REACTOR_STOP_CLIENT)
+        {
+            // The connection may be already stopped by the reactor itself
+            msgr->stop_client(msg.peer_fd, true);
+        }
+        else if (msg.type == MSGR_REACTOR_REPLY)
+        {
+            auto cl_it = msgr->clients.find(msg.peer_fd);
+            if (cl_it == msgr->clients.end())
+            {
+                delete msg.op;
+                continue;
+            }
+            if (msg.read_op_id)
+            {
+                cl_it->second->check_sequencing = true;
+                cl_it->second->read_op_id = msg.read_op_id;
+            }
+            if (msg.accepts_batches)
+            {
+                cl_it->second->accepts_batches = true;
+            }
+            if (msg.in_osd_num)
+            {
+                // Ping and idle timeouts are checked by the reactor's own keepalive timer
+                cl_it->second->in_osd_num = msg.in_osd_num;
+            }
+            msgr->outbox_push(msg.op);
+        }
+    }
+    if (inbox_blocked.exchange(false))
+    {
+        // Let the main thread push the rest of its messages
+        pool->notify();
+    }
+}
+
+void msgr_reactor_t::post(const msgr_reactor_msg_t & msg)
+{
+    if (inbox_backlog.size() || !inbox.push(msg))
+    {
+        inbox_backlog.push_back(msg);
+    }
+    if (!inbox_notify)
+    {
+        inbox_notify = true;
+        pool->ringloop->wakeup();
+    }
+}
+
+void msgr_reactor_t::post_main(const msgr_reactor_msg_t & msg)
+{
+    if (outbox_backlog.size() || !outbox.push(msg))
+    {
+        outbox_backlog.push_back(msg);
+    }
+    if (!outbox_notify)
+    {
+        outbox_notify = true;
+        ringloop->wakeup();
+    }
+}
+
+void msgr_reactor_t::flush_outbox()
+{
+    size_t i = 0;
+    while (i < outbox_backlog.size() && outbox.push(outbox_backlog[i]))
+    {
+        i++;
+    }
+    if (i < outbox_backlog.size())
+    {
+        // Ask the main thread to wake us up after draining the queue, then retry
+        // once more in case if it has already drained it before seeing the flag
+        outbox_blocked = true;
+        while (i < outbox_backlog.size() && outbox.push(outbox_backlog[i]))
+        {
+            i++;
+        }
+    }
+    if (i > 0)
+    {
+        outbox_backlog.erase(outbox_backlog.begin(), outbox_backlog.begin()+i);
+        outbox_notify = true;
+    }
+}
+
+msgr_reactor_pool_t::msgr_reactor_pool_t(osd_messenger_t *msgr, int count, const json11::Json & config)
+{
+    this->msgr = msgr;
+    this->ringloop = msgr->ringloop;
+    notify_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    if (notify_fd < 0)
+    {
+        throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+    }
+    // Reactors only handle TCP connections themselves
+    json11::Json::object reactor_config = config.object_items();
+    reactor_config.erase("osd_reactor_count");
+    reactor_config.erase("osd_iothread_count");
+    reactor_config["use_rdma"] = false;
+    for (int i = 0; i < count; i++)
+    {
+        reactors.push_back(new msgr_reactor_t(this, i, msgr->osd_num, reactor_config));
+    }
+    consumer.loop = [this]()
+    {
+        flush();
+        if (notify_pending)
+            arm_notify_poll();
+    };
+    ringloop->register_consumer(&consumer);
+    arm_notify_poll();
+}
+
+msgr_reactor_pool_t::~msgr_reactor_pool_t()
+{
+    for (auto r: reactors)
+    {
+        delete r;
+    }
+    reactors.clear();
+    ringloop->unregister_consumer(&consumer);
+    if (notify_data)
+    {
+        notify_data->callback = [](ring_data_t*){};
+    }
+    close(notify_fd);
+}
+
+void msgr_reactor_pool_t::notify()
+{
+    uint64_t ctr = 1;
+    if (write(notify_fd, &ctr, 8) < 0)
+    {
+        throw std::runtime_error(std::string("error writing to eventfd: ") + strerror(errno));
+    }
+}
+
+void msgr_reactor_pool_t::arm_notify_poll()
+{
+    io_uring_sqe *sqe = ringloop->get_sqe();
+    if (!sqe)
+    {
+        notify_pending = true;
+        return;
+    }
+    notify_pending = false;
+    notify_data = ((ring_data_t*)sqe->user_data);
+    io_uring_prep_poll_add(sqe, notify_fd, POLLIN);
+    notify_data->callback = [this](ring_data_t *data)
+    {
+        if (data->res < 0)
+        {
+            throw std::runtime_error(std::string("eventfd poll failed: ") + strerror(-data->res));
+        }
+        notify_data = NULL;
+        arm_notify_poll();
+        handle_messages();
+    };
+    ringloop->submit();
+}
+
+void msgr_reactor_pool_t::handle_messages()
+{
+    uint64_t ctr = 0;
+    if (read(notify_fd, &ctr, 8) < 0 && errno != EAGAIN && errno != EINTR)
+    {
+        throw std::runtime_error(std::string("error reading eventfd: ") + strerror(errno));
+    }
+    for (auto r: reactors)
+    {
+        msgr_reactor_msg_t msg;
+        while (r->outbox.pop(msg))
+        {
+            auto cl_it = msgr->clients.find(msg.peer_fd);
+            bool valid = cl_it != msgr->clients.end() && cl_it->second->reactor == r->num &&
+                cl_it->second->peer_state != PEER_STOPPED;
+            if (msg.type == MSGR_REACTOR_OP)
+            {
+                if (!valid)
+                {
+                    delete msg.op;
+                    continue;
+                }
+                cl_it->second->received_ops.push_back(msg.op);
+                msgr->exec_op(msg.op);
+            }
+            else if (msg.type == MSGR_REACTOR_CLOSED)
+            {
+                if (valid)
+                {
+                    msgr->stop_client(msg.peer_fd, true);
+                }
+                close(msg.peer_fd);
+            }
+        }
+        if (r->outbox_blocked.exchange(false))
+        {
+            r->wakeup();
+        }
+    }
+    // Operations may be submitted by exec_op
+    ringloop->wakeup();
+}
+
+void msgr_reactor_pool_t::flush()
+{
+    for (auto r: reactors)
+    {
+        size_t i = 0;
+        while (i < r->inbox_backlog.size() && r->inbox.push(r->inbox_backlog[i]))
+        {
+            i++;
+        }
+        if (i < r->inbox_backlog.size())
+        {
+            r->inbox_blocked = true;
+            while (i < r->inbox_backlog.size() && r->inbox.push(r->inbox_backlog[i]))
+            {
+                i++;
+            }
+        }
+        if (i > 0)
+        {
+            r->inbox_backlog.erase(r->inbox_backlog.begin(), r->inbox_backlog.begin()+i);
+            r->inbox_notify = true;
+        }
+        if (r->inbox_notify)
+        {
+            r->inbox_notify = false;
+            r->wakeup();
+        }
+    }
+}
+
+int msgr_reactor_pool_t::add_client(int peer_fd)
+{
+    int num = next_reactor;
+    next_reactor = (next_reactor+1) % reactors.size();
+    reactors[num]->post((msgr_reactor_msg_t){ .type = MSGR_REACTOR_NEW_CLIENT, .peer_fd = peer_fd });
+    return num;
+}
+
+void msgr_reactor_pool_t::send_reply(osd_client_t *cl, osd_op_t *op)
+{
+    reactors[cl->reactor]->post((msgr_reactor_msg_t){
+        .type = MSGR_REACTOR_REPLY,
+        .peer_fd = cl->peer_fd,
+        .op = op,
+        .read_op_id = op->req.hdr.opcode == OSD_OP_SHOW_CONFIG && cl->check_sequencing ? cl->read_op_id : 0,
+        .accepts_batches = op->req.hdr.opcode == OSD_OP_SHOW_CONFIG && cl->accepts_batches,
+        .in_osd_num = op->req.hdr.opcode == OSD_OP_SHOW_CONFIG ? cl->in_osd_num : 0,
+    });
+}
+
+void msgr_reactor_pool_t::stop_client(osd_client_t *cl)
+{
+    reactors[cl->reactor]->post((msgr_reactor_msg_t){ .type = MSGR_REACTOR_STOP_CLIENT, .peer_fd = cl->peer_fd });
+}
@@ -0,0 +1,113 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "messenger.h"
+#include "epoll_manager.h"
+#include "spsc_queue.h"
+
+#define MSGR_REACTOR_NEW_CLIENT 1
+#define MSGR_REACTOR_STOP_CLIENT 2
+#define MSGR_REACTOR_REPLY 3
+#define MSGR_REACTOR_OP 4
+#define MSGR_REACTOR_CLOSED 5
+
+#define MSGR_REACTOR_QUEUE_SIZE 4096
+
+struct msgr_reactor_msg_t
+{
+    int type;
+    int peer_fd;
+    osd_op_t *op;
+    // Next expected operation ID, sent with the SHOW_CONFIG reply if the client requested sequencing
+    uint64_t read_op_id;
+    // Sent with the SHOW_CONFIG reply if the client accepts batches
+    bool accepts_batches;
+    // Sent with the SHOW_CONFIG reply if the client is an OSD, so the reactor runs keepalive for it
+    osd_num_t in_osd_num;
+};
+
+class msgr_reactor_pool_t;
+
+// Reactor thread: handles sockets of a part of incoming connections with its own ring_loop_t,
+// epoll_manager_t and osd_messenger_t, i.e. receives and parses requests and sends replies.
+// Operations, reads included, are executed by the main thread, they're passed to it and back
+// through a pair of single-producer single-consumer queues, so each of them makes two extra
+// thread switches. Experimental: reactors only offload network processing.
+struct msgr_reactor_t
+{
+    msgr_reactor_pool_t *pool = NULL;
+    int num = 0;
+    ring_loop_t *ringloop = NULL;
+    epoll_manager_t *epmgr = NULL;
+    osd_messenger_t *msgr = NULL;
+    ring_consumer_t consumer;
+    std::thread thread;
+    std::atomic<bool> stopped;
+    int wakeup_fd = -1;
+    bool wakeup_pending = false;
+    // Main thread => reactor. <inbox_backlog> holds messages which didn't fit into the queue,
+    // <inbox_blocked> asks the reactor to wake up the main thread when it drains the queue
+    spsc_queue_t<msgr_reactor_msg_t> inbox;
+    std::vector<msgr_reactor_msg_t> inbox_backlog;
+    std::atomic<bool> inbox_blocked;
+    bool inbox_notify = false;
+    // Reactor => main thread
+    spsc_queue_t<msgr_reactor_msg_t> outbox;
+    std::vector<msgr_reactor_msg_t> outbox_backlog;
+    std::atomic<bool> outbox_blocked;
+    bool outbox_notify = false;
+    // Connections stopped during the current loop iteration
+    std::vector<int> closed_fds;
+
+    msgr_reactor_t(msgr_reactor_pool_t *pool, int num, osd_num_t osd_num, const json11::Json & config);
+    ~msgr_reactor_t();
+    void run();
+    void loop();
+    void arm_wakeup();
+    void wakeup();
+    void handle_inbox();
+    void flush_outbox();
+    void post(const msgr_reactor_msg_t & msg);
+    void post_main(const msgr_reactor_msg_t & msg);
+};
+
+// Reactor mode of the OSD messenger: accepted connections are distributed between
+// <osd_reactor_count> reactor threads round-robin. The main messenger keeps a proxy
+// osd_client_t for each of them, so all OSD logic (PG locks, dirty PGs, peer configuration)
+// still runs in the main thread and uses the usual client list. Proxies don't own the socket.
+// The FD is closed by the main thread after the reactor stops the connection, so FD numbers
+// are never reused while either side still knows about the old connection.
+class msgr_reactor_pool_t
+{
+    friend struct msgr_reactor_t;
+
+    osd_messenger_t *msgr = NULL;
+    ring_loop_t *ringloop = NULL;
+    ring_consumer_t consumer;
+    std::vector<msgr_reactor_t*> reactors;
+    int notify_fd = -1;
+    ring_data_t *notify_data = NULL;
+    bool notify_pending = false;
+    int next_reactor = 0;
+
+    void arm_notify_poll();
+    void handle_messages();
+    void flush();
+
+public:
+    msgr_reactor_pool_t(osd_messenger_t *msgr, int count, const json11::Json & config);
+    ~msgr_reactor_pool_t();
+
+    // Reactor threads
+    void notify();
+
+    // Main thread
+    int add_client(int peer_fd);
+    void send_reply(osd_client_t *cl, osd_op_t *op);
+    void stop_client(osd_client_t *cl);
+};
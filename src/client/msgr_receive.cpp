@@ -5,6 +5,16 @@
 
 void osd_messenger_t::read_requests()
 {
+    if (use_multishot_recv && !multishot_recv_checked)
+    {
+        // Multishot receive is set up on first use and not in init(), because
+        // the option may also come from the etcd global configuration
+        init_multishot_recv();
+    }
+    if (recv_cancel_queue.size())
+    {
+        submit_recv_cancel_queue();
+    }
     for (int i = 0; i < read_ready_clients.size(); i++)
     {
         int peer_fd = read_ready_clients[i];
@@ -14,6 +24,24 @@ void osd_messenger_t::read_requests()
             continue;
         }
         auto cl = cl_it->second;
+        if (recv_buf_ring)
+        {
+            // Multishot request stays armed until it's terminated by the kernel or the client is stopped
+            if (cl->recv_data)
+            {
+                continue;
+            }
+            if (cl->read_remaining < recv_buf_size)
+            {
+                if (!arm_multishot_recv(cl))
+                {
+                    read_ready_clients.erase(read_ready_clients.begin(), read_ready_clients.begin() + i);
+                    return;
+                }
+                continue;
+            }
+            // Large payloads are received with recvmsg directly into operation buffers
+        }
         if (cl->read_remaining < receive_buffer_size)
         {
             cl->read_iov.iov_base = cl->in_buf;
@@ -104,7 +132,7 @@ bool osd_messenger_t::handle_read(int result, osd_client_t *cl)
     }
     if (result > 0)
     {
-        if (cl->read_iov.iov_base == cl->in_buf)
+        if (cl->in_buf && cl->read_iov.iov_base == cl->in_buf)
         {
             if (!handle_read_buffer(cl, cl->in_buf, result))
             {
@@ -135,6 +163,219 @@ bool osd_messenger_t::handle_read(int result, osd_client_t *cl)
     return ret;
 }
 
+void osd_messenger_t::init_multishot_recv()
+{
+    multishot_recv_checked = true;
+    if (!ringloop || use_sync_send_recv || iothreads.size())
+    {
+        return;
+    }
+    if (!ringloop->has_multishot_recv())
+    {
+        fprintf(stderr, "Multishot receive is not supported by the kernel, using regular receive\n");
+        return;
+    }
+    recv_buf_count = multishot_recv_buffers;
+    recv_buf_size = receive_buffer_size;
+    recv_buffers = (uint8_t*)malloc_or_die((size_t)recv_buf_count*recv_buf_size);
+    int err = 0;
+    recv_buf_ring = ringloop->setup_buf_ring(recv_buf_count, &recv_buf_group, &err);
+    if (!recv_buf_ring)
+    {
+        fprintf(stderr, "Failed to register io_uring buffer ring: %s, multishot receive is disabled\n", strerror(-err));
+        free(recv_buffers);
+        recv_buffers = NULL;
+        return;
+    }
+    int mask = io_uring_buf_ring_mask(recv_buf_count);
+    for (uint32_t i = 0; i < recv_buf_count; i++)
+    {
+        io_uring_buf_ring_add(recv_buf_ring, recv_buffers + (size_t)i*recv_buf_size, recv_buf_size, i, mask, i);
+    }
+    io_uring_buf_ring_advance(recv_buf_ring, recv_buf_count);
+}
+
+void osd_messenger_t::free_multishot_recv()
+{
+    if (!recv_buf_ring)
+    {
+        return;
+    }
+    for (auto data: recv_canceled)
+    {
+        data->callback = [](ring_data_t *data)
+        {
+            if (!data->more)
+                delete data;
+        };
+    }
+    // Submit cancel requests so the kernel stops using buffers before they're freed
+    submit_recv_cancel_queue();
+    while (recv_cancel_queue.size() && ringloop->submit() > 0)
+    {
+        submit_recv_cancel_queue();
+    }
+    recv_cancel_queue.clear();
+    recv_canceled.clear();
+    ringloop->submit();
+    ringloop->free_buf_ring(recv_buf_ring, recv_buf_count, recv_buf_group);
+    recv_buf_ring = NULL;
+    free(recv_buffers);
+    recv_buffers = NULL;
+}
+
+bool osd_messenger_t::arm_multishot_recv(osd_client_t *cl)
+{
+    ring_data_t *data = new ring_data_t();
+    io_uring_sqe *sqe = ringloop->get_sqe(data);
+    if (!sqe)
+    {
+        delete data;
+        return false;
+    }
+    data->callback = [this, cl](ring_data_t *data) { handle_multishot_recv(data, cl); };
+    io_uring_prep_recv_multishot(sqe, cl->peer_fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = recv_buf_group;
+    cl->recv_data = data;
+    cl->read_ready = 0;
+    return true;
+}
+
+void osd_messenger_t::cancel_multishot_recv(osd_client_t *cl)
+{
+    if (!cl->recv_data)
+    {
+        return;
+    }
+    // The request doesn't reference client's memory, so the client may be
+    // destroyed right away, and the request is freed when it completes
+    ring_data_t *data = cl->recv_data;
+    cl->recv_data = NULL;
+    recv_canceled.insert(data);
+    data->callback = [this](ring_data_t *data)
+    {
+        recycle_recv_buffer(data);
+        if (!data->more)
+        {
+            recv_canceled.erase(data);
+            delete data;
+        }
+    };
+    if (!submit_recv_cancel(data))
+    {
+        // The request must not stay armed, otherwise it holds the socket open
+        recv_cancel_queue.push_back(data);
+        ringloop->wakeup();
+    }
+}
+
+bool osd_messenger_t::submit_recv_cancel(ring_data_t *data)
+{
+    // The cancel request has its own ring_data_t so it only fails when the submission queue is full
+    ring_data_t *cancel_data = new ring_data_t();
+    io_uring_sqe *sqe = ringloop->get_sqe(cancel_data);
+    if (!sqe)
+    {
+        delete cancel_data;
+        return false;
+    }
+    cancel_data->callback = [](ring_data_t *cancel_data) { delete cancel_data; };
+    io_uring_prep_cancel(sqe, data, 0);
+    return true;
+}
+
+void osd_messenger_t::submit_recv_cancel_queue()
+{
+    while (recv_cancel_queue.size())
+    {
+        ring_data_t *data = recv_cancel_queue.back();
+        // The request may already be terminated by the kernel and freed
+        if (recv_canceled.find(data) != recv_canceled.end() && !submit_recv_cancel(data))
+        {
+            break;
+        }
+        recv_cancel_queue.pop_back();
+    }
+}
+
+void osd_messenger_t::recycle_recv_buffer(ring_data_t *data)
+{
+    if (data->res > 0 && (data->cqe_flags & IORING_CQE_F_BUFFER))
+    {
+        int buf_id = data->cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+        io_uring_buf_ring_add(recv_buf_ring, recv_buffers + (size_t)buf_id*recv_buf_size, recv_buf_size,
+            buf_id, io_uring_buf_ring_mask(recv_buf_count), 0);
+        io_uring_buf_ring_advance(recv_buf_ring, 1);
+    }
+}
+
+void osd_messenger_t::handle_multishot_recv(ring_data_t *data, osd_client_t *cl)
+{
+    int result = data->res;
+    bool more = data->more;
+    int peer_fd = cl->peer_fd;
+    bool direct = cl->recv_direct;
+    if (!more)
+    {
+        // The request is terminated and has to be armed again
+        cl->recv_data = NULL;
+        if (direct)
+        {
+            // Data may already be waiting in the socket, EPOLLIN is ignored while the request is armed
+            cl->recv_direct = false;
+            cl->read_ready = 1;
+        }
+    }
+    if (result > 0)
+    {
+        // Data is copied from the shared buffer so it's returned to the kernel immediately
+        int buf_id = data->cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+        bool ok = handle_read_buffer(cl, recv_buffers + (size_t)buf_id*recv_buf_size, result);
+        recycle_recv_buffer(data);
+        if (!more)
+        {
+            delete data;
+        }
+        if (!ok)
+        {
+            clear_immediate_ops(peer_fd);
+            return;
+        }
+        if (more && !direct && cl->read_remaining >= recv_buf_size)
+        {
+            // Stop the request to receive the rest of a large payload directly into operation
+            // buffers instead of copying it from ring buffers. Data which is already received
+            // by the request is still handled here before the request terminates
+            cl->recv_direct = submit_recv_cancel(data);
+        }
+    }
+    else
+    {
+        if (!more)
+        {
+            delete data;
+        }
+        // -ENOBUFS means that all buffers are in use, just rearm the request in that case
+        if (result != -ENOBUFS && result != -EAGAIN && result != -EINTR && (result != -ECANCELED || !direct))
+        {
+            // this is a client socket, so don't panic on error. just disconnect it
+            if (result != 0)
+            {
+                fprintf(stderr, "Client %d socket read error: %d (%s). Disconnecting client\n", peer_fd, -result, strerror(-result));
+            }
+            stop_client(peer_fd);
+            return;
+        }
+    }
+    if (!more)
+    {
+        read_ready_clients.push_back(peer_fd);
+        ringloop->wakeup();
+    }
+    handle_immediate_ops();
+}
+
 void osd_messenger_t::clear_immediate_ops(int peer_fd)
 {
     size_t i = 0, j = 0;
@@ -170,7 +411,7 @@ void osd_messenger_t::handle_immediate_ops()
         else
         {
             // Copy lambda to be unaffected by `delete op`
-            std::function<void(osd_op_t*)>(op->callback)(op);
+            callback_t<void(osd_op_t*)>(op->callback)(op);
         }
     }
     set_immediate_ops.clear();
@@ -186,9 +427,7 @@ bool osd_messenger_t::handle_read_buffer(osd_client_t *cl, void *curbuf, int rem
             cl->read_op = new osd_op_t;
             cl->read_op->peer_fd = cl->peer_fd;
             cl->read_op->op_type = OSD_OP_IN;
-            cl->recv_list.push_back(cl->read_op->req.buf, OSD_PACKET_SIZE);
-            cl->read_remaining = OSD_PACKET_SIZE;
-            cl->read_state = CL_READ_HDR;
+            expect_header(cl);
         }
         while (cl->recv_list.done < cl->recv_list.count && remain > 0)
         {
@@ -230,28 +469,21 @@ bool osd_messenger_t::handle_finished_read(osd_client_t *cl)
     cl->recv_list.reset();
     if (cl->read_state == CL_READ_HDR)
     {
-        if (cl->read_op->req.hdr.magic == SECONDARY_OSD_REPLY_MAGIC)
-            return handle_reply_hdr(cl);
-        else if (cl->read_op->req.hdr.magic == SECONDARY_OSD_OP_MAGIC)
-        {
-            if (cl->check_sequencing)
-            {
-                if (cl->read_op->req.hdr.id != cl->read_op_id)
-                {
-                    fprintf(stderr, "Warning: operation sequencing is broken on client %d: expected num %ju, got %ju, stopping client\n", cl->peer_fd, cl->read_op_id, cl->read_op->req.hdr.id);
-                    stop_client(cl->peer_fd);
-                    return false;
-                }
-                cl->read_op_id++;
-            }
-            handle_op_hdr(cl);
-        }
-        else
+        if (cl->read_op->req.hdr.opcode == OSD_OP_BATCH &&
+            (cl->read_op->req.hdr.magic == SECONDARY_OSD_REPLY_MAGIC ||
+            cl->read_op->req.hdr.magic == SECONDARY_OSD_OP_MAGIC))
         {
-            fprintf(stderr, "Received garbage: magic=%jx id=%ju opcode=%jx from %d\n", cl->read_op->req.hdr.magic, cl->read_op->req.hdr.id, cl->read_op->req.hdr.opcode, cl->peer_fd);
-            stop_client(cl->peer_fd);
-            return false;
+            return handle_batch_hdr(cl);
         }
+        return handle_hdr(cl);
+    }
+    else if (cl->read_state == CL_READ_BATCH_ID)
+    {
+        return handle_batch_item_id(cl);
+    }
+    else if (cl->read_state == CL_READ_BATCH_HDR)
+    {
+        return handle_hdr(cl);
     }
     else if (cl->read_state == CL_READ_DATA)
     {
@@ -275,6 +507,92 @@ bool osd_messenger_t::handle_finished_read(osd_client_t *cl)
     return true;
 }
 
+void osd_messenger_t::expect_header(osd_client_t *cl)
+{
+    if (cl->read_batch_left > 0)
+    {
+        // Batch items start with the operation ID and opcode, magic is omitted
+        cl->recv_list.push_back(cl->read_op->req.buf + sizeof(uint64_t), 2*sizeof(uint64_t));
+        cl->read_remaining = 2*sizeof(uint64_t);
+        cl->read_state = CL_READ_BATCH_ID;
+    }
+    else
+    {
+        cl->recv_list.push_back(cl->read_op->req.buf, OSD_PACKET_SIZE);
+        cl->read_remaining = OSD_PACKET_SIZE;
+        cl->read_state = CL_READ_HDR;
+    }
+}
+
+bool osd_messenger_t::handle_hdr(osd_client_t *cl)
+{
+    if (cl->read_op->req.hdr.magic == SECONDARY_OSD_REPLY_MAGIC)
+        return handle_reply_hdr(cl);
+    else if (cl->read_op->req.hdr.magic == SECONDARY_OSD_OP_MAGIC)
+    {
+        if (cl->check_sequencing)
+        {
+            if (cl->read_op->req.hdr.id != cl->read_op_id)
+            {
+                fprintf(stderr, "Warning: operation sequencing is broken on client %d: expected num %ju, got %ju, stopping client\n", cl->peer_fd, cl->read_op_id, cl->read_op->req.hdr.id);
+                stop_client(cl->peer_fd);
+                return false;
+            }
+            cl->read_op_id++;
+        }
+        handle_op_hdr(cl);
+    }
+    else
+    {
+        fprintf(stderr, "Received garbage: magic=%jx id=%ju opcode=%jx from %d\n", cl->read_op->req.hdr.magic, cl->read_op->req.hdr.id, cl->read_op->req.hdr.opcode, cl->peer_fd);
+        stop_client(cl->peer_fd);
+        return false;
+    }
+    return true;
+}
+
+bool osd_messenger_t::handle_batch_hdr(osd_client_t *cl)
+{
+    uint32_t count = cl->read_op->req.batch.count;
+    if (!count || count > OSD_BATCH_MAX_OPS)
+    {
+        fprintf(stderr, "Received a batch of %u operations from %d, stopping client\n", count, cl->peer_fd);
+        stop_client(cl->peer_fd);
+        return false;
+    }
+    cl->read_batch_left = count;
+    cl->read_batch_reply = cl->read_op->req.hdr.magic == SECONDARY_OSD_REPLY_MAGIC;
+    // cl->read_op is reused for the first item
+    expect_header(cl);
+    return true;
+}
+
+bool osd_messenger_t::handle_batch_item_id(osd_client_t *cl)
+{
+    osd_op_t *cur_op = cl->read_op;
+    uint32_t size = cl->read_batch_reply
+        ? osd_batch_reply_size(cur_op->req.hdr.opcode)
+        : osd_batch_op_size(cur_op->req.hdr.opcode);
+    if (!size)
+    {
+        fprintf(stderr, "Received garbage in a batch: id=%ju opcode=%jx from %d\n", cur_op->req.hdr.id, cur_op->req.hdr.opcode, cl->peer_fd);
+        stop_client(cl->peer_fd);
+        return false;
+    }
+    cl->read_batch_left--;
+    cur_op->req.hdr.magic = cl->read_batch_reply ? SECONDARY_OSD_REPLY_MAGIC : SECONDARY_OSD_OP_MAGIC;
+    memset(cur_op->req.buf + size, 0, OSD_PACKET_SIZE - size);
+    if (size > sizeof(osd_op_header_t))
+    {
+        // Read the rest of the header
+        cl->recv_list.push_back(cur_op->req.buf + sizeof(osd_op_header_t), size - sizeof(osd_op_header_t));
+        cl->read_remaining = size - sizeof(osd_op_header_t);
+        cl->read_state = CL_READ_BATCH_HDR;
+        return true;
+    }
+    return handle_hdr(cl);
+}
+
 void osd_messenger_t::handle_op_hdr(osd_client_t *cl)
 {
     osd_op_t *cur_op = cl->read_op;
@@ -288,14 +606,14 @@ void osd_messenger_t::handle_op_hdr(osd_client_t *cl)
         if (cur_op->req.sec_rw.attr_len > 0)
         {
             if (cur_op->req.sec_rw.attr_len > sizeof(unsigned))
-                cur_op->bitmap = cur_op->rmw_buf = malloc_or_die(cur_op->req.sec_rw.attr_len);
+                cur_op->bitmap = cur_op->rmw_buf = pool_alloc(cur_op->req.sec_rw.attr_len);
             else
                 cur_op->bitmap = &cur_op->bmp_data;
             cl->recv_list.push_back(cur_op->bitmap, cur_op->req.sec_rw.attr_len);
         }
         if (cur_op->req.sec_rw.len > 0)
         {
-            cur_op->buf = memalign_or_die(MEM_ALIGNMENT, cur_op->req.sec_rw.len);
+            cur_op->buf = pool_memalign(cur_op->req.sec_rw.len);
             cl->recv_list.push_back(cur_op->buf, cur_op->req.sec_rw.len);
         }
         cl->read_remaining = cur_op->req.sec_rw.len + cur_op->req.sec_rw.attr_len;
@@ -305,7 +623,7 @@ void osd_messenger_t::handle_op_hdr(osd_client_t *cl)
     {
         if (cur_op->req.sec_stab.len > 0)
         {
-            cur_op->buf = memalign_or_die(MEM_ALIGNMENT, cur_op->req.sec_stab.len);
+            cur_op->buf = pool_memalign(cur_op->req.sec_stab.len);
             cl->recv_list.push_back(cur_op->buf, cur_op->req.sec_stab.len);
         }
         cl->read_remaining = cur_op->req.sec_stab.len;
@@ -314,7 +632,7 @@ void osd_messenger_t::handle_op_hdr(osd_client_t *cl)
     {
         if (cur_op->req.sec_read_bmp.len > 0)
         {
-            cur_op->buf = memalign_or_die(MEM_ALIGNMENT, cur_op->req.sec_read_bmp.len);
+            cur_op->buf = pool_memalign(cur_op->req.sec_read_bmp.len);
             cl->recv_list.push_back(cur_op->buf, cur_op->req.sec_read_bmp.len);
         }
         cl->read_remaining = cur_op->req.sec_read_bmp.len;
@@ -323,7 +641,7 @@ void osd_messenger_t::handle_op_hdr(osd_client_t *cl)
     {
         if (cur_op->req.rw.len > 0)
         {
-            cur_op->buf = memalign_or_die(MEM_ALIGNMENT, cur_op->req.rw.len);
+            cur_op->buf = pool_memalign(cur_op->req.rw.len);
             cl->recv_list.push_back(cur_op->buf, cur_op->req.rw.len);
         }
         cl->read_remaining = cur_op->req.rw.len;
@@ -361,17 +679,15 @@ void osd_messenger_t::handle_op_hdr(osd_client_t *cl)
 
 bool osd_messenger_t::handle_reply_hdr(osd_client_t *cl)
 {
-    auto req_it = cl->sent_ops.find(cl->read_op->req.hdr.id);
-    if (req_it == cl->sent_ops.end())
+    osd_op_t *op = cl->sent_ops.take(cl->read_op->req.hdr.id);
+    if (!op)
     {
         // Command out of sync. Drop connection
         fprintf(stderr, "Client %d command out of sync: id %ju\n", cl->peer_fd, cl->read_op->req.hdr.id);
         stop_client(cl->peer_fd);
         return false;
     }
-    osd_op_t *op = req_it->second;
     memcpy(op->reply.buf, cl->read_op->req.buf, OSD_PACKET_SIZE);
-    cl->sent_ops.erase(req_it);
     if (op->reply.hdr.opcode == OSD_OP_SEC_READ || op->reply.hdr.opcode == OSD_OP_READ)
     {
         // Read data. In this case we assume that the buffer is preallocated by the caller (!)
@@ -382,7 +698,7 @@ bool osd_messenger_t::handle_reply_hdr(osd_client_t *cl)
             // Check reply length to not overflow the buffer
             fprintf(stderr, "Client %d read reply of different length: expected %u+%u, got %jd+%u\n",
                 cl->peer_fd, expected_size, op->bitmap_len, op->reply.hdr.retval, bmp_len);
-            cl->sent_ops[op->req.hdr.id] = op;
+            cl->sent_ops.set(op->req.hdr.id, op);
             stop_client(cl->peer_fd);
             return false;
         }
@@ -423,7 +739,7 @@ bool osd_messenger_t::handle_reply_hdr(osd_client_t *cl)
         cl->read_op = op;
         cl->read_state = CL_READ_REPLY_DATA;
         cl->read_remaining = op->reply.hdr.retval;
-        free(op->buf);
+        pool_free(op->buf);
         op->buf = memalign_or_die(MEM_ALIGNMENT, cl->read_remaining);
         cl->recv_list.push_back(op->buf, cl->read_remaining);
     }
@@ -433,7 +749,7 @@ bool osd_messenger_t::handle_reply_hdr(osd_client_t *cl)
         cl->read_op = op;
         cl->read_state = CL_READ_REPLY_DATA;
         cl->read_remaining = op->reply.hdr.retval;
-        free(op->buf);
+        pool_free(op->buf);
         op->buf = malloc_or_die(op->reply.hdr.retval);
         cl->recv_list.push_back(op->buf, op->reply.hdr.retval);
     }
@@ -443,7 +759,7 @@ bool osd_messenger_t::handle_reply_hdr(osd_client_t *cl)
         cl->read_op = op;
         cl->read_state = CL_READ_REPLY_DATA;
         cl->read_remaining = op->reply.describe.result_bytes;
-        free(op->buf);
+        pool_free(op->buf);
         op->buf = malloc_or_die(op->reply.describe.result_bytes);
         cl->recv_list.push_back(op->buf, op->reply.describe.result_bytes);
     }
@@ -452,9 +768,7 @@ bool osd_messenger_t::handle_reply_hdr(osd_client_t *cl)
 reuse:
         // It's fine to reuse cl->read_op for the next reply
         handle_reply_ready(op);
-        cl->recv_list.push_back(cl->read_op->req.buf, OSD_PACKET_SIZE);
-        cl->read_remaining = OSD_PACKET_SIZE;
-        cl->read_state = CL_READ_HDR;
+        expect_header(cl);
     }
     return true;
 }
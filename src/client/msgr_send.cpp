@@ -6,6 +6,7 @@
 #include <sys/epoll.h>
 
 #include "messenger.h"
+#include "msgr_reactor.h"
 
 void osd_messenger_t::outbox_push(osd_op_t *cur_op)
 {
@@ -35,20 +36,39 @@ void osd_messenger_t::outbox_push(osd_op_t *cur_op)
             delete cur_op;
             return;
         }
+        if (cl->reactor >= 0)
+        {
+            // The reply is sent by the reactor thread
+            measure_exec(cur_op);
+            reactors->send_reply(cl, cur_op);
+            return;
+        }
     }
     auto & to_send_list = cl->write_msg.msg_iovlen ? cl->next_send_list : cl->send_list;
     auto & to_outbox = cl->write_msg.msg_iovlen ? cl->next_outbox : cl->outbox;
     if (cur_op->op_type == OSD_OP_IN)
     {
         measure_exec(cur_op);
-        to_send_list.push_back((iovec){ .iov_base = cur_op->reply.buf, .iov_len = OSD_PACKET_SIZE });
     }
     else
     {
-        to_send_list.push_back((iovec){ .iov_base = cur_op->req.buf, .iov_len = OSD_PACKET_SIZE });
-        cl->sent_ops[cur_op->req.hdr.id] = cur_op;
+        cl->sent_ops.set(cur_op->req.hdr.id, cur_op);
+    }
+    if (cl->write_msg.msg_iovlen && cl->accepts_batches && op_batch_size > 1 && batch_hdr_size(cur_op) > 0)
+    {
+        // Operations queued while a send is in progress may be packed into a batch
+        push_batched_hdr(cl, cur_op);
+    }
+    else
+    {
+        cl->send_batch = NULL;
+        cl->send_batch_pos = -1;
+        to_send_list.push_back((iovec){
+            .iov_base = cur_op->op_type == OSD_OP_IN ? cur_op->reply.buf : cur_op->req.buf,
+            .iov_len = OSD_PACKET_SIZE,
+        });
+        to_outbox.push_back((msgr_sendp_t){ .op = cur_op, .flags = MSGR_SENDP_HDR });
     }
-    to_outbox.push_back((msgr_sendp_t){ .op = cur_op, .flags = MSGR_SENDP_HDR });
     // Bitmap
     if (cur_op->op_type == OSD_OP_IN &&
         cur_op->req.hdr.opcode == OSD_OP_SEC_READ &&
@@ -96,11 +116,17 @@ void osd_messenger_t::outbox_push(osd_op_t *cur_op)
     }
     if (cur_op->req.hdr.opcode == OSD_OP_SEC_READ_BMP)
     {
+        // send_list and outbox entries must stay paired
         if (cur_op->op_type == OSD_OP_IN && cur_op->reply.hdr.retval > 0)
+        {
             to_send_list.push_back((iovec){ .iov_base = cur_op->buf, .iov_len = (size_t)cur_op->reply.hdr.retval });
+            to_outbox.push_back((msgr_sendp_t){ .op = cur_op, .flags = 0 });
+        }
         else if (cur_op->op_type == OSD_OP_OUT && cur_op->req.sec_read_bmp.len > 0)
+        {
             to_send_list.push_back((iovec){ .iov_base = cur_op->buf, .iov_len = (size_t)cur_op->req.sec_read_bmp.len });
-        to_outbox.push_back((msgr_sendp_t){ .op = cur_op, .flags = 0 });
+            to_outbox.push_back((msgr_sendp_t){ .op = cur_op, .flags = 0 });
+        }
     }
     if (cur_op->op_type == OSD_OP_IN)
     {
@@ -132,6 +158,70 @@ void osd_messenger_t::outbox_push(osd_op_t *cur_op)
     }
 }
 
+uint32_t osd_messenger_t::batch_hdr_size(osd_op_t *cur_op)
+{
+    return cur_op->op_type == OSD_OP_IN
+        ? osd_batch_reply_size(cur_op->req.hdr.opcode)
+        : osd_batch_op_size(cur_op->req.hdr.opcode);
+}
+
+// A batch is started when the second batchable operation of the same direction is queued
+// right after the first one. The first operation's header is then converted into a batch item
+// and a batch header is inserted before it. Any other operation closes the batch
+void osd_messenger_t::push_batched_hdr(osd_client_t *cl, osd_op_t *cur_op)
+{
+    uint64_t magic = cur_op->op_type == OSD_OP_IN ? SECONDARY_OSD_REPLY_MAGIC : SECONDARY_OSD_OP_MAGIC;
+    if (cl->send_batch)
+    {
+        if (cl->send_batch->req.batch.header.magic != magic ||
+            cl->send_batch->req.batch.count >= op_batch_size)
+        {
+            cl->send_batch = NULL;
+            cl->send_batch_pos = -1;
+        }
+    }
+    else if (cl->send_batch_pos >= 0 && cl->next_outbox[cl->send_batch_pos].op->op_type == cur_op->op_type)
+    {
+        osd_op_t *first_op = cl->next_outbox[cl->send_batch_pos].op;
+        iovec & first_iov = cl->next_send_list[cl->send_batch_pos];
+        first_iov.iov_base = (uint8_t*)first_iov.iov_base + sizeof(uint64_t);
+        first_iov.iov_len = batch_hdr_size(first_op) - sizeof(uint64_t);
+        // Batch header is sent as a separate operation which is freed after sending
+        osd_op_t *batch_op = new osd_op_t();
+        batch_op->req = (osd_any_op_t){
+            .batch = {
+                .header = {
+                    .magic = magic,
+                    .opcode = OSD_OP_BATCH,
+                },
+                .count = 1,
+            },
+        };
+        cl->next_send_list.insert(cl->next_send_list.begin()+cl->send_batch_pos,
+            (iovec){ .iov_base = batch_op->req.buf, .iov_len = OSD_PACKET_SIZE });
+        cl->next_outbox.insert(cl->next_outbox.begin()+cl->send_batch_pos,
+            (msgr_sendp_t){ .op = batch_op, .flags = MSGR_SENDP_HDR|MSGR_SENDP_FREE });
+        cl->send_batch = batch_op;
+    }
+    uint8_t *hdr = cur_op->op_type == OSD_OP_IN ? cur_op->reply.buf : cur_op->req.buf;
+    if (cl->send_batch)
+    {
+        // Batch items don't include magic
+        cl->send_batch->req.batch.count++;
+        cl->next_send_list.push_back((iovec){
+            .iov_base = hdr + sizeof(uint64_t),
+            .iov_len = batch_hdr_size(cur_op) - sizeof(uint64_t),
+        });
+    }
+    else
+    {
+        // The operation may become the first item of a batch
+        cl->send_batch_pos = cl->next_send_list.size();
+        cl->next_send_list.push_back((iovec){ .iov_base = hdr, .iov_len = OSD_PACKET_SIZE });
+    }
+    cl->next_outbox.push_back((msgr_sendp_t){ .op = cur_op, .flags = MSGR_SENDP_HDR });
+}
+
 void osd_messenger_t::inc_op_stats(osd_op_stats_t & stats, uint64_t opcode, timespec & tv_begin, timespec & tv_end, uint64_t len)
 {
     uint64_t usecs = (
@@ -338,6 +428,8 @@ void osd_messenger_t::handle_send(int result, bool prev, bool more, osd_client_t
             cl->outbox.insert(cl->outbox.end(), cl->next_outbox.begin(), cl->next_outbox.end());
             cl->next_send_list.clear();
             cl->next_outbox.clear();
+            cl->send_batch = NULL;
+            cl->send_batch_pos = -1;
         }
         cl->write_state = cl->outbox.size() > 0 ? CL_WRITE_READY : 0;
 #ifdef WITH_RDMA
@@ -5,19 +5,16 @@
 #include <assert.h>
 
 #include "messenger.h"
+#ifndef __MOCK__
+#include "msgr_reactor.h"
+#endif
 #ifdef WITH_RDMA
 #include "msgr_rdma.h"
 #endif
 
 void osd_client_t::cancel_ops()
 {
-    std::vector<osd_op_t*> cancel_ops;
-    cancel_ops.resize(sent_ops.size());
-    int i = 0;
-    for (auto p: sent_ops)
-    {
-        cancel_ops[i++] = p.second;
-    }
+    std::vector<osd_op_t*> cancel_ops = sent_ops.list();
     sent_ops.clear();
     for (auto op: cancel_ops)
     {
@@ -34,7 +31,7 @@ void osd_op_t::cancel()
         reply.hdr.opcode = req.hdr.opcode;
         reply.hdr.retval = -EPIPE;
         // Copy lambda to be unaffected by `delete this`
-        (std::function<void(osd_op_t*)>(callback))(this);
+        (callback_t<void(osd_op_t*)>(callback))(this);
     }
     else
     {
@@ -86,6 +83,12 @@ void osd_messenger_t::stop_client(int peer_fd, bool force, bool force_delete)
 #ifndef __MOCK__
     // Then remove FD from the eventloop so we don't accidentally read something
     tfd->set_fd_handler(peer_fd, false, NULL);
+    cancel_multishot_recv(cl);
+    if (cl->reactor >= 0 && reactors)
+    {
+        // Ask the reactor to stop the connection, it reports back when it's stopped
+        reactors->stop_client(cl);
+    }
     if (cl->connect_timeout_id >= 0)
     {
         tfd->clear_timer(cl->connect_timeout_id);
@@ -125,6 +128,10 @@ void osd_messenger_t::stop_client(int peer_fd, bool force, bool force_delete)
     {
         clients.erase(it);
     }
+    if (client_stopped_hook)
+    {
+        client_stopped_hook(peer_fd);
+    }
     cl->refs--;
     if (cl->refs <= 0 || force_delete)
     {
@@ -136,7 +143,7 @@ osd_client_t::~osd_client_t()
 {
     free(in_buf);
     in_buf = NULL;
-    if (peer_fd >= 0)
+    if (peer_fd >= 0 && !keep_fd)
     {
         // Close the FD only when the client is actually destroyed
         // Which only happens when all references are cleared
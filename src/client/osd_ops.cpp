@@ -25,3 +25,52 @@ const char* osd_op_names[] = {
     "describe",
     "sec_lock",
 };
+
+uint32_t osd_batch_op_size(uint64_t opcode)
+{
+    switch (opcode)
+    {
+    case OSD_OP_SEC_READ:
+    case OSD_OP_SEC_WRITE:
+    case OSD_OP_SEC_WRITE_STABLE:
+        return sizeof(osd_op_sec_rw_t);
+    case OSD_OP_SEC_SYNC:
+        return sizeof(osd_op_sec_sync_t);
+    case OSD_OP_SEC_STABILIZE:
+    case OSD_OP_SEC_ROLLBACK:
+        return sizeof(osd_op_sec_stab_t);
+    case OSD_OP_SEC_DELETE:
+        return sizeof(osd_op_sec_del_t);
+    case OSD_OP_READ:
+    case OSD_OP_WRITE:
+        return sizeof(osd_op_rw_t);
+    case OSD_OP_SYNC:
+        return sizeof(osd_op_sync_t);
+    }
+    // Other operations are rare or have variable-length headers (like primary deletes)
+    return 0;
+}
+
+uint32_t osd_batch_reply_size(uint64_t opcode)
+{
+    switch (opcode)
+    {
+    case OSD_OP_SEC_READ:
+    case OSD_OP_SEC_WRITE:
+    case OSD_OP_SEC_WRITE_STABLE:
+        return sizeof(osd_reply_sec_rw_t);
+    case OSD_OP_SEC_SYNC:
+        return sizeof(osd_reply_sec_sync_t);
+    case OSD_OP_SEC_STABILIZE:
+    case OSD_OP_SEC_ROLLBACK:
+        return sizeof(osd_reply_sec_stab_t);
+    case OSD_OP_SEC_DELETE:
+        return sizeof(osd_reply_sec_del_t);
+    case OSD_OP_READ:
+    case OSD_OP_WRITE:
+        return sizeof(osd_reply_rw_t);
+    case OSD_OP_SYNC:
+        return sizeof(osd_reply_sync_t);
+    }
+    return 0;
+}
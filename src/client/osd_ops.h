@@ -33,8 +33,11 @@
 #define OSD_OP_DESCRIBE             18
 #define OSD_OP_SEC_LOCK             19
 #define OSD_OP_MAX                  19
+// Batch of operations or replies. It's only a framing opcode, not an operation
+#define OSD_OP_BATCH                20
 #define OSD_RW_MAX                  64*1024*1024
 #define OSD_PROTOCOL_VERSION        1
+#define OSD_BATCH_MAX_OPS           1024
 
 #define OSD_OP_RECOVERY_RELATED     (uint32_t)1
 #define OSD_OP_IGNORE_PG_LOCK       (uint32_t)2
@@ -330,6 +333,18 @@ struct __attribute__((__packed__)) osd_reply_sec_lock_t
     uint64_t cur_primary;
 };
 
+// batch of operations (magic = SECONDARY_OSD_OP_MAGIC) or replies (magic = SECONDARY_OSD_REPLY_MAGIC)
+// it's followed by <count> items, each item is the header of the operation or reply without magic,
+// truncated to osd_batch_op_size() or osd_batch_reply_size(), followed by its usual data.
+// batches are only sent to peers which report the "op_batching" feature in SHOW_CONFIG
+struct __attribute__((__packed__)) osd_op_batch_t
+{
+    osd_op_header_t header;
+    // number of items, at most OSD_BATCH_MAX_OPS
+    uint32_t count;
+    uint32_t pad0;
+};
+
 // FIXME it would be interesting to try to unify blockstore_op and osd_op formats
 union osd_any_op_t
 {
@@ -345,6 +360,7 @@ union osd_any_op_t
     osd_op_rw_t rw;
     osd_op_sync_t sync;
     osd_op_describe_t describe;
+    osd_op_batch_t batch;
     uint8_t buf[OSD_PACKET_SIZE];
 };
 
@@ -367,3 +383,7 @@ union osd_any_reply_t
 };
 
 extern const char* osd_op_names[];
+
+// Size of the operation or reply header in a batch including magic, 0 if the operation can't be batched
+uint32_t osd_batch_op_size(uint64_t opcode);
+uint32_t osd_batch_reply_size(uint64_t opcode);
@@ -31,6 +31,7 @@ int disk_tool_t::prepare_one(std::map<std::string, std::string> options, int is_
         "discard_on_start",
         "min_discard_size",
         "discard_granularity",
+        "blockstore_shards",
     };
     if (options.find("force") == options.end())
     {
@@ -122,6 +123,11 @@ int disk_tool_t::prepare_one(std::map<std::string, std::string> options, int is_
         dsk.open_meta();
         dsk.open_journal();
         dsk.calc_lengths(true);
+        if (dsk.shard_count > 1)
+        {
+            // Each shard has its own metadata superblock and rounds its metadata up to a whole block
+            dsk.meta_len += 2*dsk.shard_count*dsk.meta_block_size;
+        }
         sb = json11::Json::object {
             { "data_device", options["data_device"] },
             { "meta_device", options["meta_device"] },
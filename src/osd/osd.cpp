@@ -219,6 +219,7 @@ void osd_t::parse_config(bool init)
         // Allow to set it to 0
         autosync_writes = config["autosync_writes"].uint64_value();
     }
+    write_pipeline_depth = config["write_pipeline_depth"].uint64_value();
     if (!config["client_queue_depth"].is_null())
     {
         client_queue_depth = config["client_queue_depth"].uint64_value();
@@ -124,6 +124,7 @@ class osd_t
     int immediate_commit = IMMEDIATE_NONE;
     int autosync_interval = DEFAULT_AUTOSYNC_INTERVAL; // "emergency" sync every 5 seconds
     int autosync_writes = DEFAULT_AUTOSYNC_WRITES;
+    int write_pipeline_depth = 0;
     uint64_t recovery_queue_depth = 1;
     uint64_t recovery_sleep_us = 0;
     double recovery_tune_util_low = 0.1;
@@ -338,6 +339,8 @@ class osd_t
     void continue_primary_sync(osd_op_t *cur_op);
     void continue_primary_del(osd_op_t *cur_op);
     bool check_write_queue(osd_op_t *cur_op, pg_t & pg);
+    bool pipeline_write(osd_op_t *cur_op, pg_t & pg);
+    osd_op_t *pop_write_queue(pg_t & pg, osd_op_t *cur_op);
     pg_osd_set_state_t* add_object_to_set(pg_t & pg, const object_id oid, const pg_osd_set_t & osd_set,
         uint64_t old_pg_state, int log_at_level);
     void remove_object_from_state(object_id & oid, pg_osd_set_state_t **object_state, pg_t &pg, bool report = true);
@@ -373,7 +376,7 @@ class osd_t
     void send_chained_read_results(pg_t *pg, osd_op_t *cur_op);
     std::vector<osd_chain_read_t> collect_chained_read_requests(osd_op_t *cur_op);
     int collect_bitmap_requests(osd_op_t *cur_op, pg_t & pg, std::vector<bitmap_request_t> & bitmap_requests);
-    int submit_bitmap_subops(osd_op_t *cur_op, pg_t & pg);
+    int submit_bitmap_subops(osd_op_t *cur_op, pg_t *pg);
     int read_bitmaps(osd_op_t *cur_op, pg_t *pg, int base_state);
 
     inline pg_num_t map_to_pg(object_id oid, uint64_t pg_stripe_size)
@@ -197,6 +197,34 @@ json11::Json osd_t::get_statistics()
         st["blockstore_ready"] = bs->is_started();
         st["size"] = bs->get_block_count() * bs->get_block_size();
         st["free"] = bs->get_free_block_count() * bs->get_block_size();
+        auto counters = bs->get_counters();
+        if (counters.size())
+        {
+            json11::Json::object bs_stats;
+            for (auto & cp: counters)
+                bs_stats[cp.first] = cp.second;
+            st["blockstore_stats"] = bs_stats;
+        }
+        json11::Json::object bs_latency;
+        for (auto & hp: bs->get_histograms())
+        {
+            if (!hp.second.count)
+                continue;
+            // Trailing empty buckets are omitted
+            int n = BS_HIST_BUCKETS;
+            while (n > 0 && !hp.second.buckets[n-1])
+                n--;
+            json11::Json::array buckets;
+            for (int i = 0; i < n; i++)
+                buckets.push_back(hp.second.buckets[i]);
+            bs_latency[hp.first] = json11::Json::object {
+                { "count", hp.second.count },
+                { "usec", hp.second.usec },
+                { "buckets", buckets },
+            };
+        }
+        if (bs_latency.size())
+            st["blockstore_latency"] = bs_latency;
     }
     st["data_block_size"] = (uint64_t)bs_block_size;
     st["bitmap_granularity"] = (uint64_t)bs_bitmap_granularity;
@@ -642,6 +670,33 @@ void osd_t::renew_lease(bool reload)
 
 void osd_t::force_stop(int exitcode)
 {
+    if (!exitcode && !stopping && bs && bs->is_started() && config["meta_snapshot_file"].string_value() != "")
+    {
+        // Finish in-flight operations and save the metadata snapshot to speed up the next start
+        stopping = true;
+        timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        tfd->set_timer(10, true, [this, start](int timer_id)
+        {
+            if (shutdown())
+            {
+                bs->save_meta_snapshot();
+            }
+            else
+            {
+                timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                if (now.tv_sec - start.tv_sec < 5)
+                {
+                    return;
+                }
+                printf("[OSD %ju] Still busy, stopping without metadata snapshot\n", this->osd_num);
+            }
+            tfd->clear_timer(timer_id);
+            force_stop(0);
+        });
+        return;
+    }
     if (etcd_lease_id != "")
     {
         st_cli.etcd_call("/kv/lease/revoke", json11::Json::object {
@@ -103,10 +103,10 @@ bool osd_t::prepare_primary_rw(osd_op_t *cur_op)
             chain_size++;
         }
     }
-    osd_primary_op_data_t *op_data = (osd_primary_op_data_t*)calloc_or_die(
+    osd_primary_op_data_t *op_data = (osd_primary_op_data_t*)pool_calloc(
         // Allocate:
         // - op_data
-        1, sizeof(osd_primary_op_data_t) +
+        sizeof(osd_primary_op_data_t) +
         // - stripes
         stripe_count * sizeof(osd_rmw_stripe_t) +
         chain_size * (
@@ -133,7 +133,7 @@ bool osd_t::prepare_primary_rw(osd_op_t *cur_op)
         split_stripes(pg_data_size, bs_block_size, (uint32_t)(cur_op->req.rw.offset - oid.stripe), cur_op->req.rw.len, op_data->stripes);
         // Resulting bitmaps have to survive op_data and be freed with the op itself
         assert(!cur_op->bitmap_buf);
-        cur_op->bitmap_buf = calloc_or_die(1, clean_entry_bitmap_size * stripe_count);
+        cur_op->bitmap_buf = pool_calloc(clean_entry_bitmap_size * stripe_count);
         for (int i = 0; i < stripe_count; i++)
         {
             op_data->stripes[i].bmp_buf = (uint8_t*)cur_op->bitmap_buf + clean_entry_bitmap_size * i;
@@ -814,14 +814,7 @@ resume_5:
         }
     }
 continue_others:
-    osd_op_t *next_op = NULL;
-    auto next_it = pg.write_queue.find(op_data->oid);
-    if (next_it != pg.write_queue.end() && next_it->second == cur_op)
-    {
-        pg.write_queue.erase(next_it++);
-        if (next_it != pg.write_queue.end() && next_it->first == op_data->oid)
-            next_op = next_it->second;
-    }
+    osd_op_t *next_op = pop_write_queue(pg, cur_op);
     finish_op(cur_op, cur_op->reply.hdr.retval);
     if (next_op)
     {
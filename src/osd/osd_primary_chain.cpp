@@ -4,6 +4,8 @@
 #include "osd_primary.h"
 #include "allocator.h"
 
+#define SELF_FD -1
+
 void osd_t::continue_chained_read(osd_op_t *cur_op)
 {
     osd_primary_op_data_t *op_data = cur_op->op_data;
@@ -44,7 +46,7 @@ resume_4:
         {
             // Handle corrupted reads and retry...
             check_corrupted_chained(*pg, cur_op);
-            free(cur_op->buf);
+            pool_free(cur_op->buf);
             cur_op->buf = NULL;
             free(op_data->chain_reads);
             op_data->chain_reads = NULL;
@@ -70,65 +72,48 @@ int osd_t::read_bitmaps(osd_op_t *cur_op, pg_t *pg, int base_state)
         goto resume_0;
     else if (op_data->st == base_state+1)
         goto resume_1;
-    if (!pg || pg->state == PG_ACTIVE && pg->scheme == POOL_SCHEME_REPLICATED)
+    if (submit_bitmap_subops(cur_op, pg) < 0)
     {
-        // Happy path for clean replicated PGs (all bitmaps are available locally)
-        osd_primary_op_data_t *op_data = cur_op->op_data;
-        for (int chain_num = 0; chain_num < op_data->chain_size; chain_num++)
-        {
-            object_id cur_oid = { .inode = op_data->read_chain[chain_num], .stripe = op_data->oid.stripe };
-            // Read bitmap synchronously from the local database
-            bs->read_bitmap(
-                cur_oid, UINT64_MAX, (uint8_t*)op_data->snapshot_bitmaps + chain_num*clean_entry_bitmap_size,
-                !chain_num ? &cur_op->reply.rw.version : NULL
-            );
-        }
+        // Failure
+        finish_op(cur_op, -EIO);
+        return -1;
     }
-    else
-    {
-        if (submit_bitmap_subops(cur_op, *pg) < 0)
-        {
-            // Failure
-            finish_op(cur_op, -EIO);
-            return -1;
-        }
 resume_0:
-        if (op_data->n_subops > 0)
-        {
-            // Wait for subops
-            op_data->st = base_state;
-            return 1;
-        }
+    if (op_data->n_subops > 0)
+    {
+        // Wait for subops
+        op_data->st = base_state;
+        return 1;
+    }
 resume_1:
-        if (pg->scheme != POOL_SCHEME_REPLICATED)
+    if (pg && pg->scheme != POOL_SCHEME_REPLICATED)
+    {
+        for (int chain_num = 0; chain_num < op_data->chain_size; chain_num++)
         {
-            for (int chain_num = 0; chain_num < op_data->chain_size; chain_num++)
+            // Check if we need to reconstruct any bitmaps
+            for (int i = 0; i < pg->pg_size; i++)
             {
-                // Check if we need to reconstruct any bitmaps
-                for (int i = 0; i < pg->pg_size; i++)
+                if (op_data->missing_flags[chain_num*pg->pg_size + i])
                 {
-                    if (op_data->missing_flags[chain_num*pg->pg_size + i])
+                    osd_rmw_stripe_t local_stripes[pg->pg_size];
+                    for (i = 0; i < pg->pg_size; i++)
                     {
-                        osd_rmw_stripe_t local_stripes[pg->pg_size];
-                        for (i = 0; i < pg->pg_size; i++)
-                        {
-                            local_stripes[i] = (osd_rmw_stripe_t){
-                                .bmp_buf = (uint8_t*)op_data->snapshot_bitmaps + (chain_num*pg->pg_size + i)*clean_entry_bitmap_size,
-                                .read_start = 1,
-                                .read_end = 1,
-                                .missing = op_data->missing_flags[chain_num*pg->pg_size + i] && true,
-                            };
-                        }
-                        if (pg->scheme == POOL_SCHEME_XOR)
-                        {
-                            reconstruct_stripes_xor(local_stripes, pg->pg_size, clean_entry_bitmap_size);
-                        }
-                        else if (pg->scheme == POOL_SCHEME_EC)
-                        {
-                            reconstruct_stripes_ec(local_stripes, pg->pg_size, pg->pg_data_size, clean_entry_bitmap_size);
-                        }
-                        break;
+                        local_stripes[i] = (osd_rmw_stripe_t){
+                            .bmp_buf = (uint8_t*)op_data->snapshot_bitmaps + (chain_num*pg->pg_size + i)*clean_entry_bitmap_size,
+                            .read_start = 1,
+                            .read_end = 1,
+                            .missing = op_data->missing_flags[chain_num*pg->pg_size + i] && true,
+                        };
+                    }
+                    if (pg->scheme == POOL_SCHEME_XOR)
+                    {
+                        reconstruct_stripes_xor(local_stripes, pg->pg_size, clean_entry_bitmap_size);
+                    }
+                    else if (pg->scheme == POOL_SCHEME_EC)
+                    {
+                        reconstruct_stripes_ec(local_stripes, pg->pg_size, pg->pg_data_size, clean_entry_bitmap_size);
                     }
+                    break;
                 }
             }
         }
@@ -214,12 +199,24 @@ int osd_t::collect_bitmap_requests(osd_op_t *cur_op, pg_t & pg, std::vector<bitm
     return 0;
 }
 
-int osd_t::submit_bitmap_subops(osd_op_t *cur_op, pg_t & pg)
+int osd_t::submit_bitmap_subops(osd_op_t *cur_op, pg_t *pg)
 {
-    assert(&pg);
     osd_primary_op_data_t *op_data = cur_op->op_data;
     std::vector<bitmap_request_t> *bitmap_requests = new std::vector<bitmap_request_t>();
-    if (collect_bitmap_requests(cur_op, pg, *bitmap_requests) < 0)
+    if (!pg || pg->state == PG_ACTIVE && pg->scheme == POOL_SCHEME_REPLICATED)
+    {
+        // Happy path for clean replicated PGs (all bitmaps are available locally)
+        for (int chain_num = 0; chain_num < op_data->chain_size; chain_num++)
+        {
+            bitmap_requests->push_back((bitmap_request_t){
+                .osd_num = this->osd_num,
+                .oid = { .inode = op_data->read_chain[chain_num], .stripe = op_data->oid.stripe },
+                .version = UINT64_MAX,
+                .bmp_buf = (uint8_t*)op_data->snapshot_bitmaps + chain_num*clean_entry_bitmap_size,
+            });
+        }
+    }
+    else if (collect_bitmap_requests(cur_op, *pg, *bitmap_requests) < 0)
     {
         delete bitmap_requests;
         return -1;
@@ -227,8 +224,7 @@ int osd_t::submit_bitmap_subops(osd_op_t *cur_op, pg_t & pg)
     op_data->n_subops = 0;
     for (int i = 0; i < bitmap_requests->size(); i++)
     {
-        if ((i == bitmap_requests->size()-1 || (*bitmap_requests)[i+1].osd_num != (*bitmap_requests)[i].osd_num) &&
-            (*bitmap_requests)[i].osd_num != this->osd_num)
+        if (i == bitmap_requests->size()-1 || (*bitmap_requests)[i+1].osd_num != (*bitmap_requests)[i].osd_num)
         {
             op_data->n_subops++;
         }
@@ -244,62 +240,72 @@ int osd_t::submit_bitmap_subops(osd_op_t *cur_op, pg_t & pg)
         if (i == bitmap_requests->size()-1 || (*bitmap_requests)[i+1].osd_num != (*bitmap_requests)[i].osd_num)
         {
             osd_num_t subop_osd_num = (*bitmap_requests)[i].osd_num;
-            if (subop_osd_num == this->osd_num)
-            {
-                // Read bitmap synchronously from the local database
-                for (int j = prev; j <= i; j++)
-                {
-                    bs->read_bitmap(
-                        (*bitmap_requests)[j].oid, (*bitmap_requests)[j].version, (*bitmap_requests)[j].bmp_buf,
-                        (*bitmap_requests)[j].oid.inode == cur_op->req.rw.inode ? &cur_op->reply.rw.version : NULL
-                    );
+            osd_op_t *subop = op_data->subops+subop_idx;
+            // FIXME: Use the pre-allocated buffer
+            assert(!subop->buf);
+            subop->buf = malloc_or_die(sizeof(obj_ver_id)*(i+1-prev));
+            subop->req = (osd_any_op_t){
+                .sec_read_bmp = {
+                    .header = {
+                        .magic = SECONDARY_OSD_OP_MAGIC,
+                        .opcode = OSD_OP_SEC_READ_BMP,
+                    },
+                    .len = sizeof(obj_ver_id)*(i+1-prev),
                 }
+            };
+            obj_ver_id *ov = (obj_ver_id*)subop->buf;
+            for (int j = prev; j <= i; j++, ov++)
+            {
+                ov->oid = (*bitmap_requests)[j].oid;
+                ov->version = (*bitmap_requests)[j].version;
             }
-            else
+            subop->callback = [cur_op, bitmap_requests, prev, i, this](osd_op_t *subop)
             {
-                // Send to a remote OSD
-                osd_op_t *subop = op_data->subops+subop_idx;
-                subop->op_type = OSD_OP_OUT;
-                // FIXME: Use the pre-allocated buffer
-                assert(!subop->buf);
-                subop->buf = malloc_or_die(sizeof(obj_ver_id)*(i+1-prev));
-                subop->req = (osd_any_op_t){
-                    .sec_read_bmp = {
-                        .header = {
-                            .magic = SECONDARY_OSD_OP_MAGIC,
-                            .opcode = OSD_OP_SEC_READ_BMP,
-                        },
-                        .len = sizeof(obj_ver_id)*(i+1-prev),
-                    }
-                };
-                obj_ver_id *ov = (obj_ver_id*)subop->buf;
-                for (int j = prev; j <= i; j++, ov++)
-                {
-                    ov->oid = (*bitmap_requests)[j].oid;
-                    ov->version = (*bitmap_requests)[j].version;
-                }
-                subop->callback = [cur_op, bitmap_requests, prev, i, this](osd_op_t *subop)
+                int requested_count = subop->req.sec_read_bmp.len / sizeof(obj_ver_id);
+                if (subop->reply.hdr.retval == requested_count * (8 + clean_entry_bitmap_size))
                 {
-                    int requested_count = subop->req.sec_read_bmp.len / sizeof(obj_ver_id);
-                    if (subop->reply.hdr.retval == requested_count * (8 + clean_entry_bitmap_size))
+                    void *cur_buf = (uint8_t*)subop->buf + 8;
+                    for (int j = prev; j <= i; j++)
                     {
-                        void *cur_buf = (uint8_t*)subop->buf + 8;
-                        for (int j = prev; j <= i; j++)
+                        memcpy((*bitmap_requests)[j].bmp_buf, cur_buf, clean_entry_bitmap_size);
+                        if ((*bitmap_requests)[j].oid.inode == cur_op->req.rw.inode)
                         {
-                            memcpy((*bitmap_requests)[j].bmp_buf, cur_buf, clean_entry_bitmap_size);
-                            if ((*bitmap_requests)[j].oid.inode == cur_op->req.rw.inode)
-                            {
-                                memcpy(&cur_op->reply.rw.version, (uint8_t*)cur_buf-8, 8);
-                            }
-                            cur_buf = (uint8_t*)cur_buf + 8 + clean_entry_bitmap_size;
+                            memcpy(&cur_op->reply.rw.version, (uint8_t*)cur_buf-8, 8);
                         }
+                        cur_buf = (uint8_t*)cur_buf + 8 + clean_entry_bitmap_size;
                     }
-                    if ((cur_op->op_data->errors + cur_op->op_data->done + 1) >= cur_op->op_data->n_subops)
-                    {
-                        delete bitmap_requests;
-                    }
-                    handle_primary_subop(subop, cur_op);
+                }
+                if ((cur_op->op_data->errors + cur_op->op_data->done + 1) >= cur_op->op_data->n_subops)
+                {
+                    delete bitmap_requests;
+                }
+                handle_primary_subop(subop, cur_op);
+            };
+            if (subop_osd_num == this->osd_num)
+            {
+                // Read bitmaps from the local blockstore, the reply has the same format as SEC_READ_BMP
+                subop->peer_fd = SELF_FD;
+                subop->bs_op = new blockstore_op_t;
+                subop->bs_op->opcode = BS_OP_READ_BITMAP;
+                subop->bs_op->len = i+1-prev;
+                subop->bs_op->buf = subop->buf;
+                subop->bs_op->bitmap = malloc_or_die((i+1-prev) * (8 + clean_entry_bitmap_size));
+                subop->bs_op->callback = [subop, this](blockstore_op_t *bs_op)
+                {
+                    subop->reply.hdr.retval = bs_op->retval < 0 ? bs_op->retval
+                        : bs_op->len * (8 + clean_entry_bitmap_size);
+                    pool_free(subop->buf);
+                    subop->buf = bs_op->bitmap;
+                    delete bs_op;
+                    subop->bs_op = NULL;
+                    callback_t<void(osd_op_t*)>(subop->callback)(subop);
                 };
+                bs->enqueue_op(subop->bs_op);
+            }
+            else
+            {
+                // Send to a remote OSD
+                subop->op_type = OSD_OP_OUT;
                 auto peer_fd_it = msgr.osd_peer_fds.find(subop_osd_num);
                 if (peer_fd_it != msgr.osd_peer_fds.end())
                 {
@@ -311,10 +317,10 @@ int osd_t::submit_bitmap_subops(osd_op_t *cur_op, pg_t & pg)
                     // Fail it immediately
                     subop->peer_fd = -1;
                     subop->reply.hdr.retval = -EPIPE;
-                    ringloop->set_immediate([subop]() { std::function<void(osd_op_t*)>(subop->callback)(subop); });
+                    ringloop->set_immediate([subop]() { callback_t<void(osd_op_t*)>(subop->callback)(subop); });
                 }
-                subop_idx++;
             }
+            subop_idx++;
             prev = i+1;
         }
     }
@@ -83,7 +83,7 @@ void osd_t::finish_op(osd_op_t *cur_op, int retval)
             rm_inflight(pg);
         }
         assert(!cur_op->op_data->subops);
-        free(cur_op->op_data);
+        pool_free(cur_op->op_data);
         cur_op->op_data = NULL;
     }
     cur_op->reply.hdr.magic = SECONDARY_OSD_REPLY_MAGIC;
@@ -98,7 +98,7 @@ void osd_t::finish_op(osd_op_t *cur_op, int retval)
             msgr.measure_exec(cur_op);
         }
         // Copy lambda to be unaffected by `delete op`
-        std::function<void(osd_op_t*)>(cur_op->callback)(cur_op);
+        callback_t<void(osd_op_t*)>(cur_op->callback)(cur_op);
     }
     else
     {
@@ -211,6 +211,8 @@ void osd_t::submit_primary_subop(osd_op_t *cur_op, osd_op_t *subop,
             } },
             .buf = (uint8_t*)(wr ? si->write_buf : si->read_buf),
             .bitmap = (uint8_t*)si->bmp_buf,
+            .qos_class = cur_op->peer_fd != SELF_FD ? BS_QOS_CLIENT
+                : (cur_op->req.hdr.opcode == OSD_OP_SCRUB ? BS_QOS_SCRUB : BS_QOS_RECOVERY),
         });
 #ifdef OSD_DEBUG
          printf(
@@ -275,7 +277,7 @@ void osd_t::submit_primary_subop(osd_op_t *cur_op, osd_op_t *subop,
             // Fail it immediately
             subop->peer_fd = -1;
             subop->reply.hdr.retval = -EPIPE;
-            ringloop->set_immediate([subop]() { std::function<void(osd_op_t*)>(subop->callback)(subop); });
+            ringloop->set_immediate([subop]() { callback_t<void(osd_op_t*)>(subop->callback)(subop); });
         }
     }
 }
@@ -290,6 +292,7 @@ static uint64_t bs_op_to_osd_op[] = {
     OSD_OP_SEC_DELETE,          // BS_OP_DELETE = 6
     OSD_OP_SEC_LIST,            // BS_OP_LIST = 7
     OSD_OP_SEC_ROLLBACK,        // BS_OP_ROLLBACK = 8
+    OSD_OP_SEC_READ_BMP,        // BS_OP_READ_BITMAP = 9
 };
 
 void osd_t::handle_primary_bs_subop(osd_op_t *subop)
@@ -587,6 +590,7 @@ void osd_t::submit_primary_del_batch(osd_op_t *cur_op, obj_ver_osd_t *chunks_to_
                     .version = chunk.version,
                 } },
             });
+            subops[i].bs_op->qos_class = cur_op->peer_fd == SELF_FD ? BS_QOS_RECOVERY : BS_QOS_CLIENT;
             bs->enqueue_op(subops[i].bs_op);
         }
         else
@@ -616,7 +620,7 @@ void osd_t::submit_primary_del_batch(osd_op_t *cur_op, obj_ver_osd_t *chunks_to_
                 // Fail it immediately
                 subops[i].peer_fd = -1;
                 subops[i].reply.hdr.retval = -EPIPE;
-                ringloop->set_immediate([subop = &subops[i]]() { std::function<void(osd_op_t*)>(subop->callback)(subop); });
+                ringloop->set_immediate([subop = &subops[i]]() { callback_t<void(osd_op_t*)>(subop->callback)(subop); });
             }
         }
     }
@@ -733,7 +737,7 @@ void osd_t::submit_primary_stab_subops(osd_op_t *cur_op)
                 // Fail it immediately
                 subops[i].peer_fd = -1;
                 subops[i].reply.hdr.retval = -EPIPE;
-                ringloop->set_immediate([subop = &subops[i]]() { std::function<void(osd_op_t*)>(subop->callback)(subop); });
+                ringloop->set_immediate([subop = &subops[i]]() { callback_t<void(osd_op_t*)>(subop->callback)(subop); });
             }
         }
     }
@@ -830,29 +834,38 @@ void osd_t::submit_primary_rollback_subops(osd_op_t *cur_op, const uint64_t* osd
 
 void osd_t::pg_cancel_write_queue(pg_t & pg, osd_op_t *first_op, object_id oid, int retval)
 {
-    auto st_it = pg.write_queue.find(oid), it = st_it;
+    auto it = pg.write_queue.find(oid);
+    while (it != pg.write_queue.end() && it->first == oid && it->second != first_op)
+    {
+        // Skip previous pipelined writes, they're still in progress
+        it++;
+    }
     if (it == pg.write_queue.end() || it->second != first_op)
     {
-        // Write queue doesn't match the first operation.
+        // Write queue doesn't contain the operation.
         // first_op is a leftover operation from the previous peering of the same PG.
         finish_op(first_op, retval);
         return;
     }
     std::vector<osd_op_t*> cancel_ops;
+    cancel_ops.push_back(first_op);
+    it = pg.write_queue.erase(it);
     while (it != pg.write_queue.end() && it->first == oid)
     {
+        if (it->second->op_data->st != 1)
+        {
+            // Next pipelined writes are already sent to secondary OSDs and will finish by themselves
+            it++;
+            continue;
+        }
         cancel_ops.push_back(it->second);
-        it++;
+        it = pg.write_queue.erase(it);
     }
-    if (st_it != it)
+    // First erase them and then run finish_op() for the sake of reenterability
+    // Calling finish_op() on a live iterator previously triggered a bug where some
+    // of the OSDs were looping infinitely if you stopped all of them with kill -INT during recovery
+    for (auto op: cancel_ops)
     {
-        // First erase them and then run finish_op() for the sake of reenterability
-        // Calling finish_op() on a live iterator previously triggered a bug where some
-        // of the OSDs were looping infinitely if you stopped all of them with kill -INT during recovery
-        pg.write_queue.erase(st_it, it);
-        for (auto op: cancel_ops)
-        {
-            finish_op(op, retval);
-        }
+        finish_op(op, retval);
     }
 }
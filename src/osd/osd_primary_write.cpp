@@ -30,13 +30,80 @@ bool osd_t::check_write_queue(osd_op_t *cur_op, pg_t & pg)
     auto vo_it = pg.write_queue.find(op_data->oid);
     if (vo_it != pg.write_queue.end())
     {
+        bool pipelined = pipeline_write(cur_op, pg);
         pg.write_queue.emplace(op_data->oid, cur_op);
-        return false;
+        return pipelined;
     }
     pg.write_queue.emplace(op_data->oid, cur_op);
     return true;
 }
 
+// Check if a write may be started while previous writes to the same object are still in progress.
+// It's possible for simple replicated writes to clean objects: the version is then just the next
+// version after the previous write, and secondary OSDs receive writes in the same order and apply
+// them in the order of versions. Partial writes to EC/XOR objects still have to read the previous
+// version of the object to calculate parity, so they're always executed one by one.
+bool osd_t::pipeline_write(osd_op_t *cur_op, pg_t & pg)
+{
+    osd_primary_op_data_t *op_data = cur_op->op_data;
+    if (!write_pipeline_depth || pg.scheme != POOL_SCHEME_REPLICATED || pg.state != PG_ACTIVE ||
+        pg.epoch > pg.reported_epoch || cur_op->req.hdr.opcode != OSD_OP_WRITE || cur_op->req.rw.version != 0)
+    {
+        return false;
+    }
+    // All previous writes must already be sent to secondary OSDs
+    osd_op_t *prev_op = NULL;
+    int queued = 0;
+    for (auto it = pg.write_queue.find(op_data->oid); it != pg.write_queue.end() && it->first == op_data->oid; it++)
+    {
+        prev_op = it->second;
+        queued++;
+    }
+    osd_primary_op_data_t *prev_data = prev_op->op_data;
+    if (queued >= write_pipeline_depth || prev_op->req.hdr.opcode != OSD_OP_WRITE ||
+        prev_data->st != 4 || prev_data->object_state || prev_data->prev_set != pg.cur_set.data())
+    {
+        return false;
+    }
+    // The next version must not require to increase the PG epoch
+    if ((prev_data->target_ver >> (64-PG_EPOCH_BITS)) < pg.epoch ||
+        (prev_data->target_ver & ((uint64_t)1 << (64-PG_EPOCH_BITS) - 1)) == ((uint64_t)1 << (64-PG_EPOCH_BITS) - 1))
+    {
+        return false;
+    }
+    op_data->pipelined = true;
+    op_data->fact_ver = prev_data->target_ver;
+    // Previous write already has the new object bitmap. If it fails without reaching
+    // any OSD, this write is failed too, because the bitmap includes its range
+    memcpy(op_data->stripes[0].bmp_buf, prev_data->stripes[0].bmp_buf, clean_entry_bitmap_size);
+    return true;
+}
+
+// Remove a completed operation from the write queue and return the next operation
+// waiting for it, if any. Pipelined writes may complete in any order, so the next
+// waiting operation is continued only after all writes started before it complete
+osd_op_t *osd_t::pop_write_queue(pg_t & pg, osd_op_t *cur_op)
+{
+    auto it = pg.write_queue.find(cur_op->op_data->oid);
+    bool first = true;
+    while (it != pg.write_queue.end() && it->first == cur_op->op_data->oid && it->second != cur_op)
+    {
+        first = false;
+        it++;
+    }
+    if (it == pg.write_queue.end() || it->second != cur_op)
+    {
+        return NULL;
+    }
+    pg.write_queue.erase(it++);
+    if (first && it != pg.write_queue.end() && it->first == cur_op->op_data->oid &&
+        it->second->op_data->st == 1)
+    {
+        return it->second;
+    }
+    return NULL;
+}
+
 void osd_t::continue_primary_write(osd_op_t *cur_op)
 {
     if (!cur_op->op_data && !prepare_primary_rw(cur_op))
@@ -62,6 +129,15 @@ void osd_t::continue_primary_write(osd_op_t *cur_op)
     {
         return;
     }
+    if (op_data->pipelined)
+    {
+        // The version is already known, so the object doesn't have to be read
+        op_data->prev_set = pg.cur_set.data();
+        op_data->stripes[0].write_start = op_data->stripes[0].req_start;
+        op_data->stripes[0].write_end = op_data->stripes[0].req_end;
+        op_data->stripes[0].write_buf = cur_op->buf;
+        goto pipelined;
+    }
 resume_1:
     // Determine blocks to read and write
     // Missing chunks are allowed to be overwritten even in incomplete objects
@@ -92,7 +168,7 @@ retry_1:
             op_data->stripes[0].read_start = 0;
             op_data->stripes[0].read_end = bs_block_size;
             assert(!cur_op->rmw_buf);
-            cur_op->rmw_buf = op_data->stripes[0].read_buf = memalign_or_die(MEM_ALIGNMENT, bs_block_size);
+            cur_op->rmw_buf = op_data->stripes[0].read_buf = pool_memalign(bs_block_size);
         }
     }
     else
@@ -155,7 +231,7 @@ resume_3:
             op_data->prev_set = op_data->object_state ? op_data->object_state->read_target.data() : pg.cur_set.data();
             if (cur_op->rmw_buf)
             {
-                free(cur_op->rmw_buf);
+                pool_free(cur_op->rmw_buf);
                 cur_op->rmw_buf = NULL;
             }
             goto retry_1;
@@ -173,6 +249,7 @@ resume_3:
         cur_op->reply.rw.version = op_data->fact_ver;
         goto continue_others;
     }
+pipelined:
     if (pg.scheme == POOL_SCHEME_REPLICATED)
     {
         // Set bitmap bits
@@ -284,11 +361,36 @@ resume_12:
             else
             {
                 pg.ver_override.erase(op_data->oid);
-                mark_partial_write(pg, op_data->oid, op_data->object_state, op_data->stripes, true);
+                if (op_data->pipelined)
+                {
+                    // Pipelined writes don't look up the object state, but previous writes
+                    // may have already marked the object as partially written in the meantime
+                    get_object_osd_set(pg, op_data->oid, &op_data->object_state);
+                    if (op_data->object_state)
+                    {
+                        op_data->object_state->ref_count++;
+                    }
+                }
+                op_data->object_state = mark_partial_write(pg, op_data->oid, op_data->object_state, op_data->stripes, true);
+                deref_object_state(pg, &op_data->object_state, true);
                 pg_cancel_write_queue(pg, cur_op, op_data->oid, op_data->errcode);
                 return;
             }
         }
+        if (op_data->done <= 0)
+        {
+            // The write didn't reach any OSD, but writes pipelined behind it are already sent
+            // with its version and object bitmap, so they also have to fail and be retried
+            for (auto it = pg.write_queue.find(op_data->oid); it != pg.write_queue.end() && it->first == op_data->oid; it++)
+            {
+                osd_primary_op_data_t *next_data = it->second->op_data;
+                if (next_data->pipelined && next_data->st != 1 && next_data->fact_ver >= op_data->target_ver &&
+                    !next_data->pipeline_errcode)
+                {
+                    next_data->pipeline_errcode = op_data->errcode;
+                }
+            }
+        }
         pg.ver_override.erase(op_data->oid);
         deref_object_state(pg, &op_data->object_state, true);
         pg_cancel_write_queue(pg, cur_op, op_data->oid, op_data->errcode);
@@ -395,19 +497,19 @@ resume_9:
             }
         }
     }
-    cur_op->reply.hdr.retval = cur_op->req.rw.len;
-    cur_op->reply.rw.version = op_data->fact_ver;
-continue_others:
-    osd_op_t *next_op = NULL;
-    auto next_it = pg.write_queue.find(op_data->oid);
-    // Remove the operation from queue before calling finish_op so it doesn't see the completed operation in queue
-    if (next_it != pg.write_queue.end() && next_it->second == cur_op)
+    if (op_data->pipeline_errcode)
     {
-        pg.write_queue.erase(next_it++);
-        if (next_it != pg.write_queue.end() && next_it->first == op_data->oid)
-            next_op = next_it->second;
+        // The write itself succeeded, but it carries the object bitmap of a failed previous write
+        cur_op->reply.hdr.retval = op_data->pipeline_errcode;
     }
-    // finish_op would invalidate next_it if it cleared pg.write_queue, but it doesn't do that :)
+    else
+    {
+        cur_op->reply.hdr.retval = cur_op->req.rw.len;
+        cur_op->reply.rw.version = op_data->fact_ver;
+    }
+continue_others:
+    // Remove the operation from queue before calling finish_op so it doesn't see the completed operation in queue
+    osd_op_t *next_op = pop_write_queue(pg, cur_op);
     finish_op(cur_op, cur_op->reply.hdr.retval);
     if (unstable_write_count >= autosync_writes)
     {
@@ -13,6 +13,7 @@ extern "C" {
 }
 #include <map>
 #include "allocator.h"
+#include "mem_pool.h"
 #include "xor.h"
 #include "osd_rmw.h"
 #include "malloc_or_die.h"
@@ -110,46 +111,28 @@ void reconstruct_stripes_xor(osd_rmw_stripe_t *stripes, int pg_size, uint32_t bi
     {
         if (stripes[role].read_end != 0 && stripes[role].missing)
         {
-            // Reconstruct missing stripe (XOR k+1)
-            int prev = -2;
+            // Reconstruct missing stripe (XOR k+1) in one pass
+            const void *data_ptrs[pg_size], *bmp_ptrs[pg_size];
+            int n = 0;
             for (int other = 0; other < pg_size; other++)
             {
                 if (other != role)
                 {
-                    if (prev == -2)
+                    if (stripes[role].read_end != UINT32_MAX)
                     {
-                        prev = other;
-                    }
-                    else if (prev >= 0)
-                    {
-                        if (stripes[role].read_end != UINT32_MAX)
-                        {
-                            assert(stripes[role].read_start >= stripes[prev].read_start &&
-                                stripes[role].read_start >= stripes[other].read_start);
-                            memxor(
-                                (uint8_t*)stripes[prev].read_buf + (stripes[role].read_start - stripes[prev].read_start),
-                                (uint8_t*)stripes[other].read_buf + (stripes[role].read_start - stripes[other].read_start),
-                                stripes[role].read_buf, stripes[role].read_end - stripes[role].read_start
-                            );
-                        }
-                        memxor(stripes[prev].bmp_buf, stripes[other].bmp_buf, stripes[role].bmp_buf, bitmap_size);
-                        prev = -1;
-                    }
-                    else
-                    {
-                        if (stripes[role].read_end != UINT32_MAX)
-                        {
-                            assert(stripes[role].read_start >= stripes[other].read_start);
-                            memxor(
-                                stripes[role].read_buf,
-                                (uint8_t*)stripes[other].read_buf + (stripes[role].read_start - stripes[other].read_start),
-                                stripes[role].read_buf, stripes[role].read_end - stripes[role].read_start
-                            );
-                        }
-                        memxor(stripes[role].bmp_buf, stripes[other].bmp_buf, stripes[role].bmp_buf, bitmap_size);
+                        assert(stripes[role].read_start >= stripes[other].read_start);
+                        data_ptrs[n] = (uint8_t*)stripes[other].read_buf + (stripes[role].read_start - stripes[other].read_start);
                     }
+                    bmp_ptrs[n] = stripes[other].bmp_buf;
+                    n++;
                 }
             }
+            if (n >= 2)
+            {
+                if (stripes[role].read_end != UINT32_MAX)
+                    memxor_multi(data_ptrs, n, stripes[role].read_buf, stripes[role].read_end - stripes[role].read_start);
+                memxor_multi(bmp_ptrs, n, stripes[role].bmp_buf, bitmap_size);
+            }
         }
     }
 }
@@ -617,7 +600,7 @@ void* alloc_read_buffer(osd_rmw_stripe_t *stripes, int read_pg_size, uint64_t ad
         }
     }
     // Allocate buffer
-    void *buf = memalign_or_die(MEM_ALIGNMENT, buf_size);
+    void *buf = pool_memalign(buf_size);
     uint64_t buf_pos = add_size;
     for (int role = 0; role < read_pg_size; role++)
     {
@@ -809,38 +792,6 @@ static void get_old_new_buffers(osd_rmw_stripe_t & stripe, uint32_t wr_start, ui
     }
 }
 
-static void xor_multiple_buffers(buf_len_t *xor1, int n1, buf_len_t *xor2, int n2, void *dest, uint32_t len)
-{
-    assert(n1 > 0 && n2 > 0);
-    int i1 = 0, i2 = 0;
-    uint32_t start1 = 0, start2 = 0, end1 = xor1[0].len, end2 = xor2[0].len;
-    uint32_t pos = 0;
-    while (pos < len)
-    {
-        // We know for sure that ranges overlap
-        uint32_t end = std::min(end1, end2);
-        memxor((uint8_t*)xor1[i1].buf + pos-start1, (uint8_t*)xor2[i2].buf + pos-start2, (uint8_t*)dest+pos, end-pos);
-        pos = end;
-        if (pos >= end1)
-        {
-            i1++;
-            if (i1 >= n1)
-            {
-                assert(pos >= end2);
-                return;
-            }
-            start1 = end1;
-            end1 += xor1[i1].len;
-        }
-        if (pos >= end2)
-        {
-            i2++;
-            start2 = end2;
-            end2 += xor2[i2].len;
-        }
-    }
-}
-
 static void calc_rmw_parity_copy_mod(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
     uint64_t *read_osd_set, uint64_t *write_osd_set, uint32_t chunk_size, uint32_t bitmap_granularity,
     uint32_t &start, uint32_t &end)
@@ -952,31 +903,48 @@ void calc_rmw_parity_xor(osd_rmw_stripe_t *stripes, int pg_size, uint64_t *read_
     calc_rmw_parity_copy_mod(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, bitmap_granularity, start, end);
     if (write_osd_set[pg_minsize] != 0 && end != 0)
     {
-        // Calculate new parity (XOR k+1)
-        int parity = pg_minsize, prev = -2;
-        for (int other = 0; other < pg_minsize; other++)
+        // Calculate new parity (XOR k+1) in one pass over all data chunks
+        int parity = pg_minsize;
+        if (pg_minsize >= 2)
         {
-            if (prev == -2)
+            buf_len_t bufs[pg_minsize][3];
+            int nbuf[pg_minsize], curbuf[pg_minsize];
+            uint32_t positions[pg_minsize];
+            const void *data_ptrs[pg_minsize];
+            for (int i = 0; i < pg_minsize; i++)
             {
-                prev = other;
+                nbuf[i] = 0;
+                curbuf[i] = 0;
+                get_old_new_buffers(stripes[i], start, end, bufs[i], nbuf[i]);
+                positions[i] = start;
+                data_ptrs[i] = stripes[i].bmp_buf;
             }
-            else
+            memxor_multi(data_ptrs, pg_minsize, stripes[parity].bmp_buf, bitmap_size);
+            uint32_t pos = start;
+            while (pos < end)
             {
-                int n1 = 0, n2 = 0;
-                buf_len_t xor1[3], xor2[3];
-                if (prev == -1)
+                uint32_t next_end = end;
+                for (int i = 0; i < pg_minsize; i++)
                 {
-                    xor1[n1++] = { .buf = stripes[parity].write_buf, .len = end-start };
-                    memxor(stripes[parity].bmp_buf, stripes[other].bmp_buf, stripes[parity].bmp_buf, bitmap_size);
+                    assert(curbuf[i] < nbuf[i]);
+                    assert(bufs[i][curbuf[i]].buf);
+                    data_ptrs[i] = (uint8_t*)bufs[i][curbuf[i]].buf + pos-positions[i];
+                    uint32_t this_end = bufs[i][curbuf[i]].len + positions[i];
+                    if (next_end > this_end)
+                        next_end = this_end;
                 }
-                else
+                assert(next_end > pos);
+                for (int i = 0; i < pg_minsize; i++)
                 {
-                    memxor(stripes[prev].bmp_buf, stripes[other].bmp_buf, stripes[parity].bmp_buf, bitmap_size);
-                    get_old_new_buffers(stripes[prev], start, end, xor1, n1);
-                    prev = -1;
+                    uint32_t this_end = bufs[i][curbuf[i]].len + positions[i];
+                    if (next_end >= this_end)
+                    {
+                        positions[i] += bufs[i][curbuf[i]].len;
+                        curbuf[i]++;
+                    }
                 }
-                get_old_new_buffers(stripes[other], start, end, xor2, n2);
-                xor_multiple_buffers(xor1, n1, xor2, n2, stripes[parity].write_buf, end-start);
+                memxor_multi(data_ptrs, pg_minsize, (uint8_t*)stripes[parity].write_buf + pos-start, next_end-pos);
+                pos = next_end;
             }
         }
     }
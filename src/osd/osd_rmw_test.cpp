@@ -189,7 +189,7 @@ void test4()
     check_pattern(stripes[2].write_buf, 4096, PATTERN0^PATTERN1); // new parity
     check_pattern(stripes[2].write_buf+4096, 128*1024-4096*2, 0); // new parity
     check_pattern(stripes[2].write_buf+128*1024-4096, 4096, PATTERN0^PATTERN1); // new parity
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
 }
 
@@ -230,7 +230,7 @@ void test5()
     assert(stripes[0].write_buf == write_buf);
     assert(stripes[1].write_buf == (uint8_t*)write_buf+128*1024);
     assert(stripes[2].write_buf == rmw_buf);
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
 }
 
@@ -267,7 +267,7 @@ void test6()
     assert(stripes[0].write_buf == write_buf);
     assert(stripes[1].write_buf == (uint8_t*)write_buf+128*1024);
     assert(stripes[2].write_buf == rmw_buf);
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
 }
 
@@ -325,7 +325,7 @@ void test7()
     check_pattern(stripes[2].write_buf, 4096, PATTERN0^PATTERN1); // new parity
     check_pattern(stripes[2].write_buf+4096, 128*1024-4096*2, 0); // new parity
     check_pattern(stripes[2].write_buf+128*1024-4096, 4096, PATTERN0^PATTERN1); // new parity
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
 }
 
@@ -388,7 +388,7 @@ void test_rmw_4k_degraded_into_lost_to_normal(bool ec)
     check_pattern(stripes[0].write_buf, 4096, PATTERN0);
     check_pattern(stripes[0].write_buf+48*1024, 4096, PATTERN2);
     check_pattern(stripes[2].write_buf, 4096, PATTERN2^PATTERN1); // new parity
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
 }
 
@@ -438,7 +438,7 @@ void test8()
     assert(stripes[2].write_buf == rmw_buf);                                 // recheck again
     check_pattern(stripes[2].write_buf, 4096, 0); // new parity
     check_pattern(stripes[2].write_buf+4096, 128*1024-4096, PATTERN0^PATTERN1); // new parity
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
 }
 
@@ -497,7 +497,7 @@ void test9()
     assert(stripes[2].write_buf == NULL);
     check_pattern(stripes[0].read_buf, 128*1024, PATTERN1);
     check_pattern(stripes[0].write_buf, 128*1024, PATTERN1);
-    free(rmw_buf);
+    pool_free(rmw_buf);
 }
 
 /***
@@ -552,7 +552,7 @@ void test10()
     assert(stripes[1].write_buf == (uint8_t*)write_buf+128*1024);
     assert(stripes[2].write_buf == rmw_buf);
     check_pattern(stripes[2].write_buf, 128*1024, PATTERN1^PATTERN2);
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
 }
 
@@ -608,7 +608,7 @@ void test11()
     assert(stripes[1].write_buf == write_buf);
     assert(stripes[2].write_buf == rmw_buf);
     check_pattern(stripes[2].write_buf, 128*1024, PATTERN1^PATTERN2);
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
 }
 
@@ -663,7 +663,7 @@ void test12()
     assert(stripes[1].write_buf == NULL);
     assert(stripes[2].write_buf == rmw_buf);
     check_pattern(stripes[2].write_buf, 128*1024, PATTERN1^PATTERN2);
-    free(rmw_buf);
+    pool_free(rmw_buf);
 }
 
 /***
@@ -757,7 +757,7 @@ void test13()
     check_pattern(stripes[0].read_buf+128*1024-4096, 4096, PATTERN3);
     check_pattern(stripes[1].read_buf, 4096, PATTERN3);
     check_pattern(stripes[1].read_buf+4096, 128*1024-4096, PATTERN2);
-    free(read_buf);
+    pool_free(read_buf);
     // Test 13.4 - partial decode (only 1st chunk) and verify
     memset(stripes, 0, sizeof(stripes));
     split_stripes(2, 128*1024, 0, 128*1024, stripes);
@@ -786,9 +786,9 @@ void test13()
     reconstruct_stripes_ec(stripes, 4, 2, 0);
     check_pattern(stripes[0].read_buf, 128*1024-4096, PATTERN1);
     check_pattern(stripes[0].read_buf+128*1024-4096, 4096, PATTERN3);
-    free(read_buf);
+    pool_free(read_buf);
     // Huh done
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
     use_ec(4, 2, false);
 }
@@ -885,9 +885,9 @@ void test14()
     reconstruct_stripes_ec(stripes, 3, 2, bmp);
     check_pattern(stripes[0].read_buf, 128*1024-4096, PATTERN1);
     check_pattern(stripes[0].read_buf+128*1024-4096, 4096, PATTERN3);
-    free(read_buf);
+    pool_free(read_buf);
     // Huh done
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
     use_ec(3, 2, false);
 }
@@ -959,7 +959,7 @@ void test15(bool second)
     // first parity is always xor :), second isn't...
     check_pattern(stripes[2+second].write_buf, 4*1024, second ? 0xb79a59a0ce8b9b81 : PATTERN1^PATTERN2);
     // Done
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
     use_ec(4, 2, false);
 }
@@ -1065,9 +1065,9 @@ void test16()
     assert(*(uint32_t*)stripes[3].bmp_buf == 0xF1F1F1F1);
     assert(bitmaps[0] == 0xFFFFFFFF);
     check_pattern(stripes[0].read_buf, 128*1024, PATTERN1);
-    free(read_buf);
+    pool_free(read_buf);
     // Done
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
     use_ec(4, 2, false);
 }
@@ -1182,7 +1182,7 @@ void test_ec43_error_bruteforce()
     res = ec_find_good(stripes, 7, 7, 4, false, 4096, 0, 100, true);
     assert_eq_vec(res, std::vector<int>());
     // Done
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
     use_ec(7, 4, false);
 }
@@ -1339,9 +1339,9 @@ void test_recover_22()
     assert(bitmaps[0] == 0xFFFFFFFF);
     assert(*(uint32_t*)stripes[1].bmp_buf == 0xFFFFFFFF);
     check_pattern(stripes[1].read_buf, 128*1024, PATTERN2);
-    free(read_buf);
+    pool_free(read_buf);
     // Done
-    free(rmw_buf);
+    pool_free(rmw_buf);
     free(write_buf);
     use_ec(4, 2, false);
 }
@@ -136,6 +136,7 @@ void osd_t::exec_secondary_real(osd_op_t *cur_op)
         : (cur_op->req.hdr.opcode == OSD_OP_SEC_DELETE ? BS_OP_DELETE
         : (cur_op->req.hdr.opcode == OSD_OP_SEC_LIST ? BS_OP_LIST
         : -1))))))));
+    cur_op->bs_op->qos_class = cur_op->is_recovery_related() ? BS_QOS_RECOVERY : BS_QOS_CLIENT;
     if (cur_op->req.hdr.opcode == OSD_OP_SEC_READ ||
         cur_op->req.hdr.opcode == OSD_OP_SEC_WRITE ||
         cur_op->req.hdr.opcode == OSD_OP_SEC_WRITE_STABLE)
@@ -151,11 +152,11 @@ void osd_t::exec_secondary_real(osd_op_t *cur_op)
         {
             // Allocate memory for the read operation
             if (clean_entry_bitmap_size > sizeof(unsigned))
-                cur_op->bitmap = cur_op->rmw_buf = malloc_or_die(clean_entry_bitmap_size);
+                cur_op->bitmap = cur_op->rmw_buf = pool_alloc(clean_entry_bitmap_size);
             else
                 cur_op->bitmap = &cur_op->bmp_data;
             if (cur_op->req.sec_rw.len > 0)
-                cur_op->buf = memalign_or_die(MEM_ALIGNMENT, cur_op->req.sec_rw.len);
+                cur_op->buf = pool_memalign(cur_op->req.sec_rw.len);
         }
         cur_op->bs_op->oid = cur_op->req.sec_rw.oid;
         cur_op->bs_op->version = cur_op->req.sec_rw.version;
@@ -241,28 +242,39 @@ void osd_t::exec_sec_read_bmp(osd_op_t *cur_op)
 {
     auto cl = msgr.clients.at(cur_op->peer_fd);
     int n = cur_op->req.sec_read_bmp.len / sizeof(obj_ver_id);
-    if (n > 0)
+    if (n <= 0)
+    {
+        finish_op(cur_op, 0);
+        return;
+    }
+    obj_ver_id *ov = (obj_ver_id*)cur_op->buf;
+    if (!(cur_op->req.sec_read_bmp.flags & OSD_OP_IGNORE_PG_LOCK))
     {
-        obj_ver_id *ov = (obj_ver_id*)cur_op->buf;
-        void *reply_buf = malloc_or_die(n * (8 + clean_entry_bitmap_size));
-        void *cur_buf = reply_buf;
         for (int i = 0; i < n; i++)
         {
-            if (!sec_check_pg_lock(cl->in_osd_num, ov[i].oid) &&
-                !(cur_op->req.sec_read_bmp.flags & OSD_OP_IGNORE_PG_LOCK))
+            if (!sec_check_pg_lock(cl->in_osd_num, ov[i].oid))
             {
-                free(reply_buf);
-                cur_op->bs_op->retval = -EPIPE;
-                secondary_op_callback(cur_op);
+                finish_op(cur_op, -EPIPE);
                 return;
             }
-            bs->read_bitmap(ov[i].oid, ov[i].version, (uint8_t*)cur_buf + sizeof(uint64_t), (uint64_t*)cur_buf);
-            cur_buf = (uint8_t*)cur_buf + (8 + clean_entry_bitmap_size);
         }
-        free(cur_op->buf);
-        cur_op->buf = reply_buf;
     }
-    finish_op(cur_op, n * (8 + clean_entry_bitmap_size));
+    // Bitmaps are read by the blockstore asynchronously because they may belong to other shards
+    cur_op->bs_op = new blockstore_op_t();
+    cur_op->bs_op->opcode = BS_OP_READ_BITMAP;
+    cur_op->bs_op->len = n;
+    cur_op->bs_op->buf = cur_op->buf;
+    cur_op->bs_op->bitmap = malloc_or_die(n * (8 + clean_entry_bitmap_size));
+    cur_op->bs_op->callback = [this, cur_op](blockstore_op_t *bs_op)
+    {
+        int retval = bs_op->retval < 0 ? bs_op->retval : bs_op->len * (8 + clean_entry_bitmap_size);
+        pool_free(cur_op->buf);
+        cur_op->buf = bs_op->bitmap;
+        delete bs_op;
+        cur_op->bs_op = NULL;
+        finish_op(cur_op, retval);
+    };
+    bs->enqueue_op(cur_op->bs_op);
 }
 
 // Lock/Unlock PG
@@ -338,6 +350,7 @@ void osd_t::exec_show_config(osd_op_t *cur_op)
         cl->check_sequencing = true;
         cl->read_op_id = cur_op->req.hdr.id + 1;
     }
+    cl->accepts_batches = req_json["features"]["op_batching"].bool_value();
     // Expose sensitive configuration values so peers can check them
     json11::Json::object wire_config = json11::Json::object {
         { "osd_num", osd_num },
@@ -350,7 +363,7 @@ void osd_t::exec_show_config(osd_op_t *cur_op)
         { "immediate_commit", (immediate_commit == IMMEDIATE_ALL ? "all" :
             (immediate_commit == IMMEDIATE_SMALL ? "small" : "none")) },
         { "lease_timeout", etcd_report_interval+(st_cli.max_etcd_attempts*(2*st_cli.etcd_quick_timeout)+999)/1000 },
-        { "features", json11::Json::object{ { "pg_locks", true } } },
+        { "features", json11::Json::object{ { "pg_locks", true }, { "op_batching", true } } },
     };
 #ifdef WITH_RDMA
     if (msgr.is_rdma_enabled())
@@ -371,7 +384,7 @@ void osd_t::exec_show_config(osd_op_t *cur_op)
     }
 #endif
     if (cur_op->buf)
-        free(cur_op->buf);
+        pool_free(cur_op->buf);
     std::string cfg_str = json11::Json(wire_config).dump();
     cur_op->buf = malloc_or_die(cfg_str.size()+1);
     memcpy(cur_op->buf, cfg_str.c_str(), cfg_str.size()+1);
@@ -1,8 +1,13 @@
 // Copyright (c) Vitaliy Filippov, 2019+
 // License: VNPL-1.1 (see README.md for details)
 
+// Allocator tests. Run with "bench [blocks]" to benchmark allocation at high fill levels
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
 #include "allocator.h"
 
 void alloc_all(int size)
@@ -39,10 +44,209 @@ void alloc_all(int size)
     delete a;
 }
 
+static uint64_t rnd_state = 1;
+
+static uint64_t rnd()
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+// Compare find_free(hint), set_range() and get_free_extents() with a plain bitmap
+void check_random(int size, int fill_pct)
+{
+    allocator_t *a = new allocator_t(size);
+    std::vector<bool> used(size);
+    uint64_t used_count = 0;
+    for (int i = 0; i < size; i++)
+    {
+        if (rnd() % 100 < fill_pct)
+        {
+            a->set(i, true);
+            used[i] = true;
+            used_count++;
+        }
+    }
+    for (int iter = 0; iter < (size > 10000 ? 200 : 2000); iter++)
+    {
+        uint64_t hint = rnd() % (size+10);
+        // find_free with a hint
+        uint64_t expected = UINT64_MAX;
+        for (uint64_t i = 0; i < size; i++)
+        {
+            uint64_t j = (i + (hint < size ? hint : 0)) % size;
+            if (!used[j])
+            {
+                expected = j;
+                break;
+            }
+        }
+        uint64_t x = a->find_free(hint);
+        if (x != expected)
+        {
+            printf("find_free(%ju) in %d blocks: expected %jx, got %jx\n", hint, size, expected, x);
+            exit(1);
+        }
+        // set_range
+        uint64_t start = rnd() % size, len = rnd() % 200;
+        bool value = rnd() % 2;
+        a->set_range(start, len, value);
+        for (uint64_t i = start; i < start+len && i < size; i++)
+        {
+            if (used[i] != value)
+                used_count += value ? 1 : -1;
+            used[i] = value;
+        }
+        if (a->get_free_count() != size-used_count)
+        {
+            printf("free count after set_range(%ju, %ju, %d): expected %ju, got %ju\n",
+                start, len, value, size-used_count, a->get_free_count());
+            exit(1);
+        }
+    }
+    // get_free_extents
+    uint64_t extents = 0, max_extent = 0, cur = 0;
+    for (int i = 0; i <= size; i++)
+    {
+        if (i < size && !used[i])
+            cur++;
+        else if (cur > 0)
+        {
+            extents++;
+            max_extent = cur > max_extent ? cur : max_extent;
+            cur = 0;
+        }
+    }
+    uint64_t got_extents, got_max;
+    a->get_free_extents(&got_extents, &got_max);
+    if (got_extents != extents || got_max != max_extent)
+    {
+        printf("get_free_extents in %d blocks: expected %ju/%ju, got %ju/%ju\n", size, extents, max_extent, got_extents, got_max);
+        exit(1);
+    }
+    delete a;
+}
+
+// Compare bitmap_set(), bitmap_clear() and bitmap_check() with a plain bit-by-bit loop
+void check_bitmap_ops(uint64_t granularity)
+{
+    const int bits = 300;
+    uint8_t bitmap[bits/8+1] = {}, expected[bits/8+1] = {};
+    for (int iter = 0; iter < 20000; iter++)
+    {
+        uint64_t start = (rnd() % bits) * granularity, len = (1 + rnd() % (bits - start/granularity)) * granularity;
+        if (rnd() % 2)
+        {
+            // Unaligned start and end are rounded outwards
+            uint64_t end = start + len - rnd() % granularity;
+            start += rnd() % granularity;
+            len = end > start ? end-start : 1;
+        }
+        uint64_t bit_start = start/granularity, bit_end = (start+len+granularity-1)/granularity;
+        int op = rnd() % 3;
+        if (op == 2)
+        {
+            bool r = false;
+            for (uint64_t i = bit_start; i < bit_end; i++)
+                r = r || (expected[i/8] & (1 << (i%8)));
+            if (bitmap_check(bitmap, start, len, granularity) != r)
+            {
+                printf("bitmap_check(%ju, %ju, %ju) returned %d\n", start, len, granularity, !r);
+                exit(1);
+            }
+            continue;
+        }
+        for (uint64_t i = bit_start; i < bit_end; i++)
+        {
+            if (op)
+                expected[i/8] |= (1 << (i%8));
+            else
+                expected[i/8] &= ~(1 << (i%8));
+        }
+        if (op)
+            bitmap_set(bitmap, start, len, granularity);
+        else
+            bitmap_clear(bitmap, start, len, granularity);
+        if (memcmp(bitmap, expected, sizeof(bitmap)) != 0)
+        {
+            printf("bitmap_%s(%ju, %ju, %ju) result differs\n", op ? "set" : "clear", start, len, granularity);
+            exit(1);
+        }
+    }
+}
+
+static double now()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec + tv.tv_nsec/1000000000.0;
+}
+
+// Fill the allocator to <fill_pct>% randomly, then allocate and free blocks in a loop
+void bench_fill(uint64_t size, int fill_pct)
+{
+    allocator_t *a = new allocator_t(size);
+    uint64_t target = size*fill_pct/100;
+    while (size-a->get_free_count() < target)
+    {
+        a->set(rnd() % size, true);
+    }
+    uint64_t extents, max_extent;
+    a->get_free_extents(&extents, &max_extent);
+    uint64_t ops = 0, failed = 0, hint = 0;
+    double start = now();
+    while (now()-start < 1)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            uint64_t x = a->find_free(hint);
+            if (x == UINT64_MAX)
+            {
+                failed++;
+                continue;
+            }
+            a->set(x, true);
+            hint = x+1;
+            // Free a random used block to keep the fill level
+            uint64_t y;
+            do
+            {
+                y = rnd() % size;
+            } while (!a->get(y));
+            a->set(y, false);
+            ops++;
+        }
+    }
+    double t = now()-start;
+    printf("%ju blocks %d%% full, %ju free extents (max %ju): %.2f M allocs/s, %ju failed\n",
+        size, fill_pct, extents, max_extent, ops/t/1000000, failed);
+    delete a;
+}
+
 int main(int narg, char *args[])
 {
+    if (narg > 1 && !strcmp(args[1], "bench"))
+    {
+        uint64_t size = narg > 2 ? strtoull(args[2], NULL, 10) : 8*1024*1024;
+        for (int fill: { 50, 90, 95, 99 })
+        {
+            bench_fill(size, fill);
+        }
+        return 0;
+    }
+    check_bitmap_ops(1);
+    check_bitmap_ops(4096);
     alloc_all(8192);
     alloc_all(8062);
     alloc_all(4096);
+    for (int size: { 2, 63, 64, 65, 4096, 4097, 8062, 262144+100 })
+    {
+        for (int fill: { 0, 50, 90, 100 })
+        {
+            check_random(size, fill);
+        }
+    }
     return 0;
 }
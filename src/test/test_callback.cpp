@@ -0,0 +1,106 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// callback_t tests
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <memory>
+#include "callback.h"
+
+struct test_op_t
+{
+    int calls = 0;
+};
+
+static void inc_op(test_op_t *op)
+{
+    op->calls++;
+}
+
+int main(int narg, char *args[])
+{
+    test_op_t op;
+    // Small lambdas, copies and function pointers
+    int n = 0;
+    callback_t<void(test_op_t*)> cb = [&n](test_op_t *op) { op->calls++; n++; };
+    cb(&op);
+    auto cb2 = cb;
+    cb2(&op);
+    if (op.calls != 2 || n != 2)
+    {
+        printf("inline lambda or its copy is not called: calls=%d n=%d\n", op.calls, n);
+        exit(1);
+    }
+    cb = inc_op;
+    cb(&op);
+    if (op.calls != 3)
+    {
+        printf("function pointer is not called: calls=%d\n", op.calls);
+        exit(1);
+    }
+    // Large captures are moved to the heap
+    std::string str(100, 'x');
+    cb = [str](test_op_t *op) { op->calls += str.size(); };
+    cb2 = std::move(cb);
+    if (cb || !cb2)
+    {
+        printf("callback is not moved\n");
+        exit(1);
+    }
+    cb2(&op);
+    if (op.calls != 103)
+    {
+        printf("heap lambda is not called: calls=%d\n", op.calls);
+        exit(1);
+    }
+    // Conversion from and to std::function
+    std::function<void(test_op_t*)> fn = cb2;
+    fn(&op);
+    cb = fn;
+    cb(&op);
+    if (op.calls != 303)
+    {
+        printf("std::function conversion is broken: calls=%d\n", op.calls);
+        exit(1);
+    }
+    fn = NULL;
+    cb = fn;
+    if (cb)
+    {
+        printf("empty std::function gives a non-empty callback\n");
+        exit(1);
+    }
+    cb = NULL;
+    if (cb)
+    {
+        printf("callback is not reset by NULL\n");
+        exit(1);
+    }
+    // Captured objects are destroyed with the callback
+    auto ptr = std::make_shared<int>(1);
+    {
+        callback_t<int()> get = [ptr]() { return *ptr; };
+        callback_t<int()> get2 = get;
+        if (get2() != 1 || ptr.use_count() != 3)
+        {
+            printf("captured object is not copied: use_count=%ld\n", ptr.use_count());
+            exit(1);
+        }
+        get.swap(get2);
+        get2 = nullptr;
+        if (ptr.use_count() != 2)
+        {
+            printf("captured object is not destroyed on reset: use_count=%ld\n", ptr.use_count());
+            exit(1);
+        }
+    }
+    if (ptr.use_count() != 1)
+    {
+        printf("captured object is not destroyed with the callback: use_count=%ld\n", ptr.use_count());
+        exit(1);
+    }
+    printf("OK\n");
+    return 0;
+}
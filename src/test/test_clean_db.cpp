@@ -0,0 +1,243 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// clean_db tests: random operations in the usual and compact mode compared with std::map.
+// Run with "bench [entries]" to compare memory usage and lookup time of both modes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <vector>
+#include "blockstore_clean_db.h"
+
+#define BLOCK_ORDER 17
+#define POOL_SHIFT 48
+
+typedef std::map<object_id, clean_entry> ref_map_t;
+
+static uint64_t rnd_state = 1;
+
+static uint64_t rnd()
+{
+    rnd_state = rnd_state*6364136223846793005ull + 1442695040888963407ull;
+    return rnd_state >> 16;
+}
+
+static double now()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec + tv.tv_nsec/1000000000.0;
+}
+
+// Mostly compact-encodable keys and entries, but also ones of other pools, with large
+// inode numbers, large block numbers and large part numbers which go to the full tree
+static object_id random_oid()
+{
+    uint64_t r = rnd() % 100;
+    uint64_t pool = r < 90 ? 1 : (r < 95 ? 2 : 0);
+    uint64_t inode = rnd() % 8;
+    if (r == 95)
+        inode |= 0x100000000ul;
+    uint64_t block = rnd() % 64;
+    if (r == 96)
+        block |= 0x100000000ul;
+    uint64_t part = rnd() % 3;
+    if (r == 97)
+        part = 0x100 + rnd() % 4;
+    return (object_id){
+        .inode = (pool << POOL_SHIFT) | inode,
+        .stripe = (block << BLOCK_ORDER) | part,
+    };
+}
+
+static clean_entry random_entry()
+{
+    uint64_t r = rnd() % 100;
+    uint64_t version = 1 + rnd() % 1000;
+    if (r == 0)
+        version |= 0x100000000ul;
+    uint64_t location = (rnd() % 1000) << BLOCK_ORDER;
+    if (r == 1)
+        location |= 512;
+    if (r == 2)
+        location |= 0x100000000ul << BLOCK_ORDER;
+    return (clean_entry){ .version = version, .location = location };
+}
+
+static void fail(const char *mode, uint64_t step, const char *what)
+{
+    printf("%s mode, step %ju: %s\n", mode, step, what);
+    exit(1);
+}
+
+static bool same(blockstore_clean_db_t::iterator it, blockstore_clean_db_t & db, ref_map_t::iterator ref_it, ref_map_t & ref)
+{
+    if (it == db.end() || ref_it == ref.end())
+        return (it == db.end()) == (ref_it == ref.end());
+    return it->first == ref_it->first &&
+        it->second.version == ref_it->second.version &&
+        it->second.location == ref_it->second.location;
+}
+
+static void check_all(blockstore_clean_db_t & db, ref_map_t & ref, const char *mode, uint64_t step)
+{
+    if (db.size() != ref.size())
+        fail(mode, step, "size mismatch");
+    auto it = db.begin();
+    for (auto ref_it = ref.begin(); ref_it != ref.end(); ref_it++, it++)
+    {
+        if (!same(it, db, ref_it, ref))
+            fail(mode, step, "iteration mismatch");
+    }
+    if (it != db.end())
+        fail(mode, step, "extra entries at the end of iteration");
+}
+
+static void check_random(bool compact)
+{
+    const char *mode = compact ? "compact" : "usual";
+    blockstore_clean_db_t db, other;
+    ref_map_t ref, other_ref;
+    if (compact)
+    {
+        db.set_compact(BLOCK_ORDER);
+        other.set_compact(BLOCK_ORDER);
+    }
+    rnd_state = 1;
+    for (uint64_t step = 0; step < 200000; step++)
+    {
+        uint64_t op = rnd() % 100;
+        object_id oid = random_oid();
+        if (op < 40)
+        {
+            clean_entry e = random_entry();
+            db.set(oid, e);
+            ref[oid] = e;
+        }
+        else if (op < 55)
+        {
+            if (db.erase(oid) != ref.erase(oid))
+                fail(mode, step, "erase(oid) result mismatch");
+        }
+        else if (op < 60)
+        {
+            auto it = db.find(oid);
+            auto ref_it = ref.find(oid);
+            if (!same(it, db, ref_it, ref))
+                fail(mode, step, "find mismatch");
+            if (it != db.end())
+            {
+                it = db.erase(it);
+                ref_it = ref.erase(ref_it);
+                if (!same(it, db, ref_it, ref))
+                    fail(mode, step, "erase(iterator) result mismatch");
+            }
+        }
+        else if (op < 75)
+        {
+            auto it = db.lower_bound(oid);
+            auto ref_it = ref.lower_bound(oid);
+            for (int i = 0; i < 4 && ref_it != ref.end(); i++, it++, ref_it++)
+            {
+                if (!same(it, db, ref_it, ref))
+                    fail(mode, step, "lower_bound mismatch");
+            }
+        }
+        else if (op < 90)
+        {
+            auto it = db.upper_bound(oid);
+            auto ref_it = ref.upper_bound(oid);
+            for (int i = 0; i < 4 && ref_it != ref.end(); i++, it++, ref_it++)
+            {
+                if (!same(it, db, ref_it, ref))
+                    fail(mode, step, "upper_bound mismatch");
+            }
+        }
+        else if (op < 98)
+        {
+            // Ordered insert with the end() hint, like loading metadata from the disk
+            if (!other.size() || !(oid < (--other_ref.end())->first) && !(oid == (--other_ref.end())->first))
+            {
+                clean_entry e = random_entry();
+                other.insert(other.end(), std::make_pair(oid, e));
+                other_ref[oid] = e;
+            }
+        }
+        else if (op < 99)
+        {
+            db.swap(other);
+            ref.swap(other_ref);
+        }
+        else if (rnd() % 10 == 0)
+        {
+            db.clear();
+            ref.clear();
+        }
+        if (step % 10000 == 0)
+        {
+            check_all(db, ref, mode, step);
+            check_all(other, other_ref, mode, step);
+        }
+    }
+    check_all(db, ref, mode, 200000);
+    check_all(other, other_ref, mode, 200000);
+    if (compact && !db.compact_size() && !other.compact_size())
+        fail(mode, 200000, "compact tree is not used");
+    if (!compact && (db.compact_size() || other.compact_size()))
+        fail(mode, 200000, "compact tree is used in the usual mode");
+}
+
+static void bench(uint64_t count)
+{
+    std::vector<object_id> oids;
+    oids.reserve(count);
+    for (uint64_t i = 0; i < count; i++)
+    {
+        // 3 replicas/parts of sequential blocks of 16 inodes, like a PG of an EC 2+1 pool
+        oids.push_back((object_id){
+            .inode = (1ul << POOL_SHIFT) | (i/3 % 16),
+            .stripe = ((i/48) << BLOCK_ORDER) | (i % 3),
+        });
+    }
+    for (int compact = 0; compact < 2; compact++)
+    {
+        blockstore_clean_db_t db;
+        if (compact)
+            db.set_compact(BLOCK_ORDER);
+        for (uint64_t i = 0; i < count; i++)
+            db.set(oids[i], (clean_entry){ .version = 1+i%7, .location = i << BLOCK_ORDER });
+        uint64_t sum = 0;
+        rnd_state = 1;
+        double start = now();
+        for (uint64_t i = 0; i < count; i++)
+        {
+            auto it = db.find(oids[rnd() % count]);
+            sum += it->second.version;
+        }
+        double t = now()-start;
+        if (!sum)
+            printf("impossible\n");
+        printf("%-7s clean_db: %ju entries, %.2f MB (%.1f bytes per entry), %.1f ns/lookup\n",
+            compact ? "compact" : "usual", count, db.bytes_used()/1024.0/1024.0,
+            (double)db.bytes_used()/count, t*1e9/count);
+    }
+}
+
+int main(int narg, char *args[])
+{
+    if (narg > 1 && !strcmp(args[1], "bench"))
+    {
+        uint64_t count = narg > 2 ? strtoull(args[2], NULL, 10) : 10000000;
+        if (count < 1)
+            count = 1;
+        bench(count);
+        return 0;
+    }
+    check_random(false);
+    check_random(true);
+    printf("OK\n");
+    return 0;
+}
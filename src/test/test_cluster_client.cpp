@@ -156,22 +156,18 @@ void check_op_count(cluster_client_t *cli, osd_num_t osd_num, int ops)
 osd_op_t *find_op(cluster_client_t *cli, osd_num_t osd_num, uint64_t opcode, uint64_t offset, uint64_t len)
 {
     int peer_fd = cli->msgr.osd_peer_fds.at(osd_num);
-    auto op_it = cli->msgr.clients[peer_fd]->sent_ops.begin();
-    while (op_it != cli->msgr.clients[peer_fd]->sent_ops.end())
+    auto sent_ops = cli->msgr.clients[peer_fd]->sent_ops.list();
+    for (auto op: sent_ops)
     {
-        auto op = op_it->second;
         if (op->req.hdr.opcode == opcode && (opcode == OSD_OP_SYNC ||
             op->req.rw.inode == 0x1000000000001 && op->req.rw.offset == offset && op->req.rw.len == len))
         {
             return op;
         }
-        op_it++;
     }
-    op_it = cli->msgr.clients[peer_fd]->sent_ops.begin();
-    while (op_it != cli->msgr.clients[peer_fd]->sent_ops.end())
+    for (auto op: sent_ops)
     {
-        printf("Found opcode %ju offset %jx size %x\n", op_it->second->req.hdr.opcode, op_it->second->req.rw.offset, op_it->second->req.rw.len);
-        op_it++;
+        printf("Found opcode %ju offset %jx size %x\n", op->req.hdr.opcode, op->req.rw.offset, op->req.rw.len);
     }
     printf("Not found opcode %ju offset %jx size %jx\n", opcode, offset, len);
     return NULL;
@@ -190,7 +186,7 @@ void pretend_op_completed(cluster_client_t *cli, osd_op_t *op, int64_t retval)
     op->reply.hdr.opcode = op->req.hdr.opcode;
     op->reply.hdr.retval = retval < 0 ? retval : (op->req.hdr.opcode == OSD_OP_SYNC ? 0 : op->req.rw.len);
     // Copy lambda to be unaffected by `delete op`
-    std::function<void(osd_op_t*)>(op->callback)(op);
+    callback_t<void(osd_op_t*)>(op->callback)(op);
 }
 
 void test1()
@@ -265,9 +261,8 @@ void test1()
         uint64_t replay_end = 0;
         std::vector<osd_op_t*> replay_ops;
         auto osd_cl = cli->msgr.clients.at(cli->msgr.osd_peer_fds.at(1));
-        for (auto & op_p: osd_cl->sent_ops)
+        for (auto op: osd_cl->sent_ops.list())
         {
-            auto op = op_p.second;
             assert(op->req.hdr.opcode == OSD_OP_WRITE);
             uint64_t offset = op->req.rw.offset;
             if (op->req.rw.offset < replay_start)
@@ -1,17 +1,166 @@
 // Copyright (c) Vitaliy Filippov, 2019+
 // License: VNPL-1.1 (see README.md for details)
 
+// Prints CRC-32C of stdin. Run with "test" to check all implementations against each other
+// and with "bench [size] [block_size]" to benchmark them
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
+#include <initializer_list>
 
 #include "malloc_or_die.h"
 #include "errno.h"
 #include "crc32c.h"
 
+static const char *impl_names[] = { "auto", "software", "sse4.2", "pclmulqdq", "avx512-vpclmulqdq" };
+
+static uint64_t rnd_state = 1;
+
+static uint64_t rnd()
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+static double now()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec + tv.tv_nsec/1000000000.0;
+}
+
+static void check(bool ok, const char *what, int impl, size_t len, size_t offset)
+{
+    if (!ok)
+    {
+        printf("%s mismatch with %s implementation, len=%zu offset=%zu\n", what, impl_names[impl], len, offset);
+        exit(1);
+    }
+}
+
+// Compare every implementation with the software one
+static void test_all()
+{
+    const size_t bufsize = 256*1024;
+    uint8_t *buf = (uint8_t*)malloc_or_die(bufsize);
+    uint8_t *zeros = (uint8_t*)malloc_or_die(bufsize);
+    memset(zeros, 0, bufsize);
+    for (size_t i = 0; i < bufsize; i++)
+        buf[i] = rnd();
+    uint32_t blocks[64], ref_blocks[64];
+    int max = crc32c_select(4);
+    for (int impl = 2; impl <= max; impl++)
+    {
+        for (int iter = 0; iter < 3000; iter++)
+        {
+            size_t len = rnd() % (iter < 2000 ? 1100 : 70000);
+            size_t offset = rnd() % 64;
+            uint32_t init = iter % 2 ? rnd() : 0;
+            crc32c_select(1);
+            uint32_t ref = crc32c(init, buf+offset, len);
+            uint32_t ref_zeros = crc32c(init, zeros, len);
+            crc32c_select(impl);
+            check(crc32c(init, buf+offset, len) == ref, "crc32c", impl, len, offset);
+            check(crc32c_append_zeros(init, len) == ref_zeros, "crc32c_append_zeros", impl, len, offset);
+            size_t split = len ? rnd() % len : 0;
+            uint32_t crc1 = crc32c(init, buf+offset, split);
+            uint32_t crc2 = crc32c(0, buf+offset+split, len-split);
+            check(crc32c_combine(crc1, crc2, len-split) == ref, "crc32c_combine", impl, len, split);
+            check(crc32c(crc1, buf+offset+split, len-split) == ref, "crc32c continuation", impl, len, split);
+        }
+        for (size_t block_size: { 8, 24, 512, 4096, 32768 })
+        {
+            for (size_t count: { 1, 2, 3, 4, 5, 7 })
+            {
+                crc32c_select(1);
+                for (size_t i = 0; i < count; i++)
+                    ref_blocks[i] = crc32c(0, buf+3+i*block_size, block_size);
+                crc32c_select(impl);
+                crc32c_blocks(blocks, buf+3, block_size, count);
+                check(!memcmp(blocks, ref_blocks, count*4), "crc32c_blocks", impl, block_size, count);
+            }
+        }
+        // crc32c_pad() must be equal to CRC-32C of a zero-padded buffer
+        memcpy(zeros+4096+5, buf, 8192);
+        check(crc32c_pad(0, buf, 8192, 4096+5, 12288-5) == crc32c(0, zeros, 8192*3), "crc32c_pad", impl, 8192, 4096+5);
+        check(crc32c_pad(0, buf, 8192, 0, 100) == crc32c(0, zeros+4096+5, 8192+100), "crc32c_pad", impl, 8192, 0);
+        memset(zeros+4096+5, 0, 8192);
+    }
+    free(zeros);
+    free(buf);
+}
+
+static void bench(size_t size, size_t block_size)
+{
+    uint8_t *buf = (uint8_t*)malloc_or_die(size);
+    uint32_t *crcs = (uint32_t*)malloc_or_die(sizeof(uint32_t) * (size/block_size));
+    for (size_t i = 0; i < size; i++)
+        buf[i] = rnd();
+    int max = crc32c_select(4);
+    for (int impl = 1; impl <= max; impl++)
+    {
+        crc32c_select(impl);
+        uint64_t bytes = 0;
+        uint32_t r = 0;
+        double start = now(), t;
+        while ((t = now()-start) < 0.5)
+        {
+            for (int i = 0; i < 100; i++)
+                r = crc32c(r, buf, size);
+            bytes += size*100;
+        }
+        printf("%-18s crc32c(%zu): %.2f GB/s", impl_names[impl], size, bytes/t/1e9);
+        bytes = 0;
+        start = now();
+        while ((t = now()-start) < 0.5)
+        {
+            for (int i = 0; i < 100; i++)
+                crc32c_blocks(crcs, buf, block_size, size/block_size);
+            bytes += size/block_size*block_size*100;
+        }
+        printf(", crc32c_blocks(%zu x %zu): %.2f GB/s", size/block_size, block_size, bytes/t/1e9);
+        // Padding with block_size-512 zeros: the way it's done in calc_block_checksums
+        uint64_t ops = 0;
+        start = now();
+        while ((t = now()-start) < 0.5)
+        {
+            for (int i = 0; i < 1000; i++)
+                r = crc32c_pad(r, buf, 512, 0, block_size-512);
+            ops += 1000;
+        }
+        printf(", crc32c_pad(512+%zu): %.2f M/s\n", block_size-512, ops/t/1e6);
+        if (r == 1)
+            printf("\n");
+    }
+    free(crcs);
+    free(buf);
+}
+
 int main(int narg, char *args[])
 {
+    if (narg > 1 && !strcmp(args[1], "test"))
+    {
+        test_all();
+        return 0;
+    }
+    if (narg > 1 && !strcmp(args[1], "bench"))
+    {
+        size_t size = narg > 2 ? strtoull(args[2], NULL, 10) : 128*1024;
+        size_t block_size = narg > 3 ? strtoull(args[3], NULL, 10) : 4096;
+        if (!size || block_size < 512 || block_size > size)
+        {
+            fprintf(stderr, "USAGE: %s bench [size] [block_size >= 512]\n", args[0]);
+            return 1;
+        }
+        bench(size, block_size);
+        return 0;
+    }
     int bufsize = 65536;
     uint8_t *buf = (uint8_t*)malloc_or_die(bufsize);
     uint32_t csum = 0;
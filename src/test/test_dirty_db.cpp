@@ -0,0 +1,114 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// dirty_db microbenchmark: insert, lookup and range-erase throughput
+// of blockstore_dirty_db_t compared to std::map
+// Usage: test_dirty_db [entries=10000000] [versions_per_object=4]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+#include "blockstore_impl.h"
+
+static double now()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec + tv.tv_nsec/1000000000.0;
+}
+
+static void report(const char *db_name, const char *test_name, uint64_t count, double start)
+{
+    double t = now()-start;
+    printf("%-9s %-12s %ju entries in %.3f s: %.2f M/s\n", db_name, test_name, count, t, count/t/1000000);
+}
+
+template<class T> void bench_db(const char *db_name, const std::vector<object_id> & oids, uint64_t versions)
+{
+    T *db = new T;
+    uint64_t total = oids.size()*versions;
+    // Writes come to random objects with increasing versions
+    double start = now();
+    for (uint64_t v = 1; v <= versions; v++)
+    {
+        for (auto & oid: oids)
+        {
+            (*db)[(obj_ver_id){ .oid = oid, .version = v }] = (dirty_entry){
+                .state = BS_ST_SMALL_WRITE | BS_ST_STABLE,
+                .flags = 0,
+                .location = v << 12,
+                .offset = 0,
+                .len = 4096,
+                .journal_sector = v << 12,
+            };
+        }
+    }
+    report(db_name, "insert", total, start);
+    if (db->size() != total)
+    {
+        printf("%s: expected %ju entries, got %zu\n", db_name, total, db->size());
+        exit(1);
+    }
+    // Lookups like in dequeue_read(): find the newest version of each object
+    start = now();
+    uint64_t found = 0;
+    for (auto & oid: oids)
+    {
+        auto dirty_it = db->upper_bound((obj_ver_id){ .oid = oid, .version = UINT64_MAX });
+        if (dirty_it != db->begin())
+        {
+            dirty_it--;
+            if (dirty_it->first.oid == oid && dirty_it->first.version == versions)
+                found++;
+        }
+    }
+    report(db_name, "lookup", oids.size(), start);
+    if (found != oids.size())
+    {
+        printf("%s: expected to find %zu objects, found %ju\n", db_name, oids.size(), found);
+        exit(1);
+    }
+    // Range erase like in erase_dirty(): remove all versions of each object
+    start = now();
+    for (auto & oid: oids)
+    {
+        auto dirty_start = db->lower_bound((obj_ver_id){ .oid = oid, .version = 0 });
+        auto dirty_end = db->upper_bound((obj_ver_id){ .oid = oid, .version = UINT64_MAX });
+        db->erase(dirty_start, dirty_end);
+    }
+    report(db_name, "range-erase", total, start);
+    if (db->size() != 0)
+    {
+        printf("%s: %zu entries left after erase\n", db_name, db->size());
+        exit(1);
+    }
+    delete db;
+}
+
+int main(int narg, char *args[])
+{
+    uint64_t entries = narg > 1 ? strtoull(args[1], NULL, 10) : 10000000;
+    uint64_t versions = narg > 2 ? strtoull(args[2], NULL, 10) : 4;
+    if (!entries || !versions)
+    {
+        printf("USAGE: %s [entries=10000000] [versions_per_object=4]\n", args[0]);
+        return 1;
+    }
+    std::vector<object_id> oids;
+    oids.reserve(entries/versions);
+    for (uint64_t i = 0; i < entries/versions; i++)
+    {
+        oids.push_back((object_id){ .inode = 1 + (i % 16), .stripe = (i / 16) << 17 });
+    }
+    std::mt19937_64 rnd(1);
+    std::shuffle(oids.begin(), oids.end(), rnd);
+    bench_db<blockstore_dirty_db_t>("btree_map", oids, versions);
+    bench_db<std::map<obj_ver_id, dirty_entry>>("std::map", oids, versions);
+    return 0;
+}
@@ -0,0 +1,74 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// Tests for the freed block range map of the online discard
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "blockstore_discard.h"
+
+static void check_ranges(discard_ranges_t & r, std::map<uint64_t, uint64_t> expected, const char *step)
+{
+    uint64_t blocks = 0;
+    for (auto & p: expected)
+        blocks += p.second-p.first;
+    if (r.ranges != expected || r.blocks != blocks)
+    {
+        printf("%s: got %ju blocks in", step, r.blocks);
+        for (auto & p: r.ranges)
+            printf(" [%ju, %ju)", p.first, p.second);
+        printf(", expected %ju blocks in", blocks);
+        for (auto & p: expected)
+            printf(" [%ju, %ju)", p.first, p.second);
+        printf("\n");
+        exit(1);
+    }
+}
+
+int main(int narg, char *args[])
+{
+    discard_ranges_t r;
+    r.add(10);
+    check_ranges(r, { { 10, 11 } }, "add");
+    r.add(12);
+    check_ranges(r, { { 10, 11 }, { 12, 13 } }, "add separate");
+    r.add(11);
+    check_ranges(r, { { 10, 13 } }, "merge both");
+    r.add(9);
+    check_ranges(r, { { 9, 13 } }, "merge next");
+    r.add(13);
+    check_ranges(r, { { 9, 14 } }, "merge previous");
+    // Blocks may be freed, reused and freed again before their discard
+    r.add(9);
+    check_ranges(r, { { 9, 14 } }, "duplicate add of the first block");
+    r.add(11);
+    check_ranges(r, { { 9, 14 } }, "duplicate add of a middle block");
+    r.add(13);
+    check_ranges(r, { { 9, 14 } }, "duplicate add of the last block");
+    r.add(20);
+    check_ranges(r, { { 9, 14 }, { 20, 21 } }, "add after");
+    // Take a range, discard a part of it and put the rest back
+    auto it = r.take(r.ranges.begin());
+    if (it == r.ranges.end() || it->first != 20)
+    {
+        printf("take() doesn't return the next range\n");
+        exit(1);
+    }
+    check_ranges(r, { { 20, 21 } }, "take");
+    r.put_back(9, 10);
+    r.put_back(12, 14);
+    r.put_back(14, 14);
+    check_ranges(r, { { 9, 10 }, { 12, 14 }, { 20, 21 } }, "put_back");
+    r.add(11);
+    check_ranges(r, { { 9, 10 }, { 11, 14 }, { 20, 21 } }, "add before a put back range");
+    r.add(10);
+    check_ranges(r, { { 9, 14 }, { 20, 21 } }, "merge put back ranges");
+    while (r.ranges.size())
+        r.take(r.ranges.begin());
+    check_ranges(r, {}, "take all");
+    r.add(5);
+    r.clear();
+    check_ranges(r, {}, "clear");
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,214 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// Memory pool tests. Run with "bench [iodepth]" to compare the pool with malloc on the allocation
+// pattern of a 4 KB write. Only the allocator is measured, not the OSD I/O path itself
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <thread>
+#include <vector>
+#include "malloc_or_die.h"
+#include "mem_pool.h"
+
+static double now()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec + tv.tv_nsec/1000000000.0;
+}
+
+void check_alloc()
+{
+    mem_pool_stats_t st = pool_get_stats();
+    // Freed items are reused for the same size class
+    void *a = pool_alloc(100);
+    memset(a, 1, 100);
+    pool_free(a);
+    void *b = pool_alloc(128);
+    if (a != b)
+    {
+        printf("freed item is not reused for the same size class: %p != %p\n", a, b);
+        exit(1);
+    }
+    void *c = pool_alloc(129);
+    if (c == b)
+    {
+        printf("item %p is reused for a different size class\n", c);
+        exit(1);
+    }
+    pool_free(b);
+    pool_free(c);
+    // Buffers are aligned
+    for (size_t size: { 1, 512, 4096, 4097, 128*1024, 1024*1024 })
+    {
+        void *buf = pool_memalign(size);
+        if ((uintptr_t)buf % MEM_POOL_ALIGNMENT)
+        {
+            printf("pool_memalign(%zu) result %p is not aligned\n", size, buf);
+            exit(1);
+        }
+        memset(buf, 0, size);
+        pool_free(buf);
+    }
+    // pool_calloc() zeroes reused memory
+    uint8_t *d = (uint8_t*)pool_alloc(1000);
+    memset(d, 0xff, 1000);
+    pool_free(d);
+    d = (uint8_t*)pool_calloc(1000);
+    for (int i = 0; i < 1000; i++)
+        if (d[i])
+        {
+            printf("pool_calloc() result is not zeroed at %d\n", i);
+            exit(1);
+        }
+    pool_free(d);
+    // Large buffers and memory from malloc() go to the heap
+    mem_pool_stats_t st2 = pool_get_stats();
+    void *large = pool_memalign(2*1024*1024);
+    memset(large, 0, 2*1024*1024);
+    if (pool_get_stats().heap != st2.heap+1)
+    {
+        printf("large buffer is not allocated from the heap\n");
+        exit(1);
+    }
+    pool_free(large);
+    pool_free(malloc_or_die(100));
+    pool_free(NULL);
+    st2 = pool_get_stats();
+    if (st2.reused <= st.reused)
+    {
+        printf("no items are reused\n");
+        exit(1);
+    }
+}
+
+void check_cross_thread()
+{
+    // Items allocated in one thread and freed in another are returned to the
+    // first one through the shared list, so the pool doesn't grow
+    const int n = 10000;
+    std::vector<void*> items(n);
+    mem_pool_stats_t st;
+    for (int round = 0; round < 10; round++)
+    {
+        if (round == 1)
+            st = pool_get_stats();
+        for (int i = 0; i < n; i++)
+            items[i] = pool_alloc(4096);
+        std::thread t([&]()
+        {
+            for (int i = 0; i < n; i++)
+                pool_free(items[i]);
+        });
+        t.join();
+    }
+    mem_pool_stats_t st2 = pool_get_stats();
+    if (st2.fresh-st.fresh >= n)
+    {
+        printf("memory freed by another thread is not reused: %ju fresh allocations\n", st2.fresh-st.fresh);
+        exit(1);
+    }
+}
+
+struct bench_op_t
+{
+    void *op, *op_data, *bitmap, *buf;
+};
+
+static void bench_path(bool use_pool, int iodepth, uint64_t ops)
+{
+    // Replays allocation sizes of a 4 KB write: osd_op_t, op_data with stripes, object bitmap
+    // and data buffer. Nothing else is done between allocations, so the result shows the cost
+    // of the allocator alone and is not an estimate of the OSD throughput gain
+    std::vector<bench_op_t> ring(iodepth);
+    mem_pool_stats_t st;
+    double start = 0;
+    for (uint64_t i = 0; i < ops + iodepth; i++)
+    {
+        if (i == iodepth)
+        {
+            // The pool is warmed up after the first <iodepth> operations
+            st = pool_get_stats();
+            start = now();
+        }
+        bench_op_t & o = ring[i % iodepth];
+        if (i >= iodepth)
+        {
+            if (use_pool)
+            {
+                pool_free(o.op);
+                pool_free(o.op_data);
+                pool_free(o.bitmap);
+                pool_free(o.buf);
+            }
+            else
+            {
+                free(o.op);
+                free(o.op_data);
+                free(o.bitmap);
+                free(o.buf);
+            }
+        }
+        if (use_pool)
+        {
+            o.op = pool_alloc(600);
+            o.op_data = pool_calloc(400);
+            o.bitmap = pool_alloc(32);
+            o.buf = pool_memalign(4096);
+        }
+        else
+        {
+            o.op = malloc_or_die(600);
+            o.op_data = calloc(1, 400);
+            o.bitmap = malloc_or_die(32);
+            o.buf = memalign_or_die(MEM_POOL_ALIGNMENT, 4096);
+        }
+        *(uint64_t*)o.buf = i;
+    }
+    double t = now()-start;
+    for (auto & o: ring)
+    {
+        pool_free(o.op);
+        pool_free(o.op_data);
+        pool_free(o.bitmap);
+        pool_free(o.buf);
+    }
+    mem_pool_stats_t st2 = pool_get_stats();
+    printf("%s, iodepth %d: %.2f M ops/s", use_pool ? "pool" : "malloc", iodepth, ops/t/1000000);
+    if (use_pool)
+    {
+        printf(", after warmup: %ju reused, %ju fresh, %ju heap allocations",
+            st2.reused-st.reused, st2.fresh-st.fresh, st2.heap-st.heap);
+    }
+    printf("\n");
+}
+
+int main(int narg, char *args[])
+{
+    if (narg > 1 && !strcmp(args[1], "bench"))
+    {
+        int iodepth = narg > 2 ? atoi(args[2]) : 128;
+        if (iodepth < 1)
+            iodepth = 1;
+        bench_path(false, iodepth, 10000000);
+        bench_path(true, iodepth, 10000000);
+        return 0;
+    }
+    check_alloc();
+    check_cross_thread();
+    // Steady state of the replayed allocation pattern doesn't allocate anything new
+    bench_path(true, 32, 100000);
+    mem_pool_stats_t st = pool_get_stats();
+    bench_path(true, 32, 100000);
+    mem_pool_stats_t st2 = pool_get_stats();
+    if (st2.fresh != st.fresh || st2.heap != st.heap)
+    {
+        printf("steady state allocates memory: %ju fresh, %ju heap\n", st2.fresh-st.fresh, st2.heap-st.heap);
+        exit(1);
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// Metadata block cache tests: CLOCK eviction and write generations
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockstore_meta_cache.h"
+
+#define BS 4096
+
+static uint8_t *block(uint8_t fill)
+{
+    static uint8_t buf[BS];
+    memset(buf, fill, BS);
+    return buf;
+}
+
+// Returns the first byte of the cached block or -1 if it's not cached
+static int cached(blockstore_meta_cache_t & c, uint64_t sector)
+{
+    uint8_t b = 0;
+    if (!c.get(sector, &b, 0, 1))
+        return -1;
+    return b;
+}
+
+static void check_cached(blockstore_meta_cache_t & c, uint64_t sector, int expected, const char *step)
+{
+    int r = cached(c, sector);
+    if (r != expected)
+    {
+        printf("%s: sector %ju contains %d, expected %d\n", step, sector, r, expected);
+        exit(1);
+    }
+}
+
+static void check_eviction()
+{
+    blockstore_meta_cache_t c;
+    c.init(3*BS, BS);
+    c.put(0*BS, block(1));
+    c.put(1*BS, block(2));
+    c.put(2*BS, block(3));
+    check_cached(c, 0*BS, 1, "fill");
+    check_cached(c, 2*BS, 3, "fill");
+    // Sector 1 is the only one not referenced, so it's evicted
+    c.put(3*BS, block(4));
+    check_cached(c, 1*BS, -1, "eviction");
+    check_cached(c, 3*BS, 4, "eviction");
+    if (c.evictions != 1)
+    {
+        printf("eviction count is %ju, expected 1\n", c.evictions);
+        exit(1);
+    }
+    if (c.size() != 3*BS)
+    {
+        printf("cache size is %ju, expected %d\n", c.size(), 3*BS);
+        exit(1);
+    }
+    // put() of a cached sector replaces it without evictions
+    c.put(3*BS, block(5));
+    check_cached(c, 3*BS, 5, "replace");
+    if (c.evictions != 1)
+    {
+        printf("eviction count after replace is %ju, expected 1\n", c.evictions);
+        exit(1);
+    }
+}
+
+static void check_generations()
+{
+    blockstore_meta_cache_t c;
+    c.init(2*BS, BS);
+    // Unchanged block read from the disk is cached
+    uint64_t gen = c.get_gen(0);
+    c.put_if_unchanged(0, block(1), gen);
+    check_cached(c, 0, 1, "unchanged read");
+    // A write during the read is newer than the read block
+    c.put(1*BS, block(1));
+    c.put(2*BS, block(2));
+    c.put(3*BS, block(3));
+    check_cached(c, 0, -1, "evicted before the read");
+    gen = c.get_gen(0);
+    c.write(0, block(9));
+    c.write_done(0);
+    c.put_if_unchanged(0, block(1), gen);
+    check_cached(c, 0, 9, "written block");
+    // Block is evicted while the write is in flight, the read may return the old block
+    c.write(0, block(10));
+    c.put(4*BS, block(4));
+    c.put(5*BS, block(5));
+    c.put(6*BS, block(6));
+    check_cached(c, 0, -1, "evicted with an inflight write");
+    gen = c.get_gen(0);
+    c.put_if_unchanged(0, block(9), gen);
+    check_cached(c, 0, -1, "read completed before the write");
+    c.write_done(0);
+    c.put_if_unchanged(0, block(9), gen);
+    check_cached(c, 0, -1, "read completed after the write");
+    // Reads after the write completes are cached again
+    gen = c.get_gen(0);
+    c.put_if_unchanged(0, block(10), gen);
+    check_cached(c, 0, 10, "read after the write");
+    // Disabled cache never returns anything
+    blockstore_meta_cache_t d;
+    d.init(0, BS);
+    d.put(0, block(1));
+    d.write(0, block(1));
+    d.write_done(0);
+    check_cached(d, 0, -1, "disabled cache");
+}
+
+int main(int narg, char *args[])
+{
+    check_eviction();
+    check_generations();
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,216 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// Operation slot table tests. Run with "bench [iodepth]" to compare it with std::map
+// on the reply matching path of one connection
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <vector>
+#include "op_slot_table.h"
+
+struct test_op_t
+{
+    uint64_t id;
+};
+
+static double now()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec + tv.tv_nsec/1000000000.0;
+}
+
+static void check_basic()
+{
+    op_slot_table_t<test_op_t> t(4, 16);
+    std::vector<test_op_t> ops(100);
+    for (uint64_t i = 0; i < ops.size(); i++)
+        ops[i].id = i+1;
+    if (t.size() != 0 || t.take(1) != NULL)
+    {
+        printf("new table is not empty\n");
+        exit(1);
+    }
+    for (int i = 0; i < 4; i++)
+        t.set(ops[i].id, &ops[i]);
+    if (t.size() != 4)
+    {
+        printf("size after insert is %zu, expected 4\n", t.size());
+        exit(1);
+    }
+    if (t.take(2) != &ops[1])
+    {
+        printf("existing op 2 is not found\n");
+        exit(1);
+    }
+    if (t.take(2) != NULL)
+    {
+        printf("removed op 2 is found again\n");
+        exit(1);
+    }
+    // ID 6 maps to the same slot as 2 in the initial table, but 2 is removed
+    t.set(ops[5].id, &ops[5]);
+    if (t.take(6) != &ops[5])
+    {
+        printf("op 6 is not found in a reused slot\n");
+        exit(1);
+    }
+    // Op 1 stays in flight while the next ones wrap around the table, so it grows
+    for (int i = 4; i < 12; i++)
+        t.set(ops[i].id, &ops[i]);
+    if (t.size() != 11)
+    {
+        printf("size after growth is %zu, expected 11\n", t.size());
+        exit(1);
+    }
+    for (int i = 0; i < 12; i++)
+        if (i != 1)
+            if (t.take(ops[i].id) != &ops[i])
+            {
+                printf("op %ju is not found after growth\n", ops[i].id);
+                exit(1);
+            }
+    if (t.size() != 0)
+    {
+        printf("table is not empty after taking all ops: size %zu\n", t.size());
+        exit(1);
+    }
+    // Old IDs never match newer operations in the same slot
+    t.set(ops[20].id, &ops[20]);
+    if (t.take(ops[20].id - 16) != NULL)
+    {
+        printf("old ID %ju matches a newer op in the same slot\n", ops[20].id - 16);
+        exit(1);
+    }
+    if (t.take(ops[20].id) != &ops[20])
+    {
+        printf("op %ju is not found after the ID check\n", ops[20].id);
+        exit(1);
+    }
+    t.clear();
+}
+
+static void check_overflow()
+{
+    // Op 1 is stuck while 100 others pass through a table of at most 16 slots
+    op_slot_table_t<test_op_t> t(4, 16);
+    std::vector<test_op_t> ops(101);
+    for (uint64_t i = 0; i < ops.size(); i++)
+        ops[i].id = i+1;
+    t.set(1, &ops[0]);
+    for (int i = 1; i < 101; i++)
+    {
+        t.set(ops[i].id, &ops[i]);
+        if (i >= 8)
+            if (t.take(ops[i-7].id) != &ops[i-7])
+            {
+                printf("op %ju is not found while op 1 is stuck\n", ops[i-7].id);
+                exit(1);
+            }
+    }
+    if (t.size() != 8)
+    {
+        printf("size with a stuck op is %zu, expected 8\n", t.size());
+        exit(1);
+    }
+    auto items = t.list();
+    if (items.size() != 8 || items[0] != &ops[0])
+    {
+        printf("list() doesn't start with the stuck op\n");
+        exit(1);
+    }
+    for (size_t i = 1; i < items.size(); i++)
+        if (items[i] != &ops[93+i])
+        {
+            printf("list() is not sorted by ID at position %zu\n", i);
+            exit(1);
+        }
+    if (t.take(1) != &ops[0])
+    {
+        printf("stuck op 1 is not found in the overflow map\n");
+        exit(1);
+    }
+    for (int i = 94; i < 101; i++)
+        if (t.take(ops[i].id) != &ops[i])
+        {
+            printf("op %ju is not found after overflow\n", ops[i].id);
+            exit(1);
+        }
+    if (t.size() != 0)
+    {
+        printf("table is not empty after overflow: size %zu\n", t.size());
+        exit(1);
+    }
+}
+
+// Simulates reply handling of one connection: <iodepth> operations are in flight,
+// replies arrive slightly out of order, each reply is matched and removed by its ID
+template<typename F1, typename F2>
+static double bench_replies(int iodepth, uint64_t ops, F1 add, F2 take)
+{
+    std::vector<test_op_t> pool(iodepth);
+    std::vector<uint64_t> inflight;
+    uint64_t next_id = 1, sum = 0;
+    for (int i = 0; i < iodepth; i++)
+    {
+        pool[i].id = next_id++;
+        add(&pool[i]);
+        inflight.push_back(pool[i].id);
+    }
+    uint64_t rnd = 1;
+    double start = now();
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        // Complete one of the 8 oldest operations
+        rnd = rnd*6364136223846793005ull + 1442695040888963407ull;
+        int pos = (i + (rnd >> 61)) % iodepth;
+        test_op_t *op = take(inflight[pos]);
+        sum += op->id;
+        op->id = next_id++;
+        add(op);
+        inflight[pos] = op->id;
+    }
+    double t = now()-start;
+    if (!sum)
+        printf("impossible\n");
+    return t;
+}
+
+static void bench(int iodepth, uint64_t ops)
+{
+    std::map<uint64_t, test_op_t*> map;
+    double t_map = bench_replies(iodepth, ops, [&](test_op_t *op) { map[op->id] = op; }, [&](uint64_t id)
+    {
+        auto it = map.find(id);
+        test_op_t *op = it->second;
+        map.erase(it);
+        return op;
+    });
+    op_slot_table_t<test_op_t> table;
+    double t_table = bench_replies(iodepth, ops, [&](test_op_t *op) { table.set(op->id, op); }, [&](uint64_t id)
+    {
+        return table.take(id);
+    });
+    printf("iodepth %d: std::map %.1f ns/reply, op_slot_table_t %.1f ns/reply\n",
+        iodepth, t_map*1e9/ops, t_table*1e9/ops);
+}
+
+int main(int narg, char *args[])
+{
+    if (narg > 1 && !strcmp(args[1], "bench"))
+    {
+        int iodepth = narg > 2 ? atoi(args[2]) : 256;
+        if (iodepth < 1)
+            iodepth = 1;
+        bench(iodepth, 20000000);
+        return 0;
+    }
+    check_basic();
+    check_overflow();
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,96 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include "spsc_queue.h"
+
+void check_single_thread()
+{
+    spsc_queue_t<int> q(3);
+    int v = 0;
+    if (!q.empty() || q.pop(v))
+    {
+        printf("new queue is not empty\n");
+        exit(1);
+    }
+    // Size is rounded up to 4
+    for (int i = 0; i < 4; i++)
+        if (!q.push(i))
+        {
+            printf("push %d into a non-full queue failed\n", i);
+            exit(1);
+        }
+    if (q.push(4))
+    {
+        printf("push into a full queue succeeded\n");
+        exit(1);
+    }
+    if (!q.pop(v) || v != 0)
+    {
+        printf("expected to pop 0, got %d\n", v);
+        exit(1);
+    }
+    if (!q.push(4))
+    {
+        printf("push failed after pop\n");
+        exit(1);
+    }
+    for (int i = 1; i <= 4; i++)
+        if (!q.pop(v) || v != i)
+        {
+            printf("expected to pop %d after wraparound, got %d\n", i, v);
+            exit(1);
+        }
+    if (!q.empty() || q.pop(v))
+    {
+        printf("queue is not empty after popping all items\n");
+        exit(1);
+    }
+}
+
+void check_two_threads()
+{
+    const uint64_t n = 1000000;
+    spsc_queue_t<uint64_t> q(64);
+    std::thread producer([&]()
+    {
+        for (uint64_t i = 0; i < n; )
+        {
+            if (q.push(i))
+                i++;
+            else
+                std::this_thread::yield();
+        }
+    });
+    uint64_t expected = 0, v;
+    while (expected < n)
+    {
+        if (q.pop(v))
+        {
+            if (v != expected)
+            {
+                printf("expected to receive %ju, got %ju\n", expected, v);
+                exit(1);
+            }
+            expected++;
+        }
+        else
+            std::this_thread::yield();
+    }
+    producer.join();
+    if (!q.empty())
+    {
+        printf("queue is not empty at the end\n");
+        exit(1);
+    }
+}
+
+int main(int narg, char *args[])
+{
+    check_single_thread();
+    check_two_threads();
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// memxor() tests. Run with "bench [size] [sources]" to benchmark XOR parity calculation
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "malloc_or_die.h"
+#include "xor.h"
+
+static const char *impl_names[] = { "auto", "scalar", "sse2", "avx2", "avx512", "neon" };
+
+static uint64_t rnd_state = 1;
+
+static uint64_t rnd()
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+static double now()
+{
+    timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec + tv.tv_nsec/1000000000.0;
+}
+
+// The old byte-by-byte memxor() for comparison
+static void memxor_bytes(const void *r1, const void *r2, void *res, unsigned int len)
+{
+    for (unsigned int i = 0; i < len; ++i)
+        ((uint8_t*)res)[i] = ((uint8_t*)r1)[i] ^ ((uint8_t*)r2)[i];
+}
+
+static int max_impl()
+{
+    int max = memxor_select(MEMXOR_NEON);
+    memxor_select(0);
+    return max;
+}
+
+// Compare all implementations with a plain byte loop for random lengths and alignments
+void check_all()
+{
+    const int bufsize = 8192, max_src = 8;
+    uint8_t *src[max_src], *res = (uint8_t*)malloc_or_die(bufsize+64), *expected = (uint8_t*)malloc_or_die(bufsize+64);
+    for (int j = 0; j < max_src; j++)
+    {
+        src[j] = (uint8_t*)malloc_or_die(bufsize+64);
+        for (int i = 0; i < bufsize+64; i++)
+            src[j][i] = rnd();
+    }
+    int max = max_impl();
+    for (int impl = MEMXOR_SCALAR; impl <= max; impl++)
+    {
+        if (memxor_select(impl) != impl)
+            continue;
+        for (int iter = 0; iter < 10000; iter++)
+        {
+            int n = 1 + rnd() % max_src;
+            unsigned len = rnd() % (iter < 5000 ? 300 : bufsize);
+            const void *ptrs[max_src];
+            for (int j = 0; j < n; j++)
+                ptrs[j] = src[j] + rnd() % 64;
+            uint8_t *dest = res + rnd() % 64;
+            memcpy(expected, ptrs[0], len);
+            for (int j = 1; j < n; j++)
+                memxor_bytes(expected, ptrs[j], expected, len);
+            memxor_multi(ptrs, n, dest, len);
+            if (memcmp(dest, expected, len) != 0)
+            {
+                printf("memxor_multi(%d sources, %u bytes) differs with %s implementation\n", n, len, impl_names[impl]);
+                exit(1);
+            }
+            // In-place XOR
+            memcpy(dest, ptrs[0], len);
+            memxor(dest, ptrs[1 % n], dest, len);
+            memxor_bytes(ptrs[0], ptrs[1 % n], expected, len);
+            if (memcmp(dest, expected, len) != 0)
+            {
+                printf("in-place memxor(%u bytes) differs with %s implementation\n", len, impl_names[impl]);
+                exit(1);
+            }
+        }
+    }
+    memxor_select(0);
+    for (int j = 0; j < max_src; j++)
+        free(src[j]);
+    free(expected);
+    free(res);
+}
+
+// Calculate XOR parity of <n> chunks of <size> bytes either pairwise or in one pass
+void bench(unsigned size, int n)
+{
+    uint8_t *src[n], *res = (uint8_t*)malloc_or_die(size);
+    for (int j = 0; j < n; j++)
+    {
+        src[j] = (uint8_t*)malloc_or_die(size);
+        for (unsigned i = 0; i < size; i++)
+            src[j][i] = rnd();
+    }
+    double t, start = now();
+    uint64_t bytes = 0;
+    while ((t = now()-start) < 0.5)
+    {
+        memxor_bytes(src[0], src[1], res, size);
+        for (int j = 2; j < n; j++)
+            memxor_bytes(res, src[j], res, size);
+        bytes += (uint64_t)size*n;
+    }
+    printf("%u x %d, byte loop: %.2f GB/s\n", size, n, bytes/t/1e9);
+    int max = max_impl();
+    for (int impl = MEMXOR_SCALAR; impl <= max; impl++)
+    {
+        if (memxor_select(impl) != impl)
+            continue;
+        start = now();
+        bytes = 0;
+        while ((t = now()-start) < 0.5)
+        {
+            memxor(src[0], src[1], res, size);
+            for (int j = 2; j < n; j++)
+                memxor(res, src[j], res, size);
+            bytes += (uint64_t)size*n;
+        }
+        printf("%u x %d, %s pairwise: %.2f GB/s", size, n, impl_names[impl], bytes/t/1e9);
+        start = now();
+        bytes = 0;
+        while ((t = now()-start) < 0.5)
+        {
+            memxor_multi((const void**)src, n, res, size);
+            bytes += (uint64_t)size*n;
+        }
+        printf(", one pass: %.2f GB/s\n", bytes/t/1e9);
+    }
+    memxor_select(0);
+    for (int j = 0; j < n; j++)
+        free(src[j]);
+    free(res);
+}
+
+int main(int narg, char *args[])
+{
+    if (narg > 1 && !strcmp(args[1], "bench"))
+    {
+        unsigned size = narg > 2 ? strtoul(args[2], NULL, 10) : 128*1024;
+        int n = narg > 3 ? atoi(args[3]) : 2;
+        if (!size || n < 2)
+        {
+            fprintf(stderr, "USAGE: %s bench [size] [sources >= 2]\n", args[0]);
+            return 1;
+        }
+        bench(size, n);
+        return 0;
+    }
+    check_all();
+    printf("memxor ok\n");
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include "allocator.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <malloc.h>
 
 allocator_t::allocator_t(uint64_t blocks)
@@ -20,6 +21,8 @@ allocator_t::allocator_t(uint64_t blocks)
         total += p2;
         p2 = p2 * 64;
     }
+    leaf_offset = total;
+    leaf_p2 = p2;
     total += (blocks+63) / 64;
     mask = new uint64_t[total];
     size = free = blocks;
@@ -43,13 +46,7 @@ bool allocator_t::get(uint64_t addr)
     {
         return false;
     }
-    uint64_t p2 = 1, offset = 0;
-    while (p2 * 64 < size)
-    {
-        offset += p2;
-        p2 = p2 * 64;
-    }
-    return ((mask[offset + addr/64] >> (addr % 64)) & 1);
+    return ((mask[leaf_offset + addr/64] >> (addr % 64)) & 1);
 }
 
 void allocator_t::set(uint64_t addr, bool value)
@@ -58,12 +55,7 @@ void allocator_t::set(uint64_t addr, bool value)
     {
         return;
     }
-    uint64_t p2 = 1, offset = 0;
-    while (p2 * 64 < size)
-    {
-        offset += p2;
-        p2 = p2 * 64;
-    }
+    uint64_t p2 = leaf_p2, offset = leaf_offset;
     uint64_t cur_addr = addr;
     bool is_last = true;
     uint64_t value64 = value ? 1 : 0;
@@ -109,31 +101,131 @@ void allocator_t::set(uint64_t addr, bool value)
     }
 }
 
-uint64_t allocator_t::find_free()
+void allocator_t::set_range(uint64_t addr, uint64_t count, bool value)
 {
-    uint64_t p2 = 1, offset = 0, addr = 0, f, i;
-    while (p2 < size)
+    if (addr >= size)
+    {
+        return;
+    }
+    if (count > size-addr)
     {
-        if (offset+addr >= total)
+        count = size-addr;
+    }
+    while (count > 0)
+    {
+        // Change a whole leaf word at once
+        uint64_t bit = addr % 64;
+        uint64_t n = 64-bit < count ? 64-bit : count;
+        uint64_t bits = (n == 64 ? UINT64_MAX : (((uint64_t)1 << n) - 1)) << bit;
+        uint64_t cur_addr = addr/64;
+        uint64_t & word = mask[leaf_offset + cur_addr];
+        if (value)
         {
-            return UINT64_MAX;
+            free -= __builtin_popcountll(~word & bits);
+            word |= bits;
+        }
+        else
+        {
+            free += __builtin_popcountll(word & bits);
+            word &= ~bits;
         }
-        uint64_t m = mask[offset + addr];
-        for (i = 0, f = 1; i < 64; i++, f <<= 1)
+        addr += n;
+        count -= n;
+        // Then update "full" bits in upper levels
+        bool full = word == (cur_addr < size/64 ? UINT64_MAX : last_one_mask);
+        uint64_t p2 = leaf_p2, offset = leaf_offset;
+        while (p2 > 1)
         {
-            if (!(m & f))
+            p2 = p2 / 64;
+            offset -= p2;
+            uint64_t parent_bit = ((uint64_t)1 << (cur_addr % 64));
+            cur_addr /= 64;
+            uint64_t & parent = mask[offset + cur_addr];
+            uint64_t new_parent = full ? (parent | parent_bit) : (parent & ~parent_bit);
+            if (new_parent == parent)
             {
                 break;
             }
+            parent = new_parent;
+            full = parent == UINT64_MAX;
+        }
+    }
+}
+
+// Find the first free block at or after <addr> without wrapping around
+uint64_t allocator_t::find_free_from(uint64_t addr)
+{
+    if (addr >= size)
+    {
+        return UINT64_MAX;
+    }
+    // Go up while the rest of the current word is full
+    uint64_t p2 = leaf_p2, offset = leaf_offset, pos = addr;
+    while (1)
+    {
+        if (offset != leaf_offset && pos/64 >= p2)
+        {
+            // End of the level
+            return UINT64_MAX;
         }
-        if (i == 64)
+        uint64_t m = mask[offset + pos/64] | ((((uint64_t)1) << (pos % 64)) - 1);
+        if (m != UINT64_MAX)
+        {
+            pos = (pos & ~(uint64_t)63) | __builtin_ctzll(~m);
+            break;
+        }
+        if (p2 == 1)
         {
             // No space
             return UINT64_MAX;
         }
-        addr = (addr * 64) | i;
+        pos = pos/64 + 1;
+        p2 = p2 / 64;
+        offset -= p2;
+    }
+    // Then go down to the first non-full leaf
+    while (offset != leaf_offset)
+    {
         offset += p2;
         p2 = p2 * 64;
+        pos = pos * 64;
+        if (offset + pos/64 >= total)
+        {
+            return UINT64_MAX;
+        }
+        pos = pos | __builtin_ctzll(~mask[offset + pos/64]);
+    }
+    return pos < size ? pos : UINT64_MAX;
+}
+
+// Count free blocks starting at <addr>, but not more than <max_len>
+uint64_t allocator_t::free_run_length(uint64_t addr, uint64_t max_len)
+{
+    uint64_t len = 0;
+    if (max_len > size-addr)
+    {
+        max_len = size-addr;
+    }
+    while (len < max_len)
+    {
+        uint64_t m = mask[leaf_offset + addr/64] >> (addr % 64);
+        uint64_t n = m ? __builtin_ctzll(m) : 64 - (addr % 64);
+        len += n;
+        addr += n;
+        if (m)
+        {
+            break;
+        }
+    }
+    return len < max_len ? len : max_len;
+}
+
+uint64_t allocator_t::find_free(uint64_t hint)
+{
+    uint64_t addr = find_free_from(hint);
+    if (addr == UINT64_MAX && hint > 0)
+    {
+        addr = find_free_from(0);
     }
     return addr;
 }
@@ -143,83 +235,88 @@ uint64_t allocator_t::get_free_count()
     return free;
 }
 
-// FIXME: Move to utils?
-void bitmap_set(void *bitmap, uint64_t start, uint64_t len, uint64_t bitmap_granularity)
+void allocator_t::get_free_extents(uint64_t *extent_count, uint64_t *max_extent)
 {
-    if (start == 0 && len == 32*bitmap_granularity)
-        *((uint32_t*)bitmap) = UINT32_MAX;
-    else if (start == 0 && len == 64*bitmap_granularity)
-        *((uint64_t*)bitmap) = UINT64_MAX;
-    else
+    *extent_count = *max_extent = 0;
+    uint64_t addr = find_free_from(0);
+    while (addr != UINT64_MAX)
     {
-        unsigned bit_start = start / bitmap_granularity;
-        unsigned bit_end = ((start + len) + bitmap_granularity - 1) / bitmap_granularity;
-        while (bit_start < bit_end)
-        {
-            if (!(bit_start & 7) && bit_end >= bit_start+8)
-            {
-                ((uint8_t*)bitmap)[bit_start / 8] = UINT8_MAX;
-                bit_start += 8;
-            }
-            else
-            {
-                ((uint8_t*)bitmap)[bit_start / 8] |= 1 << (bit_start % 8);
-                bit_start++;
-            }
-        }
+        uint64_t len = free_run_length(addr, size);
+        (*extent_count)++;
+        if (*max_extent < len)
+            *max_extent = len;
+        addr = find_free_from(addr+len+1);
     }
 }
 
-void bitmap_clear(void *bitmap, uint64_t start, uint64_t len, uint64_t bitmap_granularity)
+// FIXME: Move to utils?
+// Set or clear bits from <bit_start> to <bit_end>: partial bytes at both edges are masked,
+// all bytes in the middle are filled at once
+static void bitmap_set_bits(uint8_t *bitmap, uint64_t bit_start, uint64_t bit_end, bool value)
 {
-    if (start == 0 && len == 32*bitmap_granularity)
-        *((uint32_t*)bitmap) = 0;
-    else if (start == 0 && len == 64*bitmap_granularity)
-        *((uint64_t*)bitmap) = 0;
+    if (bit_start >= bit_end)
+        return;
+    uint64_t first = bit_start / 8, last = (bit_end-1) / 8;
+    uint8_t first_mask = 0xFF << (bit_start % 8);
+    uint8_t last_mask = 0xFF >> (7 - (bit_end-1) % 8);
+    if (first == last)
+        first_mask &= last_mask;
+    if (value)
+        bitmap[first] |= first_mask;
     else
+        bitmap[first] &= ~first_mask;
+    if (first == last)
+        return;
+    if (last > first+1)
+        memset(bitmap+first+1, value ? 0xFF : 0, last-first-1);
+    if (value)
+        bitmap[last] |= last_mask;
+    else
+        bitmap[last] &= ~last_mask;
+}
+
+// Check if any bit from <bit_start> to <bit_end> is set, 8 bytes at a time
+static bool bitmap_check_bits(const uint8_t *bitmap, uint64_t bit_start, uint64_t bit_end)
+{
+    if (bit_start >= bit_end)
+        return false;
+    uint64_t first = bit_start / 8, last = (bit_end-1) / 8;
+    uint8_t first_mask = 0xFF << (bit_start % 8);
+    uint8_t last_mask = 0xFF >> (7 - (bit_end-1) % 8);
+    if (first == last)
+        return (bitmap[first] & first_mask & last_mask) != 0;
+    if ((bitmap[first] & first_mask) || (bitmap[last] & last_mask))
+        return true;
+    uint64_t i = first+1;
+    for (; i+8 <= last; i += 8)
     {
-        unsigned bit_start = start / bitmap_granularity;
-        unsigned bit_end = ((start + len) + bitmap_granularity - 1) / bitmap_granularity;
-        while (bit_start < bit_end)
-        {
-            if (!(bit_start & 7) && bit_end >= bit_start+8)
-            {
-                ((uint8_t*)bitmap)[bit_start / 8] = 0;
-                bit_start += 8;
-            }
-            else
-            {
-                ((uint8_t*)bitmap)[bit_start / 8] &= (0xFF ^ (1 << (bit_start % 8)));
-                bit_start++;
-            }
-        }
+        uint64_t word;
+        memcpy(&word, bitmap+i, 8);
+        if (word)
+            return true;
+    }
+    for (; i < last; i++)
+    {
+        if (bitmap[i])
+            return true;
     }
+    return false;
+}
+
+void bitmap_set(void *bitmap, uint64_t start, uint64_t len, uint64_t bitmap_granularity)
+{
+    bitmap_set_bits((uint8_t*)bitmap, start / bitmap_granularity,
+        ((start + len) + bitmap_granularity - 1) / bitmap_granularity, true);
+}
+
+void bitmap_clear(void *bitmap, uint64_t start, uint64_t len, uint64_t bitmap_granularity)
+{
+    bitmap_set_bits((uint8_t*)bitmap, start / bitmap_granularity,
+        ((start + len) + bitmap_granularity - 1) / bitmap_granularity, false);
 }
 
 bool bitmap_check(void *bitmap, uint64_t start, uint64_t len, uint64_t bitmap_granularity)
 {
-    bool r = false;
-    if (start == 0 && len == 32*bitmap_granularity)
-        r = !!*((uint32_t*)bitmap);
-    else if (start == 0 && len == 64*bitmap_granularity)
-        r = !!*((uint64_t*)bitmap);
-    else
-    {
-        unsigned bit_start = start / bitmap_granularity;
-        unsigned bit_end = ((start + len) + bitmap_granularity - 1) / bitmap_granularity;
-        while (bit_start < bit_end)
-        {
-            if (!(bit_start & 7) && bit_end >= bit_start+8)
-            {
-                r = r || !!((uint8_t*)bitmap)[bit_start / 8];
-                bit_start += 8;
-            }
-            else
-            {
-                r = r || (((uint8_t*)bitmap)[bit_start / 8] & (1 << (bit_start % 8)));
-                bit_start++;
-            }
-        }
-    }
-    return r;
+    return bitmap_check_bits((uint8_t*)bitmap, start / bitmap_granularity,
+        ((start + len) + bitmap_granularity - 1) / bitmap_granularity);
 }
@@ -14,14 +14,25 @@ class allocator_t
     uint64_t size;
     uint64_t free;
     uint64_t last_one_mask;
+    // Offset of the last (leaf) level and the number of words in the level above it
+    uint64_t leaf_offset, leaf_p2;
     uint64_t *mask;
+
+    uint64_t find_free_from(uint64_t addr);
+    uint64_t free_run_length(uint64_t addr, uint64_t max_len);
 public:
     allocator_t(uint64_t blocks);
     ~allocator_t();
     bool get(uint64_t addr);
     void set(uint64_t addr, bool value);
-    uint64_t find_free();
+    // Mark <count> blocks starting at <addr> as used or free
+    void set_range(uint64_t addr, uint64_t count, bool value);
+    // Find a free block at or after <hint>, wrapping around to the beginning.
+    // Returns UINT64_MAX if there is no free space
+    uint64_t find_free(uint64_t hint = 0);
     uint64_t get_free_count();
+    // Fragmentation statistics: number of contiguous free extents and the largest of them
+    void get_free_extents(uint64_t *extent_count, uint64_t *max_extent);
 };
 
 void bitmap_set(void *bitmap, uint64_t start, uint64_t len, uint64_t bitmap_granularity);
@@ -0,0 +1,201 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#pragma once
+
+#include <string.h>
+
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Size of the inline storage, enough for a lambda capturing 4 pointers or for a std::function
+#define CALLBACK_INLINE_SIZE (4*sizeof(void*))
+
+template<typename Sig> class callback_t;
+
+// Completion callback for I/O operations, a replacement for std::function without its overhead.
+// Callables which fit into CALLBACK_INLINE_SIZE (that's almost all lambdas in Vitastor, they
+// usually capture `this` and an operation pointer) are stored inline, never allocate memory
+// and are copied with memcpy if they're trivially copyable. Larger callables, including ones
+// capturing other callbacks or strings, are moved to the heap, like std::function does.
+// A std::function may be assigned to a callback_t and vice versa, so it's used as an adapter.
+// Zero-filled memory is a valid empty callback_t, so it may be used in calloc'ed structures.
+template<typename R, typename... Args>
+class callback_t<R(Args...)>
+{
+    enum { CB_COPY, CB_MOVE, CB_DESTROY };
+
+    alignas(void*) unsigned char data[CALLBACK_INLINE_SIZE];
+    R (*invoke_fn)(void *data, Args... args);
+    // Copies, moves or destroys the stored callable. NULL if it's trivially copyable and stored inline
+    void (*manage_fn)(int action, void *dst, void *src);
+
+    template<typename F>
+    using is_inline = std::integral_constant<bool, sizeof(F) <= CALLBACK_INLINE_SIZE &&
+        alignof(F) <= alignof(void*) && std::is_nothrow_move_constructible<F>::value>;
+
+    template<typename F, typename Ret = decltype(std::declval<F&>()(std::declval<Args>()...))>
+    using is_callable = std::integral_constant<bool, std::is_void<R>::value || std::is_convertible<Ret, R>::value>;
+
+    template<typename F>
+    static bool is_null(const F & f) { return false; }
+    template<typename F>
+    static bool is_null(F *f) { return !f; }
+    template<typename S>
+    static bool is_null(const std::function<S> & f) { return !f; }
+
+    template<typename F>
+    static R invoke_inline(void *data, Args... args)
+    {
+        return static_cast<R>((*(F*)data)(std::forward<Args>(args)...));
+    }
+
+    template<typename F>
+    static R invoke_heap(void *data, Args... args)
+    {
+        return static_cast<R>((**(F**)data)(std::forward<Args>(args)...));
+    }
+
+    template<typename F>
+    static void manage_inline(int action, void *dst, void *src)
+    {
+        if (action == CB_COPY)
+            new (dst) F(*(const F*)src);
+        else if (action == CB_MOVE)
+        {
+            new (dst) F(std::move(*(F*)src));
+            ((F*)src)->~F();
+        }
+        else
+            ((F*)dst)->~F();
+    }
+
+    template<typename F>
+    static void manage_heap(int action, void *dst, void *src)
+    {
+        if (action == CB_COPY)
+            *(F**)dst = new F(**(const F**)src);
+        else if (action == CB_MOVE)
+            *(F**)dst = *(F**)src;
+        else
+            delete *(F**)dst;
+    }
+
+    template<typename F>
+    void init(F && f, std::true_type)
+    {
+        typedef typename std::decay<F>::type FT;
+        new (data) FT(std::forward<F>(f));
+        invoke_fn = invoke_inline<FT>;
+        manage_fn = std::is_trivially_copyable<FT>::value ? NULL : manage_inline<FT>;
+    }
+
+    template<typename F>
+    void init(F && f, std::false_type)
+    {
+        typedef typename std::decay<F>::type FT;
+        *(FT**)data = new FT(std::forward<F>(f));
+        invoke_fn = invoke_heap<FT>;
+        manage_fn = manage_heap<FT>;
+    }
+
+    void copy_from(const callback_t & other)
+    {
+        invoke_fn = other.invoke_fn;
+        manage_fn = other.manage_fn;
+        if (manage_fn)
+            manage_fn(CB_COPY, data, (void*)other.data);
+        else if (invoke_fn)
+            memcpy(data, other.data, CALLBACK_INLINE_SIZE);
+    }
+
+    void move_from(callback_t & other)
+    {
+        invoke_fn = other.invoke_fn;
+        manage_fn = other.manage_fn;
+        if (manage_fn)
+            manage_fn(CB_MOVE, data, other.data);
+        else if (invoke_fn)
+            memcpy(data, other.data, CALLBACK_INLINE_SIZE);
+        other.invoke_fn = NULL;
+        other.manage_fn = NULL;
+    }
+
+public:
+    callback_t() : invoke_fn(NULL), manage_fn(NULL) {}
+    callback_t(std::nullptr_t) : invoke_fn(NULL), manage_fn(NULL) {}
+    callback_t(const callback_t & other) { copy_from(other); }
+    callback_t(callback_t && other) noexcept { move_from(other); }
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, callback_t>::value &&
+        is_callable<typename std::decay<F>::type>::value>::type>
+    callback_t(F && f) : invoke_fn(NULL), manage_fn(NULL)
+    {
+        if (!is_null(f))
+            init(std::forward<F>(f), is_inline<typename std::decay<F>::type>());
+    }
+
+    ~callback_t()
+    {
+        if (manage_fn)
+            manage_fn(CB_DESTROY, data, NULL);
+    }
+
+    callback_t & operator = (const callback_t & other)
+    {
+        if (this != &other)
+        {
+            this->~callback_t();
+            copy_from(other);
+        }
+        return *this;
+    }
+
+    callback_t & operator = (callback_t && other) noexcept
+    {
+        if (this != &other)
+        {
+            this->~callback_t();
+            move_from(other);
+        }
+        return *this;
+    }
+
+    callback_t & operator = (std::nullptr_t)
+    {
+        this->~callback_t();
+        invoke_fn = NULL;
+        manage_fn = NULL;
+        return *this;
+    }
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, callback_t>::value &&
+        is_callable<typename std::decay<F>::type>::value>::type>
+    callback_t & operator = (F && f)
+    {
+        return *this = callback_t(std::forward<F>(f));
+    }
+
+    void swap(callback_t & other)
+    {
+        callback_t tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    explicit operator bool() const
+    {
+        return invoke_fn != NULL;
+    }
+
+    R operator()(Args... args) const
+    {
+        if (!invoke_fn)
+            throw std::bad_function_call();
+        return invoke_fn((void*)data, std::forward<Args>(args)...);
+    }
+};
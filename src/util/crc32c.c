@@ -37,8 +37,32 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 #include "crc32c.h"
 
+/* CRC-32C (iSCSI) polynomial in reversed bit order. */
+#define POLY 0x82f63b78
+
+/* Multiply a and b modulo POLY, both bit-reflected.  From zlib. */
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t)1 << 31, p = 0;
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+    }
+    return p;
+}
+
 #ifdef WITH_ISAL
 
 #include <isa-l/crc.h>
@@ -48,10 +72,21 @@ uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
     return crc32_iscsi((unsigned char*)buf, len, crc ^ 0xffffffff) ^ 0xffffffff;
 }
 
-#else
+void crc32c_blocks(uint32_t *crcs, const void *buf, size_t block_size, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        crcs[i] = crc32_iscsi((unsigned char*)buf + i*block_size, block_size, 0xffffffff) ^ 0xffffffff;
+}
 
-/* CRC-32C (iSCSI) polynomial in reversed bit order. */
-#define POLY 0x82f63b78
+/* ISA-L does its own dispatching */
+int crc32c_select(int impl)
+{
+    return 0;
+}
+
+#define crc32c_mulmod crc32c_multmodp
+
+#else
 
 /* Table for a quadword-at-a-time software crc. */
 static __thread int crc32_sw_init = 0;
@@ -355,62 +390,338 @@ static uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
 #endif
 }
 
-/* Check for SSE 4.2.  SSE 4.2 was first supported in Nehalem processors
-   introduced in November, 2008.  This does not check for the existence of the
-   cpuid instruction itself, which was introduced on the 486SL in 1992, so this
-   will fail on earlier x86 processors.  cpuid works on all Pentium and later
-   processors. */
-#define SSE42(have) \
-    do { \
-        uint32_t eax, ecx; \
-        eax = 1; \
-        __asm__("cpuid" \
-            : "=c"(ecx) \
-            : "a"(eax) \
-            : "%ebx", "%edx"); \
-        (have) = (ecx >> 20) & 1; \
-    } while (0)
-
-/* Compute a CRC-32C.  If the crc32 instruction is available, use the hardware
-   version.  Otherwise, use the software version. */
+#ifdef __x86_64__
+
+/* Carry-less multiplication (PCLMULQDQ) based CRC computation, see Intel's
+   "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+   The data is treated as a polynomial in the reflected bit order, 16 bytes are
+   "folded" forward by D bits by multiplying their two 8-byte halves by
+   x^(D+63) and x^(D-1) modulo POLY (one extra x comes from the PCLMULQDQ's
+   product being 127 bits long) and adding the result to the 16 bytes located
+   D bits later.  The last remaining 16 bytes are reduced with the crc32
+   instruction.  The AVX-512 version folds four 64-byte vectors at a time. */
+#define FOLD_SSE __attribute__((target("sse4.2,pclmul")))
+#define FOLD_AVX512 __attribute__((target("sse4.2,pclmul,avx512f,vpclmulqdq")))
+
+/* Fold constants for 128, 256, 384, 512 and 2048 bits */
+static int crc32c_fold_init = 0;
+static uint64_t crc32c_k128[2], crc32c_k256[2], crc32c_k384[2], crc32c_k512[2], crc32c_k2048[2];
+
+/* x^n modulo POLY, bit-reflected */
+static uint32_t crc32c_xpow(size_t n)
+{
+    uint32_t r = 0x80000000;
+    while (n--)
+        r = r & 1 ? (r >> 1) ^ POLY : r >> 1;
+    return r;
+}
+
+static void crc32c_fold_const(uint64_t *k, size_t bits)
+{
+    k[0] = (uint64_t)crc32c_xpow(bits+63) << 32;
+    k[1] = (uint64_t)crc32c_xpow(bits-1) << 32;
+}
+
+static void crc32c_init_fold(void)
+{
+    crc32c_fold_const(crc32c_k128, 128);
+    crc32c_fold_const(crc32c_k256, 256);
+    crc32c_fold_const(crc32c_k384, 384);
+    crc32c_fold_const(crc32c_k512, 512);
+    crc32c_fold_const(crc32c_k2048, 2048);
+    __atomic_store_n(&crc32c_fold_init, 1, __ATOMIC_RELEASE);
+}
+
+static inline FOLD_SSE __m128i fold128(__m128i x, __m128i k)
+{
+    return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+}
+
+/* Fold the remaining 16-byte blocks into x, reduce it and process the tail.
+   Takes and returns the pre-processed (inverted) crc */
+static inline FOLD_SSE uint64_t crc32c_fold_tail(__m128i x, const unsigned char *next, size_t len)
+{
+    __m128i k128 = _mm_loadu_si128((__m128i*)crc32c_k128);
+    while (len >= 16)
+    {
+        x = _mm_xor_si128(fold128(x, k128), _mm_loadu_si128((__m128i*)next));
+        next += 16;
+        len -= 16;
+    }
+    uint64_t crc0 = _mm_crc32_u64(0, _mm_cvtsi128_si64(x));
+    crc0 = _mm_crc32_u64(crc0, _mm_extract_epi64(x, 1));
+    while (len >= 8)
+    {
+        crc0 = _mm_crc32_u64(crc0, *(uint64_t*)next);
+        next += 8;
+        len -= 8;
+    }
+    while (len)
+    {
+        crc0 = _mm_crc32_u8(crc0, *next);
+        next++;
+        len--;
+    }
+    return crc0;
+}
+
+/* Compute CRC-32C with PCLMULQDQ, len must be at least 64 */
+static FOLD_SSE uint32_t crc32c_pclmul(uint32_t crc, const void *buf, size_t len)
+{
+    const unsigned char *next = (const unsigned char*)buf;
+    __m128i x0, x1, x2, x3, k;
+
+    if (!__atomic_load_n(&crc32c_fold_init, __ATOMIC_ACQUIRE))
+        crc32c_init_fold();
+    x0 = _mm_xor_si128(_mm_loadu_si128((__m128i*)next), _mm_cvtsi32_si128(crc ^ 0xffffffff));
+    x1 = _mm_loadu_si128((__m128i*)(next+16));
+    x2 = _mm_loadu_si128((__m128i*)(next+32));
+    x3 = _mm_loadu_si128((__m128i*)(next+48));
+    next += 64;
+    len -= 64;
+    k = _mm_loadu_si128((__m128i*)crc32c_k512);
+    while (len >= 64)
+    {
+        x0 = _mm_xor_si128(fold128(x0, k), _mm_loadu_si128((__m128i*)next));
+        x1 = _mm_xor_si128(fold128(x1, k), _mm_loadu_si128((__m128i*)(next+16)));
+        x2 = _mm_xor_si128(fold128(x2, k), _mm_loadu_si128((__m128i*)(next+32)));
+        x3 = _mm_xor_si128(fold128(x3, k), _mm_loadu_si128((__m128i*)(next+48)));
+        next += 64;
+        len -= 64;
+    }
+    k = _mm_loadu_si128((__m128i*)crc32c_k128);
+    x1 = _mm_xor_si128(x1, fold128(x0, k));
+    x2 = _mm_xor_si128(x2, fold128(x1, k));
+    x3 = _mm_xor_si128(x3, fold128(x2, k));
+    return (uint32_t)crc32c_fold_tail(x3, next, len) ^ 0xffffffff;
+}
+
+static inline FOLD_AVX512 __m512i fold512(__m512i x, __m512i k, __m512i data)
+{
+    return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00), _mm512_clmulepi64_epi128(x, k, 0x11), data, 0x96);
+}
+
+/* Compute CRC-32C with AVX-512 VPCLMULQDQ, len must be at least 256 */
+static FOLD_AVX512 uint32_t crc32c_vpclmul(uint32_t crc, const void *buf, size_t len)
+{
+    const unsigned char *next = (const unsigned char*)buf;
+    __m512i z0, z1, z2, z3, k;
+    __m128i x;
+
+    if (!__atomic_load_n(&crc32c_fold_init, __ATOMIC_ACQUIRE))
+        crc32c_init_fold();
+    z0 = _mm512_xor_si512(_mm512_loadu_si512(next), _mm512_zextsi128_si512(_mm_cvtsi32_si128(crc ^ 0xffffffff)));
+    z1 = _mm512_loadu_si512(next+64);
+    z2 = _mm512_loadu_si512(next+128);
+    z3 = _mm512_loadu_si512(next+192);
+    next += 256;
+    len -= 256;
+    k = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i*)crc32c_k2048));
+    while (len >= 256)
+    {
+        z0 = fold512(z0, k, _mm512_loadu_si512(next));
+        z1 = fold512(z1, k, _mm512_loadu_si512(next+64));
+        z2 = fold512(z2, k, _mm512_loadu_si512(next+128));
+        z3 = fold512(z3, k, _mm512_loadu_si512(next+192));
+        next += 256;
+        len -= 256;
+    }
+    k = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i*)crc32c_k512));
+    z1 = fold512(z0, k, z1);
+    z2 = fold512(z1, k, z2);
+    z3 = fold512(z2, k, z3);
+    while (len >= 64)
+    {
+        z3 = fold512(z3, k, _mm512_loadu_si512(next));
+        next += 64;
+        len -= 64;
+    }
+    /* fold four 16-byte lanes into the last one */
+    x = _mm_xor_si128(
+        _mm_xor_si128(
+            fold128(_mm512_extracti32x4_epi32(z3, 0), _mm_loadu_si128((__m128i*)crc32c_k384)),
+            fold128(_mm512_extracti32x4_epi32(z3, 1), _mm_loadu_si128((__m128i*)crc32c_k256))
+        ),
+        _mm_xor_si128(
+            fold128(_mm512_extracti32x4_epi32(z3, 2), _mm_loadu_si128((__m128i*)crc32c_k128)),
+            _mm512_extracti32x4_epi32(z3, 3)
+        )
+    );
+    return (uint32_t)crc32c_fold_tail(x, next, len) ^ 0xffffffff;
+}
+
+/* Multiply a and b modulo POLY with PCLMULQDQ: bits 31..0 of the product are
+   already reduced and bits 63..32 are reduced by the crc32 instruction */
+static FOLD_SSE uint32_t crc32c_multmodp_clmul(uint32_t a, uint32_t b)
+{
+    uint64_t p = _mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b), 0)) << 1;
+    return _mm_crc32_u32(0, (uint32_t)p) ^ (uint32_t)(p >> 32);
+}
+
+/* Compute CRC-32C of several blocks of the same size at once, interleaving
+   three independent crc instructions like in crc32c_hw() */
+static void crc32c_hw_blocks(uint32_t *crcs, const void *buf, size_t block_size, size_t count)
+{
+    const unsigned char *next = (const unsigned char*)buf;
+    const unsigned char *end;
+    uint64_t crc0, crc1, crc2;
+    if (block_size & 7)
+    {
+        for (size_t i = 0; i < count; i++)
+            crcs[i] = crc32c_hw(0, next + i*block_size, block_size);
+        return;
+    }
+    while (count >= 3)
+    {
+        crc0 = crc1 = crc2 = 0xffffffff;
+        end = next + block_size;
+        do
+        {
+            __asm__(
+                "crc32q\t" "(%3), %0\n\t"
+                "crc32q\t" "(%3,%4), %1\n\t"
+                "crc32q\t" "(%3,%4,2), %2"
+                : "=r"(crc0), "=r"(crc1), "=r"(crc2)
+                : "r"(next), "r"(block_size), "0"(crc0), "1"(crc1), "2"(crc2)
+            );
+            next += 8;
+        } while (next < end);
+        crcs[0] = (uint32_t)crc0 ^ 0xffffffff;
+        crcs[1] = (uint32_t)crc1 ^ 0xffffffff;
+        crcs[2] = (uint32_t)crc2 ^ 0xffffffff;
+        crcs += 3;
+        next += block_size*2;
+        count -= 3;
+    }
+    for (size_t i = 0; i < count; i++)
+        crcs[i] = crc32c_hw(0, next + i*block_size, block_size);
+}
+
+#endif
+
+/* Selected implementation: 0 = not yet detected, 1 = software, 2 = SSE 4.2,
+   3 = PCLMULQDQ, 4 = AVX-512 VPCLMULQDQ. Folding only pays off for longer
+   buffers, shorter ones are always handled by crc32c_hw() */
+static int crc32c_impl = 0;
+#define FOLD_MIN_LEN 512
+
+int crc32c_select(int impl)
+{
+#ifndef __x86_64__
+    crc32c_impl = 1;
+#else
+    int max = 1;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        max = 2;
+        if (__builtin_cpu_supports("pclmul"))
+        {
+            max = 3;
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq"))
+                max = 4;
+        }
+    }
+    crc32c_impl = impl <= 0 || impl > max ? max : impl;
+#endif
+    return crc32c_impl;
+}
+
+/* Compute a CRC-32C using the best available implementation. */
 uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
 {
 #ifndef __x86_64__
     return crc32c_sw(crc, buf, len);
 #else
-    static int sse42 = 0;
-    if (!sse42)
+    if (!crc32c_impl)
+        crc32c_select(0);
+    if (crc32c_impl == 1)
+        return crc32c_sw(crc, buf, len);
+    if (len >= FOLD_MIN_LEN && crc32c_impl == 4)
+        return crc32c_vpclmul(crc, buf, len);
+    if (len >= FOLD_MIN_LEN && crc32c_impl == 3)
+        return crc32c_pclmul(crc, buf, len);
+    return crc32c_hw(crc, buf, len);
+#endif
+}
+
+void crc32c_blocks(uint32_t *crcs, const void *buf, size_t block_size, size_t count)
+{
+#ifdef __x86_64__
+    if (!crc32c_impl)
+        crc32c_select(0);
+    if (crc32c_impl == 2 || (crc32c_impl > 2 && block_size < FOLD_MIN_LEN))
     {
-        SSE42(sse42);
-        sse42 = sse42 ? 2 : 1;
+        crc32c_hw_blocks(crcs, buf, block_size, count);
+        return;
     }
-    return sse42 == 2 ? crc32c_hw(crc, buf, len) : crc32c_sw(crc, buf, len);
 #endif
+    for (size_t i = 0; i < count; i++)
+        crcs[i] = crc32c(0, (const uint8_t*)buf + i*block_size, block_size);
 }
 
+static inline uint32_t crc32c_mulmod(uint32_t a, uint32_t b)
+{
+#ifdef __x86_64__
+    if (crc32c_impl >= 3)
+        return crc32c_multmodp_clmul(a, b);
 #endif
+    return crc32c_multmodp(a, b);
+}
 
-static uint8_t zero_page[4096] = {};
+#endif
 
-uint32_t crc32c_pad(uint32_t prev_crc, const void *buf, size_t len, size_t left_pad, size_t right_pad)
+/* x^(2^n) modulo POLY */
+static uint32_t crc32c_x2n_table[32];
+static int crc32c_x2n_init = 0;
+
+static void crc32c_init_x2n(void)
+{
+    uint32_t p = (uint32_t)1 << 30; /* x^1 */
+    crc32c_x2n_table[0] = p;
+    for (int n = 1; n < 32; n++)
+        crc32c_x2n_table[n] = p = crc32c_multmodp(p, p);
+    __atomic_store_n(&crc32c_x2n_init, 1, __ATOMIC_RELEASE);
+}
+
+/* x^(8*len) modulo POLY, i.e. the operator for appending len zero bytes */
+static uint32_t crc32c_zeros_mod(size_t len)
 {
-    uint32_t r = prev_crc;
-    while (left_pad >= 4096)
+    uint32_t p = (uint32_t)1 << 31; /* x^0 */
+    unsigned k = 3;
+    if (!__atomic_load_n(&crc32c_x2n_init, __ATOMIC_ACQUIRE))
+        crc32c_init_x2n();
+    while (len)
     {
-        r = crc32c(r, zero_page, 4096);
-        left_pad -= 4096;
+        if (len & 1)
+            p = crc32c_mulmod(crc32c_x2n_table[k & 31], p);
+        len >>= 1;
+        k++;
     }
-    if (left_pad > 0)
-        r = crc32c(r, zero_page, left_pad);
+    return p;
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+    return crc32c_mulmod(crc32c_zeros_mod(len2), crc1) ^ crc2;
+}
+
+/* Shorter zero paddings are cheaper to just checksum */
+#define ZEROS_MIN_LEN 256
+static uint8_t zero_page[ZEROS_MIN_LEN] = {};
+
+uint32_t crc32c_append_zeros(uint32_t crc, size_t len)
+{
+    if (len < ZEROS_MIN_LEN)
+        return len ? crc32c(crc, zero_page, len) : crc;
+    return crc32c_mulmod(crc32c_zeros_mod(len), crc ^ 0xffffffff) ^ 0xffffffff;
+}
+
+uint32_t crc32c_pad(uint32_t prev_crc, const void *buf, size_t len, size_t left_pad, size_t right_pad)
+{
+    uint32_t r = crc32c_append_zeros(prev_crc, left_pad);
     r = crc32c(r, buf, len);
-    while (right_pad >= 4096)
-    {
-        r = crc32c(r, zero_page, 4096);
-        right_pad -= 4096;
-    }
-    if (left_pad > 0)
-        r = crc32c(r, zero_page, right_pad);
-    return r;
+    return crc32c_append_zeros(r, right_pad);
 }
 
 uint32_t crc32c_nopad(uint32_t prev_crc, const void *buf, size_t len, size_t left_pad, size_t right_pad)
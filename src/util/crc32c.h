@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 // https://software.intel.com/sites/landingpage/IntrinsicsGuide/
 // unsigned int _mm_crc32_u16 (unsigned int crc, unsigned short v)
@@ -14,6 +15,15 @@
 extern "C" {
 #endif
 uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+// Calculate CRC-32C of <count> consecutive blocks of <block_size> bytes each, put results into <crcs>
+void crc32c_blocks(uint32_t *crcs, const void *buf, size_t block_size, size_t count);
+// Calculate CRC-32C of A+B from CRC-32C of A, CRC-32C of B and the length of B
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+// Calculate CRC-32C of <len> zero bytes appended to data with CRC-32C equal to <crc>
+uint32_t crc32c_append_zeros(uint32_t crc, size_t len);
+// Select implementation: 0 = best available, 1 = software, 2 = SSE 4.2, 3 = PCLMULQDQ, 4 = AVX-512 VPCLMULQDQ.
+// Returns the selected one which is lower than requested if the CPU doesn't support it
+int crc32c_select(int impl);
 uint32_t crc32c_pad(uint32_t prev_crc, const void *buf, size_t len, size_t left_pad, size_t right_pad);
 uint32_t crc32c_nopad(uint32_t prev_crc, const void *buf, size_t len, size_t left_pad, size_t right_pad);
 #ifdef __cplusplus
@@ -0,0 +1,180 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "malloc_or_die.h"
+#include "mem_pool.h"
+
+struct mem_pool_free_t
+{
+    mem_pool_free_t *next;
+};
+
+struct mem_pool_region_t
+{
+    uint8_t *base = NULL;
+    std::atomic<uint64_t> used[MEM_POOL_CLASSES];
+    // Batches of free items moved out of per-thread lists, so memory freed
+    // by one thread and allocated by another one is reused and doesn't pile up
+    std::mutex shared_mu[MEM_POOL_CLASSES];
+    std::vector<mem_pool_free_t*> shared_batches[MEM_POOL_CLASSES];
+    // Number of shared batches, checked without locking <shared_mu>
+    std::atomic<uint32_t> shared_count[MEM_POOL_CLASSES];
+
+    mem_pool_region_t()
+    {
+        for (int i = 0; i < MEM_POOL_CLASSES; i++)
+        {
+            used[i] = 0;
+            shared_count[i] = 0;
+        }
+        // Only reserve address space, pages are allocated on first access
+        void *p = mmap(NULL, (size_t)MEM_POOL_CLASSES << MEM_POOL_CLASS_SHIFT, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        // Fall back to malloc if it's not possible, for example, with vm.overcommit_memory=2
+        base = p == MAP_FAILED ? NULL : (uint8_t*)p;
+    }
+};
+
+static mem_pool_region_t & get_region()
+{
+    static mem_pool_region_t region;
+    return region;
+}
+
+static thread_local mem_pool_free_t *free_lists[MEM_POOL_CLASSES];
+static thread_local uint32_t free_counts[MEM_POOL_CLASSES];
+static thread_local mem_pool_stats_t stats;
+
+static inline int size_class(size_t size)
+{
+    if (size <= (1 << MEM_POOL_MIN_SHIFT))
+        return 0;
+    return 64-__builtin_clzll(size-1) - MEM_POOL_MIN_SHIFT;
+}
+
+// Per-thread free list limit: MEM_POOL_LOCAL_BYTES, but at least 4 and at most 256 items.
+// Half of the list is moved to the shared list when it's exceeded
+static inline uint32_t local_limit(int cls)
+{
+    uint32_t n = MEM_POOL_LOCAL_BYTES >> (cls+MEM_POOL_MIN_SHIFT);
+    return n < 4 ? 4 : (n > 256 ? 256 : n);
+}
+
+static void *class_alloc(int cls)
+{
+    if (!free_lists[cls])
+    {
+        auto & region = get_region();
+        if (!region.base)
+            return NULL;
+        // Don't take the lock when there's nothing to reuse, which is the usual case
+        // while the pool grows. The count is rechecked under the lock
+        if (region.shared_count[cls].load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(region.shared_mu[cls]);
+            auto & batches = region.shared_batches[cls];
+            if (batches.size())
+            {
+                free_lists[cls] = batches.back();
+                free_counts[cls] = local_limit(cls)/2;
+                batches.pop_back();
+                region.shared_count[cls].store(batches.size(), std::memory_order_relaxed);
+            }
+        }
+    }
+    if (free_lists[cls])
+    {
+        mem_pool_free_t *item = free_lists[cls];
+        free_lists[cls] = item->next;
+        free_counts[cls]--;
+        stats.reused++;
+        return item;
+    }
+    auto & region = get_region();
+    uint64_t item_size = (1 << (cls+MEM_POOL_MIN_SHIFT));
+    uint64_t pos = region.used[cls].fetch_add(item_size);
+    if (pos + item_size > ((uint64_t)1 << MEM_POOL_CLASS_SHIFT))
+    {
+        region.used[cls].fetch_sub(item_size);
+        return NULL;
+    }
+    stats.fresh++;
+    return region.base + ((uint64_t)cls << MEM_POOL_CLASS_SHIFT) + pos;
+}
+
+void *pool_alloc(size_t size)
+{
+    int cls = size_class(size);
+    void *ptr = cls < MEM_POOL_CLASSES ? class_alloc(cls) : NULL;
+    if (!ptr)
+    {
+        stats.heap++;
+        ptr = malloc_or_die(size);
+    }
+    return ptr;
+}
+
+void *pool_calloc(size_t size)
+{
+    void *ptr = pool_alloc(size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void *pool_memalign(size_t size)
+{
+    // Items of classes starting with MEM_POOL_ALIGNMENT are aligned to it
+    int cls = size_class(size < MEM_POOL_ALIGNMENT ? MEM_POOL_ALIGNMENT : size);
+    void *ptr = cls < MEM_POOL_CLASSES ? class_alloc(cls) : NULL;
+    if (!ptr)
+    {
+        stats.heap++;
+        ptr = memalign_or_die(MEM_POOL_ALIGNMENT, size);
+    }
+    return ptr;
+}
+
+void pool_free(void *ptr)
+{
+    if (!ptr)
+        return;
+    auto & region = get_region();
+    if (!region.base || (uint8_t*)ptr < region.base ||
+        (uint8_t*)ptr >= region.base + ((size_t)MEM_POOL_CLASSES << MEM_POOL_CLASS_SHIFT))
+    {
+        free(ptr);
+        return;
+    }
+    int cls = ((uint8_t*)ptr - region.base) >> MEM_POOL_CLASS_SHIFT;
+    mem_pool_free_t *item = (mem_pool_free_t*)ptr;
+    item->next = free_lists[cls];
+    free_lists[cls] = item;
+    free_counts[cls]++;
+    uint32_t limit = local_limit(cls);
+    if (free_counts[cls] > limit)
+    {
+        // Move a batch of items to the shared list
+        mem_pool_free_t *batch = free_lists[cls], *last = batch;
+        for (uint32_t i = 1; i < limit/2; i++)
+            last = last->next;
+        free_lists[cls] = last->next;
+        last->next = NULL;
+        free_counts[cls] -= limit/2;
+        std::lock_guard<std::mutex> lock(region.shared_mu[cls]);
+        region.shared_batches[cls].push_back(batch);
+        region.shared_count[cls].store(region.shared_batches[cls].size(), std::memory_order_relaxed);
+    }
+}
+
+mem_pool_stats_t pool_get_stats()
+{
+    return stats;
+}
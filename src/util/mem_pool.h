@@ -0,0 +1,39 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Size classes are powers of 2 from 64 bytes to 1 MB
+#define MEM_POOL_MIN_SHIFT 6
+#define MEM_POOL_MAX_SHIFT 20
+#define MEM_POOL_CLASSES (MEM_POOL_MAX_SHIFT-MEM_POOL_MIN_SHIFT+1)
+// Address space reserved for each size class
+#define MEM_POOL_CLASS_SHIFT 30
+// Alignment of pool_memalign() buffers, the same as MEM_ALIGNMENT
+#define MEM_POOL_ALIGNMENT 4096
+// Approximate size of free memory kept in each per-thread free list
+#define MEM_POOL_LOCAL_BYTES (4*1024*1024)
+
+struct mem_pool_stats_t
+{
+    // Allocations served from the free list, from the unused part of the reserved address space,
+    // and from the heap (larger than the largest class or the class space is exhausted)
+    uint64_t reused = 0, fresh = 0, heap = 0;
+};
+
+// Allocator for objects and buffers of the I/O path (operations, their private data and
+// data buffers). Each size class gets its own range of reserved address space and a per-thread
+// free list, so steady-state allocations don't take locks and don't call malloc at all.
+// Freed memory is never returned to the OS, it's only reused for the same size class.
+// Memory may be freed by another thread, excess free items are moved between threads in batches.
+// pool_free() also accepts memory allocated with malloc(), so it may be used in all places
+// where the pointer may come from either source.
+void *pool_alloc(size_t size);
+void *pool_calloc(size_t size);
+void *pool_memalign(size_t size);
+void pool_free(void *ptr);
+// Statistics of the calling thread
+mem_pool_stats_t pool_get_stats();
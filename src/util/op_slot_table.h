@@ -0,0 +1,154 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+// Table of in-flight operations indexed by operation ID.
+// IDs are assigned sequentially per connection, so an operation is kept in the slot
+// (id & mask) and found with a single lookup. Each slot also stores the full ID
+// which is checked on lookup, so an old ID never matches a newer operation.
+// When the slot is still taken by an older operation, the table grows up to <max_slots>.
+// Operations which still don't fit, i.e. ones which are in flight for much longer than
+// the others, are moved to an overflow map. ID 0 is reserved.
+template<typename T>
+class op_slot_table_t
+{
+    struct slot_t
+    {
+        uint64_t id;
+        T *item;
+    };
+
+    std::vector<slot_t> slots;
+    uint64_t mask = 0;
+    uint64_t min_slots, max_slots;
+    size_t count = 0;
+    std::map<uint64_t, T*> overflow;
+
+    void resize(uint64_t new_size)
+    {
+        std::vector<slot_t> old;
+        old.swap(slots);
+        slots.resize(new_size, (slot_t){ 0, NULL });
+        mask = new_size-1;
+        for (auto & s: old)
+        {
+            if (s.item)
+            {
+                slot_t & ns = slots[s.id & mask];
+                if (ns.item)
+                    overflow[s.id] = s.item;
+                else
+                    ns = s;
+            }
+        }
+    }
+
+public:
+    // Sizes are rounded up to powers of 2
+    op_slot_table_t(uint64_t min_slots = 256, uint64_t max_slots = 4096)
+    {
+        this->min_slots = 1;
+        while (this->min_slots < min_slots)
+            this->min_slots *= 2;
+        this->max_slots = this->min_slots;
+        while (this->max_slots < max_slots)
+            this->max_slots *= 2;
+    }
+
+    // Add the operation. The ID must not be in the table yet
+    void set(uint64_t id, T *item)
+    {
+        if (!slots.size())
+        {
+            // Allocated on first use because most connections never send operations
+            resize(min_slots);
+        }
+        while (true)
+        {
+            slot_t & s = slots[id & mask];
+            if (!s.item)
+            {
+                s.id = id;
+                s.item = item;
+                break;
+            }
+            if (slots.size() >= max_slots)
+            {
+                overflow[id] = item;
+                break;
+            }
+            resize(slots.size()*2);
+        }
+        count++;
+    }
+
+    // Remove the operation and return it, or return NULL if it's not in the table
+    T *take(uint64_t id)
+    {
+        if (!slots.size())
+            return NULL;
+        slot_t & s = slots[id & mask];
+        if (s.item && s.id == id)
+        {
+            T *item = s.item;
+            s.item = NULL;
+            count--;
+            return item;
+        }
+        if (overflow.size())
+        {
+            auto it = overflow.find(id);
+            if (it != overflow.end())
+            {
+                T *item = it->second;
+                overflow.erase(it);
+                count--;
+                return item;
+            }
+        }
+        return NULL;
+    }
+
+    bool erase(uint64_t id)
+    {
+        return take(id) != NULL;
+    }
+
+    size_t size()
+    {
+        return count;
+    }
+
+    // All operations in the order of their IDs
+    std::vector<T*> list()
+    {
+        std::vector<std::pair<uint64_t, T*>> sorted;
+        sorted.reserve(count);
+        for (auto & s: slots)
+            if (s.item)
+                sorted.push_back({ s.id, s.item });
+        for (auto & p: overflow)
+            sorted.push_back(p);
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<T*> items;
+        items.reserve(sorted.size());
+        for (auto & p: sorted)
+            items.push_back(p.second);
+        return items;
+    }
+
+    void clear()
+    {
+        slots.clear();
+        mask = 0;
+        count = 0;
+        overflow.clear();
+    }
+};
@@ -39,6 +39,8 @@ ring_loop_t::ring_loop_t(int qd, bool multithreaded, bool sqe128)
     if (probe)
     {
         support_zc = io_uring_opcode_supported(probe, IORING_OP_SENDMSG_ZC);
+        // Multishot recv doesn't have its own opcode, but it was added in 6.0 together with SEND_ZC
+        support_multishot_recv = io_uring_opcode_supported(probe, IORING_OP_SEND_ZC);
         io_uring_free_probe(probe);
     }
     io_uring_set_iowait(&ring, false);
@@ -97,6 +99,36 @@ io_uring_sqe* ring_loop_t::get_sqe()
     return sqe;
 }
 
+io_uring_sqe* ring_loop_t::get_sqe(ring_data_t *external_data)
+{
+    if (mt)
+        mu.lock();
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+    if (sqe)
+    {
+        *sqe = { 0 };
+        external_data->external = true;
+        io_uring_sqe_set_data(sqe, external_data);
+    }
+    if (mt)
+        mu.unlock();
+    return sqe;
+}
+
+io_uring_buf_ring* ring_loop_t::setup_buf_ring(unsigned entries, int *buf_group, int *err)
+{
+    *buf_group = next_buf_group;
+    io_uring_buf_ring *br = io_uring_setup_buf_ring(&ring, entries, *buf_group, 0, err);
+    if (br)
+        next_buf_group++;
+    return br;
+}
+
+void ring_loop_t::free_buf_ring(io_uring_buf_ring *br, unsigned entries, int buf_group)
+{
+    io_uring_free_buf_ring(&ring, br, entries, buf_group);
+}
+
 void ring_loop_t::loop()
 {
     if (in_loop)
@@ -126,12 +158,26 @@ void ring_loop_t::loop()
             if (mt)
                 mu.unlock();
             d->res = cqe->res;
+            d->cqe_flags = cqe->flags;
             d->more = true;
             if (d->callback)
                 d->callback(d);
             d->prev = true;
             d->more = false;
         }
+        else if (d->external)
+        {
+            // The last notification of a request with caller-owned data
+            if (mt)
+                mu.unlock();
+            d->res = cqe->res;
+            d->cqe_flags = cqe->flags;
+            d->prev = false;
+            // Copy callback to be unaffected by freeing the data
+            callback_t<void(ring_data_t*)> cb(d->callback);
+            if (cb)
+                cb(d);
+        }
         else if (d->callback)
         {
             // First free ring_data item, then call the callback
@@ -140,6 +186,7 @@ void ring_loop_t::loop()
             struct ring_data_t dl;
             dl.iov = d->iov;
             dl.res = cqe->res;
+            dl.cqe_flags = cqe->flags;
             dl.more = false;
             dl.prev = d->prev;
             dl.callback.swap(d->callback);
@@ -187,7 +234,9 @@ void ring_loop_t::restore(unsigned sqe_tail)
     unsigned inc = (1 << io_uring_sqe_shift(&ring));
     for (unsigned i = sqe_tail; i < ring.sq.sqe_tail; i += inc)
     {
-        free_ring_data[free_ring_data_ptr++] = ((ring_data_t*)ring.sq.sqes[i & *ring.sq.kring_mask].user_data) - ring_datas;
+        ring_data_t *d = (ring_data_t*)ring.sq.sqes[i & *ring.sq.kring_mask].user_data;
+        if (!d->external)
+            free_ring_data[free_ring_data_ptr++] = d - ring_datas;
     }
     ring.sq.sqe_tail = sqe_tail;
 }
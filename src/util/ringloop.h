@@ -16,6 +16,8 @@
 #include <vector>
 #include <mutex>
 
+#include "callback.h"
+
 #define RINGLOOP_DEFAULT_SIZE 1024
 
 struct ring_data_t
@@ -24,7 +26,10 @@ struct ring_data_t
     int res;
     bool prev: 1;
     bool more: 1;
-    std::function<void(ring_data_t*)> callback;
+    // Owned by the caller and not returned to the ring loop, used for long-living multishot requests
+    bool external: 1;
+    uint32_t cqe_flags;
+    callback_t<void(ring_data_t*)> callback;
 };
 
 struct ring_consumer_t
@@ -34,7 +39,7 @@ struct ring_consumer_t
 
 class __attribute__((visibility("default"))) ring_loop_t
 {
-    std::vector<std::function<void()>> immediate_queue, immediate_queue2;
+    std::vector<callback_t<void()>> immediate_queue, immediate_queue2;
     std::vector<ring_consumer_t*> consumers;
     struct ring_data_t *ring_datas;
     std::mutex mu;
@@ -46,6 +51,8 @@ class __attribute__((visibility("default"))) ring_loop_t
     struct io_uring ring;
     int ring_eventfd = -1;
     bool support_zc = false;
+    bool support_multishot_recv = false;
+    int next_buf_group = 0;
 public:
     ring_loop_t(int qd, bool multithreaded = false, bool sqe128 = false);
     ~ring_loop_t();
@@ -54,9 +61,12 @@ public:
     int register_eventfd();
 
     io_uring_sqe* get_sqe();
-    inline void set_immediate(const std::function<void()> cb)
+    io_uring_sqe* get_sqe(ring_data_t *external_data);
+    io_uring_buf_ring* setup_buf_ring(unsigned entries, int *buf_group, int *err);
+    void free_buf_ring(io_uring_buf_ring *br, unsigned entries, int buf_group);
+    inline void set_immediate(callback_t<void()> cb)
     {
-        immediate_queue.push_back(cb);
+        immediate_queue.push_back(std::move(cb));
         wakeup();
     }
     inline int submit()
@@ -81,6 +91,10 @@ public:
     {
         return support_zc;
     }
+    inline bool has_multishot_recv()
+    {
+        return support_multishot_recv;
+    }
 
     void loop();
     void wakeup();
@@ -0,0 +1,75 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// push() fails when the queue is full, so the producer has to keep the item and retry later.
+// Head and tail are on separate cache lines and each side caches the other side's position,
+// so the shared cache lines are only touched when the cached position is exhausted.
+template<typename T>
+class spsc_queue_t
+{
+    std::vector<T> items;
+    uint64_t mask;
+
+    alignas(64) std::atomic<uint64_t> head;
+    uint64_t cached_tail = 0;
+
+    alignas(64) std::atomic<uint64_t> tail;
+    uint64_t cached_head = 0;
+
+public:
+    // Size is rounded up to a power of 2
+    spsc_queue_t(uint64_t size)
+    {
+        uint64_t cap = 1;
+        while (cap < size)
+            cap *= 2;
+        items.resize(cap);
+        mask = cap-1;
+        head = 0;
+        tail = 0;
+    }
+
+    // Producer side
+    bool push(const T & item)
+    {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head > mask)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head > mask)
+                return false;
+        }
+        items[t & mask] = item;
+        tail.store(t+1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T & item)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+                return false;
+        }
+        item = items[h & mask];
+        head.store(h+1, std::memory_order_release);
+        return true;
+    }
+
+    // May be called from any side, the result is approximate
+    bool empty()
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
@@ -4,12 +4,176 @@
 #pragma once
 
 #include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
-inline void memxor(const void *r1, const void *r2, void *res, unsigned int len)
+// XOR of <n> source buffers into <res> in one pass: res = src[0] ^ src[1] ^ ... ^ src[n-1].
+// <res> may be equal to one of the sources. Vector kernels are selected at runtime:
+// AVX-512 or AVX2 on x86_64 if supported by the CPU, NEON on aarch64, word-by-word scalar code otherwise
+
+#define MEMXOR_SCALAR 1
+#define MEMXOR_SSE2 2
+#define MEMXOR_AVX2 3
+#define MEMXOR_AVX512 4
+#define MEMXOR_NEON 5
+
+// Process bytes from <i> to <len>
+static inline void memxor_multi_scalar(const void **src, int n, void *res, unsigned int i, unsigned int len)
+{
+    uint64_t v, w;
+    for (; i+8 <= len; i += 8)
+    {
+        memcpy(&v, (const uint8_t*)src[0] + i, 8);
+        for (int j = 1; j < n; j++)
+        {
+            memcpy(&w, (const uint8_t*)src[j] + i, 8);
+            v ^= w;
+        }
+        memcpy((uint8_t*)res + i, &v, 8);
+    }
+    for (; i < len; i++)
+    {
+        uint8_t b = ((const uint8_t*)src[0])[i];
+        for (int j = 1; j < n; j++)
+            b ^= ((const uint8_t*)src[j])[i];
+        ((uint8_t*)res)[i] = b;
+    }
+}
+
+#if defined(__x86_64__)
+
+// SSE2 is always available on x86_64
+static inline unsigned int memxor_multi_sse2(const void **src, int n, void *res, unsigned int len)
 {
-    unsigned int i;
-    for (i = 0; i < len; ++i)
+    unsigned int i = 0;
+    for (; i+16 <= len; i += 16)
     {
-        ((uint8_t*)res)[i] = ((uint8_t*)r1)[i] ^ ((uint8_t*)r2)[i];
+        __m128i v = _mm_loadu_si128((const __m128i*)((const uint8_t*)src[0] + i));
+        for (int j = 1; j < n; j++)
+            v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i*)((const uint8_t*)src[j] + i)));
+        _mm_storeu_si128((__m128i*)((uint8_t*)res + i), v);
     }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static inline unsigned int memxor_multi_avx2(const void **src, int n, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+64 <= len; i += 64)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i*)((const uint8_t*)src[0] + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)((const uint8_t*)src[0] + i + 32));
+        for (int j = 1; j < n; j++)
+        {
+            v0 = _mm256_xor_si256(v0, _mm256_loadu_si256((const __m256i*)((const uint8_t*)src[j] + i)));
+            v1 = _mm256_xor_si256(v1, _mm256_loadu_si256((const __m256i*)((const uint8_t*)src[j] + i + 32)));
+        }
+        _mm256_storeu_si256((__m256i*)((uint8_t*)res + i), v0);
+        _mm256_storeu_si256((__m256i*)((uint8_t*)res + i + 32), v1);
+    }
+    return i;
+}
+
+__attribute__((target("avx512f")))
+static inline unsigned int memxor_multi_avx512(const void **src, int n, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+128 <= len; i += 128)
+    {
+        __m512i v0 = _mm512_loadu_si512((const uint8_t*)src[0] + i);
+        __m512i v1 = _mm512_loadu_si512((const uint8_t*)src[0] + i + 64);
+        for (int j = 1; j < n; j++)
+        {
+            v0 = _mm512_xor_si512(v0, _mm512_loadu_si512((const uint8_t*)src[j] + i));
+            v1 = _mm512_xor_si512(v1, _mm512_loadu_si512((const uint8_t*)src[j] + i + 64));
+        }
+        _mm512_storeu_si512((uint8_t*)res + i, v0);
+        _mm512_storeu_si512((uint8_t*)res + i + 64, v1);
+    }
+    return i;
+}
+
+#elif defined(__aarch64__)
+
+// NEON is always available on aarch64
+static inline unsigned int memxor_multi_neon(const void **src, int n, void *res, unsigned int len)
+{
+    unsigned int i = 0;
+    for (; i+32 <= len; i += 32)
+    {
+        uint8x16_t v0 = vld1q_u8((const uint8_t*)src[0] + i);
+        uint8x16_t v1 = vld1q_u8((const uint8_t*)src[0] + i + 16);
+        for (int j = 1; j < n; j++)
+        {
+            v0 = veorq_u8(v0, vld1q_u8((const uint8_t*)src[j] + i));
+            v1 = veorq_u8(v1, vld1q_u8((const uint8_t*)src[j] + i + 16));
+        }
+        vst1q_u8((uint8_t*)res + i, v0);
+        vst1q_u8((uint8_t*)res + i + 16, v1);
+    }
+    return i;
+}
+
+#endif
+
+inline int & memxor_impl()
+{
+    static int impl = 0;
+    return impl;
+}
+
+// Select memxor implementation (0 = best available, MEMXOR_* = specific one).
+// Returns the selected one which is lower than requested if the CPU doesn't support it
+inline int memxor_select(int impl)
+{
+    int max = MEMXOR_SCALAR;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    max = __builtin_cpu_supports("avx512f") ? MEMXOR_AVX512
+        : (__builtin_cpu_supports("avx2") ? MEMXOR_AVX2 : MEMXOR_SSE2);
+#elif defined(__aarch64__)
+    max = MEMXOR_NEON;
+#endif
+    // AVX-512 is not faster than AVX2 for memory-bound XOR and may lower the clock
+    // frequency on older CPUs, so it's only used when requested explicitly
+    if (impl <= 0)
+        impl = max == MEMXOR_AVX512 ? MEMXOR_AVX2 : max;
+    memxor_impl() = impl > max ? max : impl;
+    return memxor_impl();
+}
+
+inline void memxor_multi(const void **src, int n, void *res, unsigned int len)
+{
+    unsigned int done = 0;
+    int impl = memxor_impl();
+    if (!impl)
+        impl = memxor_select(0);
+    // Short buffers (bitmaps) are not worth vectorizing
+    if (len >= 64)
+    {
+#if defined(__x86_64__)
+        if (impl == MEMXOR_AVX512)
+            done = memxor_multi_avx512(src, n, res, len);
+        else if (impl == MEMXOR_AVX2)
+            done = memxor_multi_avx2(src, n, res, len);
+        else if (impl == MEMXOR_SSE2)
+            done = memxor_multi_sse2(src, n, res, len);
+#elif defined(__aarch64__)
+        if (impl == MEMXOR_NEON)
+            done = memxor_multi_neon(src, n, res, len);
+#endif
+    }
+    if (done < len)
+        memxor_multi_scalar(src, n, res, done, len);
+}
+
+inline void memxor(const void *r1, const void *r2, void *res, unsigned int len)
+{
+    const void *src[2] = { r1, r2 };
+    memxor_multi(src, 2, res, len);
 }
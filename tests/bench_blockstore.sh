@@ -0,0 +1,123 @@
+#!/bin/bash -e
+# Run the standard blockstore benchmark matrix with the blockstore fio engine
+# (libfio_vitastor_blk.so) against a file-backed device and collect fio results
+# together with blockstore counters (dirty_db size, flusher activity, journal usage,
+# WAIT_* counts) into one JSON file, suitable for comparing runs with each other.
+#
+# Usage: tests/bench_blockstore.sh [output.json]
+#
+# Environment:
+#   BUILD_DIR  - build directory (./build)
+#   BENCH_DIR  - directory for the data file and per-job results (./testdata/bench)
+#   BENCH_SIZE - data file size in MB (2048)
+#   RUNTIME    - runtime of each job in seconds (30)
+#   JOBS       - space-separated list of jobs to run (all by default)
+#   BS_EXTRA   - additional bs_config JSON keys, for example '"data_io":"cached"'
+
+if [ ! "$BASH_VERSION" ] ; then
+    echo "Use bash to run this script ($0)" 1>&2
+    exit 1
+fi
+
+cd `dirname $0`/..
+
+BUILD_DIR=${BUILD_DIR:-build}
+BENCH_DIR=${BENCH_DIR:-./testdata/bench}
+BENCH_SIZE=${BENCH_SIZE:-2048}
+RUNTIME=${RUNTIME:-30}
+ENGINE=$BUILD_DIR/src/blockstore/libfio_vitastor_blk.so
+OUTPUT=${1:-$BENCH_DIR/summary.json}
+ALL_JOBS="randwrite_4k_imm randwrite_4k seqwrite_128k randrw_4k delete_storm journal_full"
+JOBS=${JOBS:-$ALL_JOBS}
+
+if [ ! -f $ENGINE ]; then
+    echo "$ENGINE not found, build Vitastor with -DWITH_FIO=yes" 1>&2
+    exit 1
+fi
+
+mkdir -p $BENCH_DIR
+DATA=$BENCH_DIR/data.bin
+SIZE=$(((BENCH_SIZE-64)*1024*1024*7/8))
+
+# Recreate the data file, so that every job starts with an empty blockstore
+reset_data()
+{
+    rm -f $DATA
+    truncate -s ${BENCH_SIZE}M $DATA
+}
+
+# run_fio <job> <step> <journal size in MB> <immediate_commit> <fio options...>
+run_fio()
+{
+    local job=$1 step=$2 journal_mb=$3 imm=$4
+    shift 4
+    local config='"data_device":"'$DATA'","meta_offset":0,"journal_offset":16777216,'
+    config=$config'"data_offset":'$(((16+journal_mb)*1024*1024))',"journal_size":'$((journal_mb*1024*1024))','
+    config=$config'"disable_data_fsync":true,"disable_meta_fsync":true,"disable_journal_fsync":true,'
+    config=$config'"immediate_commit":"'$imm'","journal_no_same_sector_overwrites":true'
+    if [[ -n "$BS_EXTRA" ]]; then
+        config="$config,$BS_EXTRA"
+    fi
+    echo "Running $job ($step)"
+    fio -thread -name=$job -ioengine=$ENGINE -direct=1 -size=$SIZE -bs_config="{$config}" \
+        -bs_stats=$BENCH_DIR/$job.$step.bs.json -output-format=json -output=$BENCH_DIR/$job.$step.fio.json "$@"
+}
+
+run_job()
+{
+    local job=$1
+    reset_data
+    case $job in
+    randwrite_4k_imm)
+        run_fio $job run 32 all -rw=randwrite -bs=4k -iodepth=32 -time_based -runtime=$RUNTIME
+        ;;
+    randwrite_4k)
+        run_fio $job run 32 none -rw=randwrite -bs=4k -iodepth=32 -fsync=32 -time_based -runtime=$RUNTIME
+        ;;
+    seqwrite_128k)
+        run_fio $job run 32 none -rw=write -bs=128k -iodepth=16 -fsync=32 -time_based -runtime=$RUNTIME
+        ;;
+    randrw_4k)
+        run_fio $job prefill 32 all -rw=write -bs=128k -iodepth=16
+        run_fio $job run 32 all -rw=randrw -rwmixread=70 -bs=4k -iodepth=32 -time_based -runtime=$RUNTIME
+        ;;
+    delete_storm)
+        # Trims delete whole objects in the blockstore fio engine
+        run_fio $job prefill 32 all -rw=write -bs=128k -iodepth=16
+        run_fio $job run 32 all -rw=randtrim -bs=128k -iodepth=32
+        ;;
+    journal_full)
+        # Small journal and no fsyncs: writes stall waiting for the flusher to trim the journal
+        run_fio $job run 4 none -rw=randwrite -bs=4k -iodepth=128 -time_based -runtime=$RUNTIME
+        ;;
+    *)
+        echo "Unknown job $job, known jobs are: $ALL_JOBS" 1>&2
+        exit 1
+        ;;
+    esac
+}
+
+for job in $JOBS; do
+    run_job $job
+done
+
+# Merge results: per job and step, fio iops/bandwidth/latency for each direction and blockstore state
+RESULT='{}'
+for job in $JOBS; do
+    for step in prefill run; do
+        if [ -f $BENCH_DIR/$job.$step.fio.json ]; then
+            RESULT=$(jq -n --argjson result "$RESULT" \
+                --slurpfile fio $BENCH_DIR/$job.$step.fio.json \
+                --slurpfile bs $BENCH_DIR/$job.$step.bs.json \
+                --arg name $job.$step '$result + { ($name): {
+                    fio: ($fio[0].jobs[0] | with_entries(select(.key == "read" or .key == "write" or .key == "trim"))
+                        | map_values({ iops, bw_kb: .bw, lat_mean_ns: .lat_ns.mean,
+                            clat_p99_ns: .clat_ns.percentile["99.000000"] })
+                        | with_entries(select(.value.iops > 0))),
+                    blockstore: $bs[0]
+                } }')
+        fi
+    done
+done
+echo "$RESULT" > $OUTPUT
+echo "Results saved to $OUTPUT"
@@ -0,0 +1,57 @@
+#!/bin/bash -ex
+# Compare QD1 and QD128 4 KB random read performance with client connections
+# handled by the OSD main thread and by reactor threads (osd_reactor_count).
+#
+# Environment:
+#   RUNTIME       - runtime of each fio run in seconds (30)
+#   REACTOR_COUNT - osd_reactor_count for the second set of runs (4)
+
+. `dirname $0`/run_3osds.sh
+
+RUNTIME=${RUNTIME:-30}
+REACTOR_COUNT=${REACTOR_COUNT:-4}
+BASE_OSD_ARGS="$OSD_ARGS"
+
+build/src/cmd/vitastor-cli --etcd_address $ETCD_URL create -s 1G testimg
+
+# Fill the image so that reads really go to the disks
+LD_PRELOAD="build/src/client/libfio_vitastor.so" \
+    fio -thread -name=test -ioengine=build/src/client/libfio_vitastor.so -bs=4M -direct=1 -iodepth=4 \
+        -end_fsync=1 -rw=write -etcd=$ETCD_URL -image=testimg -size=1G
+
+# Reactors are only started once, so OSDs are restarted to change their count
+# restart_osds <osd_reactor_count>
+restart_osds()
+{
+    for i in $(seq 1 $OSD_COUNT); do
+        eval kill -9 \$OSD${i}_PID
+        $ETCDCTL del /vitastor/osd/state/$i
+    done
+    sleep 1
+    OSD_ARGS="$BASE_OSD_ARGS --osd_reactor_count $1"
+    for i in $(seq 1 $OSD_COUNT); do
+        start_osd $i
+    done
+    wait_up 60
+}
+
+# run_fio <osd_reactor_count> <iodepth>
+run_fio()
+{
+    LD_PRELOAD="build/src/client/libfio_vitastor.so" \
+        fio -thread -name=test -ioengine=build/src/client/libfio_vitastor.so -bs=4k -direct=1 -numjobs=1 -iodepth=$2 \
+            -rw=randread -etcd=$ETCD_URL -image=testimg -size=1G -time_based -runtime=$RUNTIME \
+            -output-format=json -output=./testdata/reactor_$1_qd$2.json
+    jq '.jobs[0].read.iops | floor' ./testdata/reactor_$1_qd$2.json
+}
+
+restart_osds 0
+QD1_OFF=$(run_fio 0 1)
+QD128_OFF=$(run_fio 0 128)
+
+restart_osds $REACTOR_COUNT
+QD1_ON=$(run_fio $REACTOR_COUNT 1)
+QD128_ON=$(run_fio $REACTOR_COUNT 128)
+
+format_green "QD1 4k random read: $QD1_OFF iops without reactors, $QD1_ON iops with osd_reactor_count=$REACTOR_COUNT"
+format_green "QD128 4k random read: $QD128_OFF iops without reactors, $QD128_ON iops with osd_reactor_count=$REACTOR_COUNT"
@@ -0,0 +1,37 @@
+#!/bin/bash -ex
+# Compare QD32 4 KB sequential write performance to the same objects with
+# and without write pipelining on the primary OSD (write_pipeline_depth).
+#
+# Environment:
+#   RUNTIME        - runtime of each fio run in seconds (30)
+#   PIPELINE_DEPTH - write_pipeline_depth for the second run (32)
+
+. `dirname $0`/run_3osds.sh
+
+RUNTIME=${RUNTIME:-30}
+PIPELINE_DEPTH=${PIPELINE_DEPTH:-32}
+
+build/src/cmd/vitastor-cli --etcd_address $ETCD_URL create -s 1G testimg
+
+# run_fio <write_pipeline_depth>
+run_fio()
+{
+    $ETCDCTL put /vitastor/config/global "$($ETCDCTL get /vitastor/config/global --print-value-only | jq -c '. + { write_pipeline_depth: '$1' }')"
+    # Give OSDs time to reload the configuration
+    sleep 2
+    LD_PRELOAD="build/src/client/libfio_vitastor.so" \
+        fio -thread -name=test -ioengine=build/src/client/libfio_vitastor.so -bs=4k -direct=1 -numjobs=1 -iodepth=32 \
+            -rw=write -etcd=$ETCD_URL -image=testimg -size=1G -time_based -runtime=$RUNTIME \
+            -output-format=json -output=./testdata/pipeline_$1.json
+    jq '.jobs[0].write.iops | floor' ./testdata/pipeline_$1.json
+}
+
+IOPS_OFF=$(run_fio 0)
+IOPS_ON=$(run_fio $PIPELINE_DEPTH)
+
+# Check that pipelined writes didn't corrupt anything
+LD_PRELOAD="build/src/client/libfio_vitastor.so" \
+    fio -thread -name=test -ioengine=build/src/client/libfio_vitastor.so -bs=4k -direct=1 -numjobs=1 -iodepth=32 \
+        -rw=write -etcd=$ETCD_URL -image=testimg -size=128M -verify=crc32c -verify_fatal=1
+
+format_green "QD32 4k sequential write: $IOPS_OFF iops without pipelining, $IOPS_ON iops with write_pipeline_depth=$PIPELINE_DEPTH"
@@ -62,6 +62,10 @@ SCHEME=ec IMMEDIATE_COMMIT=1 ./test_rebalance_verify.sh
 ./test_write.sh
 SCHEME=xor ./test_write.sh
 TEST_NAME=iothreads GLOBAL_CONFIG=',"client_iothread_count":4' ./test_write.sh
+TEST_NAME=pipeline GLOBAL_CONFIG=',"write_pipeline_depth":32' ./test_write.sh
+TEST_NAME=multishot GLOBAL_CONFIG=',"use_multishot_recv":true' ./test_write.sh
+TEST_NAME=reactors GLOBAL_CONFIG=',"osd_reactor_count":2' ./test_write.sh
+TEST_NAME=batching GLOBAL_CONFIG=',"op_batch_size":32' ./test_write.sh
 
 ./test_write_no_same.sh
 